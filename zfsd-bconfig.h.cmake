@@ -1,6 +1,7 @@
 #cmakedefine ENABLE_VERSIONS
 #cmakedefine ENABLE_CHECKING
 #cmakedefine ENABLE_MUTEX_LOCKED
+#cmakedefine ENABLE_LOCK_PROFILE
 #cmakedefine ENABLE_DBUS
 #cmakedefine ENABLE_CLI
 #cmakedefine ENABLE_CLI_CONSOLE
@@ -13,6 +14,8 @@
 #cmakedefine HAVE_DOKAN
 #cmakedefine HAVE_MLOCKALL
 #cmakedefine HAVE_UCONTEXT_H
+#cmakedefine HAVE_LINUX_FUTEX_H
+#cmakedefine HAVE_LIBURING
 #cmakedefine ENABLE_FS_INTERFACE
 #cmakedefine ENABLE_HTTP_INTERFACE
 #cmakedefine ENABLE_DEBUG_PRINT
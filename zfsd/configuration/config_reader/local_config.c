@@ -27,6 +27,9 @@
 #include "local_config.h"
 #include "configuration.h"
 #include "config_common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <libconfig.h>
 #include "log.h"
 #include "constant.h"
@@ -43,7 +46,10 @@ static void config_log_error(const config_t * config)
 }
 
 /*! brief read volume settings from local config */
-static bool create_volume_from_local_config(uint32_t id, uint64_t cache_size, const char * local_path, bool reread)
+static bool create_volume_from_local_config(uint32_t id, uint64_t cache_size, const char * local_path,
+		uint32_t attr_timeout, uint32_t entry_timeout, const char ** hoard,
+		unsigned int n_hoard, uint32_t update_rate, uint32_t reintegrate_rate,
+		bool reread)
 {
 	volume vol = NULL;
 
@@ -74,7 +80,14 @@ static bool create_volume_from_local_config(uint32_t id, uint64_t cache_size, co
 	if (volume_set_local_info(&vol, &local_path_string, cache_size))
 	{
 		if (vol)
+		{
+			vol->attr_timeout = attr_timeout;
+			vol->entry_timeout = entry_timeout;
+			volume_set_hoard(vol, hoard, n_hoard);
+			vol->update_rate = update_rate;
+			vol->reintegrate_rate = reintegrate_rate;
 			zfsd_mutex_unlock(&vol->mutex);
+		}
 	}
 	else
 	{
@@ -106,6 +119,14 @@ int read_volumes_local_config(config_t * config, bool reread)
 		uint64_t id = 0;
 		uint64_t cache_size;
 		const char * local_path;
+		uint64_t attr_timeout;
+		uint64_t entry_timeout;
+		uint64_t update_rate;
+		uint64_t reintegrate_rate;
+		config_setting_t * hoard_setting;
+		const char ** hoard;
+		unsigned int n_hoard;
+		unsigned int j;
 		int rv;
 
 		rv = config_setting_lookup_uint64_t(volume_setting, "id", &id);
@@ -132,7 +153,64 @@ int read_volumes_local_config(config_t * config, bool reread)
 			return CONFIG_FALSE;
 		}
 
-		create_volume_from_local_config(id, cache_size, local_path, reread);
+		rv = config_setting_lookup_uint64_t(volume_setting, "attr_timeout", &attr_timeout);
+		if (rv != CONFIG_TRUE || attr_timeout > UINT32_MAX)
+		{
+			// kernel caches attributes for the default time
+			attr_timeout = VOLUME_CACHE_TIMEOUT;
+		}
+
+		rv = config_setting_lookup_uint64_t(volume_setting, "entry_timeout", &entry_timeout);
+		if (rv != CONFIG_TRUE || entry_timeout > UINT32_MAX)
+		{
+			// kernel caches directory entries for the default time
+			entry_timeout = VOLUME_CACHE_TIMEOUT;
+		}
+
+		rv = config_setting_lookup_uint64_t(volume_setting, "update_rate", &update_rate);
+		if (rv != CONFIG_TRUE || update_rate > UINT32_MAX)
+		{
+			// background updates of the volume are not limited
+			update_rate = 0;
+		}
+
+		rv = config_setting_lookup_uint64_t(volume_setting, "reintegrate_rate", &reintegrate_rate);
+		if (rv != CONFIG_TRUE || reintegrate_rate > UINT32_MAX)
+		{
+			// reintegrations of the volume are not limited
+			reintegrate_rate = 0;
+		}
+
+		// directory trees hoarded for offline use are optional
+		n_hoard = 0;
+		hoard_setting = config_setting_get_member(volume_setting, "hoard");
+		if (hoard_setting != NULL)
+		{
+			if (config_setting_is_array(hoard_setting) != CONFIG_TRUE
+				&& config_setting_is_list(hoard_setting) != CONFIG_TRUE)
+			{
+				message(LOG_ERROR, FACILITY_CONFIG, "Volume hoard key has wrong type, it should be an array of paths.\n");
+				return CONFIG_FALSE;
+			}
+			n_hoard = config_setting_length(hoard_setting);
+		}
+
+		hoard = (const char **) xmalloc((n_hoard + 1) * sizeof(const char *));
+		for (j = 0; j < n_hoard; ++j)
+		{
+			hoard[j] = config_setting_get_string_elem(hoard_setting, j);
+			if (hoard[j] == NULL || hoard[j][0] != '/')
+			{
+				message(LOG_ERROR, FACILITY_CONFIG, "Volume hoard path is not a string starting with '/'.\n");
+				free(hoard);
+				return CONFIG_FALSE;
+			}
+		}
+
+		create_volume_from_local_config(id, cache_size, local_path, attr_timeout,
+				entry_timeout, hoard, n_hoard, update_rate, reintegrate_rate,
+				reread);
+		free(hoard);
 	}
 
 	return CONFIG_TRUE;
@@ -416,6 +494,98 @@ int read_system_specific_config(config_t * config)
 		zfs_config.mlock_zfsd = config_setting_get_bool(member);
 	}
 
+	/*write_behind*/
+	member = config_setting_get_member(system_settings, "write_behind");
+	if (member != NULL)
+	{
+		if (config_setting_type(member) != CONFIG_TYPE_BOOL)
+		{
+			message(LOG_ERROR, FACILITY_CONFIG, "In system local config write_behind key has wrong type, it should be bool.\n");
+			return CONFIG_FALSE;
+		}
+		zfs_config.write_behind = config_setting_get_bool(member);
+	}
+
+	/*io_uring_entries*/
+	member = config_setting_get_member(system_settings, "io_uring_entries");
+	if (member != NULL)
+	{
+		if (config_setting_type(member) != CONFIG_TYPE_INT)
+		{
+			message(LOG_ERROR, FACILITY_CONFIG, "In system local config io_uring_entries key has wrong type, it should be int.\n");
+			return CONFIG_FALSE;
+		}
+
+		int entries = config_setting_get_int(member);
+		if (entries < 0 || entries > MAX_IO_URING_ENTRIES)
+		{
+			message(LOG_ERROR, FACILITY_CONFIG, "In system local config io_uring_entries key is out of range (min=0 max=%d current=%d).\n",
+					MAX_IO_URING_ENTRIES, entries);
+			return CONFIG_FALSE;
+		}
+		zfs_config.io_uring_entries = entries;
+	}
+
+	/*update_pipeline_depth*/
+	member = config_setting_get_member(system_settings, "update_pipeline_depth");
+	if (member != NULL)
+	{
+		if (config_setting_type(member) != CONFIG_TYPE_INT)
+		{
+			message(LOG_ERROR, FACILITY_CONFIG, "In system local config update_pipeline_depth key has wrong type, it should be int.\n");
+			return CONFIG_FALSE;
+		}
+
+		int depth = config_setting_get_int(member);
+		if (depth < 1 || depth > MAX_UPDATE_PIPELINE_DEPTH)
+		{
+			message(LOG_ERROR, FACILITY_CONFIG, "In system local config update_pipeline_depth key is out of range (min=1 max=%d current=%d).\n",
+					MAX_UPDATE_PIPELINE_DEPTH, depth);
+			return CONFIG_FALSE;
+		}
+		zfs_config.update_pipeline_depth = depth;
+	}
+
+	/*hoard_interval*/
+	member = config_setting_get_member(system_settings, "hoard_interval");
+	if (member != NULL)
+	{
+		if (config_setting_type(member) != CONFIG_TYPE_INT)
+		{
+			message(LOG_ERROR, FACILITY_CONFIG, "In system local config hoard_interval key has wrong type, it should be int.\n");
+			return CONFIG_FALSE;
+		}
+
+		int interval = config_setting_get_int(member);
+		if (interval < 0)
+		{
+			message(LOG_ERROR, FACILITY_CONFIG, "In system local config hoard_interval key is out of range (min=0 current=%d).\n",
+					interval);
+			return CONFIG_FALSE;
+		}
+		zfs_config.hoard_interval = interval;
+	}
+
+	/*hoard_rate*/
+	member = config_setting_get_member(system_settings, "hoard_rate");
+	if (member != NULL)
+	{
+		if (config_setting_type(member) != CONFIG_TYPE_INT)
+		{
+			message(LOG_ERROR, FACILITY_CONFIG, "In system local config hoard_rate key has wrong type, it should be int.\n");
+			return CONFIG_FALSE;
+		}
+
+		int rate = config_setting_get_int(member);
+		if (rate < 0)
+		{
+			message(LOG_ERROR, FACILITY_CONFIG, "In system local config hoard_rate key is out of range (min=0 current=%d).\n",
+					rate);
+			return CONFIG_FALSE;
+		}
+		zfs_config.hoard_rate = rate;
+	}
+
 	/*metadata_tree_depth*/
 	member = config_setting_get_member(system_settings, "metadata_tree_depth");
 	if (member != NULL)
@@ -435,6 +605,42 @@ int read_system_specific_config(config_t * config)
 		}
 	}
 
+	/*metadata_mmap*/
+	member = config_setting_get_member(system_settings, "metadata_mmap");
+	if (member != NULL)
+	{
+		if (config_setting_type(member) != CONFIG_TYPE_BOOL)
+		{
+			message(LOG_ERROR, FACILITY_CONFIG, "In system local config metadata_mmap key has wrong type, it should be bool.\n");
+			return CONFIG_FALSE;
+		}
+		zfs_config.metadata.hashfile_mmap = config_setting_get_bool(member);
+	}
+
+	/*metadata_sync*/
+	member = config_setting_get_member(system_settings, "metadata_sync");
+	if (member != NULL)
+	{
+		if (config_setting_type(member) != CONFIG_TYPE_STRING)
+		{
+			message(LOG_ERROR, FACILITY_CONFIG, "In system local config metadata_sync key has wrong type, it should be string.\n");
+			return CONFIG_FALSE;
+		}
+
+		const char * value = config_setting_get_string(member);
+		if (strcmp(value, "none") == 0)
+			zfs_config.metadata.hashfile_sync = HFILE_SYNC_NONE;
+		else if (strcmp(value, "async") == 0)
+			zfs_config.metadata.hashfile_sync = HFILE_SYNC_ASYNC;
+		else if (strcmp(value, "sync") == 0)
+			zfs_config.metadata.hashfile_sync = HFILE_SYNC_SYNC;
+		else
+		{
+			message(LOG_ERROR, FACILITY_CONFIG, "In system local config metadata_sync key has wrong value %s, it should be none, async or sync.\n", value);
+			return CONFIG_FALSE;
+		}
+	}
+
 	return CONFIG_TRUE;
 }
 
@@ -511,6 +717,135 @@ int read_threads_config(config_t * config)
 		}
 	}
 
+	setting_thread = config_setting_get_member(setting_threads, "readahead_thread");
+	if (setting_thread != NULL)
+	{
+		rv = read_thread_setting(setting_thread, &zfs_config.threads.readahead_thread_limit);
+		if (rv != CONFIG_TRUE)
+		{
+			message(LOG_ERROR, FACILITY_CONFIG, "In threads section failed to read thread limit for read-ahead thread.\n");
+			return CONFIG_FALSE;
+		}
+	}
+
+	config_setting_t * member = config_setting_get_member(setting_threads, "update_node_limit");
+	if (member != NULL)
+	{
+		if (config_setting_type(member) != CONFIG_TYPE_INT)
+		{
+			message(LOG_ERROR, FACILITY_CONFIG, "In threads section update_node_limit key has wrong type, it should be int.\n");
+			return CONFIG_FALSE;
+		}
+
+		int limit = config_setting_get_int(member);
+		if (limit < 0)
+		{
+			message(LOG_ERROR, FACILITY_CONFIG, "In threads section update_node_limit key is out of range (min=0 current=%d).\n",
+					limit);
+			return CONFIG_FALSE;
+		}
+		zfs_config.threads.update_node_limit = limit;
+	}
+
+	return CONFIG_TRUE;
+}
+
+/*! \brief read bandwidth rate NAME from local config */
+static int read_bandwidth_rate(config_setting_t * setting, const char * name, uint32_t * rate)
+{
+	config_setting_t * member = config_setting_get_member(setting, name);
+	if (member == NULL)
+		return CONFIG_TRUE;
+
+	if (config_setting_type(member) != CONFIG_TYPE_INT)
+	{
+		message(LOG_ERROR, FACILITY_CONFIG, "In bandwidth section %s key has wrong type, it should be int.\n", name);
+		return CONFIG_FALSE;
+	}
+
+	int value = config_setting_get_int(member);
+	if (value < 0)
+	{
+		message(LOG_ERROR, FACILITY_CONFIG, "In bandwidth section %s key is out of range (min=0 current=%d).\n",
+				name, value);
+		return CONFIG_FALSE;
+	}
+
+	*rate = value;
+	return CONFIG_TRUE;
+}
+
+/*! \brief read window of the day "HH:MM-HH:MM" from local config */
+static int read_window_setting(const char * str, zfs_config_window * window)
+{
+	unsigned int start_hour, start_min, end_hour, end_min;
+	char end;
+
+	if (str == NULL
+	 || sscanf(str, "%u:%u-%u:%u%c", &start_hour, &start_min, &end_hour, &end_min, &end) != 4
+	 || start_min > 59 || start_hour * 60 + start_min > 24 * 60
+	 || end_min > 59 || end_hour * 60 + end_min > 24 * 60)
+	{
+		message(LOG_ERROR, FACILITY_CONFIG, "In bandwidth section full_speed window is not a string \"HH:MM-HH:MM\".\n");
+		return CONFIG_FALSE;
+	}
+
+	window->start = start_hour * 60 + start_min;
+	window->end = end_hour * 60 + end_min;
+	return CONFIG_TRUE;
+}
+
+int read_bandwidth_config(config_t * config)
+{
+	config_setting_t * setting_bandwidth = config_lookup(config, "bandwidth");
+	if (setting_bandwidth == NULL)
+	{
+		message(LOG_INFO, FACILITY_CONFIG, "No bandwidth section was found in local config.\n");
+		return CONFIG_TRUE;
+	}
+
+	int rv;
+
+	/* bandwidth::update_rate */
+	rv = read_bandwidth_rate(setting_bandwidth, "update_rate", &zfs_config.bandwidth.update_rate);
+	if (rv != CONFIG_TRUE)
+		return rv;
+
+	/* bandwidth::reintegrate_rate */
+	rv = read_bandwidth_rate(setting_bandwidth, "reintegrate_rate", &zfs_config.bandwidth.reintegrate_rate);
+	if (rv != CONFIG_TRUE)
+		return rv;
+
+	/* bandwidth::full_speed */
+	config_setting_t * member = config_setting_get_member(setting_bandwidth, "full_speed");
+	if (member != NULL)
+	{
+		if (config_setting_is_array(member) != CONFIG_TRUE
+		 && config_setting_is_list(member) != CONFIG_TRUE)
+		{
+			message(LOG_ERROR, FACILITY_CONFIG, "In bandwidth section full_speed key has wrong type, it should be an array of windows.\n");
+			return CONFIG_FALSE;
+		}
+
+		int n = config_setting_length(member);
+		if (n > ZFS_MAX_FULL_SPEED_WINDOWS)
+		{
+			message(LOG_ERROR, FACILITY_CONFIG, "In bandwidth section full_speed key has too many windows (max=%d current=%d).\n",
+					ZFS_MAX_FULL_SPEED_WINDOWS, n);
+			return CONFIG_FALSE;
+		}
+
+		int i;
+		for (i = 0; i < n; ++i)
+		{
+			rv = read_window_setting(config_setting_get_string_elem(member, i),
+					&zfs_config.bandwidth.full_speed[i]);
+			if (rv != CONFIG_TRUE)
+				return rv;
+		}
+		zfs_config.bandwidth.n_full_speed = n;
+	}
+
 	return CONFIG_TRUE;
 }
 
@@ -662,6 +997,13 @@ int read_local_config(config_t * config)
 		return rv;
 	}
 
+	rv = read_bandwidth_config(config);
+	if (rv != CONFIG_TRUE)
+	{
+		message(LOG_ERROR, FACILITY_CONFIG, "Failed to read bandwidth config from local config.\n");
+		return rv;
+	}
+
 	rv = read_this_node_local_config(config);
 	if (rv != CONFIG_TRUE)
 	{
@@ -57,6 +57,9 @@ int read_system_specific_config(config_t * config);
 /// reads thread limits from local config
 int read_threads_config(config_t * config);
 
+/// reads bandwidth limits of the background traffic from local config
+int read_bandwidth_config(config_t * config);
+
 #ifdef ENABLE_VERSIONS
 /// reads versioning config
 int read_versioning_config(config_t * config);
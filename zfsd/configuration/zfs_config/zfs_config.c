@@ -39,6 +39,11 @@ zfs_configuration zfs_config =
 	.config_reader_data = {.mutex = ZFS_MUTEX_INITIALIZER},
 	.config_sem = ZFS_SEMAPHORE_INITIALIZER(0),
 	.mlock_zfsd = true,
+	.write_behind = false,
+	.io_uring_entries = 0,
+	.update_pipeline_depth = 4,
+	.hoard_interval = 600,
+	.hoard_rate = 0,
 #ifdef __ANDROID__
 	.local_config_path = "/data/misc/zfsd/etc/zfsd/zfsd.conf",
 #else
@@ -60,6 +65,8 @@ zfs_configuration zfs_config =
 	},
 	.metadata = {
 		.metadata_tree_depth = 1,
+		.hashfile_mmap = false,
+		.hashfile_sync = HFILE_SYNC_NONE,
 	},
 	.threads = {
 		.network_thread_limit = {
@@ -77,6 +84,17 @@ zfs_configuration zfs_config =
 			.min_spare = 1,
 			.max_spare = 2
 		},
+		.update_node_limit = 0,
+		.readahead_thread_limit = {
+			.max_total = 4,
+			.min_spare = 1,
+			.max_spare = 2
+		},
+	},
+	.bandwidth = {
+		.update_rate = 0,
+		.reintegrate_rate = 0,
+		.n_full_speed = 0,
 	},
 #ifdef ENABLE_CLI
 	.cli = {
@@ -31,6 +31,7 @@
 #include "pthread-wrapper.h"
 #include "memory.h"
 #include "thread.h"
+#include "hashfile.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -100,6 +101,13 @@ typedef struct zfs_config_metadata_def
 {
 	/*! Depth of directory tree for saving metadata about files.  */
 	uint32_t metadata_tree_depth;
+
+	/*! Access the hash files of metadata through a memory mapping.  */
+	bool hashfile_mmap;
+
+	/*! When the changes of the hash files of metadata are written to
+	    disk.  */
+	hfile_sync hashfile_sync;
 } zfs_config_metadata;
 
 /*! \brief Thread specific configuration */
@@ -113,8 +121,45 @@ typedef struct zfs_config_threads_def
 
 	/*! Limits for number of update threads.  */
 	thread_limit update_thread_limit;
+
+	/*! Maximal number of files of one master node updated or reintegrated
+	    by the update threads at once, 0 for no limit (the default).  */
+	uint32_t update_node_limit;
+
+	/*! Limits for number of read-ahead threads.  */
+	thread_limit readahead_thread_limit;
 } zfs_config_threads;
 
+/*! \brief Maximal number of windows of the day in which the background
+   traffic is not limited.  */
+#define ZFS_MAX_FULL_SPEED_WINDOWS 8
+
+/*! \brief Window of the day in minutes after midnight, it continues over
+   midnight when START is greater than END.  */
+typedef struct zfs_config_window_def
+{
+	uint32_t start;
+	uint32_t end;
+} zfs_config_window;
+
+/*! \brief Bandwidth limits of the background traffic */
+typedef struct zfs_config_bandwidth_def
+{
+	/*! Bytes per second of the background updates of files from one
+	    master node, 0 for no limit.  */
+	uint32_t update_rate;
+
+	/*! Bytes per second of the reintegrations of files to one master
+	    node, 0 for no limit.  */
+	uint32_t reintegrate_rate;
+
+	/*! Number of windows in FULL_SPEED.  */
+	uint32_t n_full_speed;
+
+	/*! Windows of the day in which the limits do not apply.  */
+	zfs_config_window full_speed[ZFS_MAX_FULL_SPEED_WINDOWS];
+} zfs_config_bandwidth;
+
 /*! \brief ZlomekFS specific global configuration */
 typedef struct zfs_configuration_def
 {
@@ -127,6 +172,25 @@ typedef struct zfs_configuration_def
 	/*! mlockall() zfsd . */
 	bool mlock_zfsd;
 
+	/*! Reply to writes to remote files before they are written.  */
+	bool write_behind;
+
+	/*! Number of entries of the io_uring used for local file I/O,
+	    0 to use synchronous I/O.  */
+	uint32_t io_uring_entries;
+
+	/*! Number of blocks of a file read from the master node at once when
+	    the file is being updated.  */
+	uint32_t update_pipeline_depth;
+
+	/*! Seconds between the walks of the hoarded directory trees,
+	    0 to disable hoarding.  */
+	uint32_t hoard_interval;
+
+	/*! Bytes per second of files scheduled for updating by hoarding,
+	    0 for no limit.  */
+	uint32_t hoard_rate;
+
 	/*! local path to local config */
 	const char * local_config_path;
 
@@ -151,6 +215,9 @@ typedef struct zfs_configuration_def
 	/*! threads config */
 	zfs_config_threads threads;
 
+	/*! bandwidth limits */
+	zfs_config_bandwidth bandwidth;
+
 #ifdef ENABLE_CLI
 	/*! cli specific config */
 	zfs_config_cli cli;
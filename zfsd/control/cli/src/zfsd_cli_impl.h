@@ -43,6 +43,11 @@
 #include "volume.h"
 #include "file.h"
 #include "fh.h"
+#include "io-engine.h"
+#include "bandwidth.h"
+#ifdef ENABLE_LOCK_PROFILE
+#include "lock-profile.h"
+#endif
 
 
 static void sayHello(const cli::OutputDevice& CLI_Out) { CLI_Out << "Hello!" << cli::endl; }
@@ -304,4 +309,79 @@ static void zlomekfs_print_internal_fhs(const cli::OutputDevice& CLI_Out)
 	for_each_internal_fh(zlomekfs_print_internal_fh, (void *) &CLI_Out);
 }
 
+#ifdef ENABLE_LOCK_PROFILE
+static void zlomekfs_print_lock_site(const lock_profile_site * site, void * data)
+{
+	const cli::OutputDevice * CLI_Out = (cli::OutputDevice *) data;
+	if (site->count == 0) return;
+
+	*CLI_Out << site->file << ":" << site->line << " " << site->name;
+	*CLI_Out << ", count: " << (unsigned long) site->count;
+	*CLI_Out << ", contended: " << (unsigned long) site->contended;
+	*CLI_Out << ", wait_us: " << (unsigned long) (site->wait_ns / 1000);
+	*CLI_Out << ", max_wait_us: " << (unsigned long) (site->max_wait_ns / 1000);
+	*CLI_Out << ", hold_us: " << (unsigned long) (site->hold_ns / 1000);
+	*CLI_Out << cli::endl;
+}
+#endif
+
+static void zlomekfs_print_lock_profile(const cli::OutputDevice& CLI_Out)
+{
+#ifdef ENABLE_LOCK_PROFILE
+	CLI_Out << "lock sites:" << cli::endl;
+	lock_profile_for_each(zlomekfs_print_lock_site, (void *) &CLI_Out);
+#else
+	CLI_Out << "Lock profiling is not enabled." << cli::endl;
+#endif
+}
+
+static void zlomekfs_reset_lock_profile(const cli::OutputDevice& CLI_Out)
+{
+#ifdef ENABLE_LOCK_PROFILE
+	lock_profile_reset();
+	CLI_Out << "OK" << cli::endl;
+#else
+	CLI_Out << "Lock profiling is not enabled." << cli::endl;
+#endif
+}
+
+static void zlomekfs_print_io_engine(const cli::OutputDevice& CLI_Out)
+{
+	io_engine_stats stats;
+
+	io_engine_get_stats(&stats);
+	CLI_Out << "requests: " << (unsigned long) stats.requests << cli::endl;
+	CLI_Out << "sync_calls: " << (unsigned long) stats.sync_calls << cli::endl;
+	if (stats.entries == 0)
+	{
+		CLI_Out << "io_uring is not used." << cli::endl;
+		return;
+	}
+
+	CLI_Out << "entries: " << (unsigned long) stats.entries << cli::endl;
+	CLI_Out << "in_flight: " << (unsigned long) stats.in_flight << cli::endl;
+	CLI_Out << "max_in_flight: " << (unsigned long) stats.max_in_flight << cli::endl;
+	CLI_Out << "submitted: " << (unsigned long) stats.submitted << cli::endl;
+	CLI_Out << "submit_calls: " << (unsigned long) stats.submit_calls << cli::endl;
+	CLI_Out << "completed: " << (unsigned long) stats.completed << cli::endl;
+	CLI_Out << "completion_batches: " << (unsigned long) stats.completion_batches << cli::endl;
+}
+
+static void zlomekfs_print_bandwidth(const cli::OutputDevice& CLI_Out)
+{
+	static const char * class_names[BANDWIDTH_CLASSES] = {"demand", "update", "reintegrate"};
+	bandwidth_stats stats;
+	int i;
+
+	bandwidth_get_stats(&stats);
+	CLI_Out << "update_rate: " << (unsigned long) zfs_config.bandwidth.update_rate << cli::endl;
+	CLI_Out << "reintegrate_rate: " << (unsigned long) zfs_config.bandwidth.reintegrate_rate << cli::endl;
+	for (i = 0; i < BANDWIDTH_CLASSES; i++)
+	{
+		CLI_Out << class_names[i] << ": bytes: " << (unsigned long) stats.bytes[i];
+		CLI_Out << ", wait_ms: " << (unsigned long) (stats.wait_ns[i] / 1000000);
+		CLI_Out << cli::endl;
+	}
+}
+
 #endif // ZFSD_CLI_IMPL_H
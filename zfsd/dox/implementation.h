@@ -433,11 +433,22 @@
           	cache_size = 0;
 		# path to local cache
           	local_path = "/var/zfs/config";
+		# optional, seconds the kernel may cache file attributes
+		# and directory entries, 5 by default
+          	attr_timeout = 5;
+          	entry_timeout = 5;
           },
           {
           	id = 2;
           	local_path = "/var/zfs/data";
           	cache_size = 0;
+		# optional, directory trees of the volume kept updated
+		# for offline use
+          	hoard = [ "/projects", "/mail" ];
+		# optional, bytes per second of the background updates and of
+		# the reintegrations of the volume, 0 by default for no limit
+          	update_rate = 0;
+          	reintegrate_rate = 0;
           }
           );
 
@@ -445,8 +456,31 @@
           system:
           {
           	mlock = false;
+		# reply to writes to files on remote nodes before they are
+		# written, errors are reported by fsync and close, false by default
+          	write_behind = false;
+		# size of the io_uring used for reading and writing local files
+		# (needs ENABLE_IO_URING build), 0 by default for synchronous I/O
+          	io_uring_entries = 0;
+		# number of blocks of a file read from the master node at once
+		# by update, 1 reads them one by one, 4 by default
+          	update_pipeline_depth = 4;
+		# seconds between the walks of the hoarded directory trees,
+		# 0 disables hoarding, 600 by default
+          	hoard_interval = 600;
+		# bytes per second of files scheduled for updating by hoarding,
+		# 0 by default for no limit
+          	hoard_rate = 0;
           	# the depth of the directory tree containing the files with variable-length metadata, the default is 1.
           	metadata_tree_depth = 1;
+		# access the hash tables of metadata through a memory mapping
+		# instead of reading each slot, false by default
+          	metadata_mmap = false;
+		# when the changes of the hash tables of metadata are written
+		# to disk: "none" leaves it to the kernel, "async" starts the
+		# writing after each change of a memory mapped table, "sync"
+		# waits for it, "none" by default
+          	metadata_sync = "none";
           	local_config = "/var/zfs/config";
           };
 
@@ -455,6 +489,24 @@
           	# max_total = 10;
           	# min_spare = 10;
           	# max_spare = 10;
+		# number of files of one master node updated or reintegrated
+		# by the update threads at once, 0 for no limit (by default,
+		# all update threads may work for one master node)
+          	update_node_limit = 2;
+          };
+
+          # limits of the background traffic to each master node
+          bandwidth:
+          {
+		# bytes per second of the background updates of files,
+		# 0 by default for no limit
+          	update_rate = 65536;
+		# bytes per second of the reintegrations of files,
+		# 0 by default for no limit
+          	reintegrate_rate = 32768;
+		# windows of the day (local time) in which the limits do
+		# not apply, at most 8
+          	full_speed = [ "22:00-06:00" ];
           };
 
           users:
@@ -34,6 +34,8 @@
 #include "fh.h"
 #include "dir.h"
 #include "file.h"
+#include "readahead.h"
+#include "writebehind.h"
 #include "reread_config.h"
 #include "zfs_config.h"
 #include "thread.h"
@@ -404,20 +406,20 @@ static bool inc_local_version_fh(zfs_fh * fh)
 
 	if (dentry)
 	{
-		dentry->fh->meta.local_version++;
+		dentry->fh->meta->local_version++;
 		if (!vol->is_copy)
-			dentry->fh->meta.master_version = dentry->fh->meta.local_version;
-		set_attr_version(&dentry->fh->attr, &dentry->fh->meta);
+			dentry->fh->meta->master_version = dentry->fh->meta->local_version;
+		set_attr_version(&dentry->fh->attr, dentry->fh->meta);
 
-		if (!flush_metadata(vol, &dentry->fh->meta))
+		if (!flush_metadata(vol, dentry->fh->meta))
 		{
 			MARK_VOLUME_DELETE(vol);
 
-			dentry->fh->meta.local_version--;
+			dentry->fh->meta->local_version--;
 			if (!vol->is_copy)
-				dentry->fh->meta.master_version =
-					dentry->fh->meta.local_version;
-			set_attr_version(&dentry->fh->attr, &dentry->fh->meta);
+				dentry->fh->meta->master_version =
+					dentry->fh->meta->local_version;
+			set_attr_version(&dentry->fh->attr, dentry->fh->meta);
 
 			release_dentry(dentry);
 			zfsd_mutex_unlock(&vol->mutex);
@@ -1407,11 +1409,11 @@ int32_t remote_getattr(fattr * attr, internal_dentry dentry, volume vol)
 	CHECK_MUTEX_LOCKED(&dentry->fh->mutex);
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 #ifdef ENABLE_CHECKING
-	if (zfs_fh_undefined(dentry->fh->meta.master_fh))
+	if (zfs_fh_undefined(dentry->fh->meta->master_fh))
 		zfsd_abort();
 #endif
 
-	args = dentry->fh->meta.master_fh;
+	args = dentry->fh->meta->master_fh;
 
 	release_dentry(dentry);
 	zfsd_mutex_lock(&node_mutex);
@@ -1454,6 +1456,9 @@ int32_t zfs_getattr(fattr * fa, zfs_fh * fh)
 	if (r != ZFS_OK)
 		RETURN_INT(r);
 
+	/* Attributes of the file must reflect the data written behind.  */
+	writebehind_flush(fh, false);
+
 	/* Lookup FH.  */
 	r = zfs_fh_lookup_nolock(fh, &vol, &dentry, &vd, true);
 	if (r == ZFS_STALE)
@@ -1536,7 +1541,7 @@ int32_t zfs_getattr(fattr * fa, zfs_fh * fh)
 	{
 		/* Update cached file attributes.  */
 		if (INTERNAL_FH_HAS_LOCAL_PATH(dentry->fh))
-			set_attr_version(fa, &dentry->fh->meta);
+			set_attr_version(fa, dentry->fh->meta);
 		dentry->fh->attr = *fa;
 	}
 
@@ -1658,14 +1663,14 @@ local_setattr(fattr * fa, internal_dentry dentry, sattr * sa, volume vol,
 				else
 					fd = open(path.str, O_RDONLY);
 
-				version_copy_data(fd, dentry->fh->version_fd, sa->size,
+				version_copy_data(fd, dentry->fh->version->fd, sa->size,
 								  fa->size - sa->size, NULL);
 
 				if (dentry->fh->fd < 0)
 					close(fd);
 
 				// add interval
-				interval_tree_insert(dentry->fh->versioned, sa->size,
+				interval_tree_insert(dentry->fh->version->versioned, sa->size,
 									 fa->size);
 			}
 
@@ -1707,12 +1712,14 @@ remote_setattr(fattr * fa, internal_dentry dentry, sattr * sa, volume vol)
 	CHECK_MUTEX_LOCKED(&dentry->fh->mutex);
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 #ifdef ENABLE_CHECKING
-	if (zfs_fh_undefined(dentry->fh->meta.master_fh))
+	if (zfs_fh_undefined(dentry->fh->meta->master_fh))
 		zfsd_abort();
 #endif
 
-	args.file = dentry->fh->meta.master_fh;
+	args.file = dentry->fh->meta->master_fh;
 	args.attr = *sa;
+	if (sa->size != (uint64_t) - 1)
+		readahead_invalidate(&args.file);
 
 	release_dentry(dentry);
 	zfsd_mutex_lock(&node_mutex);
@@ -1756,6 +1763,9 @@ int32_t zfs_setattr(fattr * fa, zfs_fh * fh, sattr * sa, bool should_version)
 	if (r != ZFS_OK)
 		RETURN_INT(r);
 
+	/* Change the attributes after the data written behind are written.  */
+	writebehind_flush(fh, false);
+
 	/* Lookup FH.  */
 	r = zfs_fh_lookup_nolock(fh, &vol, &dentry, &vd, true);
 	if (r == ZFS_STALE)
@@ -1882,7 +1892,7 @@ int32_t zfs_setattr(fattr * fa, zfs_fh * fh, sattr * sa, bool should_version)
 
 			/* Update cached file attributes.  */
 			if (INTERNAL_FH_HAS_LOCAL_PATH(dentry->fh))
-				set_attr_version(fa, &dentry->fh->meta);
+				set_attr_version(fa, dentry->fh->meta);
 			dentry->fh->attr = *fa;
 
 			if (dentry->parent)
@@ -1897,17 +1907,17 @@ int32_t zfs_setattr(fattr * fa, zfs_fh * fh, sattr * sa, bool should_version)
 						zfsd_abort();
 #endif
 
-					if (METADATA_ATTR_CHANGE_P(dentry->fh->meta,
+					if (METADATA_ATTR_CHANGE_P(*dentry->fh->meta,
 											   dentry->fh->attr)
 						&& METADATA_ATTR_EQ_P(dentry->fh->attr,
 											  other->fh->attr))
 					{
-						dentry->fh->meta.modetype
+						dentry->fh->meta->modetype
 							= GET_MODETYPE(dentry->fh->attr.mode,
 										   dentry->fh->attr.type);
-						dentry->fh->meta.uid = dentry->fh->attr.uid;
-						dentry->fh->meta.gid = dentry->fh->attr.gid;
-						if (!flush_metadata(vol, &dentry->fh->meta))
+						dentry->fh->meta->uid = dentry->fh->attr.uid;
+						dentry->fh->meta->gid = dentry->fh->attr.gid;
+						if (!flush_metadata(vol, dentry->fh->meta))
 							MARK_VOLUME_DELETE(vol);
 
 						release_dentry(dentry);
@@ -2088,11 +2098,11 @@ remote_lookup(dir_op_res * res, internal_dentry dir, string * name, volume vol)
 	CHECK_MUTEX_LOCKED(&dir->fh->mutex);
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 #ifdef ENABLE_CHECKING
-	if (zfs_fh_undefined(dir->fh->meta.master_fh))
+	if (zfs_fh_undefined(dir->fh->meta->master_fh))
 		zfsd_abort();
 #endif
 
-	args.dir = dir->fh->meta.master_fh;
+	args.dir = dir->fh->meta->master_fh;
 	args.name = *name;
 
 	release_dentry(dir);
@@ -2542,11 +2552,11 @@ remote_mkdir(dir_op_res * res, internal_dentry dir, string * name,
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 	CHECK_MUTEX_LOCKED(&dir->fh->mutex);
 #ifdef ENABLE_CHECKING
-	if (zfs_fh_undefined(dir->fh->meta.master_fh))
+	if (zfs_fh_undefined(dir->fh->meta->master_fh))
 		zfsd_abort();
 #endif
 
-	args.where.dir = dir->fh->meta.master_fh;
+	args.where.dir = dir->fh->meta->master_fh;
 	args.where.name = *name;
 	args.attr = *attr;
 
@@ -2635,7 +2645,7 @@ int32_t zfs_mkdir(dir_op_res * res, zfs_fh * dir, string * name, sattr * attr)
 		RETURN_INT(EACCES);
 	}
 
-	if (idir->fh->meta.flags & METADATA_SHADOW_TREE)
+	if (idir->fh->meta->flags & METADATA_SHADOW_TREE)
 	{
 		release_dentry(idir);
 		zfsd_mutex_unlock(&vol->mutex);
@@ -2689,8 +2699,8 @@ int32_t zfs_mkdir(dir_op_res * res, zfs_fh * dir, string * name, sattr * attr)
 				if (!add_journal_entry(vol, idir->fh->journal,
 									   &idir->fh->local_fh,
 									   &dentry->fh->local_fh,
-									   &dentry->fh->meta.master_fh,
-									   dentry->fh->meta.master_version, name,
+									   &dentry->fh->meta->master_fh,
+									   dentry->fh->meta->master_version, name,
 									   JOURNAL_OPERATION_ADD))
 					MARK_VOLUME_DELETE(vol);
 			}
@@ -2813,11 +2823,11 @@ static int32_t remote_rmdir(internal_dentry dir, string * name, volume vol)
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 	CHECK_MUTEX_LOCKED(&dir->fh->mutex);
 #ifdef ENABLE_CHECKING
-	if (zfs_fh_undefined(dir->fh->meta.master_fh))
+	if (zfs_fh_undefined(dir->fh->meta->master_fh))
 		zfsd_abort();
 #endif
 
-	args.dir = dir->fh->meta.master_fh;
+	args.dir = dir->fh->meta->master_fh;
 	args.name = *name;
 
 	release_dentry(dir);
@@ -2961,7 +2971,7 @@ int32_t zfs_rmdir(zfs_fh * dir, string * name)
 				/* "Deleting" local directory.  */
 
 				if (!ZFS_FH_EQ
-					(dentry->fh->meta.master_fh, other->fh->local_fh))
+					(dentry->fh->meta->master_fh, other->fh->local_fh))
 				{
 					/* Conflict is on file handles.  */
 					what_to_do = 3;
@@ -2971,7 +2981,7 @@ int32_t zfs_rmdir(zfs_fh * dir, string * name)
 					release_dentry(idir);
 
 					local_fh = dentry->fh->local_fh;
-					remote_fh = dentry->fh->meta.master_fh;
+					remote_fh = dentry->fh->meta->master_fh;
 					release_dentry(dentry);
 					release_dentry(other);
 					r = resolve_conflict_delete_local(&res, parent,
@@ -3003,7 +3013,7 @@ int32_t zfs_rmdir(zfs_fh * dir, string * name)
 				/* "Deleting" remote directory.  */
 
 				if (!ZFS_FH_EQ
-					(other->fh->meta.master_fh, dentry->fh->local_fh))
+					(other->fh->meta->master_fh, dentry->fh->local_fh))
 				{
 					/* Conflict is on file handles.  */
 					what_to_do = 4;
@@ -3015,7 +3025,7 @@ int32_t zfs_rmdir(zfs_fh * dir, string * name)
 
 					local_fh = other->fh->local_fh;
 					remote_fh = dentry->fh->local_fh;
-					master_version = other->fh->meta.master_version;
+					master_version = other->fh->meta->master_version;
 					release_dentry(dentry);
 					release_dentry(other);
 					r = resolve_conflict_delete_remote(vol, parent, &name2,
@@ -3100,7 +3110,7 @@ int32_t zfs_rmdir(zfs_fh * dir, string * name)
 
 			if (vol->master != this_node
 				&& !SPECIAL_DIR_P(idir, name->str, true)
-				&& !(idir->fh->meta.flags & METADATA_SHADOW_TREE))
+				&& !(idir->fh->meta->flags & METADATA_SHADOW_TREE))
 			{
 				if (!add_journal_entry_meta(vol, idir->fh->journal,
 											&idir->fh->local_fh, &meta, name,
@@ -3172,14 +3182,14 @@ int32_t zfs_rmdir(zfs_fh * dir, string * name)
 				zfsd_abort();
 #endif
 
-			set_attr_version(&fa, &dentry->fh->meta);
+			set_attr_version(&fa, dentry->fh->meta);
 			dentry->fh->attr = fa;
 			if (METADATA_ATTR_EQ_P(dentry->fh->attr, other->fh->attr))
 			{
-				dentry->fh->meta.modetype = GET_MODETYPE(fa.mode, fa.type);
-				dentry->fh->meta.uid = fa.uid;
-				dentry->fh->meta.gid = fa.gid;
-				if (!flush_metadata(vol, &dentry->fh->meta))
+				dentry->fh->meta->modetype = GET_MODETYPE(fa.mode, fa.type);
+				dentry->fh->meta->uid = fa.uid;
+				dentry->fh->meta->gid = fa.gid;
+				if (!flush_metadata(vol, dentry->fh->meta))
 					MARK_VOLUME_DELETE(vol);
 			}
 			release_dentry(dentry);
@@ -3206,10 +3216,10 @@ int32_t zfs_rmdir(zfs_fh * dir, string * name)
 			release_dentry(dentry);
 
 			other = conflict_other_dentry(idir, dentry);
-			other->fh->meta.modetype = GET_MODETYPE(fa.mode, fa.type);
-			other->fh->meta.uid = fa.uid;
-			other->fh->meta.gid = fa.gid;
-			if (!flush_metadata(vol, &other->fh->meta))
+			other->fh->meta->modetype = GET_MODETYPE(fa.mode, fa.type);
+			other->fh->meta->uid = fa.uid;
+			other->fh->meta->gid = fa.gid;
+			if (!flush_metadata(vol, other->fh->meta))
 				MARK_VOLUME_DELETE(vol);
 			release_dentry(other);
 
@@ -3406,7 +3416,7 @@ local_rename(metadata * meta_old, metadata * meta_new,
 
 	build_local_path_name(&from_path, vol, from_dir, from_name);
 	build_local_path_name(&to_path, vol, to_dir, to_name);
-	shadow = (to_dir->fh->meta.flags & METADATA_SHADOW_TREE) != 0;
+	shadow = (to_dir->fh->meta->flags & METADATA_SHADOW_TREE) != 0;
 	release_dentry(from_dir);
 	if (to_dir->fh != from_dir->fh)
 		release_dentry(to_dir);
@@ -3438,15 +3448,15 @@ remote_rename(internal_dentry from_dir, string * from_name,
 	CHECK_MUTEX_LOCKED(&to_dir->fh->mutex);
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 #ifdef ENABLE_CHECKING
-	if (zfs_fh_undefined(from_dir->fh->meta.master_fh))
+	if (zfs_fh_undefined(from_dir->fh->meta->master_fh))
 		zfsd_abort();
-	if (zfs_fh_undefined(to_dir->fh->meta.master_fh))
+	if (zfs_fh_undefined(to_dir->fh->meta->master_fh))
 		zfsd_abort();
 #endif
 
-	args.from.dir = from_dir->fh->meta.master_fh;
+	args.from.dir = from_dir->fh->meta->master_fh;
 	args.from.name = *from_name;
-	args.to.dir = to_dir->fh->meta.master_fh;
+	args.to.dir = to_dir->fh->meta->master_fh;
 	args.to.name = *to_name;
 
 	release_dentry(from_dir);
@@ -3495,7 +3505,7 @@ zfs_rename_journal(internal_dentry from_dir, string * from_name,
 #endif
 
 	if (from_dir && INTERNAL_FH_HAS_LOCAL_PATH(from_dir->fh)
-		&& !(from_dir->fh->meta.flags & METADATA_SHADOW_TREE))
+		&& !(from_dir->fh->meta->flags & METADATA_SHADOW_TREE))
 	{
 		if (vol->master != this_node)
 		{
@@ -3510,7 +3520,7 @@ zfs_rename_journal(internal_dentry from_dir, string * from_name,
 	}
 
 	if (to_dir && INTERNAL_FH_HAS_LOCAL_PATH(to_dir->fh)
-		&& !(to_dir->fh->meta.flags & METADATA_SHADOW_TREE))
+		&& !(to_dir->fh->meta->flags & METADATA_SHADOW_TREE))
 	{
 		if (vol->master != this_node)
 		{
@@ -3600,7 +3610,7 @@ zfs_rename(zfs_fh * from_dir, string * from_name,
 		RETURN_INT(EACCES);
 	}
 
-	if (to_dentry->fh->meta.flags & METADATA_SHADOW_TREE)
+	if (to_dentry->fh->meta->flags & METADATA_SHADOW_TREE)
 	{
 		release_dentry(to_dentry);
 		zfsd_mutex_unlock(&vol->mutex);
@@ -3923,14 +3933,14 @@ remote_link(internal_dentry from, internal_dentry dir, string * name,
 	CHECK_MUTEX_LOCKED(&dir->fh->mutex);
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 #ifdef ENABLE_CHECKING
-	if (zfs_fh_undefined(from->fh->meta.master_fh))
+	if (zfs_fh_undefined(from->fh->meta->master_fh))
 		zfsd_abort();
-	if (zfs_fh_undefined(dir->fh->meta.master_fh))
+	if (zfs_fh_undefined(dir->fh->meta->master_fh))
 		zfsd_abort();
 #endif
 
-	args.from = from->fh->meta.master_fh;
-	args.to.dir = dir->fh->meta.master_fh;
+	args.from = from->fh->meta->master_fh;
+	args.to.dir = dir->fh->meta->master_fh;
 	args.to.name = *name;
 
 	release_dentry(from);
@@ -4027,7 +4037,7 @@ int32_t zfs_link(zfs_fh * from, zfs_fh * dir, string * name)
 		RETURN_INT(EPERM);
 	}
 
-	if (from_dentry->fh->meta.flags & (METADATA_SHADOW_TREE | METADATA_SHADOW))
+	if (from_dentry->fh->meta->flags & (METADATA_SHADOW_TREE | METADATA_SHADOW))
 	{
 		release_dentry(from_dentry);
 		zfsd_mutex_unlock(&vol->mutex);
@@ -4079,7 +4089,7 @@ int32_t zfs_link(zfs_fh * from, zfs_fh * dir, string * name)
 		RETURN_INT(EACCES);
 	}
 
-	if (dir_dentry->fh->meta.flags & METADATA_SHADOW_TREE)
+	if (dir_dentry->fh->meta->flags & METADATA_SHADOW_TREE)
 	{
 		release_dentry(dir_dentry);
 		zfsd_mutex_unlock(&vol->mutex);
@@ -4314,11 +4324,11 @@ static int32_t remote_unlink(internal_dentry dir, string * name, volume vol)
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 	CHECK_MUTEX_LOCKED(&dir->fh->mutex);
 #ifdef ENABLE_CHECKING
-	if (zfs_fh_undefined(dir->fh->meta.master_fh))
+	if (zfs_fh_undefined(dir->fh->meta->master_fh))
 		zfsd_abort();
 #endif
 
-	args.dir = dir->fh->meta.master_fh;
+	args.dir = dir->fh->meta->master_fh;
 	args.name = *name;
 
 	release_dentry(dir);
@@ -4479,7 +4489,7 @@ int32_t zfs_unlink(zfs_fh * dir, string * name)
 					release_dentry(idir);
 
 					local_fh = dentry->fh->local_fh;
-					remote_fh = dentry->fh->meta.master_fh;
+					remote_fh = dentry->fh->meta->master_fh;
 					release_dentry(dentry);
 					release_dentry(other);
 					r = resolve_conflict_delete_local(&res, parent,
@@ -4490,7 +4500,7 @@ int32_t zfs_unlink(zfs_fh * dir, string * name)
 				else			/* Both DENTRY and OTHER are regular dentries. 
 								 */
 				{
-					if (!ZFS_FH_EQ(dentry->fh->meta.master_fh,
+					if (!ZFS_FH_EQ(dentry->fh->meta->master_fh,
 								   other->fh->local_fh))
 					{
 						/* Conflict is on file handles.  */
@@ -4501,7 +4511,7 @@ int32_t zfs_unlink(zfs_fh * dir, string * name)
 						release_dentry(idir);
 
 						local_fh = dentry->fh->local_fh;
-						remote_fh = dentry->fh->meta.master_fh;
+						remote_fh = dentry->fh->meta->master_fh;
 						release_dentry(dentry);
 						release_dentry(other);
 						r = resolve_conflict_delete_local(&res, parent,
@@ -4510,9 +4520,9 @@ int32_t zfs_unlink(zfs_fh * dir, string * name)
 														  &remote_fh, vol);
 					}
 					else if ((dentry->fh->attr.version
-							  > dentry->fh->meta.master_version)
+							  > dentry->fh->meta->master_version)
 							 && (other->fh->attr.version
-								 > dentry->fh->meta.master_version))
+								 > dentry->fh->meta->master_version))
 					{
 						/* Conflict is on file versions and possibly on
 						   attributes.  */
@@ -4557,7 +4567,7 @@ int32_t zfs_unlink(zfs_fh * dir, string * name)
 					xstringdup(&name2, &idir->name);
 					local_fh = other->fh->local_fh;
 					remote_fh = dentry->fh->local_fh;
-					master_version = other->fh->meta.master_version;
+					master_version = other->fh->meta->master_version;
 					release_dentry(idir);
 					release_dentry(dentry);
 					release_dentry(other);
@@ -4575,7 +4585,7 @@ int32_t zfs_unlink(zfs_fh * dir, string * name)
 
 					local_fh = other->fh->local_fh;
 					remote_fh = dentry->fh->local_fh;
-					master_version = other->fh->meta.master_version;
+					master_version = other->fh->meta->master_version;
 					release_dentry(dentry);
 					release_dentry(other);
 					r = resolve_conflict_delete_remote(vol, parent, &name2,
@@ -4584,7 +4594,7 @@ int32_t zfs_unlink(zfs_fh * dir, string * name)
 				else			/* Both DENTRY and OTHER are regular dentries. 
 								 */
 				{
-					if (!ZFS_FH_EQ(other->fh->meta.master_fh,
+					if (!ZFS_FH_EQ(other->fh->meta->master_fh,
 								   dentry->fh->local_fh))
 					{
 						/* Conflict is on file handles.  */
@@ -4597,16 +4607,16 @@ int32_t zfs_unlink(zfs_fh * dir, string * name)
 
 						local_fh = other->fh->local_fh;
 						remote_fh = dentry->fh->local_fh;
-						master_version = other->fh->meta.master_version;
+						master_version = other->fh->meta->master_version;
 						release_dentry(dentry);
 						release_dentry(other);
 						r = resolve_conflict_delete_remote(vol, parent, &name2,
 														   &remote_fh);
 					}
 					else if ((dentry->fh->attr.version
-							  > other->fh->meta.master_version)
+							  > other->fh->meta->master_version)
 							 && (other->fh->attr.version
-								 > other->fh->meta.master_version))
+								 > other->fh->meta->master_version))
 					{
 						/* Conflict is on file versions and possibly on
 						   attributes.  */
@@ -4701,7 +4711,7 @@ int32_t zfs_unlink(zfs_fh * dir, string * name)
 
 			if (vol->master != this_node
 				&& !SPECIAL_DIR_P(idir, name->str, true)
-				&& !(idir->fh->meta.flags & METADATA_SHADOW_TREE))
+				&& !(idir->fh->meta->flags & METADATA_SHADOW_TREE))
 			{
 				if (!add_journal_entry_meta(vol, idir->fh->journal,
 											&idir->fh->local_fh, &meta, name,
@@ -4775,14 +4785,14 @@ int32_t zfs_unlink(zfs_fh * dir, string * name)
 				zfsd_abort();
 #endif
 
-			set_attr_version(&fa, &dentry->fh->meta);
+			set_attr_version(&fa, dentry->fh->meta);
 			dentry->fh->attr = fa;
 			if (METADATA_ATTR_EQ_P(dentry->fh->attr, other->fh->attr))
 			{
-				dentry->fh->meta.modetype = GET_MODETYPE(fa.mode, fa.type);
-				dentry->fh->meta.uid = fa.uid;
-				dentry->fh->meta.gid = fa.gid;
-				if (!flush_metadata(vol, &dentry->fh->meta))
+				dentry->fh->meta->modetype = GET_MODETYPE(fa.mode, fa.type);
+				dentry->fh->meta->uid = fa.uid;
+				dentry->fh->meta->gid = fa.gid;
+				if (!flush_metadata(vol, dentry->fh->meta))
 					MARK_VOLUME_DELETE(vol);
 			}
 			release_dentry(dentry);
@@ -4809,10 +4819,10 @@ int32_t zfs_unlink(zfs_fh * dir, string * name)
 			release_dentry(dentry);
 
 			other = conflict_other_dentry(idir, dentry);
-			other->fh->meta.modetype = GET_MODETYPE(fa.mode, fa.type);
-			other->fh->meta.uid = fa.uid;
-			other->fh->meta.gid = fa.gid;
-			if (!flush_metadata(vol, &other->fh->meta))
+			other->fh->meta->modetype = GET_MODETYPE(fa.mode, fa.type);
+			other->fh->meta->uid = fa.uid;
+			other->fh->meta->gid = fa.gid;
+			if (!flush_metadata(vol, other->fh->meta))
 				MARK_VOLUME_DELETE(vol);
 			release_dentry(other);
 
@@ -4976,11 +4986,11 @@ int32_t remote_readlink(read_link_res * res, internal_dentry file, volume vol)
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 	CHECK_MUTEX_LOCKED(&file->fh->mutex);
 #ifdef ENABLE_CHECKING
-	if (zfs_fh_undefined(file->fh->meta.master_fh))
+	if (zfs_fh_undefined(file->fh->meta->master_fh))
 		zfsd_abort();
 #endif
 
-	args = file->fh->meta.master_fh;
+	args = file->fh->meta->master_fh;
 
 	release_dentry(file);
 	zfsd_mutex_lock(&node_mutex);
@@ -5209,11 +5219,11 @@ remote_symlink(dir_op_res * res, internal_dentry dir, string * name,
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 	CHECK_MUTEX_LOCKED(&dir->fh->mutex);
 #ifdef ENABLE_CHECKING
-	if (zfs_fh_undefined(dir->fh->meta.master_fh))
+	if (zfs_fh_undefined(dir->fh->meta->master_fh))
 		zfsd_abort();
 #endif
 
-	args.from.dir = dir->fh->meta.master_fh;
+	args.from.dir = dir->fh->meta->master_fh;
 	args.from.name = *name;
 	args.to = *to;
 	args.attr = *attr;
@@ -5305,7 +5315,7 @@ zfs_symlink(dir_op_res * res, zfs_fh * dir, string * name, string * to,
 		RETURN_INT(EACCES);
 	}
 
-	if (idir->fh->meta.flags & METADATA_SHADOW_TREE)
+	if (idir->fh->meta->flags & METADATA_SHADOW_TREE)
 	{
 		release_dentry(idir);
 		zfsd_mutex_unlock(&vol->mutex);
@@ -5359,8 +5369,8 @@ zfs_symlink(dir_op_res * res, zfs_fh * dir, string * name, string * to,
 				if (!add_journal_entry(vol, idir->fh->journal,
 									   &idir->fh->local_fh,
 									   &dentry->fh->local_fh,
-									   &dentry->fh->meta.master_fh,
-									   dentry->fh->meta.master_version, name,
+									   &dentry->fh->meta->master_fh,
+									   dentry->fh->meta->master_version, name,
 									   JOURNAL_OPERATION_ADD))
 					MARK_VOLUME_DELETE(vol);
 			}
@@ -5480,11 +5490,11 @@ remote_mknod(dir_op_res * res, internal_dentry dir, string * name,
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 	CHECK_MUTEX_LOCKED(&dir->fh->mutex);
 #ifdef ENABLE_CHECKING
-	if (zfs_fh_undefined(dir->fh->meta.master_fh))
+	if (zfs_fh_undefined(dir->fh->meta->master_fh))
 		zfsd_abort();
 #endif
 
-	args.where.dir = dir->fh->meta.master_fh;
+	args.where.dir = dir->fh->meta->master_fh;
 	args.where.name = *name;
 	args.attr = *attr;
 	args.type = type;
@@ -5578,7 +5588,7 @@ zfs_mknod(dir_op_res * res, zfs_fh * dir, string * name, sattr * attr,
 		RETURN_INT(EACCES);
 	}
 
-	if (idir->fh->meta.flags & METADATA_SHADOW_TREE)
+	if (idir->fh->meta->flags & METADATA_SHADOW_TREE)
 	{
 		release_dentry(idir);
 		zfsd_mutex_unlock(&vol->mutex);
@@ -5632,8 +5642,8 @@ zfs_mknod(dir_op_res * res, zfs_fh * dir, string * name, sattr * attr,
 				if (!add_journal_entry(vol, idir->fh->journal,
 									   &idir->fh->local_fh,
 									   &dentry->fh->local_fh,
-									   &dentry->fh->meta.master_fh,
-									   dentry->fh->meta.master_version, name,
+									   &dentry->fh->meta->master_fh,
+									   dentry->fh->meta->master_version, name,
 									   JOURNAL_OPERATION_ADD))
 					MARK_VOLUME_DELETE(vol);
 			}
@@ -5764,7 +5774,7 @@ int32_t zfs_file_info(file_info_res * res, zfs_fh * fh)
 		if (r != ZFS_OK)
 			RETURN_INT(r);
 
-		tmp_fh = dentry->fh->meta.master_fh;
+		tmp_fh = dentry->fh->meta->master_fh;
 		release_dentry(dentry);
 		r = remote_file_info(res, &tmp_fh, vol);
 	}
@@ -6071,7 +6081,7 @@ int32_t remote_reintegrate(internal_dentry dentry, char status, volume vol)
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 	CHECK_MUTEX_LOCKED(&dentry->fh->mutex);
 
-	args.fh = dentry->fh->meta.master_fh;
+	args.fh = dentry->fh->meta->master_fh;
 	args.status = status;
 
 	release_dentry(dentry);
@@ -6322,12 +6332,12 @@ remote_reintegrate_add(volume vol, internal_dentry dir, string * name,
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 	CHECK_MUTEX_LOCKED(&dir->fh->mutex);
 #ifdef ENABLE_CHECKING
-	if (zfs_fh_undefined(dir->fh->meta.master_fh))
+	if (zfs_fh_undefined(dir->fh->meta->master_fh))
 		zfsd_abort();
 #endif
 
 	args.fh = *fh;
-	args.dir = dir->fh->meta.master_fh;
+	args.dir = dir->fh->meta->master_fh;
 	args.name = *name;
 
 	release_dentry(dir);
@@ -6400,7 +6410,7 @@ int32_t zfs_reintegrate_add(zfs_fh * fh, zfs_fh * dir, string * name)
 		RETURN_INT(EINVAL);
 	}
 
-	if (idir->fh->meta.flags & METADATA_SHADOW_TREE)
+	if (idir->fh->meta->flags & METADATA_SHADOW_TREE)
 	{
 		release_dentry(idir);
 		zfsd_mutex_unlock(&vol->mutex);
@@ -6558,7 +6568,7 @@ local_reintegrate_del_base(zfs_fh * fh, string * name, bool destroy_p,
 
 				if (vol->master != this_node
 					&& !SPECIAL_DIR_P(dir, name->str, true)
-					&& !(dir->fh->meta.flags & METADATA_SHADOW_TREE))
+					&& !(dir->fh->meta->flags & METADATA_SHADOW_TREE))
 				{
 					if (!add_journal_entry_meta(vol, dir->fh->journal,
 												&dir->fh->local_fh, &meta,
@@ -6698,12 +6708,12 @@ remote_reintegrate_del(volume vol, zfs_fh * fh, internal_dentry dir,
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 	CHECK_MUTEX_LOCKED(&dir->fh->mutex);
 #ifdef ENABLE_CHECKING
-	if (zfs_fh_undefined(dir->fh->meta.master_fh))
+	if (zfs_fh_undefined(dir->fh->meta->master_fh))
 		zfsd_abort();
 #endif
 
 	args.fh = *fh;
-	args.dir = dir->fh->meta.master_fh;
+	args.dir = dir->fh->meta->master_fh;
 	args.name = *name;
 	args.destroy_p = destroy_p;
 
@@ -6830,7 +6840,7 @@ zfs_reintegrate_del(zfs_fh * fh, zfs_fh * dir, string * name, bool destroy_p)
 		RETURN_INT(EINVAL);
 	}
 
-	if (idir->fh->meta.flags & METADATA_SHADOW_TREE)
+	if (idir->fh->meta->flags & METADATA_SHADOW_TREE)
 	{
 		release_dentry(idir);
 		zfsd_mutex_unlock(&vol->mutex);
@@ -6883,6 +6893,253 @@ zfs_reintegrate_del(zfs_fh * fh, zfs_fh * dir, string * name, bool destroy_p)
 	RETURN_INT(r);
 }
 
+/*! Apply operation OP of a batch of journal entries to local directory DIR
+   with file handle DIR_FH on volume VOL.  Store the file handle and
+   attributes of the created file to RES.  */
+
+static int32_t
+local_reintegrate_batch_op(dir_op_res * res, reintegrate_batch_op * op,
+						   volume vol, internal_dentry dir, zfs_fh * dir_fh)
+{
+	internal_dentry dentry;
+	dir_op_res lres;
+	metadata meta;
+	int32_t r, r2;
+
+	TRACE("");
+	CHECK_MUTEX_LOCKED(&fh_mutex);
+	CHECK_MUTEX_LOCKED(&vol->mutex);
+	CHECK_MUTEX_LOCKED(&dir->fh->mutex);
+
+	/* Hide special dirs in the root of the volume.  */
+	if (SPECIAL_DIR_P(dir, op->name.str, true)
+		|| (op->oper == REINTEGRATE_BATCH_CREATE
+			&& (op->type == FT_BAD || op->type == FT_LNK))
+		|| (op->oper == REINTEGRATE_BATCH_ADD && !REGULAR_FH_P(op->fh)))
+	{
+		release_dentry(dir);
+		zfsd_mutex_unlock(&vol->mutex);
+		zfsd_mutex_unlock(&fh_mutex);
+		RETURN_INT(EINVAL);
+	}
+
+	switch (op->oper)
+	{
+	default:
+		zfsd_abort();
+
+	case REINTEGRATE_BATCH_CREATE:
+		op->attr.mode = GET_MODE(op->attr.mode);
+		op->attr.size = (uint64_t) - 1;
+		op->attr.atime = (zfs_time) - 1;
+		op->attr.mtime = (zfs_time) - 1;
+		if (op->type == FT_DIR)
+			r = local_mkdir(res, dir, &op->name, &op->attr, vol, &meta);
+		else
+			r = local_mknod(res, dir, &op->name, &op->attr, op->type,
+							op->rdev, vol, &meta);
+		if (r != ZFS_OK)
+			RETURN_INT(r);
+
+		r2 = zfs_fh_lookup_nolock(dir_fh, &vol, &dir, NULL, false);
+#ifdef ENABLE_CHECKING
+		if (r2 != ZFS_OK)
+			zfsd_abort();
+#endif
+
+		dentry = get_dentry(&res->file, &undefined_fh, vol, dir, &op->name,
+							&res->attr, &meta);
+		release_dentry(dentry);
+		if (!inc_local_version(vol, dir->fh))
+			MARK_VOLUME_DELETE(vol);
+		break;
+
+	case REINTEGRATE_BATCH_ADD:
+		r = local_lookup(&lres, dir, &op->name, vol, &meta);
+		if (r == ZFS_OK)
+			RETURN_INT(EEXIST);
+		if (r != ENOENT)
+			RETURN_INT(r);
+
+		r2 = zfs_fh_lookup_nolock(dir_fh, &vol, &dir, NULL, false);
+#ifdef ENABLE_CHECKING
+		if (r2 != ZFS_OK)
+			zfsd_abort();
+#endif
+
+		RETURN_INT(local_reintegrate_add(vol, dir, &op->name, &op->fh,
+										 dir_fh, true));
+
+	case REINTEGRATE_BATCH_DEL:
+		/* Nothing is deleted when NAME is not the file FH any more,
+		   a regular file is not destroyed when it has been modified.  */
+		r = local_lookup(&lres, dir, &op->name, vol, &meta);
+		if (r == ESTALE || (r == ZFS_OK && !ZFS_FH_EQ(lres.file, op->fh)))
+			RETURN_INT(ENOENT);
+		if (r != ZFS_OK)
+			RETURN_INT(r);
+		if (op->destroy_p && lres.attr.type == FT_REG
+			&& lres.attr.version != op->version)
+			RETURN_INT(ZFS_CHANGED);
+
+		r = local_reintegrate_del_base(&lres.file, &op->name, op->destroy_p,
+									   dir_fh, true);
+		if (r != ZFS_OK)
+			RETURN_INT(r);
+
+		r2 = zfs_fh_lookup_nolock(dir_fh, &vol, &dir, NULL, false);
+#ifdef ENABLE_CHECKING
+		if (r2 != ZFS_OK)
+			zfsd_abort();
+#endif
+
+		delete_dentry(&vol, &dir, &op->name, dir_fh);
+		break;
+	}
+
+	release_dentry(dir);
+	zfsd_mutex_unlock(&vol->mutex);
+	zfsd_mutex_unlock(&fh_mutex);
+
+	RETURN_INT(ZFS_OK);
+}
+
+/*! Apply the batch of journal entries ARGS to directory ARGS->DIR in order
+   while the directory is locked, store the status of each entry to RES.
+   Only the master node of the volume applies the batch.  */
+
+int32_t
+zfs_reintegrate_batch(reintegrate_batch_res * res,
+					  reintegrate_batch_args * args)
+{
+	volume vol;
+	internal_dentry idir;
+	zfs_fh tmp_fh;
+	uint32_t i;
+	int32_t r, r2;
+
+	TRACE("count = %" PRIu32, args->count);
+
+	if (!REGULAR_FH_P(args->dir))
+		RETURN_INT(EINVAL);
+
+	r = zfs_fh_lookup(&args->dir, &vol, &idir, NULL, true);
+	if (r == ZFS_STALE)
+	{
+		r = refresh_fh(&args->dir);
+		if (r != ZFS_OK)
+			RETURN_INT(r);
+		r = zfs_fh_lookup(&args->dir, &vol, &idir, NULL, true);
+	}
+	if (r != ZFS_OK)
+		RETURN_INT(r);
+
+	if (idir->fh->attr.type != FT_DIR)
+	{
+		release_dentry(idir);
+		zfsd_mutex_unlock(&vol->mutex);
+		RETURN_INT(ENOTDIR);
+	}
+
+	if ((idir->fh->meta->flags & METADATA_SHADOW_TREE)
+		|| !INTERNAL_FH_HAS_LOCAL_PATH(idir->fh) || vol->master != this_node)
+	{
+		release_dentry(idir);
+		zfsd_mutex_unlock(&vol->mutex);
+		RETURN_INT(EINVAL);
+	}
+
+	r = internal_dentry_lock(LEVEL_EXCLUSIVE, &vol, &idir, &tmp_fh);
+	if (r != ZFS_OK)
+		RETURN_INT(r);
+
+	res->count = args->count;
+	for (i = 0; i < args->count; i++)
+	{
+		res->res[i].file = args->op[i].fh;
+		memset(&res->res[i].attr, 0, sizeof(fattr));
+		res->status[i] = local_reintegrate_batch_op(&res->res[i],
+													&args->op[i], vol, idir,
+													&tmp_fh);
+
+		r2 = zfs_fh_lookup_nolock(&tmp_fh, &vol, &idir, NULL, false);
+#ifdef ENABLE_CHECKING
+		if (r2 != ZFS_OK)
+			zfsd_abort();
+#endif
+	}
+
+	internal_dentry_unlock(vol, idir);
+
+	RETURN_INT(ZFS_OK);
+}
+
+/*! Apply the batch of journal entries ARGS to remote directory DIR with
+   file handle DIR_FH on volume VOL, store the status of each entry to RES.  */
+
+int32_t
+remote_reintegrate_batch(reintegrate_batch_res * res,
+						 reintegrate_batch_args * args, volume vol,
+						 internal_dentry dir, zfs_fh * dir_fh)
+{
+	thread *t;
+	uint32_t i;
+	int32_t r, r2;
+	int fd;
+	node nod = vol->master;
+
+	TRACE("count = %" PRIu32, args->count);
+	CHECK_MUTEX_LOCKED(&vol->mutex);
+	CHECK_MUTEX_LOCKED(&dir->fh->mutex);
+#ifdef ENABLE_CHECKING
+	if (zfs_fh_undefined(dir->fh->meta->master_fh))
+		zfsd_abort();
+#endif
+
+	args->dir = dir->fh->meta->master_fh;
+
+	release_dentry(dir);
+	zfsd_mutex_lock(&node_mutex);
+	zfsd_mutex_lock(&nod->mutex);
+	zfsd_mutex_unlock(&vol->mutex);
+	zfsd_mutex_unlock(&node_mutex);
+
+	t = (thread *) pthread_getspecific(thread_data_key);
+	r = zfs_proc_reintegrate_batch_client(t, args, nod, &fd);
+
+	if (r == ZFS_OK)
+	{
+		if (!decode_reintegrate_batch_res(t->dc_reply, res)
+			|| !finish_decoding(t->dc_reply)
+			|| res->count != args->count)
+			r = ZFS_INVALID_REPLY;
+	}
+	else if (r >= ZFS_LAST_DECODED_ERROR)
+	{
+		if (!finish_decoding(t->dc_reply))
+			r = ZFS_INVALID_REPLY;
+	}
+
+	if (r >= ZFS_ERROR_HAS_DC_REPLY)
+		recycle_dc_to_fd(t->dc_reply, fd);
+
+	/* Delete the dentries in place of the names added or deleted.  */
+	r2 = zfs_fh_lookup_nolock(dir_fh, &vol, &dir, NULL, false);
+#ifdef ENABLE_CHECKING
+	if (r2 != ZFS_OK)
+		zfsd_abort();
+#endif
+
+	for (i = 0; i < args->count; i++)
+		if (args->op[i].oper != REINTEGRATE_BATCH_CREATE)
+			delete_dentry(&vol, &dir, &args->op[i].name, dir_fh);
+	release_dentry(dir);
+	zfsd_mutex_unlock(&vol->mutex);
+	zfsd_mutex_unlock(&fh_mutex);
+
+	RETURN_INT(r);
+}
+
 /*! Increase version of local file DENTRY on volume VOL by VERSION_INC.  */
 
 int32_t
@@ -6901,11 +7158,11 @@ local_reintegrate_ver(internal_dentry dentry, uint64_t version_inc, volume vol)
 		RETURN_INT(ESTALE);
 	}
 
-	dentry->fh->meta.local_version += version_inc;
+	dentry->fh->meta->local_version += version_inc;
 	if (!vol->is_copy)
-		dentry->fh->meta.master_version = dentry->fh->meta.local_version;
-	set_attr_version(&dentry->fh->attr, &dentry->fh->meta);
-	if (!flush_metadata(vol, &dentry->fh->meta))
+		dentry->fh->meta->master_version = dentry->fh->meta->local_version;
+	set_attr_version(&dentry->fh->attr, dentry->fh->meta);
+	if (!flush_metadata(vol, dentry->fh->meta))
 	{
 		MARK_VOLUME_DELETE(vol);
 		release_dentry(dentry);
@@ -6937,7 +7194,7 @@ remote_reintegrate_ver(internal_dentry dentry, uint64_t version_inc,
 	if (dentry)
 	{
 		CHECK_MUTEX_LOCKED(&dentry->fh->mutex);
-		if (zfs_fh_undefined(dentry->fh->meta.master_fh))
+		if (zfs_fh_undefined(dentry->fh->meta->master_fh))
 			zfsd_abort();
 	}
 #endif
@@ -6945,7 +7202,7 @@ remote_reintegrate_ver(internal_dentry dentry, uint64_t version_inc,
 	args.version_inc = version_inc;
 	if (dentry)
 	{
-		args.fh = dentry->fh->meta.master_fh;
+		args.fh = dentry->fh->meta->master_fh;
 		dentry->fh->attr.version += version_inc;
 		release_dentry(dentry);
 	}
@@ -147,6 +147,12 @@ extern int32_t remote_reintegrate_del_zfs_fh(volume vol, zfs_fh * fh,
 											 bool destroy_p);
 extern int32_t zfs_reintegrate_del(zfs_fh * fh, zfs_fh * dir, string * name,
 								   bool destroy_p);
+extern int32_t zfs_reintegrate_batch(reintegrate_batch_res * res,
+									 reintegrate_batch_args * args);
+extern int32_t remote_reintegrate_batch(reintegrate_batch_res * res,
+										reintegrate_batch_args * args,
+										volume vol, internal_dentry dir,
+										zfs_fh * dir_fh);
 extern int32_t local_reintegrate_ver(internal_dentry dentry,
 									 uint64_t version_inc, volume vol);
 extern int32_t remote_reintegrate_ver(internal_dentry dentry,
@@ -0,0 +1,384 @@
+/*! \file \brief Delta of a file against the blocks of its old contents.
+
+   When the master node has a new version of a large file the local node
+   still has the old contents of the file.  The local node sends the rolling
+   checksums and MD5 sums of the blocks of the old contents near the
+   position being updated, the master node searches the range of its file
+   for the blocks at any offset and replies with copies of the blocks found
+   and the literal data between them.  So the data which have only moved in
+   the file, for example after an insertion, are not transferred again.  */
+
+/* Copyright (C) 2026 ZFS contributors
+
+   This file is part of ZFS.
+
+   ZFS is free software; you can redistribute it and/or modify it under the
+   terms of the GNU General Public License as published by the Free Software
+   Foundation; either version 2, or (at your option) any later version.
+
+   ZFS is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General Public License along
+   with ZFS; see the file COPYING.  If not, write to the Free Software
+   Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA; or
+   download it from http://www.gnu.org/licenses/gpl.html */
+
+#include "system.h"
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include "pthread-wrapper.h"
+#include "memory.h"
+#include "log.h"
+#include "md5.h"
+#include "thread.h"
+#include "data-coding.h"
+#include "fh.h"
+#include "cap.h"
+#include "node.h"
+#include "volume.h"
+#include "network.h"
+#include "zfs-prot.h"
+#include "file.h"
+#include "rolling-delta.h"
+#include "delta.h"
+
+/*! Number of slots of the hash table of the checksums of the blocks.  */
+#define DELTA_HASH_SIZE (2 * ZFS_MAX_DELTA_BLOCKS)
+
+/*! Slot of the hash table for rolling checksum W.  */
+#define DELTA_HASH(W) (((W) ^ ((W) >> 16)) & (DELTA_HASH_SIZE - 1))
+
+/*! Size of the window of the file searched for the blocks.  The literal
+   data of one reply and a block fit to it with room for ZFS_MAXDATA bytes
+   read next.  */
+#define DELTA_WINDOW_SIZE (3 * ZFS_MAXDATA)
+
+/*! Return the index of the block of ARGS with rolling checksum WEAK and the
+   same contents as BUF, or -1 if there is no such block.  HEAD and NEXT are
+   the chains of the hash table of the blocks.  The block following the
+   block LAST is preferred so that the copies can be merged.  */
+
+static int
+delta_find(delta_args * args, int *head, int *next, const unsigned char *buf,
+		   uint32_t weak, int last)
+{
+	unsigned char strong[MD5_SIZE];
+	bool have_strong = false;
+	MD5Context context;
+	int k;
+
+	if (last >= 0 && (uint32_t) last + 1 < args->count
+		&& args->weak[last + 1] == weak)
+	{
+		MD5Init(&context);
+		MD5Update(&context, buf, args->block_size);
+		MD5Final(strong, &context);
+		have_strong = true;
+
+		if (memcmp(strong, args->strong[last + 1], MD5_SIZE) == 0)
+			return last + 1;
+	}
+
+	for (k = head[DELTA_HASH(weak)]; k >= 0; k = next[k])
+	{
+		if (args->weak[k] != weak)
+			continue;
+
+		if (!have_strong)
+		{
+			MD5Init(&context);
+			MD5Update(&context, buf, args->block_size);
+			MD5Final(strong, &context);
+			have_strong = true;
+		}
+
+		if (memcmp(strong, args->strong[k], MD5_SIZE) == 0)
+			return k;
+	}
+
+	return -1;
+}
+
+/*! Add LEN bytes of literal data from BUF to RES.  */
+
+static void delta_add_literal(delta_res * res, const unsigned char *buf,
+							  uint32_t len)
+{
+	res->op[res->count] = len;
+	res->block[res->count] = 0;
+	res->count++;
+	memcpy(res->data.buf + res->data.len, buf, len);
+	res->data.len += len;
+}
+
+/*! Add the copy of block K to RES, merge it with the previous copy if
+   possible.  */
+
+static void delta_add_copy(delta_res * res, uint32_t k)
+{
+	uint32_t i;
+
+	if (res->count > 0)
+	{
+		i = res->count - 1;
+		if ((res->op[i] & ZFS_DELTA_COPY)
+			&& res->block[i] + (res->op[i] & ~ZFS_DELTA_COPY) == k)
+		{
+			res->op[i]++;
+			return;
+		}
+	}
+
+	res->op[res->count] = ZFS_DELTA_COPY | 1;
+	res->block[res->count] = k;
+	res->count++;
+}
+
+/*! Read the following data of the range of file ARGS->CAP described by
+   ARGS to window BUF, which contains the data of the range from *START to
+   *LEN.  Drop the data before KEEP.  Set *EOF when the end of file has been
+   reached.  VERSION is the version of the file, reading fails when it
+   changes.  */
+
+static int32_t
+delta_fill(unsigned char *buf, uint32_t * start, uint32_t * len, bool * eof,
+		   uint32_t keep, delta_args * args, uint64_t version)
+{
+	read_res rres;
+	uint32_t count;
+	int32_t r;
+
+	if (keep > *start)
+	{
+		memmove(buf, buf + (keep - *start), *len - keep);
+		*start = keep;
+	}
+
+	while (!*eof && *len < args->length)
+	{
+		count = DELTA_WINDOW_SIZE - (*len - *start);
+		if (count > ZFS_MAXDATA)
+			count = ZFS_MAXDATA;
+		if (count > args->length - *len)
+			count = args->length - *len;
+		if (count == 0)
+			break;
+
+		rres.data.buf = (char *)buf + (*len - *start);
+		r = zfs_read(&rres, &args->cap, args->offset + *len, count, false);
+		if (r == ZFS_OK && rres.version != version)
+			r = ZFS_CHANGED;
+		if (r != ZFS_OK)
+			return r;
+
+		if (rres.data.len == 0)
+			*eof = true;
+		*len += rres.data.len;
+	}
+
+	return ZFS_OK;
+}
+
+/*! Describe at most ARGS->LENGTH bytes of local file ARGS->CAP starting at
+   ARGS->OFFSET as copies of the blocks whose checksums are in ARGS and
+   literal data, store the description to RES.  RES->DATA.BUF must have
+   space for ZFS_MAXDATA bytes.  The range is read by parts through a window
+   of DELTA_WINDOW_SIZE bytes.  */
+
+int32_t local_delta(delta_res * res, delta_args * args)
+{
+	internal_dentry dentry;
+	unsigned char *buf;
+	int head[DELTA_HASH_SIZE];
+	int next[ZFS_MAX_DELTA_BLOCKS];
+	uint32_t bs, start, len, pos, lit, end, room, a, b;
+	bool eof, have_weak;
+	int k, last;
+	int32_t r;
+
+	TRACE("offset = %" PRIu64 " length = %" PRIu32, args->offset,
+		  args->length);
+
+	bs = args->block_size;
+	if (bs == 0 || bs > ZFS_MAXDATA || args->length < bs
+		|| args->length > ZFS_MAX_DELTA_LENGTH)
+		RETURN_INT(EINVAL);
+
+	zfsd_mutex_lock(&fh_mutex);
+	dentry = dentry_lookup(&args->cap.fh);
+	zfsd_mutex_unlock(&fh_mutex);
+	if (!dentry)
+		RETURN_INT(ZFS_STALE);
+
+	res->size = dentry->fh->attr.size;
+	res->version = dentry->fh->attr.version;
+	res->length = 0;
+	res->count = 0;
+	res->data.len = 0;
+	release_dentry(dentry);
+
+	buf = (unsigned char *)xmalloc(DELTA_WINDOW_SIZE);
+	start = 0;
+	len = 0;
+	eof = false;
+
+	for (k = 0; k < DELTA_HASH_SIZE; k++)
+		head[k] = -1;
+	for (k = args->count - 1; k >= 0; k--)
+	{
+		next[k] = head[DELTA_HASH(args->weak[k])];
+		head[DELTA_HASH(args->weak[k])] = k;
+	}
+
+	/* Search the blocks at each offset, the data between the blocks found
+	   are literal.  */
+	pos = 0;
+	lit = 0;
+	last = -1;
+	have_weak = false;
+	a = 0;
+	b = 0;
+	while (1)
+	{
+		/* Read the data following the block, the byte after the block is
+		   needed to roll the checksum.  The data before the literal data are
+		   not needed any more.  */
+		if (pos + bs >= len)
+		{
+			r = delta_fill(buf, &start, &len, &eof, lit, args, res->version);
+			if (r != ZFS_OK)
+			{
+				free(buf);
+				RETURN_INT(r);
+			}
+		}
+		if (pos + bs > len)
+			break;
+
+		if (!have_weak)
+		{
+			delta_weak_init(buf + (pos - start), bs, &a, &b);
+			have_weak = true;
+		}
+
+		k = delta_find(args, head, next, buf + (pos - start),
+					   DELTA_WEAK(a, b), last);
+		if (k >= 0)
+		{
+			/* The literal data and the copy may need two operations.  */
+			if (res->count + 2 > ZFS_MAX_DELTA_OPS)
+				break;
+
+			if (pos > lit)
+				delta_add_literal(res, buf + (lit - start), pos - lit);
+			delta_add_copy(res, k);
+			last = k;
+			pos += bs;
+			lit = pos;
+			have_weak = false;
+			continue;
+		}
+
+		if (pos - lit >= ZFS_MAXDATA - res->data.len)
+			break;
+
+		if (pos + bs < len)
+			delta_weak_roll(&a, &b, buf[pos - start], buf[pos + bs - start],
+							bs);
+		pos++;
+	}
+
+	/* The tail of the file shorter than a block is literal.  Otherwise the
+	   following block may start in the last BS - 1 bytes so the reply ends
+	   at POS.  */
+	end = (eof && pos + bs > len ? len : pos);
+	if (end > lit && res->count == ZFS_MAX_DELTA_OPS)
+		end = lit;
+	room = ZFS_MAXDATA - res->data.len;
+	if (end - lit > room)
+		end = lit + room;
+	if (end > lit)
+		delta_add_literal(res, buf + (lit - start), end - lit);
+	res->length = end;
+
+	free(buf);
+	RETURN_INT(ZFS_OK);
+}
+
+/*! Describe at most ARGS->LENGTH bytes of remote file ARGS->CAP starting at
+   ARGS->OFFSET as copies of the blocks whose checksums are in ARGS and
+   literal data, store the description to RES.  RES->DATA.BUF must have
+   space for ZFS_MAXDATA bytes.  */
+
+int32_t remote_delta(delta_res * res, delta_args * args)
+{
+	volume vol;
+	node nod;
+	internal_cap icap;
+	internal_dentry dentry;
+	thread *t;
+	int32_t r;
+	int fd;
+
+	TRACE("");
+
+	r = find_capability(&args->cap, &icap, &vol, &dentry, NULL, false);
+#ifdef ENABLE_CHECKING
+	if (r != ZFS_OK)
+		zfsd_abort();
+#endif
+
+#ifdef ENABLE_CHECKING
+	if (zfs_cap_undefined(icap->master_cap))
+		zfsd_abort();
+	if (zfs_fh_undefined(icap->master_cap.fh))
+		zfsd_abort();
+#endif
+
+	if (dentry->fh->attr.type != FT_REG)
+	{
+		release_dentry(dentry);
+		zfsd_mutex_unlock(&vol->mutex);
+		RETURN_INT(EINVAL);
+	}
+
+	nod = vol->master;
+	args->cap = icap->master_cap;
+
+	release_dentry(dentry);
+	zfsd_mutex_lock(&node_mutex);
+	zfsd_mutex_lock(&nod->mutex);
+	zfsd_mutex_unlock(&node_mutex);
+	zfsd_mutex_unlock(&vol->mutex);
+
+	t = (thread *) pthread_getspecific(thread_data_key);
+	r = zfs_proc_delta_client(t, args, nod, &fd);
+
+	if (r == ZFS_OK)
+	{
+		char *buffer = res->data.buf;
+
+		if (!decode_delta_res(t->dc_reply, res)
+			|| !finish_decoding(t->dc_reply))
+			r = ZFS_INVALID_REPLY;
+		else
+		{
+			memcpy(buffer, res->data.buf, res->data.len);
+			res->data.buf = buffer;
+		}
+	}
+	else if (r >= ZFS_LAST_DECODED_ERROR)
+	{
+		if (!finish_decoding(t->dc_reply))
+			r = ZFS_INVALID_REPLY;
+	}
+
+	if (r >= ZFS_ERROR_HAS_DC_REPLY)
+		recycle_dc_to_fd(t->dc_reply, fd);
+
+	RETURN_INT(r);
+}
@@ -0,0 +1,42 @@
+/*! \file \brief Delta of a file against the blocks of its old contents.  */
+
+/* Copyright (C) 2026 ZFS contributors
+
+   This file is part of ZFS.
+
+   ZFS is free software; you can redistribute it and/or modify it under the
+   terms of the GNU General Public License as published by the Free Software
+   Foundation; either version 2, or (at your option) any later version.
+
+   ZFS is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General Public License along
+   with ZFS; see the file COPYING.  If not, write to the Free Software
+   Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA; or
+   download it from http://www.gnu.org/licenses/gpl.html */
+
+#ifndef DELTA_H
+#define DELTA_H
+
+#include "system.h"
+#include <inttypes.h>
+#include "zfs-prot.h"
+#include "rolling-delta.h"
+
+/*! Size of the blocks of the old contents of the local file.  */
+#define DELTA_BLOCK_SIZE 2048
+
+/*! Length of the master file described by one delta and the length of the
+   old contents whose blocks are offered for it.  */
+#define DELTA_MAX_LENGTH (ZFS_MAX_DELTA_BLOCKS * DELTA_BLOCK_SIZE)
+
+/*! Minimal size of the local file which is updated by deltas.  */
+#define DELTA_MIN_FILE_SIZE (4 * DELTA_MAX_LENGTH)
+
+extern int32_t local_delta(delta_res * res, delta_args * args);
+extern int32_t remote_delta(delta_res * res, delta_args * args);
+
+#endif
@@ -49,9 +49,12 @@
 #include "network.h"
 #include "md5.h"
 #include "update.h"
+#include "readahead.h"
+#include "writebehind.h"
 #include "reread_config.h"
 #include "version.h"
 #include "zfs_dirent.h"
+#include "io-engine.h"
 
 /*! The array of data for each file descriptor.  */
 internal_fd_data_t *internal_fd_data;
@@ -115,6 +118,11 @@ static void close_local_fd(int fd)
 	if (internal_fd_data[fd].fd < 0)
 		zfsd_abort();
 #endif
+	/* Nobody can pin the descriptor while OPENED_MUTEX is locked, wait for
+	   the I/O of the threads which have pinned it.  */
+	while (internal_fd_data[fd].busy > 0)
+		zfsd_cond_wait(&internal_fd_data[fd].cond,
+					   &internal_fd_data[fd].mutex);
 	internal_fd_data[fd].fd = -1;
 	internal_fd_data[fd].generation++;
 	close(fd);
@@ -126,6 +134,31 @@ static void close_local_fd(int fd)
 	zfsd_mutex_unlock(&internal_fd_data[fd].mutex);
 }
 
+/*! Pin file descriptor FD of local file so that it is not closed and unlock
+   INTERNAL_FD_DATA[FD].MUTEX, so the I/O on FD is not serialized.  */
+
+static void local_fd_pin(int fd)
+{
+	CHECK_MUTEX_LOCKED(&internal_fd_data[fd].mutex);
+
+	internal_fd_data[fd].busy++;
+	zfsd_mutex_unlock(&internal_fd_data[fd].mutex);
+}
+
+/*! Unpin file descriptor FD pinned by local_fd_pin.  */
+
+static void local_fd_unpin(int fd)
+{
+	zfsd_mutex_lock(&internal_fd_data[fd].mutex);
+#ifdef ENABLE_CHECKING
+	if (internal_fd_data[fd].busy == 0)
+		zfsd_abort();
+#endif
+	if (--internal_fd_data[fd].busy == 0)
+		zfsd_cond_broadcast(&internal_fd_data[fd].cond);
+	zfsd_mutex_unlock(&internal_fd_data[fd].mutex);
+}
+
 /*! Wrapper for open. If open fails because of too many open file descriptors
    it closes a file descriptor unused for longest time.  */
 
@@ -266,19 +299,23 @@ static int capability_open_nolock(int *fd, uint32_t flags, internal_dentry dentr
 			// build intervals or mark file size
 			if (dentry->version_file)
 			{
-				if (!dentry->fh->version_path)
-					dentry->fh->version_path = xstrdup(path.str);
+				internal_fh_version ver = internal_fh_version_get(dentry->fh);
+
+				if (!ver->path)
+					ver->path = xstrdup(path.str);
 				version_build_intervals(dentry, vol);
 			}
-			else
-				dentry->fh->marked_size = dentry->fh->attr.size;
+			else if (dentry->fh->version)
+				dentry->fh->version->marked_size = dentry->fh->attr.size;
 		}
 
 		if (zfs_config.versions.versioning && (dentry->fh->attr.type == FT_DIR))
 		{
 			// store directory path
-			if (!dentry->fh->version_path)
-				dentry->fh->version_path = xstrdup(path.str);
+			internal_fh_version ver = internal_fh_version_get(dentry->fh);
+
+			if (!ver->path)
+				ver->path = xstrdup(path.str);
 		}
 #endif
 		zfsd_mutex_unlock(&vol->mutex);
@@ -318,7 +355,8 @@ int32_t local_close(internal_fh fh)
 	if (fh->fd >= 0)
 	{
 #ifdef ENABLE_VERSIONS
-		if (zfs_config.versions.versioning && (fh->attr.type == FT_REG) && (fh->version_fd > 0))
+		if (zfs_config.versions.versioning && (fh->attr.type == FT_REG)
+			&& INTERNAL_FH_VERSION_OPEN(fh))
 			version_close_file(fh, true);
 #endif
 		zfsd_mutex_lock(&opened_mutex);
@@ -356,6 +394,7 @@ remote_close(internal_cap cap, internal_dentry dentry, volume vol)
 #endif
 
 	args = cap->master_cap;
+	readahead_forget(&args.fh);
 
 	release_dentry(dentry);
 	zfsd_mutex_lock(&node_mutex);
@@ -395,7 +434,7 @@ cond_remote_close(zfs_cap * cap, internal_cap icap, internal_dentry * dentryp,
 		zfsd_abort();
 	if ((*dentryp)->fh->level == LEVEL_UNLOCKED)
 		zfsd_abort();
-	if (zfs_fh_undefined((*dentryp)->fh->meta.master_fh))
+	if (zfs_fh_undefined((*dentryp)->fh->meta->master_fh))
 		zfsd_abort();
 	if (zfs_fh_undefined(icap->master_cap.fh)
 		|| zfs_cap_undefined(icap->master_cap))
@@ -550,11 +589,11 @@ remote_create(create_res * res, internal_dentry dir, string * name,
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 	CHECK_MUTEX_LOCKED(&dir->fh->mutex);
 #ifdef ENABLE_CHECKING
-	if (zfs_fh_undefined(dir->fh->meta.master_fh))
+	if (zfs_fh_undefined(dir->fh->meta->master_fh))
 		zfsd_abort();
 #endif
 
-	args.where.dir = dir->fh->meta.master_fh;
+	args.where.dir = dir->fh->meta->master_fh;
 	args.where.name = *name;
 	args.flags = flags;
 	args.attr = *attr;
@@ -656,7 +695,7 @@ zfs_create(create_res * res, zfs_fh * dir, string * name,
 		RETURN_INT(EACCES);
 	}
 
-	if (idir->fh->meta.flags & METADATA_SHADOW_TREE)
+	if (idir->fh->meta->flags & METADATA_SHADOW_TREE)
 	{
 		release_dentry(idir);
 		zfsd_mutex_unlock(&vol->mutex);
@@ -729,8 +768,8 @@ zfs_create(create_res * res, zfs_fh * dir, string * name,
 					if (!add_journal_entry(vol, idir->fh->journal,
 										   &idir->fh->local_fh,
 										   &dentry->fh->local_fh,
-										   &dentry->fh->meta.master_fh,
-										   dentry->fh->meta.master_version,
+										   &dentry->fh->meta->master_fh,
+										   dentry->fh->meta->master_version,
 										   name, JOURNAL_OPERATION_ADD))
 						MARK_VOLUME_DELETE(vol);
 				}
@@ -838,12 +877,12 @@ remote_open(zfs_cap * cap, internal_cap icap, uint32_t flags,
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 	CHECK_MUTEX_LOCKED(&dentry->fh->mutex);
 #ifdef ENABLE_CHECKING
-	if (zfs_fh_undefined(dentry->fh->meta.master_fh))
+	if (zfs_fh_undefined(dentry->fh->meta->master_fh))
 		zfsd_abort();
 #endif
 
 	/* Initialize capability.  */
-	icap->master_cap.fh = dentry->fh->meta.master_fh;
+	icap->master_cap.fh = dentry->fh->meta->master_fh;
 	icap->master_cap.flags = icap->local_cap.flags;
 
 	args.file = icap->master_cap.fh;
@@ -894,7 +933,7 @@ cond_remote_open(zfs_cap * cap, internal_cap icap, internal_dentry * dentryp,
 #ifdef ENABLE_CHECKING
 	if ((*dentryp)->fh->level == LEVEL_UNLOCKED)
 		zfsd_abort();
-	if (zfs_fh_undefined((*dentryp)->fh->meta.master_fh))
+	if (zfs_fh_undefined((*dentryp)->fh->meta->master_fh))
 		zfsd_abort();
 #endif
 
@@ -927,8 +966,10 @@ cond_remote_open(zfs_cap * cap, internal_cap icap, internal_dentry * dentryp,
 }
 
 /*! \brief Open file handle FH with open flags FLAGS and return capability in 
-   CAP. */
-int32_t zfs_open(zfs_cap * cap, zfs_fh * fh, uint32_t flags)
+   CAP.  If ATTR is not NULL store the attributes of the file known after
+   opening it to ATTR.  */
+int32_t zfs_open_attr(zfs_cap * cap, fattr * attr, zfs_fh * fh,
+					  uint32_t flags)
 {
 	volume vol;
 	internal_cap icap;
@@ -961,6 +1002,8 @@ int32_t zfs_open(zfs_cap * cap, zfs_fh * fh, uint32_t flags)
 	if (!dentry)
 	{
 		/* We are opening a pure virtual directory.  */
+		if (attr)
+			*attr = vd->attr;
 		if (vol)
 			zfsd_mutex_unlock(&vol->mutex);
 		zfsd_mutex_unlock(&vd->mutex);
@@ -970,6 +1013,8 @@ int32_t zfs_open(zfs_cap * cap, zfs_fh * fh, uint32_t flags)
 	if (CONFLICT_DIR_P(dentry->fh->local_fh))
 	{
 		/* We are opening a conflict directory.  */
+		if (attr)
+			*attr = dentry->fh->attr;
 		release_dentry(dentry);
 		zfsd_mutex_unlock(&vol->mutex);
 		if (vd)
@@ -1144,11 +1189,22 @@ int32_t zfs_open(zfs_cap * cap, zfs_fh * fh, uint32_t flags)
 		put_capability(icap, dentry->fh, vd);
 	}
 
+	if (r == ZFS_OK && attr)
+		*attr = dentry->fh->attr;
 	internal_cap_unlock(vol, dentry, vd);
 
 	RETURN_INT(r);
 }
 
+/*! \brief Open file handle FH with open flags FLAGS and return capability in
+   CAP.  */
+int32_t zfs_open(zfs_cap * cap, zfs_fh * fh, uint32_t flags)
+{
+	TRACE("");
+
+	RETURN_INT(zfs_open_attr(cap, NULL, fh, flags));
+}
+
 /*! Close capability CAP.  */
 
 int32_t zfs_close(zfs_cap * cap)
@@ -1158,7 +1214,7 @@ int32_t zfs_close(zfs_cap * cap)
 	internal_dentry dentry;
 	virtual_dir vd;
 	zfs_cap tmp_cap;
-	int32_t r, r2;
+	int32_t r, r2, r_flush;
 
 	TRACE("");
 
@@ -1166,6 +1222,9 @@ int32_t zfs_close(zfs_cap * cap)
 	if (r != ZFS_OK)
 		RETURN_INT(r);
 
+	/* Write the data written behind before closing the remote file.  */
+	r_flush = writebehind_flush(&cap->fh, true);
+
 	r = find_capability(cap, &icap, &vol, &dentry, &vd, true);
 	if (r != ZFS_OK)
 		RETURN_INT(r);
@@ -1238,7 +1297,7 @@ int32_t zfs_close(zfs_cap * cap)
 			}
 #ifdef ENABLE_VERSIONS
 			if (zfs_config.versions.versioning && (dentry->fh->attr.type == FT_REG)
-				&& (dentry->fh->version_fd > 0))
+				&& INTERNAL_FH_VERSION_OPEN(dentry->fh))
 				version_save_interval_trees(dentry->fh);
 			// we are generating new version files
 			if (zfs_config.versions.versioning)
@@ -1278,7 +1337,7 @@ int32_t zfs_close(zfs_cap * cap)
 
 	if (INTERNAL_FH_HAS_LOCAL_PATH(dentry->fh)
 		&& dentry->fh->attr.type == FT_REG
-		&& (dentry->fh->meta.flags & METADATA_MODIFIED_TREE)
+		&& (dentry->fh->meta->flags & METADATA_MODIFIED_TREE)
 		&& (cap->flags == O_WRONLY || cap->flags == O_RDWR))
 	{
 		r2 = update_cap_if_needed(&icap, &vol, &dentry, &vd, &tmp_cap,
@@ -1292,9 +1351,22 @@ int32_t zfs_close(zfs_cap * cap)
 
 	internal_cap_unlock(vol, dentry, vd);
 
+	if (r == ZFS_OK)
+		r = r_flush;
+
 	RETURN_INT(r);
 }
 
+/*! Write the data of file CAP which have been written behind, return the
+   error of writing them.  */
+
+int32_t zfs_flush(zfs_cap * cap)
+{
+	TRACE("");
+
+	RETURN_INT(writebehind_flush(&cap->fh, true));
+}
+
 /*! Encode one directory entry (INO, COOKIE, NAME[NAME_LEN]) to DC
    LIST->BUFFER. Additional data is passed in DATA.  */
 
@@ -1711,7 +1783,7 @@ local_readdir(dir_list * list, internal_dentry dentry, virtual_dir vd,
 			else
 			{
 				acquire_dentry(dentry);
-				x = xstrconcat(dentry->fh->version_path,
+				x = xstrconcat(INTERNAL_FH_VERSION_PATH(dentry->fh),
 							   DIRECTORY_SEPARATOR, VERSION_DISPLAY_FILE, NULL);
 				release_dentry(dentry);
 				if (!lstat(x, &st))
@@ -1764,7 +1836,7 @@ local_readdir(dir_list * list, internal_dentry dentry, virtual_dir vd,
 					char *f;
 					struct stat st;
 
-					f = xstrconcat(dentry->fh->version_path,
+					f = xstrconcat(INTERNAL_FH_VERSION_PATH(dentry->fh),
 								   DIRECTORY_SEPARATOR, de->d_name, NULL);
 					if (!lstat(f, &st) && (st.st_mtime > dentry->dirstamp))
 					{
@@ -2160,11 +2232,13 @@ zfs_readdir(dir_list * list, zfs_cap * cap, int32_t cookie, uint32_t count,
 }
 
 /*! Read COUNT bytes from offset OFFSET of local file DENTRY on volume VOL.
-   Store data to BUFFER and count to RCOUNT.  */
+   Store data to BUFFER and count to RCOUNT.  If SEND_FD is not NULL and the
+   file is a regular file pass the file descriptor to SEND_FD with DATA
+   instead of reading the data.  */
 
 static int32_t
 local_read(read_res * res, internal_dentry dentry, uint64_t offset,
-		   uint32_t count, volume vol)
+		   uint32_t count, volume vol, read_fd_f send_fd, void *data)
 {
 	int32_t r;
 	int fd;
@@ -2181,17 +2255,36 @@ local_read(read_res * res, internal_dentry dentry, uint64_t offset,
 	if (r != ZFS_OK)
 		RETURN_INT(r);
 
-	if (regular_file || offset != (uint64_t) - 1)
+	/* Positional reads of a regular file do not use the file offset, let
+	   the other threads read it meanwhile.  */
+	if (regular_file)
 	{
-		r = lseek(fd, offset, SEEK_SET);
-		if (r < 0)
+		local_fd_pin(fd);
+		if (send_fd)
+		{
+			r = (*send_fd) (fd, offset, count, data);
+			if (r == ZFS_OK)
+				res->data.len = count;
+		}
+		else
 		{
-			zfsd_mutex_unlock(&internal_fd_data[fd].mutex);
-			RETURN_INT(errno);
+			r = io_pread(fd, res->data.buf, count, offset);
+			if (r < 0)
+				r = errno;
+			else
+			{
+				res->data.len = r;
+				r = ZFS_OK;
+			}
 		}
+		local_fd_unpin(fd);
+		RETURN_INT(r);
 	}
 
-	r = read(fd, res->data.buf, count);
+	if (offset != (uint64_t) - 1)
+		r = io_pread(fd, res->data.buf, count, offset);
+	else
+		r = read(fd, res->data.buf, count);
 	if (r < 0)
 	{
 		zfsd_mutex_unlock(&internal_fd_data[fd].mutex);
@@ -2204,6 +2297,44 @@ local_read(read_res * res, internal_dentry dentry, uint64_t offset,
 	RETURN_INT(ZFS_OK);
 }
 
+/*! Read data described by ARGS from node NOD and store them to RES.  */
+
+static int32_t remote_read_1(read_res * res, read_args * args, node nod)
+{
+	thread *t;
+	int32_t r;
+	int fd;
+
+	TRACE("");
+	CHECK_MUTEX_LOCKED(&nod->mutex);
+
+	t = (thread *) pthread_getspecific(thread_data_key);
+	r = zfs_proc_read_client(t, args, nod, &fd);
+
+	if (r == ZFS_OK)
+	{
+		char *buffer = res->data.buf;
+
+		if (!decode_read_res(t->dc_reply, res)
+			|| !finish_decoding(t->dc_reply))
+			r = ZFS_INVALID_REPLY;
+		else
+		{
+			memcpy(buffer, res->data.buf, res->data.len);
+			res->data.buf = buffer;
+		}
+	}
+	else if (r >= ZFS_LAST_DECODED_ERROR)
+	{
+		if (!finish_decoding(t->dc_reply))
+			r = ZFS_INVALID_REPLY;
+	}
+
+	if (r >= ZFS_ERROR_HAS_DC_REPLY)
+		recycle_dc_to_fd(t->dc_reply, fd);
+	RETURN_INT(r);
+}
+
 /*! Read COUNT bytes from offset OFFSET of remote file with capability CAP of 
    dentry DENTRY on volume VOL.  */
 
@@ -2212,9 +2343,6 @@ remote_read(read_res * res, internal_cap cap, internal_dentry dentry,
 			uint64_t offset, uint32_t count, volume vol)
 {
 	read_args args;
-	thread *t;
-	int32_t r;
-	int fd;
 	node nod = vol->master;
 
 	TRACE("");
@@ -2236,39 +2364,71 @@ remote_read(read_res * res, internal_cap cap, internal_dentry dentry,
 	zfsd_mutex_unlock(&node_mutex);
 	zfsd_mutex_unlock(&vol->mutex);
 
-	t = (thread *) pthread_getspecific(thread_data_key);
-	r = zfs_proc_read_client(t, &args, nod, &fd);
+	RETURN_INT(remote_read_1(res, &args, nod));
+}
 
-	if (r == ZFS_OK)
-	{
-		char *buffer = res->data.buf;
+/*! Read COUNT bytes from offset OFFSET of remote regular file with
+   capability CAP of dentry DENTRY on volume VOL.  Use the data read ahead if
+   they are available, and read ahead when the file is read sequentially.  */
 
-		if (!decode_read_res(t->dc_reply, res)
-			|| !finish_decoding(t->dc_reply))
-			r = ZFS_INVALID_REPLY;
-		else
-		{
-			memcpy(buffer, res->data.buf, res->data.len);
-			res->data.buf = buffer;
-		}
-	}
-	else if (r >= ZFS_LAST_DECODED_ERROR)
+static int32_t
+remote_read_ahead(read_res * res, internal_cap cap, internal_dentry dentry,
+				  uint64_t offset, uint32_t count, volume vol)
+{
+	read_args args;
+	uint64_t size, version;
+	uint32_t vid;
+	int32_t r;
+	node nod = vol->master;
+
+	TRACE("");
+	CHECK_MUTEX_LOCKED(&vol->mutex);
+#ifdef ENABLE_CHECKING
+	if (zfs_cap_undefined(cap->master_cap))
+		zfsd_abort();
+	if (zfs_fh_undefined(cap->master_cap.fh))
+		zfsd_abort();
+#endif
+
+	args.cap = cap->master_cap;
+	args.offset = offset;
+	args.count = count;
+	size = dentry->fh->attr.size;
+	version = dentry->fh->attr.version;
+	vid = vol->id;
+
+	/* Do not hold the locks while waiting for the blocks being read
+	   ahead.  */
+	release_dentry(dentry);
+	zfsd_mutex_unlock(&vol->mutex);
+
+	r = readahead_read(res, &args.cap, offset, count, version);
+	if (r == ENOENT)
 	{
-		if (!finish_decoding(t->dc_reply))
-			r = ZFS_INVALID_REPLY;
+		zfsd_mutex_lock(&node_mutex);
+		zfsd_mutex_lock(&nod->mutex);
+		zfsd_mutex_unlock(&node_mutex);
+		r = remote_read_1(res, &args, nod);
 	}
 
-	if (r >= ZFS_ERROR_HAS_DC_REPLY)
-		recycle_dc_to_fd(t->dc_reply, fd);
+	if (r == ZFS_OK)
+		readahead_schedule(&args.cap, vid, offset, res->data.len, size,
+						   res->version);
+
 	RETURN_INT(r);
 }
 
 /*! Read COUNT bytes from file CAP at offset OFFSET, store the results to
-   RES. If UPDATE_LOCAL is true update the local file on copied volume.  */
+   RES. If UPDATE_LOCAL is true update the local file on copied volume.
+   If SEND_FD is not NULL and the data are read from a local regular file,
+   SEND_FD is called with DATA and the file descriptor of the local file
+   instead of reading the data to RES->DATA.BUF.  In this case COUNT may be
+   greater than ZFS_MAXDATA and RES->DATA.BUF must have space for COUNT
+   bytes; data read from remote node are limited to ZFS_MAXDATA bytes.  */
 
 int32_t
-zfs_read(read_res * res, zfs_cap * cap, uint64_t offset, uint32_t count,
-		 bool update_local)
+zfs_read_fd(read_res * res, zfs_cap * cap, uint64_t offset, uint32_t count,
+			bool update_local, read_fd_f send_fd, void *data)
 {
 	volume vol;
 	internal_cap icap;
@@ -2278,12 +2438,15 @@ zfs_read(read_res * res, zfs_cap * cap, uint64_t offset, uint32_t count,
 
 	TRACE("offset = %" PRIu64 " count = %" PRIu32, offset, count);
 
-	if (count > ZFS_MAXDATA)
+	if (count > ZFS_MAXDATA && send_fd == NULL)
 		RETURN_INT(EINVAL);
 
 	if (cap->flags != O_RDONLY && cap->flags != O_RDWR)
 		RETURN_INT(EBADF);
 
+	/* Read the data written behind.  */
+	writebehind_flush(&cap->fh, false);
+
 	if (VIRTUAL_FH_P(cap->fh))
 		RETURN_INT(EISDIR);
 
@@ -2306,27 +2469,50 @@ zfs_read(read_res * res, zfs_cap * cap, uint64_t offset, uint32_t count,
 	if (r != ZFS_OK)
 		RETURN_INT(r);
 
+#ifdef ENABLE_VERSIONS
+	/* Old versions of the data are merged to the buffer after reading.  */
+	if (zfs_config.versions.versioning && dentry->version_file)
+		send_fd = NULL;
+#endif
+
 	if (INTERNAL_FH_HAS_LOCAL_PATH(dentry->fh))
 	{
-		if (zfs_fh_undefined(dentry->fh->meta.master_fh)
+		if (zfs_fh_undefined(dentry->fh->meta->master_fh)
 			|| vol->master == this_node)
-			r = local_read(res, dentry, offset, count, vol);
+			r = local_read(res, dentry, offset, count, vol, send_fd, data);
 		else if (dentry->fh->attr.type == FT_REG && update_local)
 		{
 			varray blocks;
 			uint64_t end;
 			uint64_t offset2;
+			uint64_t ahead;
 			uint32_t count2;
-			unsigned int i;
 			bool complete;
 
 			message(LOG_FUNC, FACILITY_DATA,
 					"zfs_read(): file has local path\n");
 
-			count2 = (count < ZFS_UPDATED_BLOCK_SIZE
-					  ? ZFS_UPDATED_BLOCK_SIZE : count);
+			count2 = (count < UPDATED_BLOCK_SIZE(dentry->fh)
+					  ? UPDATED_BLOCK_SIZE(dentry->fh) : count);
 			end = (offset < (uint64_t) - 1 - count2
 				   ? offset + count2 : (uint64_t) - 1);
+			offset2 = (offset < (uint64_t) - 1 - count
+					   ? offset + count : (uint64_t) - 1);
+
+			/* Fetch also the data following a sequential read so that the
+			   next reads do not wait for the master node.  */
+			if (offset != dentry->fh->next_read)
+				dentry->fh->fetch_window = 0;
+			else if (dentry->fh->fetch_window == 0)
+				dentry->fh->fetch_window = READAHEAD_MIN_WINDOW;
+			dentry->fh->next_read = offset2;
+
+			ahead = (end < (uint64_t) - 1 - dentry->fh->fetch_window
+					 ? end + dentry->fh->fetch_window : (uint64_t) - 1);
+			if (ahead > dentry->fh->attr.size)
+				ahead = dentry->fh->attr.size;
+			if (ahead > end)
+				end = ahead;
 
 			message(LOG_FUNC, FACILITY_DATA,
 					"zfs_read(): calling get_blocks_for_updating()\n");
@@ -2334,36 +2520,28 @@ zfs_read(read_res * res, zfs_cap * cap, uint64_t offset, uint32_t count,
 			message(LOG_FUNC, FACILITY_DATA,
 					"zfs_read(): back from get_blocks_for_updating()\n");
 
-			complete = true;
-			offset2 = offset + count;
-			for (i = 0; i < VARRAY_USED(blocks); i++)
-			{
-				if (offset2 <= VARRAY_ACCESS(blocks, i, interval).start)
-					break;
-
-				if (VARRAY_ACCESS(blocks, i, interval).start <= offset
-					&& offset < VARRAY_ACCESS(blocks, i, interval).end)
-				{
-					complete = false;
-					break;
-				}
-				else if (VARRAY_ACCESS(blocks, i, interval).start < offset2
-						 && offset2 <= VARRAY_ACCESS(blocks, i, interval).end)
-				{
-					complete = false;
-					break;
-				}
-			}
+			/* The blocks are sorted and start at OFFSET or later so the
+			   requested data are complete unless the first block starts
+			   before OFFSET2.  */
+			complete = (VARRAY_USED(blocks) == 0
+						|| VARRAY_ACCESS(blocks, 0, interval).start >= offset2);
 
 			if (complete)
 			{
 				message(LOG_DEBUG, FACILITY_DATA,
 						"zfs_read(): nothing to update\n");
-				r = local_read(res, dentry, offset, count, vol);
+
+				/* Update the rest of the file being read sooner.  */
+				if (dentry->fh->flags & IFH_ENQUEUED)
+					schedule_update_or_reintegration(vol, dentry,
+													 UPDATE_PRIORITY_ACCESSED);
+
+				r = local_read(res, dentry, offset, count, vol, send_fd, data);
 			}
 			else
 			{
 				message(LOG_DEBUG, FACILITY_DATA, "zfs_read(): will update\n");
+				uint32_t block_size;
 				bool modified;
 
 				if (icap->master_busy == 0)
@@ -2376,7 +2554,22 @@ zfs_read(read_res * res, zfs_cap * cap, uint64_t offset, uint32_t count,
 				}
 
 				modified = (dentry->fh->attr.version
-							!= dentry->fh->meta.master_version);
+							!= dentry->fh->meta->master_version);
+				block_size = UPDATED_BLOCK_SIZE(dentry->fh);
+
+				/* Fetch more ahead next time if the reads stay sequential.  */
+				if (dentry->fh->fetch_window != 0)
+				{
+					dentry->fh->fetch_window *= 2;
+					if (dentry->fh->fetch_window > READAHEAD_MAX_WINDOW)
+						dentry->fh->fetch_window = READAHEAD_MAX_WINDOW;
+				}
+
+				/* This request waits for the blocks of the file, update the
+				   rest of the file before the files updated in
+				   background.  */
+				schedule_update_or_reintegration(vol, dentry,
+												 UPDATE_PRIORITY_WAITING);
 
 				release_dentry(dentry);
 				zfsd_mutex_unlock(&vol->mutex);
@@ -2388,7 +2581,8 @@ zfs_read(read_res * res, zfs_cap * cap, uint64_t offset, uint32_t count,
 				/* update the file blocks needed for this read, parameter for
 				   slow = false, we don't want to get interrupted here, it's
 				   not background update */
-				r = update_file_blocks(&tmp_cap, &blocks, modified, false);
+				r = update_file_blocks(&tmp_cap, &blocks, block_size,
+									   modified, false, BANDWIDTH_DEMAND);
 				if (r == ZFS_OK)
 				{
 				  out_update:
@@ -2399,7 +2593,7 @@ zfs_read(read_res * res, zfs_cap * cap, uint64_t offset, uint32_t count,
 						zfsd_abort();
 #endif
 
-					r = local_read(res, dentry, offset, count, vol);
+					r = local_read(res, dentry, offset, count, vol, send_fd, data);
 				}
 			}
 
@@ -2410,7 +2604,7 @@ zfs_read(read_res * res, zfs_cap * cap, uint64_t offset, uint32_t count,
 			switch (dentry->fh->attr.type)
 			{
 			case FT_REG:
-				r = local_read(res, dentry, offset, count, vol);
+				r = local_read(res, dentry, offset, count, vol, send_fd, data);
 				break;
 
 			case FT_BLK:
@@ -2420,10 +2614,12 @@ zfs_read(read_res * res, zfs_cap * cap, uint64_t offset, uint32_t count,
 				if (!zfs_cap_undefined(icap->master_cap))
 				{
 					zfsd_mutex_unlock(&fh_mutex);
-					r = remote_read(res, icap, dentry, offset, count, vol);
+					r = remote_read(res, icap, dentry, offset,
+									(count > ZFS_MAXDATA
+									 ? ZFS_MAXDATA : count), vol);
 				}
 				else
-					r = local_read(res, dentry, offset, count, vol);
+					r = local_read(res, dentry, offset, count, vol, send_fd, data);
 				break;
 
 			default:
@@ -2434,7 +2630,13 @@ zfs_read(read_res * res, zfs_cap * cap, uint64_t offset, uint32_t count,
 	else if (vol->master != this_node)
 	{
 		zfsd_mutex_unlock(&fh_mutex);
-		r = remote_read(res, icap, dentry, offset, count, vol);
+		if (dentry->fh->attr.type == FT_REG)
+			r = remote_read_ahead(res, icap, dentry, offset,
+								  (count > ZFS_MAXDATA ? ZFS_MAXDATA : count),
+								  vol);
+		else
+			r = remote_read(res, icap, dentry, offset,
+							(count > ZFS_MAXDATA ? ZFS_MAXDATA : count), vol);
 	}
 	else
 		zfsd_abort();
@@ -2448,7 +2650,7 @@ zfs_read(read_res * res, zfs_cap * cap, uint64_t offset, uint32_t count,
 #ifdef ENABLE_VERSIONS
 	if (zfs_config.versions.versioning && (dentry->fh->attr.type == FT_REG) & (r == ZFS_OK)
 		&& (dentry->version_file) && (offset < dentry->fh->attr.size)
-		&& (dentry->fh->version_list_length))
+		&& dentry->fh->version && dentry->fh->version->list_length)
 	{
 		r = version_read_old_data(dentry, offset, offset + count,
 								  res->data.buf);
@@ -2460,15 +2662,30 @@ zfs_read(read_res * res, zfs_cap * cap, uint64_t offset, uint32_t count,
 	RETURN_INT(r);
 }
 
-/*! Write DATA to offset OFFSET of local file DENTRY on volume VOL.  */
+/*! Read COUNT bytes from file CAP at offset OFFSET, store the results to
+   RES. If UPDATE_LOCAL is true update the local file on copied volume.  */
+
+int32_t
+zfs_read(read_res * res, zfs_cap * cap, uint64_t offset, uint32_t count,
+		 bool update_local)
+{
+	TRACE("");
+
+	RETURN_INT(zfs_read_fd(res, cap, offset, count, update_local, NULL,
+						   NULL));
+}
+
+/*! Write DATA to offset OFFSET of local file DENTRY on volume VOL.  If
+   RECV_FD is not NULL let it write DATA->LEN bytes to the file descriptor
+   with RECV_DATA instead of writing DATA->BUF.  */
 
 static int32_t
 local_write(write_res * res, internal_dentry dentry,
 			uint64_t offset, data_buffer * data, volume vol,
-			ATTRIBUTE_UNUSED_VERSIONS bool remote)
+			ATTRIBUTE_UNUSED_VERSIONS bool remote, write_fd_f recv_fd,
+			void *recv_data)
 {
 	int32_t r;
-	off_t writing_position = -1;
 	int fd;
 #ifdef ENABLE_VERSIONS
 	bool version_was_open = true;
@@ -2491,7 +2708,7 @@ local_write(write_res * res, internal_dentry dentry,
 		if (!WAS_FILE_TRUNCATED(dentry->fh))
 		{
 			// version file open?
-			if (dentry->fh->version_fd < 0)
+			if (!INTERNAL_FH_VERSION_OPEN(dentry->fh))
 			{
 				version_create_file(dentry, vol);
 				version_was_open = false;
@@ -2501,17 +2718,18 @@ local_write(write_res * res, internal_dentry dentry,
 			{
 				// write before marked file size
 				version_write = true;
-				fdv = dentry->fh->version_fd;
+				fdv = dentry->fh->version->fd;
 				verend = offset + data->len;
-				// if (verend > dentry->fh->marked_size) verend =
-				// dentry->fh->marked_size;
+				// if (verend > dentry->fh->version->marked_size) verend =
+				// dentry->fh->version->marked_size;
 
 				// get intervals that should be copied
-				interval_tree_complement(dentry->fh->versioned, offset, verend,
-										 &save);
+				interval_tree_complement(dentry->fh->version->versioned,
+										 offset, verend, &save);
 
 				// write our new interval into tree
-				interval_tree_insert(dentry->fh->versioned, offset, verend);
+				interval_tree_insert(dentry->fh->version->versioned, offset,
+									 verend);
 			}
 		}
 	}
@@ -2523,7 +2741,7 @@ local_write(write_res * res, internal_dentry dentry,
 #ifdef ENABLE_VERSIONS
 		// TODO: should not use fh - not locked here
 		if (!remote && zfs_config.versions.versioning && (dentry->fh->attr.type == FT_REG)
-			&& (dentry->fh->version_fd > 0))
+			&& INTERNAL_FH_VERSION_OPEN(dentry->fh))
 			version_close_file(dentry->fh, false);
 #endif
 		RETURN_INT(r);
@@ -2544,41 +2762,75 @@ local_write(write_res * res, internal_dentry dentry,
 	}
 #endif
 
-	writing_position = lseek(fd, offset, SEEK_SET);
-	if (writing_position == (off_t) - 1)
+	/* The old data have been saved to the version file, write the new data
+	   without serializing the threads writing the file.  */
+	local_fd_pin(fd);
+	if (recv_fd)
 	{
-		zfsd_mutex_unlock(&internal_fd_data[fd].mutex);
-		RETURN_INT(errno);
+		uint32_t written;
+
+		r = (*recv_fd) (fd, offset, data->len, &written, recv_data);
+		if (r == ZFS_OK)
+			res->written = written;
+
+		local_fd_unpin(fd);
+		RETURN_INT(r);
 	}
 
 	message(LOG_DEBUG, FACILITY_DATA,
-			"writing data of size %u to %ld(wanted %llu - %ld)\n",
-			data->len, writing_position, offset, (long int)offset);
+			"writing data of size %u to %" PRIu64 "\n", data->len, offset);
 
-	r = write(fd, data->buf, data->len);
+	r = io_pwrite(fd, data->buf, data->len, offset);
 	if (r < 0)
 	{
-		zfsd_mutex_unlock(&internal_fd_data[fd].mutex);
-		RETURN_INT(errno);
+		r = errno;
+		local_fd_unpin(fd);
+		RETURN_INT(r);
 	}
 	res->written = r;
-	message(LOG_DEBUG, FACILITY_DATA,
-			"written %d of %u, pos is %ld\n",
-			r, data->len, lseek(fd, 0, SEEK_CUR));
+	message(LOG_DEBUG, FACILITY_DATA, "written %d of %u\n", r, data->len);
 
-	zfsd_mutex_unlock(&internal_fd_data[fd].mutex);
+	local_fd_unpin(fd);
 	RETURN_INT(ZFS_OK);
 }
 
+/*! Write data described by ARGS to node NOD, store the result to RES.  */
+
+static int32_t remote_write_1(write_res * res, write_args * args, node nod)
+{
+	thread *t;
+	int32_t r;
+	int fd;
+
+	TRACE("");
+	CHECK_MUTEX_LOCKED(&nod->mutex);
+
+	t = (thread *) pthread_getspecific(thread_data_key);
+	r = zfs_proc_write_client(t, args, nod, &fd);
+
+	if (r == ZFS_OK)
+	{
+		if (!decode_write_res(t->dc_reply, res)
+			|| !finish_decoding(t->dc_reply))
+			r = ZFS_INVALID_REPLY;
+	}
+	else if (r >= ZFS_LAST_DECODED_ERROR)
+	{
+		if (!finish_decoding(t->dc_reply))
+			r = ZFS_INVALID_REPLY;
+	}
+
+	if (r >= ZFS_ERROR_HAS_DC_REPLY)
+		recycle_dc_to_fd(t->dc_reply, fd);
+	RETURN_INT(r);
+}
+
 /*! Write to remote file with capability CAP of dentry DENTRY on volume VOL. */
 
 static int32_t
 remote_write(write_res * res, internal_cap cap, internal_dentry dentry,
 			 write_args * args, volume vol)
 {
-	thread *t;
-	int32_t r;
-	int fd;
 	node nod = vol->master;
 
 	TRACE("");
@@ -2592,6 +2844,7 @@ remote_write(write_res * res, internal_cap cap, internal_dentry dentry,
 #endif
 
 	args->cap = cap->master_cap;
+	readahead_invalidate(&args->cap.fh);
 
 	release_dentry(dentry);
 	zfsd_mutex_lock(&node_mutex);
@@ -2599,29 +2852,68 @@ remote_write(write_res * res, internal_cap cap, internal_dentry dentry,
 	zfsd_mutex_unlock(&node_mutex);
 	zfsd_mutex_unlock(&vol->mutex);
 
-	t = (thread *) pthread_getspecific(thread_data_key);
-	r = zfs_proc_write_client(t, args, nod, &fd);
+	RETURN_INT(remote_write_1(res, args, nod));
+}
+
+/*! Write to remote regular file with capability CAP of dentry DENTRY on
+   volume VOL behind, i.e. store the data to the write-behind buffer of the
+   file.  Write them synchronously if there is no space for them.  */
+
+static int32_t
+remote_write_behind(write_res * res, internal_cap cap, internal_dentry dentry,
+					write_args * args, volume vol)
+{
+	zfs_fh fh;
+	uint32_t vid;
+	int32_t r;
+	node nod = vol->master;
+
+	TRACE("");
+	CHECK_MUTEX_LOCKED(&vol->mutex);
+#ifdef ENABLE_CHECKING
+	if (zfs_cap_undefined(cap->master_cap))
+		zfsd_abort();
+	if (zfs_fh_undefined(cap->master_cap.fh))
+		zfsd_abort();
+#endif
+
+	fh = args->cap.fh;
+	args->cap = cap->master_cap;
+	res->version = dentry->fh->attr.version;
+	vid = vol->id;
+
+	/* Do not hold the locks while waiting for the previous data.  */
+	release_dentry(dentry);
+	zfsd_mutex_unlock(&vol->mutex);
 
+	/* The version is the one the master node replied when it wrote the
+	   previous data of the file.  */
+	r = writebehind_write(&fh, &args->cap, vid, args->offset, &args->data,
+						  &res->version);
 	if (r == ZFS_OK)
+		res->written = args->data.len;
+	else if (r == EAGAIN)
 	{
-		if (!decode_write_res(t->dc_reply, res)
-			|| !finish_decoding(t->dc_reply))
-			r = ZFS_INVALID_REPLY;
-	}
-	else if (r >= ZFS_LAST_DECODED_ERROR)
-	{
-		if (!finish_decoding(t->dc_reply))
-			r = ZFS_INVALID_REPLY;
+		readahead_invalidate(&args->cap.fh);
+
+		zfsd_mutex_lock(&node_mutex);
+		zfsd_mutex_lock(&nod->mutex);
+		zfsd_mutex_unlock(&node_mutex);
+		r = remote_write_1(res, args, nod);
 	}
 
-	if (r >= ZFS_ERROR_HAS_DC_REPLY)
-		recycle_dc_to_fd(t->dc_reply, fd);
 	RETURN_INT(r);
 }
 
-/*! Write to file.  */
+/*! Write to file.  If RECV_FD is not NULL ARGS->DATA.BUF is not used, the
+   data are written to the local file by RECV_FD with RECV_DATA instead and
+   ARGS->DATA.LEN may be greater than ZFS_MAXDATA.  If the file is not a local
+   regular file whose data may be written this way, return EAGAIN without
+   writing anything.  */
 
-int32_t zfs_write(write_res * res, write_args * args)
+int32_t
+zfs_write_fd(write_res * res, write_args * args, write_fd_f recv_fd,
+			 void *recv_data)
 {
 	volume vol;
 	internal_cap icap;
@@ -2629,10 +2921,11 @@ int32_t zfs_write(write_res * res, write_args * args)
 	zfs_cap tmp_cap;
 	int32_t r, r2;
 	bool remote_call = false;
+	bool behind = false;
 
 	TRACE("");
 
-	if (args->data.len > ZFS_MAXDATA)
+	if (args->data.len > ZFS_MAXDATA && recv_fd == NULL)
 		RETURN_INT(EINVAL);
 
 	if (args->cap.flags != O_WRONLY && args->cap.flags != O_RDWR)
@@ -2660,19 +2953,33 @@ int32_t zfs_write(write_res * res, write_args * args)
 	if (r != ZFS_OK)
 		RETURN_INT(r);
 
+	/* Only local regular files can be written through RECV_FD.  Versioning
+	   needs the new data in ARGS->DATA.BUF.  */
+	if (recv_fd
+		&& (!INTERNAL_FH_HAS_LOCAL_PATH(dentry->fh)
+			|| dentry->fh->attr.type != FT_REG
+#ifdef ENABLE_VERSIONS
+			|| (zfs_config.versions.versioning && !args->remote)
+#endif
+		))
+	{
+		internal_cap_unlock(vol, dentry, NULL);
+		RETURN_INT(EAGAIN);
+	}
+
 	if (INTERNAL_FH_HAS_LOCAL_PATH(dentry->fh))
 	{
-		if (zfs_fh_undefined(dentry->fh->meta.master_fh)
+		if (zfs_fh_undefined(dentry->fh->meta->master_fh)
 			|| vol->master == this_node)
 			r = local_write(res, dentry, args->offset, &args->data, vol,
-							args->remote);
+							args->remote, recv_fd, recv_data);
 		else
 		{
 			switch (dentry->fh->attr.type)
 			{
 			case FT_REG:
 				r = local_write(res, dentry, args->offset, &args->data, vol,
-								args->remote);
+								args->remote, recv_fd, recv_data);
 				break;
 
 			case FT_BLK:
@@ -2687,7 +2994,7 @@ int32_t zfs_write(write_res * res, write_args * args)
 				}
 				else
 					r = local_write(res, dentry, args->offset, &args->data,
-									vol, args->remote);
+									vol, args->remote, recv_fd, recv_data);
 				break;
 
 			default:
@@ -2698,7 +3005,14 @@ int32_t zfs_write(write_res * res, write_args * args)
 	else if (vol->master != this_node)
 	{
 		zfsd_mutex_unlock(&fh_mutex);
-		r = remote_write(res, icap, dentry, args, vol);
+		if (zfs_config.write_behind && !args->remote
+			&& dentry->fh->attr.type == FT_REG)
+		{
+			r = remote_write_behind(res, icap, dentry, args, vol);
+			behind = true;
+		}
+		else
+			r = remote_write(res, icap, dentry, args, vol);
 		remote_call = true;
 	}
 	else
@@ -2724,17 +3038,17 @@ int32_t zfs_write(write_res * res, write_args * args)
 			else
 			{
 				uint64_t start, end;
+				uint32_t block_size;
 				varray blocks;
 				unsigned int i;
 
 				if (!inc_local_version_and_modified(vol, dentry->fh))
 					MARK_VOLUME_DELETE(vol);
 
-				start = (args->offset / ZFS_MODIFIED_BLOCK_SIZE
-						 * ZFS_MODIFIED_BLOCK_SIZE);
-				end = ((args->offset + res->written
-						+ ZFS_MODIFIED_BLOCK_SIZE - 1)
-					   / ZFS_MODIFIED_BLOCK_SIZE * ZFS_MODIFIED_BLOCK_SIZE);
+				block_size = MODIFIED_BLOCK_SIZE(dentry->fh);
+				start = args->offset / block_size * block_size;
+				end = ((args->offset + res->written + block_size - 1)
+					   / block_size * block_size);
 
 				interval_tree_intersection(dentry->fh->updated, start, end,
 										   &blocks);
@@ -2776,6 +3090,12 @@ int32_t zfs_write(write_res * res, write_args * args)
 			   reply of remote call.  */
 			res->version = dentry->fh->attr.version;
 		}
+		else if (behind && dentry->fh->attr.version < res->version)
+		{
+			/* Take the version the master node replied when it wrote the
+			   data written behind.  */
+			dentry->fh->attr.version = res->version;
+		}
 	}
 
 	internal_cap_unlock(vol, dentry, NULL);
@@ -2783,6 +3103,15 @@ int32_t zfs_write(write_res * res, write_args * args)
 	RETURN_INT(r);
 }
 
+/*! Write to file.  */
+
+int32_t zfs_write(write_res * res, write_args * args)
+{
+	TRACE("");
+
+	RETURN_INT(zfs_write_fd(res, args, NULL, NULL));
+}
+
 /*! Read complete contents of local directory FH and store it to ENTRIES.  */
 
 int32_t full_local_readdir(zfs_fh * fh, filldir_htab_entries * entries)
@@ -3011,7 +3340,8 @@ full_local_read(uint32_t * rcount, void *buffer, zfs_cap * cap,
 		}
 
 		res.data.buf = (char *)buffer + total;
-		r = local_read(&res, dentry, offset + total, count - total, vol);
+		r = local_read(&res, dentry, offset + total, count - total, vol,
+					   NULL, NULL);
 		if (r != ZFS_OK)
 			RETURN_INT(r);
 
@@ -3045,7 +3375,8 @@ full_local_read_dentry(uint32_t * rcount, void *buffer, zfs_cap * cap,
 	for (total = 0; total < count; total += res.data.len)
 	{
 		res.data.buf = (char *)buffer + total;
-		r = local_read(&res, dentry, offset + total, count - total, vol);
+		r = local_read(&res, dentry, offset + total, count - total, vol,
+					   NULL, NULL);
 
 		r2 = find_capability_nolock(cap, &icap, &vol, &dentry, NULL, false);
 #ifdef ENABLE_CHECKING
@@ -3159,7 +3490,8 @@ full_local_write(uint32_t * rcount, void *buffer, zfs_cap * cap,
 
 		data.len = count - total;
 		data.buf = (char *)buffer + total;
-		r = local_write(&res, dentry, offset + total, &data, vol, false);
+		r = local_write(&res, dentry, offset + total, &data, vol, false,
+						NULL, NULL);
 		if (r != ZFS_OK)
 			RETURN_INT(r);
 
@@ -3255,7 +3587,8 @@ int32_t local_md5sum(md5sum_res * res, md5sum_args * args)
 		for (total = 0; total < args->length[i]; total += rres.data.len)
 		{
 			r = zfs_read(&rres, &args->cap, args->offset[i] + total,
-						 args->length[i] - total, false);
+						 (args->length[i] - total < ZFS_MAXDATA
+						  ? args->length[i] - total : ZFS_MAXDATA), false);
 			if (r != ZFS_OK)
 				RETURN_INT(r);
 			if (!args->ignore_changes && rres.version != res->version)
@@ -3384,8 +3717,11 @@ void initialize_file_c(void)
 	for (i = 0; i < max_nfd; i++)
 	{
 		zfsd_mutex_init(&internal_fd_data[i].mutex);
+		zfsd_cond_init(&internal_fd_data[i].cond);
 		internal_fd_data[i].fd = -1;
 	}
+
+	initialize_writebehind_c();
 }
 
 /*! Destroy data structures in CAP.C.  */
@@ -3431,4 +3767,6 @@ void cleanup_file_c(void)
 	zfsd_mutex_destroy(&opened_mutex);
 
 	free(internal_fd_data);
+
+	cleanup_writebehind_c();
 }
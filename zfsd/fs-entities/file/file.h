@@ -50,6 +50,9 @@ typedef struct internal_fd_data_def
 	unsigned int generation;	/*!< generation of open file descriptor */
 	fibnode heap_node;			/*!< node of heap whose data is this
 								   structure */
+	unsigned int busy;			/*!< number of threads doing I/O on FD
+								   without holding MUTEX */
+	pthread_cond_t cond;		/*!< signalled when BUSY drops to 0 */
 } internal_fd_data_t;
 
 /*! \brief Data for supplementary functions of readdir.  */
@@ -74,6 +77,19 @@ typedef bool(*filldir_f) (uint32_t ino, int32_t cookie, const char *name,
 						  uint32_t name_len, dir_list * list,
 						  readdir_data * data);
 
+/*! Function called to send COUNT bytes from offset OFFSET of local file
+   descriptor FD directly to the reader.  The file descriptor is valid only
+   during the call and the locks of the file are held, so the function
+   should duplicate FD and send the data after zfs_read_fd returns.  */
+typedef int32_t(*read_fd_f) (int fd, uint64_t offset, uint32_t count,
+							 void *data);
+
+/*! Function called to write COUNT bytes to offset OFFSET of local file
+   descriptor FD directly from the writer and store the number of bytes
+   written to WRITTEN.  The file descriptor is valid only during the call.  */
+typedef int32_t(*write_fd_f) (int fd, uint64_t offset, uint32_t count,
+							  uint32_t * written, void *data);
+
 #include "cap.h"
 extern int32_t local_close(internal_fh fh);
 extern int32_t cond_remote_close(zfs_cap * cap, internal_cap icap,
@@ -88,8 +104,11 @@ extern int32_t zfs_create(create_res * res, zfs_fh * dir, string * name,
 						  uint32_t flags, sattr * attr);
 extern int32_t cond_remote_open(zfs_cap * cap, internal_cap icap,
 								internal_dentry * dentryp, volume * volp);
+extern int32_t zfs_open_attr(zfs_cap * cap, fattr * attr, zfs_fh * fh,
+							 uint32_t flags);
 extern int32_t zfs_open(zfs_cap * cap, zfs_fh * fh, uint32_t flags);
 extern int32_t zfs_close(zfs_cap * cap);
+extern int32_t zfs_flush(zfs_cap * cap);
 extern bool filldir_encode(uint32_t ino, int32_t cookie, const char *name,
 						   uint32_t name_len, dir_list * list,
 						   readdir_data * data);
@@ -114,7 +133,12 @@ extern int32_t zfs_readdir(dir_list * list, zfs_cap * cap, int32_t cookie,
 						   uint32_t count, filldir_f filldir);
 extern int32_t zfs_read(read_res * res, zfs_cap * cap, uint64_t offset,
 						uint32_t count, bool update);
+extern int32_t zfs_read_fd(read_res * res, zfs_cap * cap, uint64_t offset,
+						   uint32_t count, bool update, read_fd_f send_fd,
+						   void *data);
 extern int32_t zfs_write(write_res * res, write_args * args);
+extern int32_t zfs_write_fd(write_res * res, write_args * args,
+							write_fd_f recv_fd, void *recv_data);
 
 extern int32_t full_local_readdir(zfs_fh * fh, filldir_htab_entries * entries);
 extern int32_t full_remote_readdir(zfs_fh * fh,
@@ -0,0 +1,836 @@
+/*! \file \brief Read-ahead of files whose data are on remote node.
+
+   When a client reads a file whose data are on the master node
+   sequentially, the following blocks of the file are read by the read-ahead
+   threads into a buffer of the file before the client asks for them.  The
+   window read ahead starts at READAHEAD_MIN_WINDOW and is doubled by each
+   sequential read up to READAHEAD_MAX_WINDOW, a read from another offset
+   stops reading ahead.  The buffer is dropped when the file is written
+   through this node, when the master reports a newer version of the file
+   and when the remote capability is closed.  When READAHEAD_MAX_FILES files
+   are being read ahead the state of the least recently used one is freed.  */
+
+/* Copyright (C) 2026 ZFS contributors
+
+   This file is part of ZFS.
+
+   ZFS is free software; you can redistribute it and/or modify it under the
+   terms of the GNU General Public License as published by the Free Software
+   Foundation; either version 2, or (at your option) any later version.
+
+   ZFS is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General Public License along
+   with ZFS; see the file COPYING.  If not, write to the Free Software
+   Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA; or
+   download it from http://www.gnu.org/licenses/gpl.html */
+
+#include "system.h"
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include "pthread-wrapper.h"
+#include "memory.h"
+#include "log.h"
+#include "crc32.h"
+#include "hashtab.h"
+#include "queue.h"
+#include "thread.h"
+#include "data-coding.h"
+#include "fh.h"
+#include "node.h"
+#include "volume.h"
+#include "network.h"
+#include "zfs-prot.h"
+#include "configuration.h"
+#include "readahead.h"
+
+/*! Maximal number of blocks the main read-ahead thread gets at once.  */
+#define READAHEAD_QUEUE_BATCH 16
+
+/*! State of a block of the read-ahead buffer.  */
+typedef enum readahead_block_state_def
+{
+	READAHEAD_EMPTY,			/*!< the block is not used */
+	READAHEAD_PENDING,			/*!< the block is being read */
+	READAHEAD_VALID				/*!< the block contains data */
+} readahead_block_state;
+
+/*! \brief Block of the read-ahead buffer.  */
+typedef struct readahead_block_def
+{
+	uint64_t offset;			/*!< offset of the block in the file */
+	uint32_t len;				/*!< length of data, shorter at EOF */
+	readahead_block_state state;	/*!< state of the block */
+	uint64_t version;			/*!< version of the file the data belong to */
+	char *buf;					/*!< the data */
+} readahead_block;
+
+/*! \brief Read-ahead state of a file.  */
+typedef struct readahead_file_def
+{
+	/*! Capability of the file on the master node, its FH is the key.  */
+	zfs_cap cap;
+
+	/*! ID of the volume of the file.  */
+	uint32_t vid;
+
+	/*! Offset where the next sequential read starts.  */
+	uint64_t next_offset;
+
+	/*! End of the data which have been requested to be read ahead.  */
+	uint64_t end;
+
+	/*! Size of the read-ahead window, 0 if the access is not sequential.  */
+	uint32_t window;
+
+	/*! Latest version of the file on the master node, the blocks of an older
+	   version are dropped.  */
+	uint64_t version;
+
+	/*! Generation of the state, blocks read by an older generation are
+	   dropped.  */
+	unsigned int generation;
+
+	/*! Number of blocks queued or being read.  */
+	unsigned int pending;
+
+	/*! The remote capability has been closed, free the state when the
+	   pending blocks are finished.  */
+	bool closed;
+
+	/*! Signalled when a pending block has been finished.  */
+	pthread_cond_t cond;
+
+	/*! Previous (more recently used) and next state in the LRU list.  */
+	struct readahead_file_def *lru_prev;
+	struct readahead_file_def *lru_next;
+
+	/*! Ring buffer of blocks, block at offset O is in slot
+	   (O / READAHEAD_BLOCK_SIZE) % READAHEAD_BLOCKS.  */
+	readahead_block blocks[READAHEAD_BLOCKS];
+} *readahead_file;
+
+/*! \brief Job for a read-ahead thread.  */
+typedef struct readahead_job_def
+{
+	readahead_job_f func;		/*!< function doing the job */
+	void *data;					/*!< e.g. read-ahead state of the file */
+	uint64_t offset;			/*!< offset of the block */
+	unsigned int generation;	/*!< generation of the state */
+} readahead_job;
+
+/*! Queue of jobs for read-ahead threads.  */
+queue readahead_queue;
+
+/*! Mutex protecting the readahead_queue.  */
+static pthread_mutex_t readahead_queue_mutex;
+
+/*! Pool of read-ahead threads.  */
+thread_pool readahead_pool;
+
+/*! Hash table of read-ahead states, searched by the remote file handle.  */
+static htab_t readahead_htab;
+
+/*! Mutex protecting the readahead_htab and the read-ahead states.  */
+static pthread_mutex_t readahead_mutex;
+
+/*! The most recently and the least recently used read-ahead state.  */
+static readahead_file readahead_lru_first;
+static readahead_file readahead_lru_last;
+
+/*! zfsd is exiting, do not wait for the blocks being read.  */
+static bool readahead_exiting_p;
+
+/*! Return the slot of the buffer of file F for block at offset OFFSET.  */
+#define READAHEAD_SLOT(F, OFFSET)					\
+  (&(F)->blocks[((OFFSET) / READAHEAD_BLOCK_SIZE) % READAHEAD_BLOCKS])
+
+static void readahead_block_read(thread * t, void *data, uint64_t offset,
+								 unsigned int generation);
+
+/*! Hash function for read-ahead state X.  */
+
+static hash_t readahead_file_hash(const void *x)
+{
+	return ZFS_FH_HASH(&((const struct readahead_file_def *)x)->cap.fh);
+}
+
+/*! Compare the file handle of read-ahead state XX with file handle YY.  */
+
+static int readahead_file_eq(const void *xx, const void *yy)
+{
+	const zfs_fh *x = &((const struct readahead_file_def *)xx)->cap.fh;
+	const zfs_fh *y = (const zfs_fh *)yy;
+
+	return ZFS_FH_EQ(*x, *y);
+}
+
+/*! Remove read-ahead state F from the LRU list.  */
+
+static void readahead_lru_unlink(readahead_file f)
+{
+	CHECK_MUTEX_LOCKED(&readahead_mutex);
+
+	/* F is not in the list.  */
+	if (!f->lru_prev && readahead_lru_first != f)
+		return;
+
+	if (f->lru_prev)
+		f->lru_prev->lru_next = f->lru_next;
+	else
+		readahead_lru_first = f->lru_next;
+	if (f->lru_next)
+		f->lru_next->lru_prev = f->lru_prev;
+	else
+		readahead_lru_last = f->lru_prev;
+	f->lru_prev = NULL;
+	f->lru_next = NULL;
+}
+
+/*! Move read-ahead state F to the head of the LRU list.  */
+
+static void readahead_lru_touch(readahead_file f)
+{
+	CHECK_MUTEX_LOCKED(&readahead_mutex);
+
+	if (readahead_lru_first == f)
+		return;
+
+	readahead_lru_unlink(f);
+	f->lru_next = readahead_lru_first;
+	if (readahead_lru_first)
+		readahead_lru_first->lru_prev = f;
+	else
+		readahead_lru_last = f;
+	readahead_lru_first = f;
+}
+
+/*! Free read-ahead state X.  */
+
+static void readahead_file_del(void *x)
+{
+	readahead_file f = (readahead_file) x;
+	unsigned int i;
+
+	readahead_lru_unlink(f);
+	for (i = 0; i < READAHEAD_BLOCKS; i++)
+		if (f->blocks[i].buf)
+			free(f->blocks[i].buf);
+	zfsd_cond_destroy(&f->cond);
+	free(f);
+}
+
+/*! Drop the data read ahead for file F and stop reading ahead.  The blocks
+   being read are dropped when they are finished.  */
+
+static void readahead_file_reset(readahead_file f)
+{
+	unsigned int i;
+
+	CHECK_MUTEX_LOCKED(&readahead_mutex);
+
+	f->generation++;
+	f->window = 0;
+	f->end = 0;
+	for (i = 0; i < READAHEAD_BLOCKS; i++)
+		if (f->blocks[i].state == READAHEAD_VALID)
+			f->blocks[i].state = READAHEAD_EMPTY;
+
+	zfsd_cond_broadcast(&f->cond);
+}
+
+/*! Record that the master node reported version VERSION of the file with
+   read-ahead state F.  Drop the blocks of an older version.  */
+
+static void readahead_file_check_version(readahead_file f, uint64_t version)
+{
+	CHECK_MUTEX_LOCKED(&readahead_mutex);
+
+	if (version > f->version)
+	{
+		if (f->version != 0)
+			readahead_file_reset(f);
+		f->version = version;
+	}
+}
+
+/*! Free the state of the least recently used file which has no blocks being
+   read.  Return false if there is no such file.  */
+
+static bool readahead_evict_lru(void)
+{
+	readahead_file f;
+	void **slot;
+
+	CHECK_MUTEX_LOCKED(&readahead_mutex);
+
+	for (f = readahead_lru_last; f; f = f->lru_prev)
+		if (f->pending == 0)
+		{
+			slot = htab_find_slot_with_hash(readahead_htab, &f->cap.fh,
+											ZFS_FH_HASH(&f->cap.fh),
+											NO_INSERT);
+#ifdef ENABLE_CHECKING
+			if (!slot)
+				zfsd_abort();
+#endif
+			htab_clear_slot(readahead_htab, slot);
+			return true;
+		}
+
+	return false;
+}
+
+/*! If COUNT bytes at offset OFFSET of file with remote capability CAP have
+   been read ahead store them to RES and return ZFS_OK.  Wait for the blocks
+   which are being read.  RES->DATA.BUF must have space for COUNT bytes.
+   VERSION is the version of the file known by this node, the blocks of an
+   older version are not used.  Return ZFS_EXITING if zfsd is exiting while
+   waiting and ENOENT if the data have not been read ahead.  */
+
+int32_t
+readahead_read(read_res * res, zfs_cap * cap, uint64_t offset, uint32_t count,
+			   uint64_t version)
+{
+	readahead_file f;
+	readahead_block *b;
+	uint64_t pos, end, block_offset;
+	uint32_t len;
+
+	TRACE("offset = %" PRIu64 " count = %" PRIu32, offset, count);
+
+	if (offset > (uint64_t) - 1 - count)
+		RETURN_INT(ENOENT);
+
+	zfsd_mutex_lock(&readahead_mutex);
+	f = (readahead_file) htab_find_with_hash(readahead_htab, &cap->fh,
+											 ZFS_FH_HASH(&cap->fh));
+	if (f)
+		readahead_file_check_version(f, version);
+	if (!f || f->window == 0)
+	{
+		zfsd_mutex_unlock(&readahead_mutex);
+		RETURN_INT(ENOENT);
+	}
+	readahead_lru_touch(f);
+
+  retry:
+	/* Check that all blocks are there before copying anything.  */
+	end = offset + count;
+	for (pos = offset; pos < end; pos = block_offset + READAHEAD_BLOCK_SIZE)
+	{
+		block_offset = pos - pos % READAHEAD_BLOCK_SIZE;
+		b = READAHEAD_SLOT(f, pos);
+		if (b->offset != block_offset || b->state == READAHEAD_EMPTY
+			|| (b->state == READAHEAD_VALID && b->version != f->version))
+		{
+			zfsd_mutex_unlock(&readahead_mutex);
+			RETURN_INT(ENOENT);
+		}
+
+		if (b->state == READAHEAD_PENDING)
+		{
+			/* The jobs still in the queue will not be run.  */
+			if (readahead_exiting_p)
+			{
+				zfsd_mutex_unlock(&readahead_mutex);
+				RETURN_INT(ZFS_EXITING);
+			}
+
+			/* The blocks checked so far might have changed meanwhile.  */
+			zfsd_cond_wait(&f->cond, &readahead_mutex);
+			goto retry;
+		}
+
+		if (b->len < READAHEAD_BLOCK_SIZE)
+		{
+			/* End of file.  */
+			if (end > block_offset + b->len)
+				end = block_offset + b->len;
+			break;
+		}
+	}
+
+	res->data.len = end > offset ? end - offset : 0;
+	for (pos = offset; pos < end; pos += len)
+	{
+		b = READAHEAD_SLOT(f, pos);
+		len = (b->offset + b->len < end ? b->offset + b->len : end) - pos;
+		memcpy(res->data.buf + (pos - offset), b->buf + (pos - b->offset), len);
+	}
+	res->version = f->version;
+
+	zfsd_mutex_unlock(&readahead_mutex);
+	RETURN_INT(ZFS_OK);
+}
+
+/*! Record that COUNT bytes have been read from offset OFFSET of file of size
+   SIZE and version VERSION with remote capability CAP on volume VID.  If the
+   file is being read sequentially enlarge the read-ahead window and queue
+   the blocks in the window which have not been read ahead yet.  */
+
+void
+readahead_schedule(zfs_cap * cap, uint32_t vid, uint64_t offset,
+				   uint32_t count, uint64_t size, uint64_t version)
+{
+	readahead_file f;
+	readahead_block *b;
+	uint64_t pos, limit;
+	hash_t hash;
+	void **slot;
+
+	TRACE("offset = %" PRIu64 " count = %" PRIu32, offset, count);
+
+	if (offset > (uint64_t) - 1 - count)
+		RETURN_VOID;
+
+	hash = ZFS_FH_HASH(&cap->fh);
+	zfsd_mutex_lock(&readahead_mutex);
+	f = (readahead_file) htab_find_with_hash(readahead_htab, &cap->fh, hash);
+	if (!f)
+	{
+		/* Bound the memory used by the buffers.  */
+		if (HTAB_N_ELEMENTS(readahead_htab) >= READAHEAD_MAX_FILES
+			&& !readahead_evict_lru())
+		{
+			zfsd_mutex_unlock(&readahead_mutex);
+			RETURN_VOID;
+		}
+
+		f = (readahead_file) xcalloc(1, sizeof(struct readahead_file_def));
+		f->cap = *cap;
+		f->vid = vid;
+		f->next_offset = offset + count;
+		f->version = version;
+		zfsd_cond_init(&f->cond);
+
+		slot = htab_find_slot_with_hash(readahead_htab, &cap->fh, hash,
+										INSERT);
+		*slot = f;
+		readahead_lru_touch(f);
+		zfsd_mutex_unlock(&readahead_mutex);
+		RETURN_VOID;
+	}
+
+	/* The file has been opened again.  */
+	f->closed = false;
+	f->cap = *cap;
+	f->vid = vid;
+	readahead_file_check_version(f, version);
+	readahead_lru_touch(f);
+
+	if (offset == f->next_offset && count > 0)
+		f->window = (f->window == 0 ? READAHEAD_MIN_WINDOW
+					 : f->window >= READAHEAD_MAX_WINDOW / 2
+					 ? READAHEAD_MAX_WINDOW : 2 * f->window);
+	else
+	{
+		f->window = 0;
+		f->end = 0;
+	}
+	f->next_offset = offset + count;
+
+	if (f->window == 0 || f->next_offset >= size)
+	{
+		zfsd_mutex_unlock(&readahead_mutex);
+		RETURN_VOID;
+	}
+
+	limit = (size - f->next_offset > f->window
+			 ? f->next_offset + f->window : size);
+	pos = f->next_offset - f->next_offset % READAHEAD_BLOCK_SIZE;
+	if (pos < f->end)
+		pos = f->end;
+	for (; pos < limit; pos += READAHEAD_BLOCK_SIZE)
+	{
+		b = READAHEAD_SLOT(f, pos);
+		if (b->offset == pos && b->state != READAHEAD_EMPTY)
+			continue;
+
+		/* Do not overwrite a block which has not been read yet.  */
+		if (b->state == READAHEAD_PENDING
+			|| (b->state == READAHEAD_VALID
+				&& b->offset + b->len > f->next_offset))
+			break;
+
+		if (!b->buf)
+			b->buf = (char *) xmalloc(READAHEAD_BLOCK_SIZE);
+		b->offset = pos;
+		b->len = 0;
+		b->state = READAHEAD_PENDING;
+		f->pending++;
+
+		readahead_queue_job(readahead_block_read, f, pos, f->generation,
+							false);
+	}
+	f->end = pos;
+
+	zfsd_mutex_unlock(&readahead_mutex);
+	RETURN_VOID;
+}
+
+/*! Drop the data read ahead for remote file handle FH because the file has
+   been modified.  */
+
+void readahead_invalidate(zfs_fh * fh)
+{
+	readahead_file f;
+
+	TRACE("");
+
+	zfsd_mutex_lock(&readahead_mutex);
+	f = (readahead_file) htab_find_with_hash(readahead_htab, fh,
+											 ZFS_FH_HASH(fh));
+	if (f)
+		readahead_file_reset(f);
+	zfsd_mutex_unlock(&readahead_mutex);
+}
+
+/*! Forget the read-ahead state of remote file handle FH because its remote
+   capability is being closed.  */
+
+void readahead_forget(zfs_fh * fh)
+{
+	readahead_file f;
+	void **slot;
+
+	TRACE("");
+
+	zfsd_mutex_lock(&readahead_mutex);
+	slot = htab_find_slot_with_hash(readahead_htab, fh, ZFS_FH_HASH(fh),
+									NO_INSERT);
+	if (slot)
+	{
+		f = (readahead_file) * slot;
+		if (f->pending == 0)
+			htab_clear_slot(readahead_htab, slot);
+		else
+		{
+			readahead_file_reset(f);
+			f->closed = true;
+		}
+	}
+	zfsd_mutex_unlock(&readahead_mutex);
+}
+
+/*! \brief Tell the read-ahead threads we are exiting, i.e. wake up the
+   threads waiting for blocks which will not be read.  */
+void readahead_exiting(void)
+{
+	void **slot;
+
+	queue_exiting(&readahead_queue);
+
+	zfsd_mutex_lock(&readahead_mutex);
+	readahead_exiting_p = true;
+	HTAB_FOR_EACH_SLOT(readahead_htab, slot)
+	{
+		readahead_file f = (readahead_file) * slot;
+
+		zfsd_cond_broadcast(&f->cond);
+	}
+	zfsd_mutex_unlock(&readahead_mutex);
+}
+
+/*! Queue job FUNC with DATA, OFFSET and GENERATION to be run by
+   a read-ahead thread.  If URGENT the job is run before the jobs already
+   queued, e.g. writing data behind before reading ahead.  */
+
+void
+readahead_queue_job(readahead_job_f func, void *data, uint64_t offset,
+					unsigned int generation, bool urgent)
+{
+	readahead_job job;
+
+	job.func = func;
+	job.data = data;
+	job.offset = offset;
+	job.generation = generation;
+	zfsd_mutex_lock(&readahead_queue_mutex);
+	if (urgent)
+		queue_put_first(&readahead_queue, &job);
+	else
+		queue_put(&readahead_queue, &job);
+	zfsd_mutex_unlock(&readahead_queue_mutex);
+}
+
+/*! Store the result R of reading the block at offset OFFSET of file F for
+   generation GENERATION of its read-ahead state, RES is the reply if R is
+   ZFS_OK.  Free the state if it has been closed and this was the last
+   pending block.  */
+
+static void
+readahead_block_finish(readahead_file f, uint64_t offset,
+					   unsigned int generation, int32_t r, read_res * res)
+{
+	readahead_block *b;
+	void **slot;
+
+	zfsd_mutex_lock(&readahead_mutex);
+	if (r == ZFS_OK)
+		readahead_file_check_version(f, res->version);
+	b = READAHEAD_SLOT(f, offset);
+	if (r == ZFS_OK && f->generation == generation
+		&& res->version == f->version
+		&& res->data.len <= READAHEAD_BLOCK_SIZE)
+	{
+		memcpy(b->buf, res->data.buf, res->data.len);
+		b->len = res->data.len;
+		b->version = res->version;
+		b->state = READAHEAD_VALID;
+	}
+	else
+		b->state = READAHEAD_EMPTY;
+	f->pending--;
+	zfsd_cond_broadcast(&f->cond);
+
+	if (f->closed && f->pending == 0)
+	{
+		slot = htab_find_slot_with_hash(readahead_htab, &f->cap.fh,
+										ZFS_FH_HASH(&f->cap.fh), NO_INSERT);
+#ifdef ENABLE_CHECKING
+		if (!slot)
+			zfsd_abort();
+#endif
+		htab_clear_slot(readahead_htab, slot);
+	}
+	zfsd_mutex_unlock(&readahead_mutex);
+}
+
+/*! Read the block at offset OFFSET of file DATA for generation GENERATION of
+   its read-ahead state using data of thread T.  */
+
+static void
+readahead_block_read(thread * t, void *data, uint64_t offset,
+					 unsigned int generation)
+{
+	readahead_file f = (readahead_file) data;
+	read_args args;
+	read_res res;
+	volume vol;
+	node nod;
+	uint32_t vid;
+	int32_t r;
+	int fd;
+
+	TRACE("offset = %" PRIu64, offset);
+
+	zfsd_mutex_lock(&readahead_mutex);
+	args.cap = f->cap;
+	vid = f->vid;
+	r = (f->generation == generation ? ZFS_OK : ESTALE);
+	zfsd_mutex_unlock(&readahead_mutex);
+	args.offset = offset;
+	args.count = READAHEAD_BLOCK_SIZE;
+
+	if (r == ZFS_OK)
+	{
+		vol = volume_lookup(vid);
+		if (!vol)
+			r = ENOENT;
+		else if (vol->master == this_node)
+		{
+			zfsd_mutex_unlock(&vol->mutex);
+			r = EINVAL;
+		}
+		else
+		{
+			nod = vol->master;
+			zfsd_mutex_lock(&node_mutex);
+			zfsd_mutex_lock(&nod->mutex);
+			zfsd_mutex_unlock(&node_mutex);
+			zfsd_mutex_unlock(&vol->mutex);
+
+			r = zfs_proc_read_client(t, &args, nod, &fd);
+			if (r == ZFS_OK)
+			{
+				if (!decode_read_res(t->dc_reply, &res)
+					|| !finish_decoding(t->dc_reply))
+					r = ZFS_INVALID_REPLY;
+			}
+			else if (r >= ZFS_LAST_DECODED_ERROR)
+			{
+				if (!finish_decoding(t->dc_reply))
+					r = ZFS_INVALID_REPLY;
+			}
+
+			/* Copy the data before the reply buffer is recycled.  */
+			readahead_block_finish(f, offset, generation, r, &res);
+
+			if (r >= ZFS_ERROR_HAS_DC_REPLY)
+				recycle_dc_to_fd(t->dc_reply, fd);
+			return;
+		}
+	}
+
+	readahead_block_finish(f, offset, generation, r, NULL);
+}
+
+/*! \brief Initialize read-ahead thread T. */
+static void readahead_worker_init(thread * t)
+{
+	t->dc_call = dc_create();
+}
+
+/*! \brief Cleanup read-ahead thread DATA. */
+static void readahead_worker_cleanup(void *data)
+{
+	thread *t = (thread *) data;
+
+	dc_destroy(t->dc_call);
+}
+
+/*! \brief The main function of a read-ahead thread.  It runs the job
+   passed from #readahead_main() and goes idle.  */
+static void *readahead_worker(void *data)
+{
+	thread *t = (thread *) data;
+	lock_info li[MAX_LOCKED_FILE_HANDLES];
+
+	thread_disable_signals();
+
+	pthread_cleanup_push(readahead_worker_cleanup, data);
+	pthread_setspecific(thread_data_key, data);
+	pthread_setspecific(thread_name_key, "Read-ahead worker thread");
+	set_lock_info(li);
+
+	while (1)
+	{
+		/* Wait until readahead_main() wakes us up.  */
+		semaphore_down(&t->sem, 1);
+
+#ifdef ENABLE_CHECKING
+		if (get_thread_state(t) == THREAD_DEAD)
+			zfsd_abort();
+#endif
+
+		/* We were requested to die.  */
+		if (get_thread_state(t) == THREAD_DYING)
+			break;
+
+		t->from_sid = this_node->id;
+
+		(*t->u.readahead.func) (t, t->u.readahead.data,
+								t->u.readahead.offset,
+								t->u.readahead.generation);
+
+		/* Put self to the idle queue if not requested to die meanwhile.  */
+		zfsd_mutex_lock(&readahead_pool.mutex);
+		if (get_thread_state(t) == THREAD_BUSY)
+			thread_pool_idle_push(&readahead_pool, t);
+		else
+		{
+#ifdef ENABLE_CHECKING
+			if (get_thread_state(t) != THREAD_DYING)
+				zfsd_abort();
+#endif
+			zfsd_mutex_unlock(&readahead_pool.mutex);
+			break;
+		}
+		zfsd_mutex_unlock(&readahead_pool.mutex);
+	}
+
+	pthread_cleanup_pop(1);
+
+	return NULL;
+}
+
+/*! \brief Main function of the main read-ahead thread.  It gets jobs from
+   #readahead_queue and passes them to idle read-ahead threads.  */
+static void *readahead_main(ATTRIBUTE_UNUSED void *data)
+{
+	readahead_job job[READAHEAD_QUEUE_BATCH];
+	unsigned int i, n;
+	thread *t;
+
+	thread_disable_signals();
+	pthread_setspecific(thread_name_key, "Read-ahead main thread");
+
+	message(LOG_NOTICE, FACILITY_DATA | FACILITY_THREADING,
+			"Starting main read-ahead thread...\n");
+
+	while (!thread_pool_terminate_p(&readahead_pool))
+	{
+		zfsd_mutex_lock(&readahead_queue_mutex);
+		n = queue_get_batch(&readahead_queue, job, READAHEAD_QUEUE_BATCH);
+		zfsd_mutex_unlock(&readahead_queue_mutex);
+		if (n == 0)
+			break;
+
+		zfsd_mutex_lock(&readahead_pool.mutex);
+		for (i = 0; i < n; i++)
+		{
+			t = thread_pool_idle_pop(&readahead_pool);
+			if (!t)
+				break;
+
+			t->u.readahead.func = job[i].func;
+			t->u.readahead.data = job[i].data;
+			t->u.readahead.offset = job[i].offset;
+			t->u.readahead.generation = job[i].generation;
+			semaphore_up(&t->sem, 1);
+		}
+		zfsd_mutex_unlock(&readahead_pool.mutex);
+
+		if (i < n)
+			break;
+	}
+
+	message(LOG_NOTICE, FACILITY_DATA | FACILITY_THREADING,
+			"Terminating main read-ahead thread...\n");
+
+	return NULL;
+}
+
+/*! \brief Initialize the read-ahead states and queue, and create the
+   #readahead_pool.  */
+bool readahead_start(void)
+{
+	zfsd_mutex_init(&readahead_mutex);
+	readahead_htab = htab_create(READAHEAD_MAX_FILES, readahead_file_hash,
+								 readahead_file_eq, readahead_file_del,
+								 &readahead_mutex);
+	zfsd_mutex_init(&readahead_queue_mutex);
+	queue_create(&readahead_queue, sizeof(readahead_job), 250,
+				 &readahead_queue_mutex);
+
+	if (!thread_pool_create(&readahead_pool,
+							&zfs_config.threads.readahead_thread_limit,
+							readahead_main, readahead_worker,
+							readahead_worker_init))
+	{
+		zfsd_mutex_lock(&readahead_queue_mutex);
+		queue_destroy(&readahead_queue);
+		zfsd_mutex_unlock(&readahead_queue_mutex);
+		zfsd_mutex_destroy(&readahead_queue_mutex);
+
+		zfsd_mutex_lock(&readahead_mutex);
+		htab_destroy(readahead_htab);
+		zfsd_mutex_unlock(&readahead_mutex);
+		zfsd_mutex_destroy(&readahead_mutex);
+
+		return false;
+	}
+
+	return true;
+}
+
+/*! \brief Destroy #readahead_pool and free the read-ahead states.  */
+void readahead_cleanup(void)
+{
+	thread_pool_destroy(&readahead_pool);
+
+	zfsd_mutex_lock(&readahead_queue_mutex);
+	queue_destroy(&readahead_queue);
+	zfsd_mutex_unlock(&readahead_queue_mutex);
+	zfsd_mutex_destroy(&readahead_queue_mutex);
+
+	zfsd_mutex_lock(&readahead_mutex);
+	htab_destroy(readahead_htab);
+	zfsd_mutex_unlock(&readahead_mutex);
+	zfsd_mutex_destroy(&readahead_mutex);
+}
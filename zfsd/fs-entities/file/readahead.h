@@ -0,0 +1,72 @@
+/*! \file \brief Read-ahead of files whose data are on remote node.  */
+
+/* Copyright (C) 2026 ZFS contributors
+
+   This file is part of ZFS.
+
+   ZFS is free software; you can redistribute it and/or modify it under the
+   terms of the GNU General Public License as published by the Free Software
+   Foundation; either version 2, or (at your option) any later version.
+
+   ZFS is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General Public License along
+   with ZFS; see the file COPYING.  If not, write to the Free Software
+   Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA; or
+   download it from http://www.gnu.org/licenses/gpl.html */
+
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include "system.h"
+#include <inttypes.h>
+#include "pthread-wrapper.h"
+#include "queue.h"
+#include "thread.h"
+#include "zfs-prot.h"
+
+/*! Size of a block read ahead by one request.  */
+#define READAHEAD_BLOCK_SIZE ZFS_MAXDATA
+
+/*! Number of blocks buffered for one file.  */
+#define READAHEAD_BLOCKS 32
+
+/*! Initial size of the read-ahead window.  */
+#define READAHEAD_MIN_WINDOW (2 * READAHEAD_BLOCK_SIZE)
+
+/*! Maximal size of the read-ahead window.  One block of the buffer is kept
+   for the block being read by the client.  */
+#define READAHEAD_MAX_WINDOW ((READAHEAD_BLOCKS - 1) * READAHEAD_BLOCK_SIZE)
+
+/*! Maximal number of files being read ahead.  */
+#define READAHEAD_MAX_FILES 32
+
+/*! Type of a job run by a read-ahead thread T with DATA, OFFSET and
+   GENERATION.  */
+typedef void (*readahead_job_f) (thread * t, void *data, uint64_t offset,
+								 unsigned int generation);
+
+/*! Queue of jobs for read-ahead threads.  */
+extern queue readahead_queue;
+
+/*! Pool of read-ahead threads, they also write the data written behind.  */
+extern thread_pool readahead_pool;
+
+extern int32_t readahead_read(read_res * res, zfs_cap * cap, uint64_t offset,
+							  uint32_t count, uint64_t version);
+extern void readahead_schedule(zfs_cap * cap, uint32_t vid, uint64_t offset,
+							   uint32_t count, uint64_t size,
+							   uint64_t version);
+extern void readahead_invalidate(zfs_fh * fh);
+extern void readahead_queue_job(readahead_job_f func, void *data,
+								uint64_t offset, unsigned int generation,
+								bool urgent);
+extern void readahead_forget(zfs_fh * fh);
+extern void readahead_exiting(void);
+extern bool readahead_start(void);
+extern void readahead_cleanup(void);
+
+#endif
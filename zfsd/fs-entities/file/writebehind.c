@@ -0,0 +1,514 @@
+/*! \file \brief Write-behind of files whose data are on remote node.
+
+   When write-behind is enabled the writes to a file whose data are on the
+   master node are replied to immediately.  Contiguous writes are collected
+   to a buffer of ZFS_MAXDATA bytes which is written to the master node by
+   a read-ahead thread when it is full, when a write to another offset comes
+   or when the data have been in the buffer for WRITEBEHIND_DELAY seconds.
+   The buffers are written before the jobs reading ahead.  At most one
+   buffer of a file is being written at a time so the writes reach the
+   master node in order.  The other operations on the file wait for the data
+   to be written first, an error of writing is returned by the following
+   write, fsync or close of the file.  When zfsd exits the buffers are
+   written before the read-ahead and network threads are stopped.  */
+
+/* Copyright (C) 2026 ZFS contributors
+
+   This file is part of ZFS.
+
+   ZFS is free software; you can redistribute it and/or modify it under the
+   terms of the GNU General Public License as published by the Free Software
+   Foundation; either version 2, or (at your option) any later version.
+
+   ZFS is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General Public License along
+   with ZFS; see the file COPYING.  If not, write to the Free Software
+   Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA; or
+   download it from http://www.gnu.org/licenses/gpl.html */
+
+#include "system.h"
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "pthread-wrapper.h"
+#include "memory.h"
+#include "log.h"
+#include "crc32.h"
+#include "hashtab.h"
+#include "thread.h"
+#include "data-coding.h"
+#include "fh.h"
+#include "node.h"
+#include "volume.h"
+#include "network.h"
+#include "zfs-prot.h"
+#include "configuration.h"
+#include "readahead.h"
+#include "writebehind.h"
+
+/*! \brief Write-behind state of a file.  */
+typedef struct writebehind_file_def
+{
+	/*! File handle of the file used by clients, the key.  */
+	zfs_fh fh;
+
+	/*! Capability of the file on the master node.  */
+	zfs_cap cap;
+
+	/*! ID of the volume of the file.  */
+	uint32_t vid;
+
+	/*! Number of threads using the state.  */
+	unsigned int busy;
+
+	/*! Offset of the data collected in BUF.  */
+	uint64_t offset;
+
+	/*! Length of the data collected in BUF.  */
+	uint32_t len;
+
+	/*! Time when the data collected in BUF have to be written.  */
+	time_t deadline;
+
+	/*! Buffer collecting the data.  */
+	char *buf;
+
+	/*! The data in FLUSH_BUF are being written.  */
+	bool flushing;
+
+	/*! Offset of the data being written.  */
+	uint64_t flush_offset;
+
+	/*! Length of the data being written.  */
+	uint32_t flush_len;
+
+	/*! Buffer with the data being written.  */
+	char *flush_buf;
+
+	/*! Error of writing which has not been reported yet.  */
+	int32_t error;
+
+	/*! Version of the file the master node replied when the data were
+	   written last time.  */
+	uint64_t version;
+
+	/*! Signalled when the data have been written.  */
+	pthread_cond_t cond;
+} *writebehind_file;
+
+/*! Hash table of write-behind states, searched by the file handle.  */
+static htab_t writebehind_htab;
+
+/*! Mutex protecting the writebehind_htab and the write-behind states.  */
+static pthread_mutex_t writebehind_mutex;
+
+/*! Hash function for write-behind state X.  */
+
+static hash_t writebehind_file_hash(const void *x)
+{
+	return ZFS_FH_HASH(&((const struct writebehind_file_def *)x)->fh);
+}
+
+/*! Compare the file handle of write-behind state XX with file handle YY.  */
+
+static int writebehind_file_eq(const void *xx, const void *yy)
+{
+	const zfs_fh *x = &((const struct writebehind_file_def *)xx)->fh;
+	const zfs_fh *y = (const zfs_fh *)yy;
+
+	return ZFS_FH_EQ(*x, *y);
+}
+
+/*! Free write-behind state X.  */
+
+static void writebehind_file_del(void *x)
+{
+	writebehind_file f = (writebehind_file) x;
+
+	free(f->buf);
+	free(f->flush_buf);
+	zfsd_cond_destroy(&f->cond);
+	free(f);
+}
+
+/*! Free the write-behind state F if it is not needed anymore, i.e. nobody
+   uses it, it has no data and no error to report.  */
+
+static void writebehind_file_release(writebehind_file f)
+{
+	void **slot;
+
+	CHECK_MUTEX_LOCKED(&writebehind_mutex);
+
+	if (f->busy > 0 || f->flushing || f->len > 0 || f->error != ZFS_OK)
+		return;
+
+	slot = htab_find_slot_with_hash(writebehind_htab, &f->fh,
+									ZFS_FH_HASH(&f->fh), NO_INSERT);
+#ifdef ENABLE_CHECKING
+	if (!slot)
+		zfsd_abort();
+#endif
+	htab_clear_slot(writebehind_htab, slot);
+}
+
+/*! Write the data collected for file DATA to the master node using data of
+   thread T.  */
+
+static void
+writebehind_flush_job(thread * t, void *data,
+					  ATTRIBUTE_UNUSED uint64_t offset,
+					  ATTRIBUTE_UNUSED unsigned int generation)
+{
+	writebehind_file f = (writebehind_file) data;
+	write_args args;
+	write_res res;
+	volume vol;
+	node nod;
+	uint32_t vid;
+	int32_t r;
+	int fd;
+
+	TRACE("");
+
+	zfsd_mutex_lock(&writebehind_mutex);
+	args.cap = f->cap;
+	args.offset = f->flush_offset;
+	args.data.len = f->flush_len;
+	args.data.buf = f->flush_buf;
+	args.remote = false;
+	vid = f->vid;
+	zfsd_mutex_unlock(&writebehind_mutex);
+
+	readahead_invalidate(&args.cap.fh);
+
+	vol = volume_lookup(vid);
+	if (!vol)
+		r = ENOENT;
+	else if (vol->master == this_node)
+	{
+		zfsd_mutex_unlock(&vol->mutex);
+		r = EINVAL;
+	}
+	else
+	{
+		nod = vol->master;
+		zfsd_mutex_lock(&node_mutex);
+		zfsd_mutex_lock(&nod->mutex);
+		zfsd_mutex_unlock(&node_mutex);
+		zfsd_mutex_unlock(&vol->mutex);
+
+		r = zfs_proc_write_client(t, &args, nod, &fd);
+		if (r == ZFS_OK)
+		{
+			if (!decode_write_res(t->dc_reply, &res)
+				|| !finish_decoding(t->dc_reply))
+				r = ZFS_INVALID_REPLY;
+			else if (res.written != args.data.len)
+				r = EIO;
+		}
+		else if (r >= ZFS_LAST_DECODED_ERROR)
+		{
+			if (!finish_decoding(t->dc_reply))
+				r = ZFS_INVALID_REPLY;
+		}
+
+		if (r >= ZFS_ERROR_HAS_DC_REPLY)
+			recycle_dc_to_fd(t->dc_reply, fd);
+	}
+
+	if (r != ZFS_OK)
+		message(LOG_WARNING, FACILITY_DATA,
+				"Writing %" PRIu32 " bytes at %" PRIu64 " behind failed: %d\n",
+				args.data.len, args.offset, r);
+
+	zfsd_mutex_lock(&writebehind_mutex);
+	if (r == ZFS_OK && f->version < res.version)
+		f->version = res.version;
+	if (r != ZFS_OK && f->error == ZFS_OK)
+		f->error = r;
+	f->flushing = false;
+	zfsd_cond_broadcast(&f->cond);
+	writebehind_file_release(f);
+	zfsd_mutex_unlock(&writebehind_mutex);
+}
+
+/*! Start writing the data collected for file F, wait for the previous data
+   of the file to be written first.  */
+
+static void writebehind_start_flush(writebehind_file f)
+{
+	char *tmp;
+
+	CHECK_MUTEX_LOCKED(&writebehind_mutex);
+
+	while (f->flushing)
+		zfsd_cond_wait(&f->cond, &writebehind_mutex);
+
+	if (f->len == 0)
+		return;
+
+	tmp = f->flush_buf;
+	f->flush_buf = f->buf;
+	f->buf = tmp;
+	f->flush_offset = f->offset;
+	f->flush_len = f->len;
+	f->len = 0;
+	f->flushing = true;
+
+	readahead_queue_job(writebehind_flush_job, f, 0, 0, true);
+}
+
+/*! Write DATA to offset OFFSET of file FH with capability CAP on the master
+   node of volume VID behind.  Return ZFS_OK if the data have been stored to
+   the buffer of the file, EAGAIN if they have to be written synchronously or
+   the error of writing the previous data.  If the data have been stored
+   raise *VERSION to the version the master node replied when the previous
+   data of the file were written.  */
+
+int32_t
+writebehind_write(zfs_fh * fh, zfs_cap * cap, uint32_t vid, uint64_t offset,
+				  data_buffer * data, uint64_t * version)
+{
+	writebehind_file f;
+	char *buf;
+	uint32_t len, n;
+	hash_t hash;
+	void **slot;
+	int32_t r;
+
+	TRACE("offset = %" PRIu64 " len = %" PRIu32, offset, data->len);
+
+	if (offset > (uint64_t) - 1 - data->len)
+		RETURN_INT(EAGAIN);
+
+	hash = ZFS_FH_HASH(fh);
+	zfsd_mutex_lock(&writebehind_mutex);
+	f = (writebehind_file) htab_find_with_hash(writebehind_htab, fh, hash);
+	if (!f)
+	{
+		/* Bound the memory used by the buffers.  */
+		if (HTAB_N_ELEMENTS(writebehind_htab) >= WRITEBEHIND_MAX_FILES)
+		{
+			zfsd_mutex_unlock(&writebehind_mutex);
+			RETURN_INT(EAGAIN);
+		}
+
+		f = (writebehind_file) xcalloc(1, sizeof(struct writebehind_file_def));
+		f->fh = *fh;
+		f->buf = (char *) xmalloc(ZFS_MAXDATA);
+		f->flush_buf = (char *) xmalloc(ZFS_MAXDATA);
+		f->error = ZFS_OK;
+		zfsd_cond_init(&f->cond);
+
+		slot = htab_find_slot_with_hash(writebehind_htab, fh, hash, INSERT);
+		*slot = f;
+	}
+
+	if (f->error != ZFS_OK)
+	{
+		r = f->error;
+		f->error = ZFS_OK;
+		writebehind_file_release(f);
+		zfsd_mutex_unlock(&writebehind_mutex);
+		RETURN_INT(r);
+	}
+
+	f->busy++;
+	buf = data->buf;
+	len = data->len;
+	while (len > 0)
+	{
+		/* Other writers may have added data while we were waiting.  */
+		if (f->len == ZFS_MAXDATA
+			|| (f->len > 0 && offset != f->offset + f->len))
+		{
+			writebehind_start_flush(f);
+			continue;
+		}
+
+		/* The capability is used for writing the buffer, change it only
+		   when the buffer is empty.  */
+		if (f->len == 0)
+		{
+			f->cap = *cap;
+			f->vid = vid;
+			f->offset = offset;
+			f->deadline = time(NULL) + WRITEBEHIND_DELAY;
+		}
+
+		n = ZFS_MAXDATA - f->len;
+		if (n > len)
+			n = len;
+		memcpy(f->buf + f->len, buf, n);
+		f->len += n;
+		buf += n;
+		offset += n;
+		len -= n;
+
+		if (f->len == ZFS_MAXDATA)
+			writebehind_start_flush(f);
+	}
+	f->busy--;
+
+	if (*version < f->version)
+		*version = f->version;
+
+	zfsd_mutex_unlock(&writebehind_mutex);
+	RETURN_INT(ZFS_OK);
+}
+
+/*! Write the data of file FH which have been written behind and wait until
+   they are written.  If REPORT is true return the error of writing which
+   has not been reported yet.  */
+
+int32_t writebehind_flush(zfs_fh * fh, bool report)
+{
+	writebehind_file f;
+	int32_t r;
+
+	TRACE("");
+
+	if (!zfs_config.write_behind)
+		RETURN_INT(ZFS_OK);
+
+	zfsd_mutex_lock(&writebehind_mutex);
+	f = (writebehind_file) htab_find_with_hash(writebehind_htab, fh,
+											   ZFS_FH_HASH(fh));
+	if (!f)
+	{
+		zfsd_mutex_unlock(&writebehind_mutex);
+		RETURN_INT(ZFS_OK);
+	}
+
+	f->busy++;
+	writebehind_start_flush(f);
+	while (f->flushing)
+		zfsd_cond_wait(&f->cond, &writebehind_mutex);
+	f->busy--;
+
+	r = ZFS_OK;
+	if (report)
+	{
+		r = f->error;
+		f->error = ZFS_OK;
+	}
+	writebehind_file_release(f);
+
+	zfsd_mutex_unlock(&writebehind_mutex);
+	RETURN_INT(r);
+}
+
+/*! Start writing the data which have been in the buffers for too long.  */
+
+void writebehind_flush_expired(void)
+{
+	writebehind_file f;
+	time_t now;
+	void **slot;
+
+	TRACE("");
+
+	if (!zfs_config.write_behind)
+		RETURN_VOID;
+
+	now = time(NULL);
+	zfsd_mutex_lock(&writebehind_mutex);
+	HTAB_FOR_EACH_SLOT(writebehind_htab, slot)
+	{
+		f = (writebehind_file) * slot;
+
+		/* The data of a file being written are written when it finishes
+		   or later.  */
+		if (f->len > 0 && !f->flushing && f->deadline <= now)
+			writebehind_start_flush(f);
+	}
+	zfsd_mutex_unlock(&writebehind_mutex);
+	RETURN_VOID;
+}
+
+/*! Write the data of all files which have been written behind and wait
+   until they are written.  */
+
+void writebehind_flush_all(void)
+{
+	writebehind_file f;
+	void **slot;
+	bool pending;
+
+	TRACE("");
+
+	if (!zfs_config.write_behind)
+		RETURN_VOID;
+
+	zfsd_mutex_lock(&writebehind_mutex);
+	do
+	{
+		pending = false;
+		HTAB_FOR_EACH_SLOT(writebehind_htab, slot)
+		{
+			f = (writebehind_file) * slot;
+			if (f->flushing || f->len > 0)
+			{
+				pending = true;
+				break;
+			}
+		}
+
+		/* The table may change while we are waiting, search it again.  */
+		if (pending)
+		{
+			f->busy++;
+			writebehind_start_flush(f);
+			while (f->flushing)
+				zfsd_cond_wait(&f->cond, &writebehind_mutex);
+			f->busy--;
+			writebehind_file_release(f);
+		}
+	}
+	while (pending);
+	zfsd_mutex_unlock(&writebehind_mutex);
+	RETURN_VOID;
+}
+
+/*! Initialize data structures in WRITEBEHIND.C.  */
+
+void initialize_writebehind_c(void)
+{
+	zfsd_mutex_init(&writebehind_mutex);
+	writebehind_htab = htab_create(WRITEBEHIND_MAX_FILES, writebehind_file_hash,
+								   writebehind_file_eq, writebehind_file_del,
+								   &writebehind_mutex);
+}
+
+/*! Destroy data structures in WRITEBEHIND.C.  */
+
+void cleanup_writebehind_c(void)
+{
+	writebehind_file f;
+	void **slot;
+
+	/* The data have been written by writebehind_flush_all unless zfsd
+	   failed to start, the read-ahead threads and the connections are gone
+	   so they can not be written any more.  */
+	zfsd_mutex_lock(&writebehind_mutex);
+	HTAB_FOR_EACH_SLOT(writebehind_htab, slot)
+	{
+		f = (writebehind_file) * slot;
+
+		if (f->flushing || f->len > 0)
+			message(LOG_ERROR, FACILITY_DATA,
+					"Data written behind lost: %" PRIu32 " bytes of file [%"
+					PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32
+					"]\n", (f->flushing ? f->flush_len : 0) + f->len,
+					f->fh.sid, f->fh.vid, f->fh.dev, f->fh.ino, f->fh.gen);
+	}
+	htab_destroy(writebehind_htab);
+	zfsd_mutex_unlock(&writebehind_mutex);
+	zfsd_mutex_destroy(&writebehind_mutex);
+}
@@ -0,0 +1,44 @@
+/*! \file \brief Write-behind of files whose data are on remote node.  */
+
+/* Copyright (C) 2026 ZFS contributors
+
+   This file is part of ZFS.
+
+   ZFS is free software; you can redistribute it and/or modify it under the
+   terms of the GNU General Public License as published by the Free Software
+   Foundation; either version 2, or (at your option) any later version.
+
+   ZFS is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General Public License along
+   with ZFS; see the file COPYING.  If not, write to the Free Software
+   Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA; or
+   download it from http://www.gnu.org/licenses/gpl.html */
+
+#ifndef WRITEBEHIND_H
+#define WRITEBEHIND_H
+
+#include "system.h"
+#include <inttypes.h>
+#include "zfs-prot.h"
+
+/*! Maximal number of files with data written behind.  */
+#define WRITEBEHIND_MAX_FILES 32
+
+/*! Number of seconds the data may stay in the buffer before they are
+   written.  */
+#define WRITEBEHIND_DELAY 1
+
+extern int32_t writebehind_write(zfs_fh * fh, zfs_cap * cap, uint32_t vid,
+								 uint64_t offset, data_buffer * data,
+								 uint64_t * version);
+extern int32_t writebehind_flush(zfs_fh * fh, bool report);
+extern void writebehind_flush_expired(void);
+extern void writebehind_flush_all(void);
+extern void initialize_writebehind_c(void);
+extern void cleanup_writebehind_c(void);
+
+#endif
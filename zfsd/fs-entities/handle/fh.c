@@ -45,6 +45,7 @@
 #include "user-group.h"
 #include "dir.h"
 #include "update.h"
+#include "writebehind.h"
 #include "configuration.h"
 #include "version.h"
 #include "fs-iface.h"
@@ -62,6 +63,9 @@ static virtual_dir root;
 /*! Allocation pool for file handles.  */
 static alloc_pool fh_pool;
 
+/*! Allocation pool for metadata of file handles.  */
+static alloc_pool fh_meta_pool;
+
 /*! Allocation pool for dentries.  */
 static alloc_pool dentry_pool;
 
@@ -342,7 +346,8 @@ static void cleanup_unused_dentries(void)
 	while (n > 0);
 }
 
-/*! Main function of thread freeing file handles unused for a long time.  */
+/*! Main function of thread freeing file handles unused for a long time.  It
+   also starts writing the data written behind which wait for too long.  */
 
 static void *cleanup_dentry_thread_main(ATTRIBUTE_UNUSED void *data)
 {
@@ -359,6 +364,7 @@ static void *cleanup_dentry_thread_main(ATTRIBUTE_UNUSED void *data)
 			break;
 
 		cleanup_unused_dentries();
+		writebehind_flush_expired();
 	}
 
 	return NULL;
@@ -1244,10 +1250,35 @@ bool set_master_fh(volume vol, internal_fh fh, zfs_fh * master_fh)
 	if (INTERNAL_FH_HAS_LOCAL_PATH(fh))
 		RETURN_BOOL(set_metadata_master_fh(vol, fh, master_fh));
 
-	fh->meta.master_fh = *master_fh;
+	fh->meta->master_fh = *master_fh;
 	RETURN_BOOL(true);
 }
 
+#ifdef ENABLE_VERSIONS
+/*! Return versioning state of file handle FH, create it when FH does not
+   have one yet.  */
+
+internal_fh_version internal_fh_version_get(internal_fh fh)
+{
+	TRACE("");
+
+	if (!fh->version)
+	{
+		fh->version = (internal_fh_version) xmalloc(sizeof(*fh->version));
+		fh->version->fd = -1;
+		fh->version->path = NULL;
+		fh->version->file_truncated = false;
+		fh->version->marked_size = -1;
+		fh->version->versioned = NULL;
+		fh->version->interval_tree_users = 0;
+		fh->version->list = NULL;
+		fh->version->list_length = 0;
+	}
+
+	RETURN_PTR(fh->version);
+}
+#endif
+
 /*! Clear metadata in file handle FH.  */
 
 static void clear_meta(internal_fh fh)
@@ -1255,8 +1286,8 @@ static void clear_meta(internal_fh fh)
 	TRACE("");
 	CHECK_MUTEX_LOCKED(&fh->mutex);
 
-	memset(&fh->meta, 0, offsetof(metadata, master_fh));
-	zfs_fh_undefine(fh->meta.master_fh);
+	memset(fh->meta, 0, offsetof(metadata, master_fh));
+	zfs_fh_undefine(fh->meta->master_fh);
 	RETURN_VOID;
 }
 
@@ -1276,12 +1307,15 @@ internal_fh_create(zfs_fh * local_fh, zfs_fh * master_fh, fattr * attr,
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 
 	fh = (internal_fh) pool_alloc(fh_pool);
+	fh->meta = (metadata *) pool_alloc(fh_meta_pool);
 	fh->local_fh = *local_fh;
 	fh->attr = *attr;
 	fh->cap = NULL;
 	fh->ndentries = 0;
 	fh->updated = NULL;
 	fh->modified = NULL;
+	fh->next_read = 0;
+	fh->fetch_window = 0;
 	fh->interval_tree_users = 0;
 	fh->journal = NULL;
 	fh->level = level;
@@ -1294,14 +1328,7 @@ internal_fh_create(zfs_fh * local_fh, zfs_fh * master_fh, fattr * attr,
 	fh->reintegrating_sid = 0;
 	fh->reintegrating_generation = 0;
 #ifdef ENABLE_VERSIONS
-	fh->version_fd = -1;
-	fh->version_path = NULL;
-	fh->versioned = NULL;
-	UNMARK_FILE_TRUNCATED(fh);
-	fh->marked_size = -1;
-	fh->version_interval_tree_users = 0;
-	fh->version_list = NULL;
-	fh->version_list_length = 0;
+	fh->version = NULL;
 #endif
 
 	message(LOG_DEBUG, FACILITY_DATA, "FH %p CREATED, by %"PTRid"\n", (void *)fh,
@@ -1341,8 +1368,8 @@ internal_fh_create(zfs_fh * local_fh, zfs_fh * master_fh, fattr * attr,
 		if (meta->slot_status != VALID_SLOT)
 			zfsd_abort();
 #endif
-		fh->meta = *meta;
-		set_attr_version(&fh->attr, &fh->meta);
+		*fh->meta = *meta;
+		set_attr_version(&fh->attr, fh->meta);
 		attr->version = fh->attr.version;
 
 		if (fh->attr.type == FT_DIR)
@@ -1402,19 +1429,25 @@ static void internal_fh_destroy_stage1(internal_fh fh)
 	}
 
 #ifdef ENABLE_VERSIONS
-	if (fh->version_list)
+	if (fh->version)
 	{
-		unsigned int i;
-		for (i = 0; i < fh->version_list_length; i++)
-			CLEAR_VERSION_ITEM(fh->version_list[i]);
-		free(fh->version_list);
-	}
+		if (fh->version->list)
+		{
+			unsigned int i;
+			for (i = 0; i < fh->version->list_length; i++)
+				CLEAR_VERSION_ITEM(fh->version->list[i]);
+			free(fh->version->list);
+		}
+
+		if (fh->version->path)
+			free(fh->version->path);
 
-	if (fh->version_path)
-		free(fh->version_path);
+		if (fh->version->versioned)
+			interval_tree_destroy(fh->version->versioned);
 
-	if (fh->versioned)
-		interval_tree_destroy(fh->versioned);
+		free(fh->version);
+		fh->version = NULL;
+	}
 #endif
 
 	slot = htab_find_slot_with_hash(fh_htab, &fh->local_fh,
@@ -1442,6 +1475,7 @@ static void internal_fh_destroy_stage2(internal_fh fh)
 
 	zfsd_mutex_unlock(&fh->mutex);
 	zfsd_mutex_destroy(&fh->mutex);
+	pool_free(fh_meta_pool, fh->meta);
 	pool_free(fh_pool, fh);
 
 	RETURN_VOID;
@@ -1499,9 +1533,9 @@ void print_fh_htab(FILE * f)
 
 		fprintf(f, "[%u,%u,%u,%u,%u] ", fh->local_fh.sid, fh->local_fh.vid,
 				fh->local_fh.dev, fh->local_fh.ino, fh->local_fh.gen);
-		fprintf(f, "[%u,%u,%u,%u,%u] ", fh->meta.master_fh.sid,
-				fh->meta.master_fh.vid, fh->meta.master_fh.dev,
-				fh->meta.master_fh.ino, fh->meta.master_fh.gen);
+		fprintf(f, "[%u,%u,%u,%u,%u] ", fh->meta->master_fh.sid,
+				fh->meta->master_fh.vid, fh->meta->master_fh.dev,
+				fh->meta->master_fh.ino, fh->meta->master_fh.gen);
 		fprintf(f, "L%d ", fh->level);
 		fprintf(f, "\n");
 	}
@@ -1845,8 +1879,8 @@ get_dentry(zfs_fh * local_fh, zfs_fh * master_fh, volume vol,
 		CHECK_MUTEX_LOCKED(&dentry->fh->mutex);
 
 		if (!ZFS_FH_EQ(dentry->fh->local_fh, *local_fh)
-			|| (!ZFS_FH_EQ(dentry->fh->meta.master_fh, *master_fh)
-				&& !zfs_fh_undefined(dentry->fh->meta.master_fh)
+			|| (!ZFS_FH_EQ(dentry->fh->meta->master_fh, *master_fh)
+				&& !zfs_fh_undefined(dentry->fh->meta->master_fh)
 				&& !zfs_fh_undefined(*master_fh)))
 		{
 			unsigned int level;
@@ -1892,11 +1926,11 @@ get_dentry(zfs_fh * local_fh, zfs_fh * master_fh, volume vol,
 		}
 		else
 		{
-			if (zfs_fh_undefined(dentry->fh->meta.master_fh))
+			if (zfs_fh_undefined(dentry->fh->meta->master_fh))
 				set_master_fh(vol, dentry->fh, master_fh);
 
 			if (INTERNAL_FH_HAS_LOCAL_PATH(dentry->fh))
-				set_attr_version(attr, &dentry->fh->meta);
+				set_attr_version(attr, dentry->fh->meta);
 			dentry->fh->attr = *attr;
 		}
 	}
@@ -2579,7 +2613,7 @@ add_file_to_conflict_dir(volume vol, internal_dentry conflict, bool exists,
 	if (dentry)
 	{
 		if (INTERNAL_FH_HAS_LOCAL_PATH(dentry->fh))
-			set_attr_version(attr, &dentry->fh->meta);
+			set_attr_version(attr, dentry->fh->meta);
 		dentry->fh->attr = *attr;
 		release_dentry(dentry);
 		RETURN_PTR(dentry);
@@ -2764,13 +2798,13 @@ bool try_resolve_conflict(volume vol, internal_dentry conflict)
 				zfsd_abort();
 #endif
 
-			if (ZFS_FH_EQ(dentry->fh->meta.master_fh, dentry2->fh->local_fh)
-				&& !(dentry->fh->attr.version > dentry->fh->meta.master_version
+			if (ZFS_FH_EQ(dentry->fh->meta->master_fh, dentry2->fh->local_fh)
+				&& !(dentry->fh->attr.version > dentry->fh->meta->master_version
 					 && (dentry2->fh->attr.version
-						 > dentry->fh->meta.master_version))
-				&& !(METADATA_ATTR_CHANGE_P(dentry->fh->meta,
+						 > dentry->fh->meta->master_version))
+				&& !(METADATA_ATTR_CHANGE_P(*dentry->fh->meta,
 											dentry->fh->attr)
-					 && METADATA_ATTR_CHANGE_P(dentry->fh->meta,
+					 && METADATA_ATTR_CHANGE_P(*dentry->fh->meta,
 											   dentry2->fh->attr)))
 			{
 				release_dentry(dentry2);
@@ -3402,6 +3436,8 @@ void initialize_fh_c(void)
 	pthread_key_create(&lock_info_key, NULL);
 	fh_pool = create_alloc_pool("fh_pool", sizeof(struct internal_fh_def),
 								1023, &fh_mutex);
+	fh_meta_pool = create_alloc_pool("fh_meta_pool", sizeof(metadata),
+									 1023, &fh_mutex);
 	dentry_pool = create_alloc_pool("dentry_pool",
 									sizeof(struct internal_dentry_def),
 									1023, &fh_mutex);
@@ -3447,6 +3483,10 @@ void cleanup_fh_c(void)
 		message(LOG_WARNING, FACILITY_MEMORY,
 				"Memory leak (%u elements) in fh_pool.\n",
 				fh_pool->elts_allocated - fh_pool->elts_free);
+	if (fh_meta_pool->elts_free < fh_meta_pool->elts_allocated)
+		message(LOG_WARNING, FACILITY_MEMORY,
+				"Memory leak (%u elements) in fh_meta_pool.\n",
+				fh_meta_pool->elts_allocated - fh_meta_pool->elts_free);
 	if (dentry_pool->elts_free < dentry_pool->elts_allocated)
 		message(LOG_WARNING, FACILITY_MEMORY,
 				"Memory leak (%u elements) in dentry_pool.\n",
@@ -3462,6 +3502,7 @@ void cleanup_fh_c(void)
 	htab_destroy(vd_htab_name);
 	htab_destroy(vd_htab);
 	free_alloc_pool(fh_pool);
+	free_alloc_pool(fh_meta_pool);
 	free_alloc_pool(dentry_pool);
 	free_alloc_pool(vd_pool);
 	zfsd_mutex_unlock(&fh_mutex);
@@ -126,7 +126,11 @@ typedef struct volume_def *volume;
 #ifdef ENABLE_VERSIONS
 /*! True if file handle FH has version file open.  */
 #define INTERNAL_FH_VERSION_OPEN(FH)          \
-  ((FH)->version_fd > 0)
+  ((FH)->version != NULL && (FH)->version->fd > 0)
+
+/*! Path of version file of file handle FH or NULL if it has none.  */
+#define INTERNAL_FH_VERSION_PATH(FH)          \
+  ((FH)->version != NULL ? (FH)->version->path : NULL)
 #endif
 
 /*! "Lock" level of the file handle or virtual directory.  */
@@ -166,47 +170,55 @@ extern "C"
 {
 #endif
 
-/*! \brief Internal information about file handle.  */
-struct internal_fh_def
+#ifdef ENABLE_VERSIONS
+/*! \brief Versioning state of internal file handle.
+   Only files which are being versioned need it so it is kept out of line
+   and allocated on demand by internal_fh_version_get.  */
+typedef struct internal_fh_version_def
 {
-#ifdef ENABLE_CHECKING
-	long unused0;
-	long unused1;
-#endif
-	// NOTE: why uses pthread_mutex, when have zfs_mutex?
-	pthread_mutex_t mutex;
-	pthread_cond_t cond;
-
-	/*! File handle for client, key for hash table.  */
-	zfs_fh local_fh;
+	/*! Version file description. Set to -1 if version file is not open.  */
+	int fd;
 
-	/*! Number of directory entries associated with this file handle.  */
-	unsigned int ndentries;
+	/*! Complete path of version file. Valid only when version file is open. */
+	char *path;
 
-	/*! File attributes.  */
-	fattr attr;
+	/*! File attributes before modification occurred.  */
+	fattr orig_attr;
 
-	/*! Metadata.  */
-	metadata meta;
+	/*! File was truncated before opening.  */
+	bool file_truncated;
 
-	/*! Contained directory entries (of type 'struct internal_dentry_def *'). 
-	 */
-	varray subdentries;
+	/* File size when the file was opened.  */
+	uint64_t marked_size;
 
-	/*! Chain of capabilities associated with this file handle.  */
-	internal_cap cap;
+	/*! Version file content intervals.  */
+	interval_tree versioned;
 
-	/*! Updated intervals.  */
-	interval_tree updated;
+	/*! Number of users of version interval tree.  */
+	unsigned int interval_tree_users;
 
-	/*! Modified intervals.  */
-	interval_tree modified;
+	/* List of intervals for open version file.  */
+	version_item *list;
+	unsigned int list_length;
+} *internal_fh_version;
+#endif
 
-	/*! Journal for a directory.  */
-	journal_t journal;
+/*! \brief Internal information about file handle.
+   Fields used by hash table lookups, locking and attribute checks are kept
+   together at the start of the structure so that a lookup touches as few
+   cache lines as possible.  Rarely used data follow them, the bulky
+   metadata are allocated out of line.  */
+struct internal_fh_def
+{
+#ifdef ENABLE_CHECKING
+	long unused0;
+	long unused1;
+#endif
+	/*! File handle for client, key for hash table.  */
+	zfs_fh local_fh;
 
-	/*! Number of users of interval trees.  */
-	unsigned int interval_tree_users;
+	/*! Flags, see IFH_* below.  */
+	unsigned int flags;
 
 	/*! "Lock" level of the file handle.  */
 	unsigned int level;
@@ -214,6 +226,9 @@ struct internal_fh_def
 	/*! Number of current users of the file handle.  */
 	unsigned int users;
 
+	/*! Number of directory entries associated with this file handle.  */
+	unsigned int ndentries;
+
 	/*! Lock ID which will be assigned next.  */
 	unsigned int id2assign;
 
@@ -226,8 +241,15 @@ struct internal_fh_def
 	/*! Generation of open file descriptor.  */
 	unsigned int generation;
 
-	/*! Flags, see IFH_* below.  */
-	unsigned int flags;
+	/*! Chain of capabilities associated with this file handle.  */
+	internal_cap cap;
+
+	/*! File attributes.  */
+	fattr attr;
+
+	// NOTE: why uses pthread_mutex, when have zfs_mutex?
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
 
 	/*! Node which is reintegrating this file.  */
 	uint32_t reintegrating_sid;
@@ -235,31 +257,35 @@ struct internal_fh_def
 	/*! Generation of socket to node which is reintegrating this file.  */
 	unsigned int reintegrating_generation;
 
-#ifdef ENABLE_VERSIONS
-	/*! Version file description. Set to -1 if version file is not open.  */
-	int version_fd;
+	/*! Number of users of interval trees.  */
+	unsigned int interval_tree_users;
 
-	/*! Complete path of version file. Valid only when version file is open. */
-	char *version_path;
+	/*! Updated intervals.  */
+	interval_tree updated;
 
-	/*! File attributes before modification occurred.  */
-	fattr version_orig_attr;
+	/*! Modified intervals.  */
+	interval_tree modified;
 
-	/*! File was truncated before opening.  */
-	bool file_truncated;
+	/*! Offset following the last local read of a file being updated.  */
+	uint64_t next_read;
 
-	/* File size when the file was opened.  */
-	uint64_t marked_size;
+	/*! Length of the data fetched ahead of a sequential read of a file
+	   being updated, 0 if the reads are not sequential.  */
+	uint32_t fetch_window;
 
-	/*! Version file content intervals.  */
-	interval_tree versioned;
+	/*! Journal for a directory.  */
+	journal_t journal;
 
-	/*! Number of users of version interval tree.  */
-	unsigned int version_interval_tree_users;
+	/*! Contained directory entries (of type 'struct internal_dentry_def *'). 
+	 */
+	varray subdentries;
 
-	/* List of intervals for open version file.  */
-	version_item *version_list;
-	unsigned int version_list_length;
+	/*! Metadata, allocated with the file handle from FH_META_POOL.  */
+	metadata *meta;
+
+#ifdef ENABLE_VERSIONS
+	/*! Versioning state, NULL until the file is versioned.  */
+	internal_fh_version version;
 #endif
 };
 
@@ -440,6 +466,9 @@ extern int32_t internal_dentry_lock2(unsigned int level1, unsigned int level2,
 									 internal_dentry * dentry2p,
 									 zfs_fh * tmp_fh1, zfs_fh * tmp_fh2);
 extern bool set_master_fh(volume vol, internal_fh fh, zfs_fh * master_fh);
+#ifdef ENABLE_VERSIONS
+extern internal_fh_version internal_fh_version_get(internal_fh fh);
+#endif
 bool internal_fh_should_wait_for_locked(const internal_fh fh, int new_level);
 void for_each_internal_fh(void(*visit)(const internal_fh, void *), void * data);
 extern void print_fh_htab(FILE * f);
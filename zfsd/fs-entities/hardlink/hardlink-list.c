@@ -263,7 +263,7 @@ unsigned int hardlink_list_length(hardlink_list hl)
 {
 	CHECK_MUTEX_LOCKED(hl->mutex);
 
-	return hl->htab->n_elements - hl->htab->n_deleted;
+	return HTAB_N_ELEMENTS(hl->htab);
 }
 
 /*! Print the hardlink list HL to file F.  */
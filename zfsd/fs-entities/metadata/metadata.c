@@ -971,7 +971,7 @@ delete_useless_interval_file(volume vol, internal_fh fh, metadata_type type,
 			&& INTERVAL_END(tree->splay->root) == fh->attr.size)
 		{
 			if (!set_metadata_flags(vol, fh,
-									fh->meta.flags & ~METADATA_UPDATED_TREE))
+									fh->meta->flags & ~METADATA_UPDATED_TREE))
 				MARK_VOLUME_DELETE(vol);
 
 			if (!remove_file_and_path(path, get_metadata_tree_depth()))
@@ -982,7 +982,7 @@ delete_useless_interval_file(volume vol, internal_fh fh, metadata_type type,
 		else
 		{
 			if (!set_metadata_flags(vol, fh,
-									fh->meta.flags | METADATA_UPDATED_TREE))
+									fh->meta->flags | METADATA_UPDATED_TREE))
 				MARK_VOLUME_DELETE(vol);
 		}
 		break;
@@ -991,7 +991,7 @@ delete_useless_interval_file(volume vol, internal_fh fh, metadata_type type,
 		if (tree->size == 0)
 		{
 			if (!set_metadata_flags(vol, fh,
-									fh->meta.flags & ~METADATA_MODIFIED_TREE))
+									fh->meta->flags & ~METADATA_MODIFIED_TREE))
 				MARK_VOLUME_DELETE(vol);
 
 			if (!remove_file_and_path(path, get_metadata_tree_depth()))
@@ -1002,7 +1002,7 @@ delete_useless_interval_file(volume vol, internal_fh fh, metadata_type type,
 		else
 		{
 			if (!set_metadata_flags(vol, fh,
-									fh->meta.flags | METADATA_MODIFIED_TREE))
+									fh->meta->flags | METADATA_MODIFIED_TREE))
 				MARK_VOLUME_DELETE(vol);
 		}
 		break;
@@ -1176,6 +1176,8 @@ bool init_volume_metadata(volume vol)
 								 offsetof(metadata, parent_dev), 32,
 								 metadata_hash, metadata_eq, metadata_decode,
 								 metadata_encode, path.str, &vol->mutex);
+	hfile_set_io(vol->metadata, zfs_config.metadata.hashfile_mmap,
+				 zfs_config.metadata.hashfile_sync);
 	insert_volume_root = (lstat(vol->local_path.str, &st) < 0);
 
 	if (!create_path_for_file(&path, S_IRWXU, NULL))
@@ -1257,6 +1259,8 @@ bool init_volume_metadata(volume vol)
 								   32, fh_mapping_hash,
 								   fh_mapping_eq, fh_mapping_decode,
 								   fh_mapping_encode, path.str, &vol->mutex);
+	hfile_set_io(vol->fh_mapping, zfs_config.metadata.hashfile_mmap,
+				 zfs_config.metadata.hashfile_sync);
 	free(path.str);
 
 	fd = open_hash_file(vol, METADATA_TYPE_FH_MAPPING);
@@ -1419,7 +1423,7 @@ static bool init_interval_tree(volume vol, internal_fh fh, metadata_type type)
 	switch (type)
 	{
 	case METADATA_TYPE_UPDATED:
-		if (!(fh->meta.flags & METADATA_UPDATED_TREE))
+		if (!(fh->meta->flags & METADATA_UPDATED_TREE))
 		{
 			fh->updated = interval_tree_create(62, &fh->mutex);
 			interval_tree_insert(fh->updated, 0, fh->attr.size);
@@ -1429,7 +1433,7 @@ static bool init_interval_tree(volume vol, internal_fh fh, metadata_type type)
 		break;
 
 	case METADATA_TYPE_MODIFIED:
-		if (!(fh->meta.flags & METADATA_MODIFIED_TREE))
+		if (!(fh->meta->flags & METADATA_MODIFIED_TREE))
 		{
 			fh->modified = interval_tree_create(62, &fh->mutex);
 			RETURN_BOOL(true);
@@ -1965,35 +1969,35 @@ set_metadata(volume vol, internal_fh fh, uint32_t flags,
 	CHECK_MUTEX_LOCKED(&fh->mutex);
 
 	modified = false;
-	if (fh->meta.flags != flags)
+	if (fh->meta->flags != flags)
 	{
-		fh->meta.flags = flags;
+		fh->meta->flags = flags;
 		modified = true;
 	}
-	if (fh->meta.local_version != local_version)
+	if (fh->meta->local_version != local_version)
 	{
-		fh->meta.local_version = local_version;
+		fh->meta->local_version = local_version;
 		modified = true;
 	}
 	if (vol->is_copy)
 	{
-		if (fh->meta.master_version != master_version)
+		if (fh->meta->master_version != master_version)
 		{
-			fh->meta.master_version = master_version;
+			fh->meta->master_version = master_version;
 			modified = true;
 		}
 	}
 	else
 	{
-		fh->meta.master_version = local_version;
+		fh->meta->master_version = local_version;
 	}
 
 	if (!modified)
 		RETURN_BOOL(true);
 
-	set_attr_version(&fh->attr, &fh->meta);
+	set_attr_version(&fh->attr, fh->meta);
 
-	RETURN_BOOL(flush_metadata(vol, &fh->meta));
+	RETURN_BOOL(flush_metadata(vol, fh->meta));
 }
 
 /*! Set metadata flags FLAGS for file handle FH on volume VOL. Return false
@@ -2005,12 +2009,12 @@ bool set_metadata_flags(volume vol, internal_fh fh, uint32_t flags)
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 	CHECK_MUTEX_LOCKED(&fh->mutex);
 
-	if (fh->meta.flags == flags)
+	if (fh->meta->flags == flags)
 		RETURN_BOOL(true);
 
-	fh->meta.flags = flags;
+	fh->meta->flags = flags;
 
-	RETURN_BOOL(flush_metadata(vol, &fh->meta));
+	RETURN_BOOL(flush_metadata(vol, fh->meta));
 }
 
 /*! Set master_fh to MASTER_FH in metadata for file handle FH on volume VOL
@@ -2024,7 +2028,7 @@ bool set_metadata_master_fh(volume vol, internal_fh fh, zfs_fh * master_fh)
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 	CHECK_MUTEX_LOCKED(&fh->mutex);
 
-	if (ZFS_FH_EQ(fh->meta.master_fh, *master_fh))
+	if (ZFS_FH_EQ(fh->meta->master_fh, *master_fh))
 		RETURN_BOOL(true);
 
 	if (!hashfile_opened_p(vol->fh_mapping))
@@ -2036,8 +2040,8 @@ bool set_metadata_master_fh(volume vol, internal_fh fh, zfs_fh * master_fh)
 			RETURN_BOOL(false);
 	}
 
-	if (fh->meta.master_fh.dev == master_fh->dev
-		&& fh->meta.master_fh.ino == master_fh->ino)
+	if (fh->meta->master_fh.dev == master_fh->dev
+		&& fh->meta->master_fh.ino == master_fh->ino)
 	{
 		map.slot_status = VALID_SLOT;
 		map.master_fh = *master_fh;
@@ -2051,8 +2055,8 @@ bool set_metadata_master_fh(volume vol, internal_fh fh, zfs_fh * master_fh)
 	else
 	{
 		/* Delete original reverse file handle mapping.  */
-		map.master_fh.dev = fh->meta.master_fh.dev;
-		map.master_fh.ino = fh->meta.master_fh.ino;
+		map.master_fh.dev = fh->meta->master_fh.dev;
+		map.master_fh.ino = fh->meta->master_fh.ino;
 		if (!hfile_delete(vol->fh_mapping, &map))
 		{
 			zfsd_mutex_unlock(&metadata_fd_data[vol->fh_mapping->fd].mutex);
@@ -2075,8 +2079,8 @@ bool set_metadata_master_fh(volume vol, internal_fh fh, zfs_fh * master_fh)
 	}
 	zfsd_mutex_unlock(&metadata_fd_data[vol->fh_mapping->fd].mutex);
 
-	fh->meta.master_fh = *master_fh;
-	RETURN_BOOL(flush_metadata(vol, &fh->meta));
+	fh->meta->master_fh = *master_fh;
+	RETURN_BOOL(flush_metadata(vol, fh->meta));
 }
 
 /*! Increase the local version for file FH on volume VOL. Return false on
@@ -2088,12 +2092,12 @@ bool inc_local_version(volume vol, internal_fh fh)
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 	CHECK_MUTEX_LOCKED(&fh->mutex);
 
-	fh->meta.local_version++;
+	fh->meta->local_version++;
 	if (!vol->is_copy)
-		fh->meta.master_version = fh->meta.local_version;
-	set_attr_version(&fh->attr, &fh->meta);
+		fh->meta->master_version = fh->meta->local_version;
+	set_attr_version(&fh->attr, fh->meta);
 
-	RETURN_BOOL(flush_metadata(vol, &fh->meta));
+	RETURN_BOOL(flush_metadata(vol, fh->meta));
 }
 
 /*! Increase the local version for file FH on volume VOL and set MODIFIED
@@ -2105,13 +2109,13 @@ bool inc_local_version_and_modified(volume vol, internal_fh fh)
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 	CHECK_MUTEX_LOCKED(&fh->mutex);
 
-	fh->meta.local_version++;
+	fh->meta->local_version++;
 	if (!vol->is_copy)
-		fh->meta.master_version = fh->meta.local_version;
-	fh->meta.flags |= METADATA_MODIFIED_TREE;
-	set_attr_version(&fh->attr, &fh->meta);
+		fh->meta->master_version = fh->meta->local_version;
+	fh->meta->flags |= METADATA_MODIFIED_TREE;
+	set_attr_version(&fh->attr, fh->meta);
 
-	RETURN_BOOL(flush_metadata(vol, &fh->meta));
+	RETURN_BOOL(flush_metadata(vol, fh->meta));
 }
 
 /*! Delete all metadata files for file on volume VOL with device DEV and
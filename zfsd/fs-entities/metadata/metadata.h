@@ -116,6 +116,16 @@ typedef struct fh_mapping_def
 									   seems) */
 #define METADATA_SHADOW		16	/*!< file is in shadow */
 #define METADATA_SHADOW_TREE	32	/*!< dir is a part of shadow tree */
+#define METADATA_BLOCK_SHIFT_MASK	0xff000000	/*!< log2 of the block size
+												   of a regular file, 0 if
+												   it has not been chosen */
+#define METADATA_BLOCK_SHIFT_FIRST_BIT	24	/*!< the lowest bit of
+											   METADATA_BLOCK_SHIFT_MASK */
+
+/*! log2 of the block size of a regular file with flags FLAGS, 0 if it has
+   not been chosen.  */
+#define METADATA_BLOCK_SHIFT(FLAGS)					\
+  (((FLAGS) & METADATA_BLOCK_SHIFT_MASK) >> METADATA_BLOCK_SHIFT_FIRST_BIT)
 
 #include "volume.h"
 #include "fh.h"
@@ -156,6 +156,8 @@ node node_create(uint32_t id, string * name, string * host_name, uint16_t tcp_po
 	nod->fd = -1;
 	nod->generation = 0;
 	nod->marked = false;
+	token_bucket_init(&nod->update_bucket, 0, 0);
+	token_bucket_init(&nod->reintegrate_bucket, 0, 0);
 	nod->map_uid_to_node = NULL;
 	nod->map_uid_to_zfs = NULL;
 	nod->map_gid_to_node = NULL;
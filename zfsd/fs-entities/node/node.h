@@ -26,6 +26,7 @@
 #include "memory.h"
 #include "pthread-wrapper.h"
 #include "hashtab.h"
+#include "token-bucket.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -49,6 +50,11 @@ typedef struct node_def
 	int fd;						/*!< file descriptor */
 	unsigned int generation;	/*!< generation of open file descriptor */
 	bool marked;				/*!< Is the node marked? */
+	token_bucket update_bucket;	/*!< limit of the background updates from
+								   the node, protected by bandwidth_mutex */
+	token_bucket reintegrate_bucket;	/*!< limit of the reintegrations to
+										   the node, protected by
+										   bandwidth_mutex */
 
 	/* Tables for mapping between ZFS IDs and node IDs.  */
 	htab_t map_uid_to_node;
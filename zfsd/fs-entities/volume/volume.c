@@ -164,6 +164,13 @@ volume volume_create(uint32_t id)
 	vol->n_locked_fhs = 0;
 	vol->local_path = invalid_string;
 	vol->size_limit = VOLUME_NO_LIMIT;
+	vol->attr_timeout = VOLUME_CACHE_TIMEOUT;
+	vol->entry_timeout = VOLUME_CACHE_TIMEOUT;
+	varray_create(&vol->hoard, sizeof(string), 2);
+	vol->update_rate = 0;
+	vol->reintegrate_rate = 0;
+	token_bucket_init(&vol->update_bucket, 0, 0);
+	token_bucket_init(&vol->reintegrate_bucket, 0, 0);
 	vol->last_conflict_ino = 0;
 	vol->root_dentry = NULL;
 	vol->root_vd = NULL;
@@ -191,6 +198,17 @@ volume volume_create(uint32_t id)
 	return vol;
 }
 
+/*! Free the paths of the hoarded directory trees of volume VOL.  */
+
+static void volume_free_hoard(volume vol)
+{
+	unsigned int i;
+
+	for (i = 0; i < VARRAY_USED(vol->hoard); i++)
+		xfreestring(&VARRAY_ACCESS(vol->hoard, i, string));
+	VARRAY_CLEAR(vol->hoard);
+}
+
 /*! Destroy volume VOL and free memory associated with it. This function
    expects volume_mutex to be locked.  */
 
@@ -244,6 +262,8 @@ static void volume_destroy(volume vol)
 	zfsd_mutex_unlock(&vol->mutex);
 	zfsd_mutex_destroy(&vol->mutex);
 
+	volume_free_hoard(vol);
+	varray_destroy(&vol->hoard);
 	if (vol->local_path.str)
 		free(vol->local_path.str);
 	if (vol->mountpoint.str)
@@ -253,6 +273,24 @@ static void volume_destroy(volume vol)
 	free(vol);
 }
 
+/*! Set the paths of the directory trees of volume VOL which are hoarded
+   for offline use to N paths PATHS.  */
+
+void volume_set_hoard(volume vol, const char **paths, unsigned int n)
+{
+	string path;
+	unsigned int i;
+
+	CHECK_MUTEX_LOCKED(&vol->mutex);
+
+	volume_free_hoard(vol);
+	for (i = 0; i < n; i++)
+	{
+		xmkstring(&path, paths[i]);
+		VARRAY_PUSH(vol->hoard, path, string);
+	}
+}
+
 /*! Destroy volume VOL and free memory associated with it. Destroy dentries
    while volume_mutex is unlocked. This function expects fh_mutex to be
    locked.  */
@@ -475,6 +513,37 @@ void mark_all_volumes(void)
 	zfsd_mutex_unlock(&volume_mutex);
 }
 
+/*! Store the copies of the paths of the hoarded directory trees of the
+   volumes which are cached on this node to PATHS (of type
+   volume_hoard_path).  */
+
+void volume_get_hoard(varray * paths)
+{
+	volume_hoard_path item;
+	unsigned int i;
+	void **slot;
+
+	zfsd_mutex_lock(&volume_mutex);
+	HTAB_FOR_EACH_SLOT(volume_htab, slot)
+	{
+		volume vol = (volume) * slot;
+
+		zfsd_mutex_lock(&vol->mutex);
+		if (!vol->delete_p && vol->local_path.str
+			&& vol->master != NULL && vol->master != this_node)
+		{
+			for (i = 0; i < VARRAY_USED(vol->hoard); i++)
+			{
+				item.vid = vol->id;
+				xstringdup(&item.path, &VARRAY_ACCESS(vol->hoard, i, string));
+				VARRAY_PUSH(*paths, item, volume_hoard_path);
+			}
+		}
+		zfsd_mutex_unlock(&vol->mutex);
+	}
+	zfsd_mutex_unlock(&volume_mutex);
+}
+
 /*! Delete all dentries of marked volume and clear local path. \param vol
    Volume on which the dentries will be deleted.  */
 
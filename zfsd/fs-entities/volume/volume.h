@@ -26,6 +26,8 @@
 #include "pthread-wrapper.h"
 #include "hashtab.h"
 #include "hashfile.h"
+#include "varray.h"
+#include "token-bucket.h"
 #include "fh.h"
 #include "node.h"
 
@@ -60,6 +62,21 @@ struct volume_def
 
 	string local_path;			/*!< directory with local copy of volume */
 	uint64_t size_limit;		/*!< size limit of a copy of the volume */
+	uint32_t attr_timeout;		/*!< seconds the kernel may cache attributes
+								   of files on the volume */
+	uint32_t entry_timeout;		/*!< seconds the kernel may cache directory
+								   entries on the volume */
+	varray hoard;				/*!< paths of the directory trees of the
+								   volume hoarded for offline use (of type
+								   string) */
+	uint32_t update_rate;		/*!< bytes per second of the background
+								   updates of the volume, 0 for no limit */
+	uint32_t reintegrate_rate;	/*!< bytes per second of the reintegrations
+								   of the volume, 0 for no limit */
+	token_bucket update_bucket;	/*!< limit of the background updates,
+								   protected by bandwidth_mutex */
+	token_bucket reintegrate_bucket;	/*!< limit of the reintegrations,
+										   protected by bandwidth_mutex */
 
 	uint32_t last_conflict_ino;	/*!< the inode number of conflict dir
 								   assigned for the last time */
@@ -70,6 +87,13 @@ struct volume_def
 								   mapping */
 };
 
+/*! \brief Directory tree of a volume hoarded for offline use.  */
+typedef struct volume_hoard_path_def
+{
+	uint32_t vid;				/*!< ID of the volume */
+	string path;				/*!< path of the tree on the volume */
+} volume_hoard_path;
+
 /*! Predefined volume IDs.  */
 #define VOLUME_ID_VIRTUAL 0		/*!< ID of the non-existing 'root' volume */
 #define VOLUME_ID_CONFIG  1		/*!< ID of 'config' volume */
@@ -77,6 +101,10 @@ struct volume_def
 /*! Value of size limit indicating that the volume is not limited.  */
 #define VOLUME_NO_LIMIT 0
 
+/*! Default number of seconds the kernel may cache attributes and directory
+   entries of files on a volume.  */
+#define VOLUME_CACHE_TIMEOUT 5
+
 /*! Mutex for table of volumes.  */
 extern pthread_mutex_t volume_mutex;
 
@@ -97,6 +125,8 @@ extern bool volume_set_local_info(volume * volp, string * local_path,
 								  uint64_t size_limit);
 extern bool volume_set_local_info_wrapper(volume * volp, char *local_path,
 										  uint64_t size_limit);
+extern void volume_set_hoard(volume vol, const char **paths, unsigned int n);
+extern void volume_get_hoard(varray * paths);
 extern void mark_all_volumes(void);
 extern void delete_dentries_of_marked_volumes(void);
 extern void destroy_marked_volume(uint32_t vid);
@@ -32,11 +32,13 @@
 #include <signal.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include "pthread-wrapper.h"
 #include "constant.h"
 #include "semaphore.h"
 #include "hashtab.h"
-#include "alloc-pool.h"
 #include "data-coding.h"
 #include "dir.h"
 #include "file.h"
@@ -49,11 +51,15 @@
 #include "memory.h"
 #include "thread.h"
 #include "user-group.h"
+#include "volume.h"
 #include "zfs-prot.h"
 #include "configuration.h"
 
-/* In seconds before a revalidation is required */
-#define CACHE_VALIDITY 5
+/*! Size of the buffer for requests of a kernel thread.  libfuse reserves 4 KiB
+   of it for the headers, the rest limits the size of writes.  It is not
+   larger than the default maximal size of a pipe so libfuse can splice the
+   requests.  */
+#define KERNEL_BUF_SIZE (1024 * 1024)
 
 /*! Arguments from main (), after parsing the zfsd-specific options */
 struct fuse_args main_args;
@@ -64,6 +70,9 @@ thread_pool kernel_pool;
 /*! Is ZFS mounted? */
 bool mounted = false;
 
+/*! Are the threads of kernel_pool running?  */
+static bool kernel_pool_running = false;
+
 /*! FUSE kernel communication channel */
 static struct fuse_chan *fuse_ch;
 /*! FUSE mount session */
@@ -71,23 +80,50 @@ static struct fuse_session *fuse_se;
 
 /* Inode <-> file handle mapping */
 
+/* The mapping is split to shards so that requests for different files do not
+   contend for one mutex.  The shard of a file handle is given by its hash,
+   the low bits of inode numbers of files in a shard are the index of the
+   shard.  The root has the fixed inode number FUSE_ROOT_ID and it is not
+   stored in the shards.  */
+#define INODE_MAP_SHARD_BITS 6
+#define INODE_MAP_SHARDS (1 << INODE_MAP_SHARD_BITS)
+#define INODE_MAP_SHARD_MASK (INODE_MAP_SHARDS - 1)
+
 struct inode_map
 {
 	fuse_ino_t ino;
 	zfs_fh fh;
+	/* Number of lookups of the inode the kernel has not forgotten yet.  */
+	uint64_t nlookup;
+	/* Version of the file when it was opened for the last time, the data in
+	   kernel page cache are not older than this version.  */
+	uint64_t cached_version;
+	/* Is CACHED_VERSION valid?  */
+	bool cached;
+	/* Seconds the kernel may cache the attributes and the directory entry
+	   of the inode.  They are taken from the volume when the inode is
+	   created so that replies do not lock the volumes.  */
+	uint32_t attr_timeout;
+	uint32_t entry_timeout;
 };
 
-static fuse_ino_t next_ino;
-
-static htab_t inode_map_ino, inode_map_fh;
-static pthread_mutex_t inode_map_mutex;
+/* One shard of the inode map.  */
+struct inode_map_shard
+{
+	pthread_mutex_t mutex;
+	htab_t ino_htab;			/* inode number -> struct inode_map */
+	htab_t fh_htab;				/* file handle -> struct inode_map */
+	fuse_ino_t next_seq;		/* number of the next inode in the shard */
+};
 
-static void fuse_kernel_invalidate_data(struct fuse_chan *ch, fuse_ino_t ino)
+/* Shard of the inode map padded to 128 bytes to avoid cache ping pong.  */
+typedef union padded_inode_map_shard_def
 {
-	message(LOG_INFO, FACILITY_ZFSD, "fuse_kernel_invalidate_data: ino = %d\n",
-			ino);
-	fuse_lowlevel_notify_inval_inode(ch, ino, 0, 0);
-}
+	struct inode_map_shard s;
+	char padding[((sizeof(struct inode_map_shard) + 127) / 128) * 128];
+} padded_inode_map_shard;
+
+static padded_inode_map_shard inode_map_shards[INODE_MAP_SHARDS];
 
 static void fuse_kernel_invalidate_inode(struct fuse_chan *ch, fuse_ino_t ino)
 {
@@ -138,86 +174,317 @@ static int inode_map_fh_eq(const void *x, const void *y)
 	return ZFS_FH_EQ(((const struct inode_map *)x)->fh, *(const zfs_fh *)y);
 }
 
+/* Return the shard containing inode INO.  */
+static inline struct inode_map_shard *inode_map_shard_ino(fuse_ino_t ino)
+{
+	return &inode_map_shards[ino & INODE_MAP_SHARD_MASK].s;
+}
+
+/* Return the shard containing file handle with hash HASH.  */
+static inline struct inode_map_shard *inode_map_shard_fh(hash_t hash)
+{
+	return &inode_map_shards[hash & INODE_MAP_SHARD_MASK].s;
+}
+
 /* Return 0 if not found */
 static fuse_ino_t fh_get_inode(const zfs_fh * fh)
 {
+	struct inode_map_shard *shard;
 	struct inode_map *map;
+	fuse_ino_t ino;
+	hash_t hash;
+
+	if (ZFS_FH_EQ(*fh, root_fh))
+		return FUSE_ROOT_ID;
+
+	hash = ZFS_FH_HASH(fh);
+	shard = inode_map_shard_fh(hash);
+	zfsd_mutex_lock(&shard->mutex);
+	map = htab_find_with_hash(shard->fh_htab, fh, hash);
+	ino = (map != NULL) ? map->ino : 0;
+	zfsd_mutex_unlock(&shard->mutex);
+	return ino;
+}
 
-	zfsd_mutex_lock(&inode_map_mutex);
-	map = htab_find_with_hash(inode_map_fh, fh, ZFS_FH_HASH(fh));
-	zfsd_mutex_unlock(&inode_map_mutex);
-	if (map != NULL)
-		return map->ino;
-	else
-		return 0;
+/* Get the number of seconds the kernel may cache attributes (ATTR_TIMEOUT)
+   and directory entries (ENTRY_TIMEOUT) of files on volume VID.  */
+static void volume_cache_timeouts(uint32_t vid, uint32_t *attr_timeout,
+								  uint32_t *entry_timeout)
+{
+	volume vol;
+
+	*attr_timeout = VOLUME_CACHE_TIMEOUT;
+	*entry_timeout = VOLUME_CACHE_TIMEOUT;
+	vol = volume_lookup(vid);
+	if (vol != NULL)
+	{
+		*attr_timeout = vol->attr_timeout;
+		*entry_timeout = vol->entry_timeout;
+		zfsd_mutex_unlock(&vol->mutex);
+	}
 }
 
-/* FIXME? This means that (find zfs_root) will permanently pin a lot of
-   memory... */
-static fuse_ino_t fh_to_inode(const zfs_fh * fh)
+/* Return the inode number of FH, allocate a new one if FH has none.  If
+   LOOKUP is true the inode is being passed to the kernel which will forget
+   it later.  Inodes which are never passed to the kernel this way are kept
+   forever.  If ATTR_TIMEOUT and ENTRY_TIMEOUT are not NULL store the cache
+   timeouts of the inode to them.  */
+static fuse_ino_t fh_to_inode(const zfs_fh * fh, bool lookup,
+							  double *attr_timeout, double *entry_timeout)
 {
-	void **slot;
+	struct inode_map_shard *shard;
 	struct inode_map *map;
+	uint32_t new_attr_timeout, new_entry_timeout;
+	fuse_ino_t ino;
+	hash_t hash;
+	void **slot;
+
+	if (ZFS_FH_EQ(*fh, root_fh))
+	{
+		if (attr_timeout != NULL)
+		{
+			*attr_timeout = VOLUME_CACHE_TIMEOUT;
+			*entry_timeout = VOLUME_CACHE_TIMEOUT;
+		}
+		return FUSE_ROOT_ID;
+	}
 
-	zfsd_mutex_lock(&inode_map_mutex);
-	slot = htab_find_slot_with_hash(inode_map_fh, fh, ZFS_FH_HASH(fh), INSERT);
+	hash = ZFS_FH_HASH(fh);
+	shard = inode_map_shard_fh(hash);
+	zfsd_mutex_lock(&shard->mutex);
+	map = htab_find_with_hash(shard->fh_htab, fh, hash);
+	new_attr_timeout = VOLUME_CACHE_TIMEOUT;
+	new_entry_timeout = VOLUME_CACHE_TIMEOUT;
+	if (map == NULL)
+	{
+		/* The volume must not be locked while the shard is locked.  */
+		zfsd_mutex_unlock(&shard->mutex);
+		volume_cache_timeouts(fh->vid, &new_attr_timeout, &new_entry_timeout);
+		zfsd_mutex_lock(&shard->mutex);
+	}
+	slot = htab_find_slot_with_hash(shard->fh_htab, fh, hash, INSERT);
 	if (*slot != NULL)
 		map = *slot;
 	else
 	{
 		map = xmalloc(sizeof(*map));
-		map->ino = next_ino;
-		next_ino++;
+		map->ino = ((shard->next_seq << INODE_MAP_SHARD_BITS)
+					| (hash & INODE_MAP_SHARD_MASK));
+		shard->next_seq++;
 		map->fh = *fh;
+		map->nlookup = 0;
+		map->cached = false;
+		map->attr_timeout = new_attr_timeout;
+		map->entry_timeout = new_entry_timeout;
 		*slot = map;
-		slot = htab_find_slot_with_hash(inode_map_ino, &map->ino, map->ino,
+		slot = htab_find_slot_with_hash(shard->ino_htab, &map->ino, map->ino,
 										INSERT);
 		assert(*slot == NULL);
 		*slot = map;
 	}
-	zfsd_mutex_unlock(&inode_map_mutex);
-	return map->ino;
+	if (lookup)
+		map->nlookup++;
+	ino = map->ino;
+	if (attr_timeout != NULL)
+	{
+		*attr_timeout = map->attr_timeout;
+		*entry_timeout = map->entry_timeout;
+	}
+	zfsd_mutex_unlock(&shard->mutex);
+	return ino;
 }
 
+/* The returned file handle is valid until the kernel forgets INO, i.e. for
+   the whole request on INO.  */
 static const zfs_fh *inode_to_fh(fuse_ino_t ino)
 {
+	struct inode_map_shard *shard;
 	struct inode_map *map;
 
-	zfsd_mutex_lock(&inode_map_mutex);
-	map = htab_find_with_hash(inode_map_ino, &ino, ino);
-	zfsd_mutex_unlock(&inode_map_mutex);
+	if (ino == FUSE_ROOT_ID)
+		return &root_fh;
+
+	shard = inode_map_shard_ino(ino);
+	zfsd_mutex_lock(&shard->mutex);
+	map = htab_find_with_hash(shard->ino_htab, &ino, ino);
+	zfsd_mutex_unlock(&shard->mutex);
 	if (map != NULL)
 		return &map->fh;
 	else
 		return NULL;
 }
 
+/* Return the number of seconds the kernel may cache attributes of INO.  */
+static double inode_attr_timeout(fuse_ino_t ino)
+{
+	struct inode_map_shard *shard;
+	struct inode_map *map;
+	double timeout;
+
+	if (ino == FUSE_ROOT_ID)
+		return VOLUME_CACHE_TIMEOUT;
+
+	timeout = VOLUME_CACHE_TIMEOUT;
+	shard = inode_map_shard_ino(ino);
+	zfsd_mutex_lock(&shard->mutex);
+	map = htab_find_with_hash(shard->ino_htab, &ino, ino);
+	if (map != NULL)
+		timeout = map->attr_timeout;
+	zfsd_mutex_unlock(&shard->mutex);
+	return timeout;
+}
+
+/* Return true if the kernel may keep the cached data of file INO when it is
+   opened and its version is VERSION.  Remember VERSION for the next open.  */
+static bool inode_keep_cache(fuse_ino_t ino, uint64_t version)
+{
+	struct inode_map_shard *shard;
+	struct inode_map *map;
+	bool keep;
+
+	if (ino == FUSE_ROOT_ID)
+		return false;
+
+	keep = false;
+	shard = inode_map_shard_ino(ino);
+	zfsd_mutex_lock(&shard->mutex);
+	map = htab_find_with_hash(shard->ino_htab, &ino, ino);
+	if (map != NULL)
+	{
+		keep = map->cached && map->cached_version == version;
+		map->cached_version = version;
+		map->cached = true;
+	}
+	zfsd_mutex_unlock(&shard->mutex);
+	return keep;
+}
+
+/* The data of file INO in kernel page cache have been changed through this
+   node to VERSION.  Update the remembered version unless the cached data
+   have been invalidated meanwhile.  */
+static void inode_update_cache(fuse_ino_t ino, uint64_t version)
+{
+	struct inode_map_shard *shard;
+	struct inode_map *map;
+
+	if (ino == FUSE_ROOT_ID)
+		return;
+
+	shard = inode_map_shard_ino(ino);
+	zfsd_mutex_lock(&shard->mutex);
+	map = htab_find_with_hash(shard->ino_htab, &ino, ino);
+	if (map != NULL && map->cached)
+		map->cached_version = version;
+	zfsd_mutex_unlock(&shard->mutex);
+}
+
+/* Forget the version of the cached data of file FH and return its inode
+   number, 0 if not found.  */
+static fuse_ino_t inode_forget_cache(const zfs_fh * fh)
+{
+	struct inode_map_shard *shard;
+	struct inode_map *map;
+	fuse_ino_t ino;
+	hash_t hash;
+
+	if (ZFS_FH_EQ(*fh, root_fh))
+		return FUSE_ROOT_ID;
+
+	ino = 0;
+	hash = ZFS_FH_HASH(fh);
+	shard = inode_map_shard_fh(hash);
+	zfsd_mutex_lock(&shard->mutex);
+	map = htab_find_with_hash(shard->fh_htab, fh, hash);
+	if (map != NULL)
+	{
+		map->cached = false;
+		ino = map->ino;
+	}
+	zfsd_mutex_unlock(&shard->mutex);
+	return ino;
+}
+
+/* The kernel forgot NLOOKUP lookups of inode INO from SHARD, delete the
+   inode when it has forgotten all of them.  */
+static void inode_forget_nolock(struct inode_map_shard *shard, fuse_ino_t ino,
+								uint64_t nlookup)
+{
+	struct inode_map *map;
+	void **slot;
+
+	CHECK_MUTEX_LOCKED(&shard->mutex);
+
+	slot = htab_find_slot_with_hash(shard->ino_htab, &ino, ino, NO_INSERT);
+	if (slot == NULL)
+		return;
+
+	map = *slot;
+	map->nlookup = (map->nlookup > nlookup) ? map->nlookup - nlookup : 0;
+	if (map->nlookup == 0)
+	{
+		void **fh_slot;
+
+		fh_slot = htab_find_slot_with_hash(shard->fh_htab, &map->fh,
+										   ZFS_FH_HASH(&map->fh), NO_INSERT);
+		assert(fh_slot != NULL);
+		htab_clear_slot(shard->fh_htab, fh_slot);
+		htab_clear_slot(shard->ino_htab, slot);
+	}
+}
+
 static void inode_map_init(void)
 {
-	zfsd_mutex_init(&inode_map_mutex);
-	inode_map_ino =
-		htab_create(100, inode_map_ino_hash, inode_map_ino_eq,
-					inode_map_ino_del, NULL);
-	inode_map_fh =
-		htab_create(100, inode_map_fh_hash, inode_map_fh_eq, NULL, NULL);
-	next_ino = FUSE_ROOT_ID;
+	unsigned int i;
+
+	for (i = 0; i < INODE_MAP_SHARDS; i++)
+	{
+		struct inode_map_shard *shard = &inode_map_shards[i].s;
+
+		zfsd_mutex_init(&shard->mutex);
+		shard->ino_htab =
+			htab_create(100, inode_map_ino_hash, inode_map_ino_eq,
+						inode_map_ino_del, &shard->mutex);
+		shard->fh_htab =
+			htab_create(100, inode_map_fh_hash, inode_map_fh_eq, NULL,
+						&shard->mutex);
+		shard->next_seq = 1;
+	}
 }
 
 static void inode_map_destroy(void)
 {
-	zfsd_mutex_destroy(&inode_map_mutex);
-	htab_destroy(inode_map_fh);
-	htab_destroy(inode_map_ino);
+	unsigned int i;
+
+	for (i = 0; i < INODE_MAP_SHARDS; i++)
+	{
+		struct inode_map_shard *shard = &inode_map_shards[i].s;
+
+		zfsd_mutex_lock(&shard->mutex);
+		htab_destroy(shard->fh_htab);
+		htab_destroy(shard->ino_htab);
+		zfsd_mutex_unlock(&shard->mutex);
+		zfsd_mutex_destroy(&shard->mutex);
+	}
 }
 
- /* Alloc pool for fuse requests buffers */
-static alloc_pool fuse_req_buf_pool;
-static pthread_mutex_t fuse_req_buf_pool_mutex = ZFS_MUTEX_INITIALIZER;
+/*! Terminate the kernel threads and wait for them, they use the FUSE
+   session and channels.  The pool must have been told to terminate.  */
+
+static void kernel_pool_destroy(void)
+{
+	if (!kernel_pool_running)
+		return;
+
+	thread_pool_destroy(&kernel_pool);
+	kernel_pool_running = false;
+}
 
 /*! Unmount the FUSE mountpoint and destroy data structures used by it.  */
 
 void fs_unmount(void)
 {
+	kernel_pool_destroy();
+
 	if (!mounted)
 		return;
 
@@ -305,11 +572,10 @@ static void stat_from_fattr(struct stat *st, const fattr * fa, fuse_ino_t ino)
 
 static void entry_from_dir_op_res(struct fuse_entry_param *e, const dir_op_res * res)
 {
-	e->ino = fh_to_inode(&res->file);
+	e->ino = fh_to_inode(&res->file, true, &e->attr_timeout,
+						 &e->entry_timeout);
 	e->generation = res->file.gen;
 	stat_from_fattr(&e->attr, &res->attr, e->ino);
-	e->attr_timeout = CACHE_VALIDITY;
-	e->entry_timeout = CACHE_VALIDITY;
 }
 
  /* Request translation */
@@ -346,6 +612,54 @@ static void zfs_fuse_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 	fuse_reply_err(req, err);
 }
 
+static void zfs_fuse_forget(fuse_req_t req, fuse_ino_t ino,
+							unsigned long nlookup)
+{
+	struct inode_map_shard *shard;
+
+	message(LOG_INFO, FACILITY_ZFSD, "FUSE: forget ino=%d, nlookup=%lu\n",
+			ino, nlookup);
+	if (ino != FUSE_ROOT_ID)
+	{
+		shard = inode_map_shard_ino(ino);
+		zfsd_mutex_lock(&shard->mutex);
+		inode_forget_nolock(shard, ino, nlookup);
+		zfsd_mutex_unlock(&shard->mutex);
+	}
+	fuse_reply_none(req);
+}
+
+/*! Forget COUNT inodes in FORGETS.  The mutex of a shard is kept locked
+   while the following inodes are in the same shard.  */
+
+static void zfs_fuse_forget_multi(fuse_req_t req, size_t count,
+								  struct fuse_forget_data *forgets)
+{
+	struct inode_map_shard *shard, *locked;
+	size_t i;
+
+	message(LOG_INFO, FACILITY_ZFSD, "FUSE: forget_multi count=%d\n", count);
+	locked = NULL;
+	for (i = 0; i < count; i++)
+	{
+		if (forgets[i].ino == FUSE_ROOT_ID)
+			continue;
+
+		shard = inode_map_shard_ino(forgets[i].ino);
+		if (shard != locked)
+		{
+			if (locked != NULL)
+				zfsd_mutex_unlock(&locked->mutex);
+			zfsd_mutex_lock(&shard->mutex);
+			locked = shard;
+		}
+		inode_forget_nolock(shard, forgets[i].ino, forgets[i].nlookup);
+	}
+	if (locked != NULL)
+		zfsd_mutex_unlock(&locked->mutex);
+	fuse_reply_none(req);
+}
+
 static void zfs_fuse_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
 	struct stat st;
@@ -368,7 +682,7 @@ static void zfs_fuse_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_in
 	if (err != 0)
 		goto err;				/* ESTALE not handled specially */
 	stat_from_fattr(&st, &fa, ino);
-	fuse_reply_attr(req, &st, CACHE_VALIDITY);
+	fuse_reply_attr(req, &st, inode_attr_timeout(ino));
 	return;
 
   err:
@@ -430,7 +744,7 @@ static void zfs_fuse_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
 	if (err != 0)
 		goto err_estale;
 	stat_from_fattr(&st, &fa, ino);
-	fuse_reply_attr(req, &st, CACHE_VALIDITY);
+	fuse_reply_attr(req, &st, inode_attr_timeout(ino));
 	return;
 
   err_estale:
@@ -747,6 +1061,7 @@ static void zfs_fuse_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info
 	const zfs_fh *fh;
 	open_args args;
 	zfs_cap res, *cap;
+	fattr fa;
 	int err;
 
 	message(LOG_INFO, FACILITY_ZFSD, "FUSE: open ino=%d, flags=%o\n", ino,
@@ -759,14 +1074,16 @@ static void zfs_fuse_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info
 	}
 	args.file = *fh;
 	args.flags = fi->flags;
-	err = -zfs_error(zfs_open(&res, &args.file, args.flags));
+	err = -zfs_error(zfs_open_attr(&res, &fa, &args.file, args.flags));
 	if (err != 0)
 		goto err_estale;
 	cap = xmalloc(sizeof(*cap));
 	*cap = res;
 	fi->fh = (intptr_t) cap;
 	fi->direct_io = 0;			/* Use the page cache */
-	fi->keep_cache = 1;
+	/* Keep the data in page cache if the file has not changed since it was
+	   opened for the last time.  */
+	fi->keep_cache = inode_keep_cache(ino, fa.version);
 	if (fuse_reply_open(req, fi) != 0)
 	{
 		(void)zfs_close(cap);
@@ -781,9 +1098,78 @@ static void zfs_fuse_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info
 	fuse_reply_err(req, err);
 }
 
+/*! \brief Local file whose data are sent by zfs_fuse_read_fd_reply.  */
+typedef struct fuse_read_data_def
+{
+	int fd;						/*!< duplicate of the descriptor, or -1 */
+	uint64_t offset;			/*!< offset of the data */
+	uint32_t count;				/*!< length of the data */
+} fuse_read_data;
+
+/*! Remember that COUNT bytes from offset OFFSET of local file descriptor FD
+   are to be sent as the reply to the read request, store a duplicate of FD
+   to DATA.  zfsd holds its locks during the call, the reply is sent by
+   zfs_fuse_read_fd_reply after they are released.  */
+
+static int32_t zfs_fuse_read_fd(int fd, uint64_t offset, uint32_t count,
+								void *data)
+{
+	fuse_read_data *rd = (fuse_read_data *) data;
+
+	rd->fd = dup(fd);
+	if (rd->fd < 0)
+		return errno;
+
+	rd->offset = offset;
+	rd->count = count;
+	return ZFS_OK;
+}
+
+/*! Reply to read request REQ by the data of the local file remembered in RD
+   and close the duplicate of its descriptor.  The data are spliced from the
+   file to the FUSE device if the kernel supports it so they are not copied
+   to user space.  */
+
+static void zfs_fuse_read_fd_reply(fuse_req_t req, fuse_read_data * rd)
+{
+	struct fuse_bufvec bufv = FUSE_BUFVEC_INIT(rd->count);
+	int r;
+
+	bufv.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+	bufv.buf[0].fd = rd->fd;
+	bufv.buf[0].pos = rd->offset;
+
+	r = fuse_reply_data(req, &bufv, FUSE_BUF_SPLICE_MOVE);
+	if (r != 0)
+		message(LOG_NOTICE, FACILITY_ZFSD, "FUSE: read reply failed: %s\n",
+				strerror(-r));
+
+	close(rd->fd);
+	rd->fd = -1;
+}
+
+/*! Return a buffer of at least SIZE bytes for data of a reply.  The buffer
+   is owned by the current kernel thread and reused by its requests.  */
+
+static void *kernel_reply_buf(size_t size)
+{
+	thread *t;
+
+	t = (thread *) pthread_getspecific(thread_data_key);
+	if (t->u.kernel.reply_buf_size < size)
+	{
+		free(t->u.kernel.reply_buf);
+		t->u.kernel.reply_buf = xmalloc(size);
+		t->u.kernel.reply_buf_size = size;
+	}
+
+	return t->u.kernel.reply_buf;
+}
+
 static void zfs_fuse_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
 			  struct fuse_file_info *fi)
 {
+	fuse_read_data rd;
 	zfs_cap *cap;
 	void *buf;
 	size_t done;
@@ -793,38 +1179,54 @@ static void zfs_fuse_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off
 	message(LOG_INFO, FACILITY_ZFSD, "FUSE: read ino=%d, size=%d, off=%d\n",
 			ino, size, off);
 	cap = (zfs_cap *) (intptr_t) fi->fh;
-	buf = xmalloc(size);
+	buf = kernel_reply_buf(size);
+	rd.fd = -1;
 	done = 0;
 	do
 	{
 		read_args args;
 		read_res res;
-		size_t run;
 
-		run = size - done;
-		if (run > ZFS_MAXDATA)
-			run = ZFS_MAXDATA;
 		args.cap = *cap;
 		args.offset = off + done;
-		args.count = run;
+		args.count = size - done;
 		res.data.buf = (char *)buf + done;
-		err = -zfs_error(zfs_read(&res, &args.cap, args.offset, args.count,
-								  true));
+		/* Only the first chunk may be sent directly from the local file,
+		   the following ones must be appended to the buffer.  */
+		if (done == 0)
+			err = -zfs_error(zfs_read_fd(&res, &args.cap, args.offset,
+										 args.count, true, zfs_fuse_read_fd,
+										 &rd));
+		else
+		{
+			if (args.count > ZFS_MAXDATA)
+				args.count = ZFS_MAXDATA;
+			err = -zfs_error(zfs_read(&res, &args.cap, args.offset,
+									  args.count, true));
+		}
+		if (rd.fd >= 0)
+		{
+			if (err == 0)
+			{
+				zfs_fuse_read_fd_reply(req, &rd);
+				return;
+			}
+			close(rd.fd);
+			rd.fd = -1;
+		}
 		if (err != 0)
-			goto err_buf_estale;
+			goto err_estale;
 		if (res.data.len == 0)
 			break;
 		done += res.data.len;
 	}
 	while (done < size);
 	fuse_reply_buf(req, buf, done);
-	free(buf);
 	return;
 
-  err_buf_estale:
+  err_estale:
 	if (err == ESTALE)
 		(void)fuse_kernel_invalidate_inode(fuse_ch, ino);
-	free(buf);
 	fuse_reply_err(req, err);
 }
 
@@ -872,20 +1274,124 @@ static void zfs_fuse_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size
 	fuse_reply_err(req, err);
 }
 
+/*! Write COUNT bytes of the write request in DATA to offset OFFSET of local
+   file descriptor FD.  When the request has been spliced from the FUSE
+   device to a pipe the data are spliced further to FD.  */
+
+static int32_t zfs_fuse_write_fd(int fd, uint64_t offset, uint32_t count,
+								 uint32_t * written, void *data)
+{
+	struct fuse_bufvec *src = (struct fuse_bufvec *) data;
+	struct fuse_bufvec dst = FUSE_BUFVEC_INIT(count);
+	ssize_t r;
+
+	dst.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+	dst.buf[0].fd = fd;
+	dst.buf[0].pos = offset;
+
+	r = fuse_buf_copy(&dst, src, FUSE_BUF_SPLICE_MOVE);
+	if (r < 0)
+		return -r;
+
+	*written = r;
+	return ZFS_OK;
+}
+
+static void zfs_fuse_write_buf(fuse_req_t req, fuse_ino_t ino,
+							   struct fuse_bufvec *bufv, off_t off,
+							   struct fuse_file_info *fi)
+{
+	write_args args;
+	write_res res;
+	zfs_cap *cap;
+	size_t size;
+	void *buf;
+	ssize_t r;
+	int err;
+
+	TRACE("");
+	size = fuse_buf_size(bufv);
+	message(LOG_INFO, FACILITY_ZFSD, "FUSE: write_buf ino=%d, size=%d, off=%d\n",
+			ino, size, off);
+	cap = (zfs_cap *) (intptr_t) fi->fh;
+	args.cap = *cap;
+	args.offset = off;
+	args.data.len = size;
+	args.data.buf = NULL;
+	args.remote = false;
+	err = -zfs_error(zfs_write_fd(&res, &args, zfs_fuse_write_fd, bufv));
+	if (err == 0)
+	{
+		fuse_reply_write(req, res.written);
+		return;
+	}
+	if (err != EAGAIN)
+		goto err_estale;
+
+	/* The file is not local, write the data in ZFS_MAXDATA chunks.  */
+	if (bufv->count == 1 && !(bufv->buf[0].flags & FUSE_BUF_IS_FD))
+	{
+		zfs_fuse_write(req, ino, bufv->buf[0].mem, size, off, fi);
+		return;
+	}
+
+	buf = kernel_reply_buf(size);
+	{
+		struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+
+		dst.buf[0].mem = buf;
+		r = fuse_buf_copy(&dst, bufv, 0);
+	}
+	if (r < 0)
+	{
+		err = -r;
+		goto err_estale;
+	}
+	zfs_fuse_write(req, ino, buf, r, off, fi);
+	return;
+
+  err_estale:
+	if (err == ESTALE)
+		(void)fuse_kernel_invalidate_inode(fuse_ch, ino);
+	fuse_reply_err(req, err);
+}
+
+/* Report errors of writing the data written behind on close and fsync.  */
+
+static void zfs_fuse_flush(fuse_req_t req, fuse_ino_t ino,
+						   struct fuse_file_info *fi)
+{
+	zfs_cap *cap;
+
+	message(LOG_INFO, FACILITY_ZFSD, "FUSE: flush ino=%d\n", ino);
+	cap = (zfs_cap *) (intptr_t) fi->fh;
+	fuse_reply_err(req, -zfs_error(zfs_flush(cap)));
+}
+
+static void zfs_fuse_fsync(fuse_req_t req, fuse_ino_t ino,
+						   ATTRIBUTE_UNUSED int datasync,
+						   struct fuse_file_info *fi)
+{
+	zfs_fuse_flush(req, ino, fi);
+}
+
 static void zfs_fuse_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
 	zfs_cap *cap;
+	fattr fa;
 	int err;
 
 	message(LOG_INFO, FACILITY_ZFSD, "FUSE: release ino=%d\n", ino);
 	/* Sync is not needed - its kernel responsibility to call write for all
 	   data (void)fuse_kernel_sync_inode(fuse_ch, ino); */
 	cap = (zfs_cap *) (intptr_t) fi->fh;
+	/* The writes through this capability are in page cache already.  */
+	if (cap->flags != O_RDONLY && zfs_getattr(&fa, &cap->fh) == ZFS_OK)
+		inode_update_cache(ino, fa.version);
 	err = -zfs_error(zfs_close(cap));
 	free(cap);
 	if (err != 0)
 		goto err;				/* ESTALE not handled specially */
-	(void)fuse_kernel_invalidate_data(fuse_ch, ino);
 	/* Fall through */
   err:
 	fuse_reply_err(req, err);
@@ -950,7 +1456,7 @@ static void zfs_fuse_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t
 		free(lookup_args.name.str);
 		if (err != 0)
 			continue;
-		st.st_ino = fh_to_inode(&lookup_res.file);
+		st.st_ino = fh_to_inode(&lookup_res.file, false, NULL, NULL);
 		st.st_mode = ftype2dtype[lookup_res.attr.type];
 #ifdef __ANDROID__
 		st.st_mode |= S_IRWXU | S_IRWXG | S_IRWXO;
@@ -1028,7 +1534,7 @@ static void zfs_fuse_create(fuse_req_t req, fuse_ino_t parent, const char *name,
 	*cap = res.cap;
 	fi->fh = (intptr_t) cap;
 	fi->direct_io = 0;			/* Use the page cache */
-	fi->keep_cache = 1;
+	fi->keep_cache = inode_keep_cache(e.ino, res.dor.attr.version);
 	if (fuse_reply_create(req, &e, fi) != 0)
 	{
 		(void)zfs_close(cap);
@@ -1043,9 +1549,27 @@ static void zfs_fuse_create(fuse_req_t req, fuse_ino_t parent, const char *name,
 	fuse_reply_err(req, err);
 }
 
+/*! Initialize the connection to kernel.  Let libfuse splice the data of
+   read replies to the FUSE device and the data of write requests from it,
+   and let the kernel send writes as large as KERNEL_BUF_SIZE allows.
+   The requests are spliced to per-thread pipes of the session so this
+   relies on fs_unmount joining the kernel threads before it destroys the
+   session.  */
+
+static void zfs_fuse_init(ATTRIBUTE_UNUSED void *userdata,
+						  struct fuse_conn_info *conn)
+{
+	conn->want |= conn->capable & (FUSE_CAP_SPLICE_WRITE
+								   | FUSE_CAP_SPLICE_MOVE
+								   | FUSE_CAP_SPLICE_READ
+								   | FUSE_CAP_BIG_WRITES);
+}
+
 static const struct fuse_lowlevel_ops zfs_fuse_ops = {
+	.init = zfs_fuse_init,
 	.lookup = zfs_fuse_lookup,
-	/* FIXME? .forget */
+	.forget = zfs_fuse_forget,
+	.forget_multi = zfs_fuse_forget_multi,
 	.getattr = zfs_fuse_getattr,
 	.setattr = zfs_fuse_setattr,
 	.readlink = zfs_fuse_readlink,
@@ -1059,9 +1583,10 @@ static const struct fuse_lowlevel_ops zfs_fuse_ops = {
 	.open = zfs_fuse_open,
 	.read = zfs_fuse_read,
 	.write = zfs_fuse_write,
-	/* .flush not necessary */
+	.write_buf = zfs_fuse_write_buf,
+	.flush = zfs_fuse_flush,
 	.release = zfs_fuse_release,
-	/* .fsync not implemented */
+	.fsync = zfs_fuse_fsync,
 	.opendir = zfs_fuse_open,
 	.readdir = zfs_fuse_readdir,
 	.releasedir = zfs_fuse_release,
@@ -1080,9 +1605,14 @@ int32_t fs_invalidate_fh(zfs_fh * fh)
 	if (!mounted)
 		RETURN_INT(ZFS_COULD_NOT_CONNECT);
 
-	fuse_ino_t ino = fh_get_inode(fh);
+	fuse_ino_t ino = inode_forget_cache(fh);
 	if (ino != 0)
 	{
+		/* The callers hold the locks of zfsd, the kernel might wait for
+		   a request which needs them while dropping the cached data.  So
+		   only the attributes are invalidated here, the cached data are
+		   dropped by the next open because the cached version has been
+		   forgotten.  */
 		(void)fuse_kernel_invalidate_inode(fuse_ch, ino);
 	}
 
@@ -1121,6 +1651,105 @@ int32_t fs_invalidate_dentry(internal_dentry dentry, bool volume_root_p)
 
  /* Thread glue */
 
+#ifndef FUSE_DEV_IOC_CLONE
+/*! Attach a new /dev/fuse file descriptor to the connection of another one.
+   Requests may be read from any of them but the reply has to be sent through
+   the file descriptor the request was read from.  */
+#define FUSE_DEV_IOC_CLONE _IOR(229, 0, uint32_t)
+#endif
+
+/*! Receive a request from the kernel channel *CHP to BUF of size SIZE.  */
+
+static int kernel_chan_receive(struct fuse_chan **chp, char *buf, size_t size)
+{
+	ssize_t r;
+
+	r = read(fuse_chan_fd(*chp), buf, size);
+	if (r < 0)
+		return (errno == ENOENT) ? -EINTR : -errno;
+
+	return r;
+}
+
+/*! Send the reply in COUNT vectors IOV through the kernel channel CH.  */
+
+static int kernel_chan_send(struct fuse_chan *ch, const struct iovec iov[],
+							size_t count)
+{
+	if (iov && writev(fuse_chan_fd(ch), iov, count) < 0)
+	{
+		/* The request was interrupted meanwhile.  */
+		if (errno == ENOENT)
+			return 0;
+
+		return -errno;
+	}
+
+	return 0;
+}
+
+/*! Close the file descriptor of the kernel channel CH.  */
+
+static void kernel_chan_destroy(struct fuse_chan *ch)
+{
+	close(fuse_chan_fd(ch));
+}
+
+static struct fuse_chan_ops kernel_chan_ops = {
+	.receive = kernel_chan_receive,
+	.send = kernel_chan_send,
+	.destroy = kernel_chan_destroy
+};
+
+/*! Data of the channels whose file descriptor is a duplicate of the one of
+   the mount.  They share its file description so the reads are blocking.  */
+static int kernel_chan_shared;
+
+/*! Create a channel of its own for a kernel thread.  Clone the /dev/fuse file
+   descriptor of the mount so the kernel thread can read requests and send
+   replies without going through the other threads.  When the kernel can not
+   clone the file descriptor, duplicate it, the threads then share one
+   request queue.  */
+
+static struct fuse_chan *kernel_chan_create(void)
+{
+	struct fuse_chan *ch;
+	uint32_t master_fd = fuse_chan_fd(fuse_ch);
+	void *data = NULL;
+	int fd;
+
+	fd = open("/dev/fuse", O_RDWR | O_CLOEXEC);
+	if (fd >= 0 && ioctl(fd, FUSE_DEV_IOC_CLONE, &master_fd) != 0)
+	{
+		close(fd);
+		fd = -1;
+	}
+
+	if (fd < 0)
+	{
+		message(LOG_INFO, FACILITY_ZFSD | FACILITY_THREADING,
+				"Can not clone FUSE device, sharing it: %s\n", strerror(errno));
+		fd = dup(master_fd);
+		if (fd < 0)
+			return NULL;
+
+		/* O_NONBLOCK would be set for the mount too.  */
+		data = &kernel_chan_shared;
+	}
+	else
+	{
+		/* The kernel threads wait in ppoll, a request may be picked up by
+		   another thread between ppoll and read.  */
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	}
+
+	ch = fuse_chan_new(&kernel_chan_ops, fd, KERNEL_BUF_SIZE, data);
+	if (ch == NULL)
+		close(fd);
+
+	return ch;
+}
+
 /*! Initialize kernel thread T.  */
 
 static void kernel_worker_init(thread * t)
@@ -1134,55 +1763,151 @@ static void kernel_worker_cleanup(void *data)
 {
 	thread *t = (thread *) data;
 
+	if (t->u.kernel.fuse_ch)
+	{
+		if (t->u.kernel.fuse_ch != fuse_ch)
+			fuse_chan_destroy(t->u.kernel.fuse_ch);
+		t->u.kernel.fuse_ch = NULL;
+	}
+	free(t->u.kernel.buf);
+	t->u.kernel.buf = NULL;
+	free(t->u.kernel.reply_buf);
+	t->u.kernel.reply_buf = NULL;
+	t->u.kernel.reply_buf_size = 0;
 	dc_destroy(t->dc_call);
 }
 
-/*! The main function of the kernel thread.  */
+/*! Wake up idle kernel thread T waiting in ppoll or in a blocking read, it
+   has been requested to die.  */
+
+static void kernel_worker_wakeup(thread * t)
+{
+	pthread_kill(t->thread_id, SIGUSR1);
+}
+
+/*! Wait until kernel thread T is requested to die.  */
+
+static void kernel_worker_wait_for_death(thread * t)
+{
+	while (get_thread_state(t) != THREAD_DYING)
+		semaphore_down(&t->sem, 1);
+}
+
+/*! The main function of the kernel thread.  The idle kernel thread waits for
+   a request on its own channel and processes it itself.  */
 
 static void *kernel_worker(void *data)
 {
 	thread *t = (thread *) data;
 	lock_info li[MAX_LOCKED_FILE_HANDLES];
+	sigset_t mask, poll_mask;
+	struct pollfd pfd;
+	struct fuse_buf fbuf;
+	struct fuse_chan *ch;
+	ssize_t r;
+	bool dying, blocking;
 
 	thread_disable_signals();
 
+	/* SIGUSR1 which wakes us up to die is delivered only in ppoll so it can
+	   not come between checking the state and going to sleep.  */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &mask, &poll_mask);
+	sigdelset(&poll_mask, SIGUSR1);
+
+	t->u.kernel.fuse_ch = NULL;
+	t->u.kernel.buf = NULL;
+	t->u.kernel.reply_buf = NULL;
+	t->u.kernel.reply_buf_size = 0;
 	pthread_cleanup_push(kernel_worker_cleanup, data);
 	pthread_setspecific(thread_data_key, data);
 	pthread_setspecific(thread_name_key, "Kernel worker thread");
 	set_lock_info(li);
 
-	while (1)
+	t->u.kernel.fuse_ch = kernel_chan_create();
+	if (t->u.kernel.fuse_ch == NULL)
 	{
-		/* Wait until kernel_dispatch wakes us up.  */
-		semaphore_down(&t->sem, 1);
-
-#ifdef ENABLE_CHECKING
-		if (get_thread_state(t) == THREAD_DEAD)
-			zfsd_abort();
-#endif
+		message(LOG_ERROR, FACILITY_ZFSD | FACILITY_THREADING,
+				"Kernel worker can not create FUSE channel, using the channel"
+				" of the mount\n");
+		t->u.kernel.fuse_ch = fuse_ch;
+	}
+	blocking = (t->u.kernel.fuse_ch == fuse_ch
+				|| fuse_chan_data(t->u.kernel.fuse_ch) == &kernel_chan_shared);
+	t->u.kernel.buf_size = KERNEL_BUF_SIZE;
+	t->u.kernel.buf = xmalloc(t->u.kernel.buf_size);
+	pfd.fd = fuse_chan_fd(t->u.kernel.fuse_ch);
+	pfd.events = POLLIN;
 
+	while (1)
+	{
 		/* We were requested to die.  */
 		if (get_thread_state(t) == THREAD_DYING)
 			break;
 
+		if (ppoll(&pfd, 1, NULL, &poll_mask) < 0)
+			continue;
+
+		if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+		{
+			/* The filesystem has been unmounted, kernel_main is exiting. */
+			kernel_worker_wait_for_death(t);
+			break;
+		}
+
+		/* Write requests may be spliced to a pipe, the others are read to
+		   the buffer of the thread.  */
+		fbuf.mem = t->u.kernel.buf;
+		fbuf.size = t->u.kernel.buf_size;
+		fbuf.flags = 0;
+		ch = t->u.kernel.fuse_ch;
+		if (blocking)
+		{
+			/* Another thread may take the request first, let SIGUSR1
+			   interrupt the blocking read when we are requested to die
+			   meanwhile.  */
+			pthread_sigmask(SIG_SETMASK, &poll_mask, NULL);
+			if (get_thread_state(t) == THREAD_DYING)
+				r = -EINTR;
+			else
+				r = fuse_session_receive_buf(fuse_se, &fbuf, &ch);
+			pthread_sigmask(SIG_BLOCK, &mask, NULL);
+		}
+		else
+			r = fuse_session_receive_buf(fuse_se, &fbuf, &ch);
+		if (r <= 0)
+		{
+			if (r == 0 || r == -ENODEV)
+			{
+				kernel_worker_wait_for_death(t);
+				break;
+			}
+
+			/* The request was taken by another thread or interrupted.  */
+			if (r != -EAGAIN && r != -EINTR && r != -ENOENT)
+				message(LOG_NOTICE, FACILITY_ZFSD | FACILITY_THREADING,
+						"Kernel worker read: %s\n", strerror(-r));
+			continue;
+		}
+
+		/* We are busy now, let another thread wait for requests.  */
+		zfsd_mutex_lock(&kernel_pool.mutex);
+		dying = !thread_pool_idle_remove(&kernel_pool, t);
+		zfsd_mutex_unlock(&kernel_pool.mutex);
+
 		/* ZFS is mounted if kernel wants something from zfsd.  */
 		mounted = true;
 
-		fuse_session_process(fuse_se, t->u.kernel.buf, t->u.kernel.buf_size,
-							 t->u.kernel.fuse_ch);
-
+		fuse_session_process_buf(fuse_se, &fbuf, ch);
 
-		zfsd_mutex_lock(&fuse_req_buf_pool_mutex);
-		pool_free(fuse_req_buf_pool, t->u.kernel.buf);
-		zfsd_mutex_unlock(&fuse_req_buf_pool_mutex);
+		if (dying)
+			break;
 
-		/* Put self to the idle queue if not requested to die meanwhile.  */
+		/* Put self to the idle stack if not requested to die meanwhile.  */
 		zfsd_mutex_lock(&kernel_pool.mutex);
 		if (get_thread_state(t) == THREAD_BUSY)
-		{
-			queue_put(&kernel_pool.idle, &t->index);
-			set_thread_state(t, THREAD_IDLE);
-		}
+			thread_pool_idle_push(&kernel_pool, t);
 		else
 		{
 #ifdef ENABLE_CHECKING
@@ -1200,57 +1925,32 @@ static void *kernel_worker(void *data)
 	return NULL;
 }
 
-/*! Function which gets a request and passes it to some kernel thread. It
-   also regulates the number of kernel threads.  */
-static void kernel_dispatch(struct fuse_chan *ch, void *buf, size_t buf_size)
-{
-	size_t idx;
-
-	zfsd_mutex_lock(&kernel_pool.mutex);
-
-	/* Regulate the number of threads.  */
-	if (kernel_pool.idle.nelem == 0)
-		thread_pool_regulate(&kernel_pool);
-
-	/* Select an idle thread and forward the request to it.  */
-	queue_get(&kernel_pool.idle, &idx);
-#ifdef ENABLE_CHECKING
-	if (get_thread_state(&kernel_pool.threads[idx].t) == THREAD_BUSY)
-		zfsd_abort();
-#endif
-	set_thread_state(&kernel_pool.threads[idx].t, THREAD_BUSY);
-	kernel_pool.threads[idx].t.from_sid = this_node->id;
-	kernel_pool.threads[idx].t.u.kernel.buf = buf;
-	kernel_pool.threads[idx].t.u.kernel.buf_size = buf_size;
-	kernel_pool.threads[idx].t.u.kernel.fuse_ch = ch;
-
-	/* Let the thread run.  */
-	semaphore_up(&kernel_pool.threads[idx].t.sem, 1);
-
-	zfsd_mutex_unlock(&kernel_pool.mutex);
-}
-
-/*! Main function of the main (i.e. listening) kernel thread.  */
+/*! Main function of the main kernel thread.  The requests are read by the
+   kernel threads themselves, the main thread only waits until the
+   filesystem is unmounted or zfsd terminates.  */
 
 static void *kernel_main(ATTRIBUTE_UNUSED void *data)
 {
-	size_t fuse_buf_size = fuse_chan_bufsize(fuse_ch);
+	sigset_t mask, poll_mask;
+	struct pollfd pfd;
+	int r;
 
 	thread_disable_signals();
 	pthread_setspecific(thread_name_key, "Kernel main thread");
 
-	while (!thread_pool_terminate_p(&kernel_pool) && !fuse_session_exited(fuse_se))
-	{
-		struct fuse_chan *ch_copy;
-		int recv_res;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &mask, &poll_mask);
+	sigdelset(&poll_mask, SIGUSR1);
 
-		zfsd_mutex_lock(&fuse_req_buf_pool_mutex);
-		char * fuse_req_buf = pool_alloc(fuse_req_buf_pool);
-		zfsd_mutex_unlock(&fuse_req_buf_pool_mutex);
+	/* Wait only for errors, i.e. for the connection to be aborted.  */
+	pfd.fd = fuse_chan_fd(fuse_ch);
+	pfd.events = 0;
 
-		ch_copy = fuse_ch;
+	while (!thread_pool_terminate_p(&kernel_pool))
+	{
 		zfsd_mutex_lock(&kernel_pool.main_in_syscall);
-		recv_res = fuse_chan_recv(&ch_copy, fuse_req_buf, fuse_buf_size);
+		r = ppoll(&pfd, 1, NULL, &poll_mask);
 		zfsd_mutex_unlock(&kernel_pool.main_in_syscall);
 
 		if (thread_pool_terminate_p(&kernel_pool))
@@ -1261,35 +1961,16 @@ static void *kernel_main(ATTRIBUTE_UNUSED void *data)
 			break;
 		}
 
-		if (recv_res == -EINTR || recv_res == -EAGAIN)
-			continue;
-
-		if (recv_res <= 0)
+		if (r > 0 && (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)))
 		{
-			/* log error */
-			switch (recv_res)
-			{
-				/* filesystem was unmounted */
-				case -ENODEV:
-					message(LOG_NOTICE, FACILITY_ZFSD | FACILITY_DATA,
-						"FUSE unmounted, kernel_main exiting\n");
-					break;
-				default:
-					message(LOG_NOTICE, FACILITY_ZFSD | FACILITY_THREADING,
-						"kernel_main exiting: %s\n", strerror(-recv_res));
-					break;
-			}
-
-			/* exit while cyklus */
+			message(LOG_NOTICE, FACILITY_ZFSD | FACILITY_DATA,
+					"FUSE unmounted, kernel_main exiting\n");
 			break;
 		}
-
-		/* Dispatch the packet.  */
-		kernel_dispatch(ch_copy, fuse_req_buf, recv_res);
 	}
 
-	fs_unmount();
-
+	/* The FUSE session is destroyed by fs_unmount after the kernel threads
+	   are terminated.  */
 	if (!thread_pool_terminate_p(&kernel_pool))
 	{
 		/* notify zfsd daemon about network thread termination */
@@ -1303,14 +1984,14 @@ static void *kernel_main(ATTRIBUTE_UNUSED void *data)
 	return NULL;
 }
 
-/*! Open the FUSE mount and start the main kernel thread.  */
+/*! Open the FUSE mount and start the kernel threads.  */
 bool fs_start(void)
 {
 	fuse_ino_t root_ino;
 
 	inode_map_init();
 
-	root_ino = fh_to_inode(&root_fh);
+	root_ino = fh_to_inode(&root_fh, false, NULL, NULL);
 	assert(root_ino == FUSE_ROOT_ID);
 
 	fuse_ch = fuse_mount(zfs_config.mountpoint, &main_args);
@@ -1324,24 +2005,20 @@ bool fs_start(void)
 
 	fuse_session_add_chan(fuse_se, fuse_ch);
 
-	size_t fuse_buf_size = fuse_chan_bufsize(fuse_ch);
-
-	// initialize alloc pool for fuse requests buffers
-	zfsd_mutex_lock(&fuse_req_buf_pool_mutex);
-	fuse_req_buf_pool = create_alloc_pool("fuse requests buffers", fuse_buf_size, MAX_FREE_DCS, &fuse_req_buf_pool_mutex);
-	zfsd_mutex_unlock(&fuse_req_buf_pool_mutex);
-	if (fuse_req_buf_pool == NULL)
-	{
-		message(LOG_ERROR, FACILITY_ZFSD, "Failed to create fuse request buffer alloc pool.\n");
-		goto err_ch;
-	}
-
+	kernel_pool.worker_wakeup = kernel_worker_wakeup;
 	if (!thread_pool_create(&kernel_pool, &zfs_config.threads.kernel_thread_limit, kernel_main,
 							kernel_worker, kernel_worker_init))
 	{
 		fs_unmount();
 		return false;
 	}
+	kernel_pool_running = true;
+
+	/* Some kernel thread has to wait for requests.  */
+	zfsd_mutex_lock(&kernel_pool.mutex);
+	if (kernel_pool.n_idle == 0)
+		create_idle_thread(&kernel_pool);
+	zfsd_mutex_unlock(&kernel_pool.mutex);
 
 	return true;
 
@@ -1355,12 +2032,7 @@ bool fs_start(void)
 
 void fs_cleanup(void)
 {
-	thread_pool_destroy(&kernel_pool);
-
-	// destroy alloc pool for fuse requests buffers
-	zfsd_mutex_lock(&fuse_req_buf_pool_mutex);
-	free_alloc_pool(fuse_req_buf_pool);
-	zfsd_mutex_unlock(&fuse_req_buf_pool_mutex);
+	fs_unmount();
 
 	inode_map_destroy();
 }
@@ -47,6 +47,12 @@
 /*! Minimal value for MetadataTreeDepth.  */
 #define MIN_METADATA_TREE_DEPTH 1
 
+/*! Maximal number of entries of the io_uring for local file I/O.  */
+#define MAX_IO_URING_ENTRIES 4096
+
+/*! Maximal number of blocks of a file read at once by update.  */
+#define MAX_UPDATE_PIPELINE_DEPTH 32
+
 /*! The event groups for poll().  */
 #define CAN_READ (POLLIN | POLLPRI | POLLRDNORM | POLLRDBAND)
 #define CAN_WRITE (POLLOUT | POLLWRNORM | POLLWRBAND)
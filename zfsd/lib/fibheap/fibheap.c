@@ -244,6 +244,14 @@ unsigned int fibheap_size(fibheap heap)
 	return n;
 }
 
+/*! Return size of the heap HEAP whose mutex is locked by the caller.  */
+unsigned int fibheap_size_nolock(fibheap heap)
+{
+	CHECK_MUTEX_LOCKED(heap->mutex);
+
+	return heap->nodes;
+}
+
 /*! Extract the minimum node of the heap.  */
 static fibnode fibheap_extr_min_node(fibheap heap)
 {
@@ -21,12 +21,15 @@
 #include "system.h"
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include "pthread-wrapper.h"
 #include "hashfile.h"
+#include "io-engine.h"
 #include "log.h"
 #include "memory.h"
 #include "util.h"
@@ -35,30 +38,178 @@
 /*! Size of buffer used in hfile_expand.  */
 #define HFILE_BUFFER_SIZE 0x4000
 
+/*! Map hash file HFILE to memory if it should be accessed through a memory
+   mapping and it is not mapped yet.  The blocks of the file are allocated
+   first because a write to a hole of a mapped file raises SIGBUS when the
+   disk is full.  If it can not be mapped it is read and written by system
+   calls.  */
+
+static void hfile_map(hfile_t hfile)
+{
+	struct stat st;
+	uint64_t size;
+	void *map;
+	int r;
+
+	if (!hfile->use_mmap || hfile->map)
+		return;
+
+#ifdef ENABLE_CHECKING
+	if (hfile->fd < 0)
+		zfsd_abort();
+#endif
+
+	size = (uint64_t) hfile->size * hfile->element_size + hfile->element_size;
+	if (size > (uint64_t) SIZE_MAX
+		|| fstat(hfile->fd, &st) < 0 || (uint64_t) st.st_size < size)
+		map = MAP_FAILED;
+	else if ((r = posix_fallocate(hfile->fd, 0, (off_t) size)) != 0)
+	{
+		message(LOG_WARNING, FACILITY_DATA, "%s: posix_fallocate: %s\n",
+				hfile->file_name, strerror(r));
+		map = MAP_FAILED;
+	}
+	else
+		map = mmap(NULL, (size_t) size, PROT_READ | PROT_WRITE, MAP_SHARED,
+				   hfile->fd, 0);
+	if (map == MAP_FAILED)
+	{
+		message(LOG_WARNING, FACILITY_DATA,
+				"%s: can not be mapped to memory, reading it instead\n",
+				hfile->file_name);
+		hfile->use_mmap = false;
+		return;
+	}
+
+	hfile->map = (char *)map;
+	hfile->map_size = (size_t) size;
+}
+
+/*! Unmap hash file HFILE from memory.  */
+
+static void hfile_unmap(hfile_t hfile)
+{
+	if (!hfile->map)
+		return;
+
+	munmap(hfile->map, hfile->map_size);
+	hfile->map = NULL;
+	hfile->map_size = 0;
+}
+
 /*! Read and return status of slot from HFILE on offset OFFSET.  */
 
 static uint32_t hfile_read_slot_status(hfile_t hfile, uint64_t offset)
 {
-	if ((uint64_t) lseek(hfile->fd, offset, SEEK_SET) != offset)
-		return (uint32_t) - 1;
+	if (hfile->map)
+		return le_to_u32(*(uint32_t *) (hfile->map + offset));
 
-	if (!full_read(hfile->fd, hfile->element, sizeof(uint32_t)))
+	if (!full_pread(hfile->fd, hfile->element, sizeof(uint32_t), offset))
 		return (uint32_t) - 1;
 
 	return le_to_u32(*(uint32_t *) hfile->element);
 }
 
-/*! Read an element and return status of slot from HFILE on offset OFFSET.  */
+/*! Return the element of HFILE on offset OFFSET.  The element of a hash file
+   mapped to memory is not copied, otherwise it is read to HFILE->ELEMENT.
+   Return NULL on file failure.  */
 
-static uint32_t hfile_read_element(hfile_t hfile, uint64_t offset)
+static char *hfile_read_element(hfile_t hfile, uint64_t offset)
 {
-	if ((uint64_t) lseek(hfile->fd, offset, SEEK_SET) != offset)
-		return (uint32_t) - 1;
+	if (hfile->map)
+		return hfile->map + offset;
 
-	if (!full_read(hfile->fd, hfile->element, hfile->element_size))
-		return (uint32_t) - 1;
+	if (!full_pread(hfile->fd, hfile->element, hfile->element_size, offset))
+		return NULL;
 
-	return le_to_u32(*(uint32_t *) hfile->element);
+	return hfile->element;
+}
+
+/*! Write the pages of hash file HFILE mapped to memory which contain LEN
+   bytes on offset OFFSET and the header to disk as HFILE->SYNC says.
+   Return false on file failure.  */
+
+static bool hfile_msync(hfile_t hfile, uint64_t offset, size_t len)
+{
+	uintptr_t page_mask;
+	char *start;
+	int flags;
+
+	if (hfile->sync == HFILE_SYNC_NONE)
+		return true;
+
+	flags = (hfile->sync == HFILE_SYNC_SYNC ? MS_SYNC : MS_ASYNC);
+	page_mask = ~((uintptr_t) sysconf(_SC_PAGESIZE) - 1);
+	start = (char *)((uintptr_t) (hfile->map + offset) & page_mask);
+	if (msync(start, hfile->map + offset + len - start, flags) < 0
+		|| msync(hfile->map, sizeof(hashfile_header), flags) < 0)
+	{
+		message(LOG_NOTICE, FACILITY_DATA, "msync FAILED: %d (%s)\n", errno,
+				strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+/*! Write LEN bytes of element X to offset OFFSET of HFILE and the numbers
+   of elements to the header of HFILE by one submission.  Return false on
+   file failure.  */
+
+static bool
+hfile_write_element(hfile_t hfile, void *x, size_t len, uint64_t offset)
+{
+	hashfile_header header;
+	io_request reqs[2];
+	unsigned int i;
+
+	header.n_elements = u32_to_le(hfile->n_elements);
+	header.n_deleted = u32_to_le(hfile->n_deleted);
+
+	if (hfile->map)
+	{
+		memcpy(hfile->map + offset, x, len);
+		memcpy(hfile->map, &header, sizeof(header));
+		return hfile_msync(hfile, offset, len);
+	}
+
+	reqs[0].fd = hfile->fd;
+	reqs[0].write = true;
+	reqs[0].buf = x;
+	reqs[0].len = len;
+	reqs[0].offset = offset;
+	reqs[1].fd = hfile->fd;
+	reqs[1].write = true;
+	reqs[1].buf = &header;
+	reqs[1].len = sizeof(header);
+	reqs[1].offset = 0;
+	io_engine_rw(reqs, 2);
+
+	for (i = 0; i < 2; i++)
+	{
+		if (reqs[i].result < 0)
+		{
+			message(LOG_NOTICE, FACILITY_DATA, "writing data FAILED: %d (%s)\n",
+					(int) -reqs[i].result, strerror(-reqs[i].result));
+			return false;
+		}
+
+		/* Finish a short write.  */
+		if ((size_t) reqs[i].result < reqs[i].len
+			&& !full_pwrite(hfile->fd, (char *)reqs[i].buf + reqs[i].result,
+							reqs[i].len - reqs[i].result,
+							reqs[i].offset + reqs[i].result))
+			return false;
+	}
+
+	if (hfile->sync == HFILE_SYNC_SYNC && fdatasync(hfile->fd) < 0)
+	{
+		message(LOG_NOTICE, FACILITY_DATA, "fdatasync FAILED: %d (%s)\n",
+				errno, strerror(errno));
+		return false;
+	}
+
+	return true;
 }
 
 /*! Find an empty slot for hfile_expand. HASH is the hash value for the
@@ -115,16 +266,19 @@ static uint64_t hfile_find_empty_slot(hfile_t hfile, hashval_t hash)
 }
 
 /*! Find a slot for ELEM. HASH is the hash value for the element to be
-   inserted. Expects no deleted slots in the table.  */
+   inserted. Expects no deleted slots in the table.  Store the last element
+   read to *SLOTP.  */
 
 static uint64_t
-hfile_find_slot(hfile_t hfile, const void *elem, hashval_t hash, bool insert)
+hfile_find_slot(hfile_t hfile, const void *elem, hashval_t hash, bool insert,
+				char **slotp)
 {
 	unsigned int size;
 	unsigned int idx;
 	uint64_t offset;
 	uint64_t first_deleted_slot;
 	uint32_t status;
+	char *slot;
 
 #ifdef ENABLE_CHECKING
 	if (hfile->fd < 0)
@@ -136,9 +290,11 @@ hfile_find_slot(hfile_t hfile, const void *elem, hashval_t hash, bool insert)
 	first_deleted_slot = 0;
 
 	offset = (uint64_t) idx *hfile->element_size + hfile->element_size;
-	status = hfile_read_element(hfile, offset);
-	if (status == (uint32_t) - 1)
+	slot = hfile_read_element(hfile, offset);
+	if (!slot)
 		return 0;
+	*slotp = slot;
+	status = le_to_u32(*(uint32_t *) slot);
 	if (status == EMPTY_SLOT)
 		goto empty_slot;
 	if (status == DELETED_SLOT)
@@ -149,7 +305,7 @@ hfile_find_slot(hfile_t hfile, const void *elem, hashval_t hash, bool insert)
 		if (status != VALID_SLOT)
 			zfsd_abort();
 #endif
-		if ((*hfile->eq_f) (hfile->element, elem))
+		if ((*hfile->eq_f) (slot, elem))
 			return offset;
 	}
 
@@ -160,9 +316,11 @@ hfile_find_slot(hfile_t hfile, const void *elem, hashval_t hash, bool insert)
 			idx -= size;
 
 		offset = (uint64_t) idx *hfile->element_size + hfile->element_size;
-		status = hfile_read_element(hfile, offset);
-		if (status == (uint32_t) - 1)
+		slot = hfile_read_element(hfile, offset);
+		if (!slot)
 			return 0;
+		*slotp = slot;
+		status = le_to_u32(*(uint32_t *) slot);
 		if (status == EMPTY_SLOT)
 			goto empty_slot;
 		if (status == DELETED_SLOT)
@@ -176,7 +334,7 @@ hfile_find_slot(hfile_t hfile, const void *elem, hashval_t hash, bool insert)
 			if (status != VALID_SLOT)
 				zfsd_abort();
 #endif
-			if ((*hfile->eq_f) (hfile->element, elem))
+			if ((*hfile->eq_f) (slot, elem))
 				return offset;
 		}
 	}
@@ -217,6 +375,9 @@ static bool hfile_expand(hfile_t hfile)
 	else
 		return true;
 
+	/* The elements are moved to a new file.  */
+	hfile_unmap(hfile);
+
 	old_fd = hfile->fd;
 	old_size = hfile->size;
 	hfile->size = new_size;
@@ -290,13 +451,8 @@ static bool hfile_expand(hfile_t hfile)
 					goto hfile_expand_error_with_fd;
 				}
 
-				if ((uint64_t) lseek(hfile->fd, offset, SEEK_SET) != offset)
-				{
-					message(LOG_ALERT, FACILITY_ZFSD, "%s:%d\n", __func__, __LINE__);
-					goto hfile_expand_error_with_fd;
-				}
-
-				if (!full_write(hfile->fd, element, hfile->element_size))
+				if (!full_pwrite(hfile->fd, element, hfile->element_size,
+								 offset))
 				{
 					message(LOG_ALERT, FACILITY_ZFSD, "%s:%d\n", __func__, __LINE__);
 					goto hfile_expand_error_with_fd;
@@ -383,6 +539,10 @@ hfile_create(unsigned int element_size, unsigned int base_size,
 	hfile->file_name = xstrdup(file_name);
 	hfile->fd = -1;
 	hfile->generation = 0;
+	hfile->use_mmap = false;
+	hfile->sync = HFILE_SYNC_NONE;
+	hfile->map = NULL;
+	hfile->map_size = 0;
 
 	return hfile;
 }
@@ -418,6 +578,19 @@ bool hfile_init(hfile_t hfile, struct stat * st)
 	return true;
 }
 
+/*! Access hash file HFILE through a memory mapping if USE_MMAP is true and
+   write its changes to disk as SYNC says.  */
+
+void hfile_set_io(hfile_t hfile, bool use_mmap, hfile_sync sync)
+{
+	CHECK_MUTEX_LOCKED(hfile->mutex);
+
+	if (!use_mmap)
+		hfile_unmap(hfile);
+	hfile->use_mmap = use_mmap;
+	hfile->sync = sync;
+}
+
 /*! Destroy the hash table HTAB.  */
 
 void hfile_destroy(hfile_t hfile)
@@ -429,6 +602,7 @@ void hfile_destroy(hfile_t hfile)
 		zfsd_abort();
 #endif
 
+	hfile_unmap(hfile);
 	free(hfile->file_name);
 	free(hfile->element);
 	free(hfile);
@@ -440,11 +614,14 @@ bool hfile_lookup(hfile_t hfile, void *x)
 {
 	uint64_t offset;
 	uint32_t status;
+	char *slot;
+
+	hfile_map(hfile);
 
 	if (hfile->encode_f)
 		(*hfile->encode_f) (x);
 
-	offset = hfile_find_slot(hfile, x, (*hfile->hash_f) (x), false);
+	offset = hfile_find_slot(hfile, x, (*hfile->hash_f) (x), false, &slot);
 	if (!offset)
 	{
 		if (hfile->decode_f)
@@ -452,10 +629,10 @@ bool hfile_lookup(hfile_t hfile, void *x)
 		return false;
 	}
 
-	status = le_to_u32(*(uint32_t *) hfile->element);
+	status = le_to_u32(*(uint32_t *) slot);
 	if (status == VALID_SLOT)
 	{
-		memcpy(x, hfile->element, hfile->element_size);
+		memcpy(x, slot, hfile->element_size);
 		if (hfile->decode_f)
 			(*hfile->decode_f) (x);
 	}
@@ -472,18 +649,19 @@ bool hfile_insert(hfile_t hfile, void *x, bool base_only)
 {
 	uint64_t offset;
 	uint32_t status;
-	hashfile_header header;
+	char *slot;
 
 	if (!hfile_expand(hfile))
 	{
 		message(LOG_ALERT, FACILITY_ZFSD, "%s: hfile_expand has failed\n", __func__);
 		return false;
 	}
+	hfile_map(hfile);
 
 	if (hfile->encode_f)
 		(*hfile->encode_f) (x);
 
-	offset = hfile_find_slot(hfile, x, (*hfile->hash_f) (x), true);
+	offset = hfile_find_slot(hfile, x, (*hfile->hash_f) (x), true, &slot);
 	if (!offset)
 	{
 		if (hfile->decode_f)
@@ -492,30 +670,12 @@ bool hfile_insert(hfile_t hfile, void *x, bool base_only)
 		return false;
 	}
 
-	status = le_to_u32(*(uint32_t *) hfile->element);
+	status = le_to_u32(*(uint32_t *) slot);
 	*(uint32_t *) x = u32_to_le(VALID_SLOT);
 
-	if ((uint64_t) lseek(hfile->fd, offset, SEEK_SET) != offset)
-	{
-		message(LOG_ALERT, FACILITY_ZFSD, "%s:%d\n", __func__, __LINE__);
-		goto hfile_insert_error;
-	}
-
-	if (!full_write(hfile->fd, x, (base_only ? hfile->base_size : hfile->element_size)))
-	{
-		message(LOG_ALERT, FACILITY_ZFSD, "%s:%d\n", __func__, __LINE__);
-		goto hfile_insert_error;
-	}
-
-	if ((uint64_t) lseek(hfile->fd, 0, SEEK_SET) != 0)
-	{
-		message(LOG_ALERT, FACILITY_ZFSD, "%s:%d\n", __func__, __LINE__);
-		goto hfile_insert_error;
-	}
-
-	header.n_elements = u32_to_le(hfile->n_elements);
-	header.n_deleted = u32_to_le(hfile->n_deleted);
-	if (!full_write(hfile->fd, &header, sizeof(header)))
+	if (!hfile_write_element(hfile, x,
+							 (base_only ? hfile->base_size
+							  : hfile->element_size), offset))
 	{
 		message(LOG_ALERT, FACILITY_ZFSD, "%s:%d\n", __func__, __LINE__);
 		goto hfile_insert_error;
@@ -544,15 +704,16 @@ bool hfile_delete(hfile_t hfile, void *x)
 {
 	uint64_t offset;
 	uint32_t status;
-	hashfile_header header;
+	char *slot;
 
 	if (!hfile_expand(hfile))
 		return false;
+	hfile_map(hfile);
 
 	if (hfile->encode_f)
 		(*hfile->encode_f) (x);
 
-	offset = hfile_find_slot(hfile, x, (*hfile->hash_f) (x), false);
+	offset = hfile_find_slot(hfile, x, (*hfile->hash_f) (x), false, &slot);
 	if (!offset)
 	{
 		if (hfile->decode_f)
@@ -560,7 +721,7 @@ bool hfile_delete(hfile_t hfile, void *x)
 		return false;
 	}
 
-	status = le_to_u32(*(uint32_t *) hfile->element);
+	status = le_to_u32(*(uint32_t *) slot);
 	if (status != VALID_SLOT)
 	{
 		if (hfile->decode_f)
@@ -568,23 +729,24 @@ bool hfile_delete(hfile_t hfile, void *x)
 		return true;
 	}
 
-	memset(hfile->element, 0, hfile->element_size);
-	*(uint32_t *) hfile->element = u32_to_le(DELETED_SLOT);
 	hfile->n_deleted++;
 
-	if ((uint64_t) lseek(hfile->fd, offset, SEEK_SET) != offset)
-		goto hfile_delete_error;
-
-	if (!full_write(hfile->fd, hfile->element, hfile->element_size))
-		goto hfile_delete_error;
-
-	if ((uint64_t) lseek(hfile->fd, 0, SEEK_SET) != 0)
-		goto hfile_delete_error;
-
-	header.n_elements = u32_to_le(hfile->n_elements);
-	header.n_deleted = u32_to_le(hfile->n_deleted);
-	if (!full_write(hfile->fd, &header, sizeof(header)))
-		goto hfile_delete_error;
+	/* The slot of a hash file mapped to memory is not copied to
+	   HFILE->ELEMENT, write only its status.  */
+	if (hfile->map)
+	{
+		status = u32_to_le(DELETED_SLOT);
+		if (!hfile_write_element(hfile, &status, sizeof(status), offset))
+			goto hfile_delete_error;
+	}
+	else
+	{
+		memset(hfile->element, 0, hfile->element_size);
+		*(uint32_t *) hfile->element = u32_to_le(DELETED_SLOT);
+		if (!hfile_write_element(hfile, hfile->element, hfile->element_size,
+								 offset))
+			goto hfile_delete_error;
+	}
 
 	if (hfile->decode_f)
 		(*hfile->decode_f) (x);
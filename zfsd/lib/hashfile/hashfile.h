@@ -29,6 +29,11 @@
 #include "pthread-wrapper.h"
 #include "memory.h"
 
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
 /*! Type of hash value.  */
 typedef unsigned int hashval_t;
 
@@ -44,6 +49,21 @@ typedef void (*hfile_decode) (void *x);
 /*! Encode element of the hash file.  */
 typedef void (*hfile_encode) (void *x);
 
+/*! When the changes of the hash file are written to disk.  */
+typedef enum hfile_sync_def
+{
+	/*! The kernel writes the changes when it wants to.  */
+	HFILE_SYNC_NONE,
+
+	/*! The writing of the changed pages of a hash file mapped to memory is
+	    started after each change.  */
+	HFILE_SYNC_ASYNC,
+
+	/*! Each change is on disk when the function changing the hash file
+	    returns.  */
+	HFILE_SYNC_SYNC
+} hfile_sync;
+
 /*! \brief Hash file datatype.  */
 typedef struct hfile_def
 {
@@ -88,6 +108,18 @@ typedef struct hfile_def
 
 	/*! Generation of file descriptor.  */
 	unsigned int generation;
+
+	/*! Access the hash file through a memory mapping.  */
+	bool use_mmap;
+
+	/*! When the changes of the hash file are written to disk.  */
+	hfile_sync sync;
+
+	/*! The hash file mapped to memory, NULL if it is not mapped.  */
+	char *map;
+
+	/*! Size of the mapping.  */
+	size_t map_size;
 } *hfile_t;
 
 /*! \brief Header of the hash file.  */
@@ -108,9 +140,14 @@ extern hfile_t hfile_create(unsigned int element_size, unsigned int base_size,
 							hfile_decode decode_f, hfile_encode encode_f,
 							const char *file_name, pthread_mutex_t * mutex);
 extern bool hfile_init(hfile_t hfile, struct stat *st);
+extern void hfile_set_io(hfile_t hfile, bool use_mmap, hfile_sync sync);
 extern void hfile_destroy(hfile_t hfile);
 extern bool hfile_lookup(hfile_t hfile, void *x);
 extern bool hfile_insert(hfile_t hfile, void *x, bool base_only);
 extern bool hfile_delete(hfile_t hfile, void *x);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,207 @@
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <iostream>
+#include "hashfile.h"
+
+/* Element of the size of the metadata of a file, the first 4 bytes are the
+   status of the slot.  */
+struct test_elem
+{
+	uint32_t status;
+	uint32_t key;
+	uint32_t value;
+	char padding[116];
+};
+
+static hashval_t test_hash(const void *x)
+{
+	return (hashval_t) (((const test_elem *) x)->key * 2654435761u);
+}
+
+static int test_eq(const void *x, const void *y)
+{
+	return ((const test_elem *) x)->key == ((const test_elem *) y)->key;
+}
+
+#define N_ELEMS 20000
+#define N_LOOKUPS 1000000
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Open hash file PATH the way init_volume_metadata does.  */
+
+static hfile_t test_open(const char *path, bool use_mmap)
+{
+	hashfile_header header;
+	struct stat st;
+	hfile_t hfile;
+
+	hfile = hfile_create(sizeof(test_elem), sizeof(test_elem), 32, test_hash,
+						 test_eq, NULL, NULL, path, NULL);
+	hfile->fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	EXPECT_GE(hfile->fd, 0);
+	if (!hfile_init(hfile, &st))
+	{
+		header.n_elements = 0;
+		header.n_deleted = 0;
+		EXPECT_EQ((ssize_t) sizeof(header),
+				  pwrite(hfile->fd, &header, sizeof(header), 0));
+		EXPECT_EQ(0, ftruncate(hfile->fd, ((uint64_t) hfile->size + 1)
+							   * sizeof(test_elem)));
+	}
+	hfile_set_io(hfile, use_mmap, HFILE_SYNC_NONE);
+
+	return hfile;
+}
+
+static void test_close(hfile_t hfile)
+{
+	close(hfile->fd);
+	hfile->fd = -1;
+	hfile_destroy(hfile);
+}
+
+static bool test_lookup(hfile_t hfile, uint32_t key, test_elem * e)
+{
+	memset(e, 0, sizeof(*e));
+	e->key = key;
+	return hfile_lookup(hfile, e);
+}
+
+/* Fill the hash file in mode WRITE_MMAP and check it in mode READ_MMAP.  */
+
+static void test_modes(bool write_mmap, bool read_mmap)
+{
+	char path[] = "/tmp/hashfile_testXXXXXX";
+	hfile_t hfile;
+	test_elem e;
+	uint32_t i;
+	int fd;
+
+	fd = mkstemp(path);
+	ASSERT_GE(fd, 0);
+	close(fd);
+	unlink(path);
+
+	hfile = test_open(path, write_mmap);
+	for (i = 0; i < N_ELEMS; i++)
+	{
+		memset(&e, 0, sizeof(e));
+		e.key = i;
+		e.value = ~i;
+		ASSERT_TRUE(hfile_insert(hfile, &e, false));
+	}
+	for (i = 0; i < N_ELEMS; i += 2)
+	{
+		memset(&e, 0, sizeof(e));
+		e.key = i;
+		ASSERT_TRUE(hfile_delete(hfile, &e));
+	}
+	test_close(hfile);
+
+	hfile = test_open(path, read_mmap);
+	ASSERT_EQ((unsigned int) N_ELEMS / 2, hfile->n_elements - hfile->n_deleted);
+	for (i = 0; i < N_ELEMS; i++)
+	{
+		ASSERT_TRUE(test_lookup(hfile, i, &e));
+		if (i % 2)
+		{
+			ASSERT_EQ((uint32_t) VALID_SLOT, e.status);
+			ASSERT_EQ(~i, e.value);
+		}
+		else
+			ASSERT_NE((uint32_t) VALID_SLOT, e.status);
+	}
+	test_close(hfile);
+
+	unlink(path);
+}
+
+TEST(hashfile_test, pread)
+{
+	test_modes(false, false);
+}
+
+TEST(hashfile_test, mmap)
+{
+	test_modes(true, true);
+}
+
+TEST(hashfile_test, mixed)
+{
+	test_modes(true, false);
+	test_modes(false, true);
+}
+
+/* Microbenchmark of the lookups of the metadata of a volume.  It only
+   reports the numbers, the test does not fail when it is slow.  */
+
+static double bench_lookups(const char *path, bool use_mmap)
+{
+	hfile_t hfile;
+	test_elem e;
+	double start, ns;
+	uint32_t i;
+
+	hfile = test_open(path, use_mmap);
+	start = now_ns();
+	for (i = 0; i < N_LOOKUPS; i++)
+	{
+		EXPECT_TRUE(test_lookup(hfile, (i * 7919) % N_ELEMS, &e));
+		EXPECT_EQ((uint32_t) VALID_SLOT, e.status);
+	}
+	ns = now_ns() - start;
+	test_close(hfile);
+
+	return N_LOOKUPS / (ns / 1e9);
+}
+
+TEST(hashfile_test, lookup_throughput)
+{
+	char path[] = "/tmp/hashfile_benchXXXXXX";
+	double pread_rate, mmap_rate;
+	hfile_t hfile;
+	test_elem e;
+	uint32_t i;
+	int fd;
+
+	fd = mkstemp(path);
+	ASSERT_GE(fd, 0);
+	close(fd);
+	unlink(path);
+
+	hfile = test_open(path, true);
+	for (i = 0; i < N_ELEMS; i++)
+	{
+		memset(&e, 0, sizeof(e));
+		e.key = i;
+		ASSERT_TRUE(hfile_insert(hfile, &e, false));
+	}
+	test_close(hfile);
+
+	pread_rate = bench_lookups(path, false);
+	mmap_rate = bench_lookups(path, true);
+	unlink(path);
+
+	std::cout << "lookups per second: pread " << pread_rate << ", mmap "
+		<< mmap_rate << std::endl;
+	RecordProperty("pread_lookups_per_second", (int) pread_rate);
+	RecordProperty("mmap_lookups_per_second", (int) mmap_rate);
+}
+
+int main(int argc, char **argv)
+{
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -23,6 +23,7 @@
    download it from http://www.gnu.org/licenses/gpl.html */
 
 #include "system.h"
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include "pthread-wrapper.h"
@@ -93,8 +94,15 @@ static unsigned int get_higher_prime(unsigned int n)
 	return primes[low];
 }
 
-/*! Find an empty slot for htab_expand. HASH is the hash value for the
-   element to be inserted. Expects no deleted slots in the table.  */
+/*! Tables smaller than this are rehashed at once when expanded, bigger
+   tables are migrated incrementally.  */
+#define HTAB_INCREMENTAL_SIZE 4093
+
+/*! Number of slots of the old table migrated by one insertion.  */
+#define HTAB_MIGRATE_SLOTS 32
+
+/*! Find an empty slot in the table of HTAB for an element being moved from
+   the old table. HASH is the hash value for the element to be inserted.  */
 
 static void **htab_find_empty_slot(htab_t htab, hash_t hash)
 {
@@ -107,11 +115,15 @@ static void **htab_find_empty_slot(htab_t htab, hash_t hash)
 	idx = hash % size;
 	slot = htab->table + idx;
 	if (*slot == EMPTY_ENTRY)
+	{
+		htab->n_elements++;
 		return slot;
-#ifdef ENABLE_CHECKING
+	}
 	if (*slot == DELETED_ENTRY)
-		zfsd_abort();
-#endif
+	{
+		htab->n_deleted--;
+		return slot;
+	}
 
 	step = 1 + hash % (size - 2);
 	for (;;)
@@ -122,44 +134,112 @@ static void **htab_find_empty_slot(htab_t htab, hash_t hash)
 
 		slot = htab->table + idx;
 		if (*slot == EMPTY_ENTRY)
+		{
+			htab->n_elements++;
 			return slot;
-#ifdef ENABLE_CHECKING
+		}
 		if (*slot == DELETED_ENTRY)
+		{
+			htab->n_deleted--;
+			return slot;
+		}
+	}
+}
+
+/*! Return true if SLOT points to the old table of HTAB.  */
+
+static inline bool htab_old_slot_p(htab_t htab, void **slot)
+{
+	return (htab->old_table != NULL && slot >= htab->old_table
+			&& slot < htab->old_table + htab->old_size);
+}
+
+/*! Move at most N slots from the old table of HTAB to its table.  Free the
+   old table when all slots were moved.  */
+
+static void htab_migrate(htab_t htab, unsigned int n)
+{
+	void **old_slot;
+
+	while (n > 0 && htab->migrate_pos < htab->old_size)
+	{
+		old_slot = htab->old_table + htab->migrate_pos;
+		if (*old_slot != EMPTY_ENTRY && *old_slot != DELETED_ENTRY)
+		{
+			void **slot;
+
+			slot = htab_find_empty_slot(htab, (*htab->hash_f) (*old_slot));
+			*slot = *old_slot;
+
+			/* Keep the probe chains of the old table unbroken.  */
+			*old_slot = DELETED_ENTRY;
+			htab->old_n_elements--;
+		}
+		htab->migrate_pos++;
+		n--;
+	}
+
+	if (htab->migrate_pos >= htab->old_size)
+	{
+#ifdef ENABLE_CHECKING
+		if (htab->old_n_elements != 0)
 			zfsd_abort();
 #endif
+		free(htab->old_table);
+		htab->old_table = NULL;
+		htab->old_size = 0;
+		htab->old_n_elements = 0;
+		htab->migrate_pos = 0;
 	}
 }
 
-/*! Expand the hash table HTAB.  */
+/*! Allocate a bigger table for HTAB.  If INCREMENTAL is true the elements
+   are migrated from the old table later, a few slots per insertion, so that
+   expansion of a big table does not block the users of the table.  */
 
-void htab_expand(htab_t htab)
+static void htab_resize(htab_t htab, bool incremental)
 {
-	void **new_table;
 	void **old_table;
-	unsigned int new_size, old_size, i;
+	unsigned int new_size, old_size;
+
+	/* Finish the previous expansion first.  */
+	if (htab->old_table)
+		htab_migrate(htab, UINT_MAX);
 
 	old_table = htab->table;
 	old_size = htab->size;
 
 	/* Get next prime number from table.  */
 	new_size = get_higher_prime((htab->n_elements - htab->n_deleted) * 2 + 1);
-	new_table = (void **)xcalloc(new_size, sizeof(void *));
-	htab->table = new_table;
+	htab->table = (void **)xcalloc(new_size, sizeof(void *));
 	htab->size = new_size;
 
-	htab->n_elements -= htab->n_deleted;
+	htab->old_table = old_table;
+	htab->old_size = old_size;
+	htab->old_n_elements = htab->n_elements - htab->n_deleted;
+	htab->migrate_pos = 0;
+
+	htab->n_elements = 0;
 	htab->n_deleted = 0;
 
-	for (i = 0; i < old_size; i++)
-		if (old_table[i] != EMPTY_ENTRY && old_table[i] != DELETED_ENTRY)
-		{
-			void **slot;
+	if (!incremental || old_size < HTAB_INCREMENTAL_SIZE)
+		htab_migrate(htab, UINT_MAX);
+}
 
-			slot = htab_find_empty_slot(htab, (*htab->hash_f) (old_table[i]));
-			*slot = old_table[i];
-		}
+/*! Expand the hash table HTAB, i.e. rehash all elements to a new table.  */
 
-	free(old_table);
+void htab_expand(htab_t htab)
+{
+	htab_resize(htab, false);
+}
+
+/*! Move the elements of HTAB which have not been migrated from the old table
+   yet, so that all elements are in the table of HTAB.  */
+
+void htab_finish_migration(htab_t htab)
+{
+	if (htab->old_table)
+		htab_migrate(htab, UINT_MAX);
 }
 
 /*! Create the hash table data structure with SIZE elements, hash function
@@ -184,6 +264,10 @@ htab_create(unsigned int size, htab_hash hash_f, htab_eq eq_f, htab_del del_f,
 	htab->size = size;
 	htab->n_elements = 0;
 	htab->n_deleted = 0;
+	htab->old_table = NULL;
+	htab->old_size = 0;
+	htab->old_n_elements = 0;
+	htab->migrate_pos = 0;
 	htab->hash_f = hash_f;
 	htab->eq_f = eq_f;
 	htab->del_f = del_f;
@@ -191,21 +275,33 @@ htab_create(unsigned int size, htab_hash hash_f, htab_eq eq_f, htab_del del_f,
 	return htab;
 }
 
+/*! Call the cleanup function of HTAB for each element of TABLE of size
+   SIZE.  */
+
+static void htab_delete_elements(htab_t htab, void **table, unsigned int size)
+{
+	unsigned int i;
+
+	if (htab->del_f)
+	{
+		for (i = 0; i < size; i++)
+			if (table[i] != EMPTY_ENTRY && table[i] != DELETED_ENTRY)
+				(*htab->del_f) (table[i]);
+	}
+}
+
 /*! Destroy the hash table HTAB.  If the cleanup function is defined it is
    called for each present element.  */
 
 void htab_destroy(htab_t htab)
 {
-	unsigned int i;
-
 	CHECK_MUTEX_LOCKED(htab->mutex);
 
-	if (htab->del_f)
+	htab_delete_elements(htab, htab->table, htab->size);
+	if (htab->old_table)
 	{
-		for (i = 0; i < htab->size; i++)
-			if (htab->table[i] != EMPTY_ENTRY
-				&& htab->table[i] != DELETED_ENTRY)
-				(*htab->del_f) (htab->table[i]);
+		htab_delete_elements(htab, htab->old_table, htab->old_size);
+		free(htab->old_table);
 	}
 	free(htab->table);
 	free(htab);
@@ -215,19 +311,22 @@ void htab_destroy(htab_t htab)
 
 void htab_empty(htab_t htab)
 {
-	unsigned int i;
-
 	CHECK_MUTEX_LOCKED(htab->mutex);
 
-	if (htab->del_f)
+	htab_delete_elements(htab, htab->table, htab->size);
+	if (htab->old_table)
 	{
-		for (i = 0; i < htab->size; i++)
-			if (htab->table[i] != EMPTY_ENTRY
-				&& htab->table[i] != DELETED_ENTRY)
-				(*htab->del_f) (htab->table[i]);
+		htab_delete_elements(htab, htab->old_table, htab->old_size);
+		free(htab->old_table);
+		htab->old_table = NULL;
+		htab->old_size = 0;
+		htab->old_n_elements = 0;
+		htab->migrate_pos = 0;
 	}
 
 	memset(htab->table, 0, htab->size * sizeof(void *));
+	htab->n_elements = 0;
+	htab->n_deleted = 0;
 }
 
 /*! Clear the slot SLOT of the hash table HTAB.  If the cleanup function is
@@ -235,9 +334,13 @@ void htab_empty(htab_t htab)
 
 void htab_clear_slot(htab_t htab, void **slot)
 {
+	bool old_p;
+
 	CHECK_MUTEX_LOCKED(htab->mutex);
+
+	old_p = htab_old_slot_p(htab, slot);
 #ifdef ENABLE_CHECKING
-	if (slot < htab->table || slot >= htab->table + htab->size
+	if ((!old_p && (slot < htab->table || slot >= htab->table + htab->size))
 		|| *slot == EMPTY_ENTRY || *slot == DELETED_ENTRY)
 		zfsd_abort();
 #endif
@@ -246,7 +349,10 @@ void htab_clear_slot(htab_t htab, void **slot)
 		(*htab->del_f) (*slot);
 
 	*slot = DELETED_ENTRY;
-	htab->n_deleted++;
+	if (old_p)
+		htab->old_n_elements--;
+	else
+		htab->n_deleted++;
 }
 
 /*! Similar to HTAB_FIND_WITH_HASH but it computes the hash key first.  */
@@ -255,26 +361,24 @@ void *htab_find(htab_t htab, const void *elem)
 	return htab_find_with_hash(htab, elem, (*htab->hash_f) (elem));
 }
 
-/*! Find the element ELEM whose hash key is HASH in hash table HTAB. This
-   function cannot be used to insert or delete an element, use
-   htab_find_slot_with_hash and htab_clear_slot for that purpose.  */
+/*! Find the slot of TABLE of size SIZE which contains element ELEM with
+   hash key HASH using compare function EQ_F.  Return NULL if ELEM is not in
+   TABLE.  */
 
-void *htab_find_with_hash(htab_t htab, const void *elem, hash_t hash)
+static void **htab_lookup_slot(void **table, unsigned int size, htab_eq eq_f,
+							   const void *elem, hash_t hash)
 {
-	unsigned int size;
 	unsigned int idx;
 	unsigned int step;
 	void *entry;
 
-	CHECK_MUTEX_LOCKED(htab->mutex);
-
-	size = htab->size;
 	idx = hash % size;
 
-	entry = htab->table[idx];
-	if (entry == EMPTY_ENTRY
-		|| (entry != DELETED_ENTRY && (*htab->eq_f) (entry, elem)))
-		return entry;
+	entry = table[idx];
+	if (entry == EMPTY_ENTRY)
+		return NULL;
+	if (entry != DELETED_ENTRY && (*eq_f) (entry, elem))
+		return &table[idx];
 
 	step = 1 + hash % (size - 2);
 	for (;;)
@@ -283,13 +387,32 @@ void *htab_find_with_hash(htab_t htab, const void *elem, hash_t hash)
 		if (idx >= size)
 			idx -= size;
 
-		entry = htab->table[idx];
-		if (entry == EMPTY_ENTRY
-			|| (entry != DELETED_ENTRY && (*htab->eq_f) (entry, elem)))
-			return entry;
+		entry = table[idx];
+		if (entry == EMPTY_ENTRY)
+			return NULL;
+		if (entry != DELETED_ENTRY && (*eq_f) (entry, elem))
+			return &table[idx];
 	}
 }
 
+/*! Find the element ELEM whose hash key is HASH in hash table HTAB. This
+   function cannot be used to insert or delete an element, use
+   htab_find_slot_with_hash and htab_clear_slot for that purpose.  */
+
+void *htab_find_with_hash(htab_t htab, const void *elem, hash_t hash)
+{
+	void **slot;
+
+	CHECK_MUTEX_LOCKED(htab->mutex);
+
+	slot = htab_lookup_slot(htab->table, htab->size, htab->eq_f, elem, hash);
+	if (!slot && htab->old_table)
+		slot = htab_lookup_slot(htab->old_table, htab->old_size, htab->eq_f,
+								elem, hash);
+
+	return slot ? *slot : EMPTY_ENTRY;
+}
+
 /*! Similar to HTAB_FIND_SLOT_WITH_HASH but it computes the hash key first.  */
 
 void **htab_find_slot(htab_t htab, const void *elem, enum insert insert)
@@ -310,11 +433,17 @@ void **htab_find_slot_with_hash(htab_t htab, const void *elem, hash_t hash,
 	unsigned int idx;
 	unsigned int step;
 	void **first_deleted_slot;
+	void **old_slot;
 
 	CHECK_MUTEX_LOCKED(htab->mutex);
 
-	if (insert == INSERT && htab->size * 2 <= htab->n_elements * 3)
-		htab_expand(htab);
+	if (insert == INSERT)
+	{
+		if (htab->size * 2 <= (htab->n_elements + htab->old_n_elements) * 3)
+			htab_resize(htab, true);
+		else if (htab->old_table)
+			htab_migrate(htab, HTAB_MIGRATE_SLOTS);
+	}
 
 	size = htab->size;
 	idx = hash % size;
@@ -346,16 +475,33 @@ void **htab_find_slot_with_hash(htab_t htab, const void *elem, hash_t hash,
 	}
 
   empty_entry:
+	old_slot = NULL;
+	if (htab->old_table)
+		old_slot = htab_lookup_slot(htab->old_table, htab->old_size,
+									htab->eq_f, elem, hash);
+
 	if (insert == NO_INSERT)
-		return NULL;
+		return old_slot;
 
 	if (first_deleted_slot)
 	{
 		htab->n_deleted--;
 		*first_deleted_slot = EMPTY_ENTRY;
-		return first_deleted_slot;
+	}
+	else
+	{
+		htab->n_elements++;
+		first_deleted_slot = &htab->table[idx];
+	}
+
+	/* Move the element found in the old table to the new one so that the
+	   returned slot is always in the current table.  */
+	if (old_slot)
+	{
+		*first_deleted_slot = *old_slot;
+		*old_slot = DELETED_ENTRY;
+		htab->old_n_elements--;
 	}
 
-	htab->n_elements++;
-	return &htab->table[idx];
+	return first_deleted_slot;
 }
@@ -28,6 +28,11 @@
 #include "system.h"
 #include "pthread-wrapper.h"
 
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
 /*! Insert operation.  */
 enum insert
 {
@@ -62,6 +67,18 @@ typedef struct htab_def
 	/*! Current number of deleted elements.  */
 	unsigned int n_deleted;
 
+	/*! Table being migrated to TABLE after the last expansion or NULL.  */
+	void **old_table;
+
+	/*! Size of the old table.  */
+	unsigned int old_size;
+
+	/*! Number of elements which were not migrated from old table yet.  */
+	unsigned int old_n_elements;
+
+	/*! Index of the next slot of old table to be migrated.  */
+	unsigned int migrate_pos;
+
 	/*! Hash function.  */
 	htab_hash hash_f;
 
@@ -76,6 +93,7 @@ typedef struct htab_def
 } *htab_t;
 
 extern void htab_expand(htab_t htab);
+extern void htab_finish_migration(htab_t htab);
 extern htab_t htab_create(unsigned int size, htab_hash hash_f, htab_eq eq_f,
 						  htab_del del_f, pthread_mutex_t * mutex);
 extern void htab_destroy(htab_t htab);
@@ -88,15 +106,25 @@ extern void **htab_find_slot(htab_t htab, const void *elem,
 extern void **htab_find_slot_with_hash(htab_t htab, const void *elem,
 									   hash_t hash, enum insert insert);
 
+#ifdef __cplusplus
+}
+#endif
+
 /*! Value for empty hash table entry.  */
 #define EMPTY_ENTRY ((void *) 0)
 
 /*! Value for deleted hash table entry.  */
 #define DELETED_ENTRY ((void *) 1)
 
+/*! Number of elements stored in hash table HTAB.  */
+#define HTAB_N_ELEMENTS(HTAB)						\
+  ((HTAB)->n_elements - (HTAB)->n_deleted + (HTAB)->old_n_elements)
+
 /*! Loop through all valid SLOTs of hash table HTAB.  */
 #define HTAB_FOR_EACH_SLOT(HTAB, SLOT)					\
   CHECK_MUTEX_LOCKED ((HTAB)->mutex);					\
+  if ((HTAB)->old_table != NULL)					\
+    htab_finish_migration ((HTAB));					\
   if (((HTAB)->n_elements - (HTAB)->n_deleted) * 8 < (HTAB)->size)	\
     htab_expand ((HTAB));						\
   for ((SLOT) = (HTAB)->table;						\
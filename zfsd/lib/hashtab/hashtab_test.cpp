@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include "hashtab.h"
+
+static hash_t test_hash(const void *x)
+{
+	return (hash_t) (*(const uintptr_t *) x * 2654435761u);
+}
+
+static int test_eq(const void *x, const void *y)
+{
+	return *(const uintptr_t *) x == *(const uintptr_t *) y;
+}
+
+#define N_ELEMS 100000
+
+static uintptr_t elems[N_ELEMS];
+
+TEST(hashtab_test, incremental_expand)
+{
+	htab_t htab = htab_create(7, test_hash, test_eq, NULL, NULL);
+	unsigned int i;
+
+	for (i = 0; i < N_ELEMS; i++)
+	{
+		void **slot;
+
+		elems[i] = i;
+		slot = htab_find_slot(htab, &elems[i], INSERT);
+		ASSERT_TRUE(*slot == EMPTY_ENTRY) << "Element " << i << " inserted twice.";
+		*slot = &elems[i];
+
+		/* Every element must be reachable while the table is migrated.  */
+		ASSERT_TRUE(htab_find(htab, &elems[i / 2]) == &elems[i / 2]);
+	}
+	ASSERT_EQ((unsigned int) N_ELEMS, HTAB_N_ELEMENTS(htab));
+
+	for (i = 0; i < N_ELEMS; i += 2)
+	{
+		void **slot = htab_find_slot(htab, &elems[i], NO_INSERT);
+		ASSERT_TRUE(slot != NULL);
+		htab_clear_slot(htab, slot);
+	}
+	ASSERT_EQ((unsigned int) N_ELEMS / 2, HTAB_N_ELEMENTS(htab));
+
+	for (i = 0; i < N_ELEMS; i++)
+	{
+		void *found = htab_find(htab, &elems[i]);
+		if (i % 2)
+			ASSERT_TRUE(found == &elems[i]);
+		else
+			ASSERT_TRUE(found == EMPTY_ENTRY);
+	}
+
+	void **slot;
+	unsigned int n = 0;
+	HTAB_FOR_EACH_SLOT(htab, slot)
+		n++;
+	ASSERT_EQ((unsigned int) N_ELEMS / 2, n);
+
+	htab_destroy(htab);
+}
+
+TEST(hashtab_test, for_each_finishes_migration)
+{
+	htab_t htab = htab_create(7, test_hash, test_eq, NULL, NULL);
+	unsigned int i, n;
+	void **table, **slot;
+
+	/* Insert until a big table is being migrated.  */
+	for (i = 0; i < N_ELEMS; i++)
+	{
+		elems[i] = i;
+		slot = htab_find_slot(htab, &elems[i], INSERT);
+		*slot = &elems[i];
+		if (htab->old_table != NULL && htab->migrate_pos > 0)
+			break;
+	}
+	ASSERT_TRUE(htab->old_table != NULL);
+
+	/* The pending migration is finished without rehashing the table.  */
+	table = htab->table;
+	n = 0;
+	HTAB_FOR_EACH_SLOT(htab, slot)
+		n++;
+	ASSERT_TRUE(htab->old_table == NULL);
+	ASSERT_TRUE(htab->table == table);
+	ASSERT_EQ(i + 1, n);
+	ASSERT_EQ(i + 1, HTAB_N_ELEMENTS(htab));
+
+	htab_destroy(htab);
+}
+
+int main(int argc, char **argv) 
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -337,22 +337,23 @@ bool interval_tree_covered(interval_tree tree, uint64_t start, uint64_t end)
 	return (end <= INTERVAL_END(node));
 }
 
-/*! Read N intervals of interval tree TREE from file descriptor FD. Position
-   in FD should be at the beginning.  */
+/*! Read N intervals of interval tree TREE from the beginning of file
+   descriptor FD.  */
 
 bool interval_tree_read(interval_tree tree, int fd, uint64_t n)
 {
 	interval intervals[INTERVAL_COUNT];
+	off_t offset;
 	int i, block;
 	bool r;
 
 	CHECK_MUTEX_LOCKED(tree->mutex);
 
-	for (; n > 0; n -= block)
+	for (offset = 0; n > 0; n -= block, offset += block * sizeof(interval))
 	{
 		block = n > INTERVAL_COUNT ? INTERVAL_COUNT : n;
 
-		r = full_read(fd, intervals, block * sizeof(interval));
+		r = full_pread(fd, intervals, block * sizeof(interval), offset);
 		if (!r)
 			return false;
 
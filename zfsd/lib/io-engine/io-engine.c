@@ -0,0 +1,481 @@
+/**
+ *  \file io-engine.c
+ *  \brief Engine doing the positional I/O on local files.
+ *
+ *  When zfsd is built with liburing and the ring is configured, the reads
+ *  and writes are submitted to one io_uring shared by all threads.  All
+ *  requests passed to io_engine_rw together are submitted by one system
+ *  call.  A completion thread reaps the completions in batches and wakes up
+ *  the threads waiting for them.  Otherwise, and before io_engine_start or
+ *  after io_engine_cleanup, the requests are done by pread and pwrite in the
+ *  calling thread.  The requests which the kernel did not accept are done
+ *  by pread and pwrite too.
+ */
+
+/* Copyright (C) 2026 ZFS contributors
+
+   This file is part of ZFS.
+
+   ZFS is free software; you can redistribute it and/or modify it under the
+   terms of the GNU General Public License as published by the Free Software
+   Foundation; either version 2, or (at your option) any later version.
+
+   ZFS is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General Public License along
+   with ZFS; see the file COPYING.  If not, write to the Free Software
+   Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA; or
+   download it from http://www.gnu.org/licenses/gpl.html */
+
+#include "system.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+#include "pthread-wrapper.h"
+#include "thread.h"
+#include "log.h"
+#include "io-engine.h"
+
+/*! Mutex protecting the ring and the statistics.  */
+static pthread_mutex_t io_engine_mutex = ZFS_MUTEX_INITIALIZER;
+
+/*! Statistics of the engine.  REQUESTS and SYNC_CALLS are updated
+   atomically without IO_ENGINE_MUTEX.  */
+static io_engine_stats io_stats;
+
+/*! Do request REQ by a system call in the calling thread.  */
+
+static void io_request_sync(io_request * req)
+{
+	ssize_t r;
+
+	do
+	{
+		__atomic_add_fetch(&io_stats.sync_calls, 1, __ATOMIC_RELAXED);
+		if (req->write)
+			r = pwrite(req->fd, req->buf, req->len, req->offset);
+		else
+			r = pread(req->fd, req->buf, req->len, req->offset);
+	}
+	while (r < 0 && errno == EINTR);
+
+	req->result = (r < 0 ? -errno : r);
+}
+
+#ifdef HAVE_LIBURING
+
+/*! Maximal number of completions reaped at once.  */
+#define IO_ENGINE_CQE_BATCH 32
+
+/*! Maximal delay in seconds between the retries of a failing wait for
+   completions.  */
+#define IO_ENGINE_MAX_RETRY_DELAY 8
+
+/*! \brief Requests submitted together.  */
+typedef struct io_batch_def
+{
+	unsigned int pending;		/*!< number of requests not completed yet */
+} io_batch;
+
+/*! The ring shared by all threads.  */
+static struct io_uring io_ring;
+
+/*! Is the ring used?  It is changed only when no other thread does I/O.  */
+static bool io_ring_running;
+
+/*! Thread reaping the completions.  */
+static pthread_t io_completion_thread;
+
+/*! Signalled when some requests have completed.  */
+static pthread_cond_t io_engine_cond = PTHREAD_COND_INITIALIZER;
+
+/*! Number of entries left in the submission queue by a failed submission.
+   They are no-ops which are submitted together with the next requests.  */
+static unsigned int io_ring_unsubmitted;
+
+/*! Data of the no-ops replacing the requests which were not submitted.  */
+static io_request io_cancelled_request;
+
+/*! Main function of the thread reaping the completions.  It exits when
+   the request without data submitted by io_engine_cleanup completes.  */
+
+static void *io_completion_main(ATTRIBUTE_UNUSED void *data)
+{
+	struct io_uring_cqe *cqes[IO_ENGINE_CQE_BATCH];
+	struct io_uring_cqe *cqe;
+	io_request *req;
+	io_batch *batch;
+	unsigned int i, n, reaped;
+	unsigned int delay = 0;
+	bool stop = false;
+	int r;
+
+	thread_disable_signals();
+	pthread_setspecific(thread_name_key, "I/O completion thread");
+
+	while (!stop)
+	{
+		r = io_uring_wait_cqe(&io_ring, &cqe);
+		if (r < 0)
+		{
+			if (r == -EINTR)
+				continue;
+
+			/* Do not spin when the error persists.  */
+			if (delay == 0)
+				message(LOG_ERROR, FACILITY_DATA, "io_uring_wait_cqe: %s\n",
+						strerror(-r));
+			delay = (delay == 0 ? 1 : 2 * delay);
+			if (delay > IO_ENGINE_MAX_RETRY_DELAY)
+				delay = IO_ENGINE_MAX_RETRY_DELAY;
+			sleep(delay);
+			continue;
+		}
+		delay = 0;
+
+		n = io_uring_peek_batch_cqe(&io_ring, cqes, IO_ENGINE_CQE_BATCH);
+
+		zfsd_mutex_lock(&io_engine_mutex);
+		reaped = 0;
+		for (i = 0; i < n; i++)
+		{
+			req = (io_request *) io_uring_cqe_get_data(cqes[i]);
+			if (!req)
+			{
+				stop = true;
+				continue;
+			}
+
+			reaped++;
+			if (req == &io_cancelled_request)
+				continue;
+
+			/* The waiting thread checks PENDING under IO_ENGINE_MUTEX and
+			   the batch is not used after it is unlocked.  */
+			req->result = cqes[i]->res;
+			batch = (io_batch *) req->batch;
+			batch->pending--;
+		}
+		io_uring_cq_advance(&io_ring, n);
+
+		io_stats.in_flight -= reaped;
+		io_stats.completed += reaped;
+		io_stats.completion_batches++;
+		zfsd_cond_broadcast(&io_engine_cond);
+		zfsd_mutex_unlock(&io_engine_mutex);
+	}
+
+	return NULL;
+}
+
+/*! Submit TO_SUBMIT entries waiting in the submission queue.  Return the
+   number of entries the kernel did not accept, they are the last ones
+   because the kernel consumes the queue in order.  */
+
+static unsigned int io_ring_submit(unsigned int to_submit)
+{
+	int r = 0;
+
+	CHECK_MUTEX_LOCKED(&io_engine_mutex);
+
+	while (to_submit > 0)
+	{
+		r = io_uring_submit(&io_ring);
+		if (r == -EINTR)
+			continue;
+		if (r <= 0)
+			break;
+		to_submit -= r;
+		io_stats.submit_calls++;
+	}
+
+	if (to_submit > 0)
+		message(LOG_ERROR, FACILITY_DATA, "io_uring_submit: %s\n",
+				r < 0 ? strerror(-r) : "no entry accepted");
+
+	return to_submit;
+}
+
+/*! Submit the N requests REQS to the ring by one system call and wait until
+   they complete.  N must not be greater than the size of the ring.  The
+   requests which the kernel did not accept are done synchronously.  */
+
+static void io_ring_rw(io_request * reqs, unsigned int n)
+{
+	struct io_uring_sqe *sqe;
+	io_batch batch;
+	unsigned int i, failed;
+
+	zfsd_mutex_lock(&io_engine_mutex);
+	while (1)
+	{
+		/* Do not wait for the space occupied by entries which may never
+		   be submitted.  */
+		if (io_ring_unsubmitted > 0)
+		{
+			io_ring_unsubmitted = io_ring_submit(io_ring_unsubmitted);
+			if (io_ring_unsubmitted > 0)
+			{
+				zfsd_mutex_unlock(&io_engine_mutex);
+				for (i = 0; i < n; i++)
+					io_request_sync(&reqs[i]);
+				return;
+			}
+		}
+		if (io_stats.in_flight + n <= io_stats.entries)
+			break;
+		zfsd_cond_wait(&io_engine_cond, &io_engine_mutex);
+	}
+
+	/* The submission queue has a free entry for each request because the
+	   queue is flushed before IO_ENGINE_MUTEX is unlocked.  */
+	batch.pending = n;
+	for (i = 0; i < n; i++)
+	{
+		sqe = io_uring_get_sqe(&io_ring);
+#ifdef ENABLE_CHECKING
+		if (!sqe)
+			zfsd_abort();
+#endif
+		reqs[i].batch = &batch;
+		reqs[i].sqe = sqe;
+		if (reqs[i].write)
+			io_uring_prep_write(sqe, reqs[i].fd, reqs[i].buf, reqs[i].len,
+								reqs[i].offset);
+		else
+			io_uring_prep_read(sqe, reqs[i].fd, reqs[i].buf, reqs[i].len,
+							   reqs[i].offset);
+		io_uring_sqe_set_data(sqe, &reqs[i]);
+	}
+
+	failed = io_ring_submit(n);
+	if (failed > 0)
+	{
+		/* The entries stay in the submission queue, turn them to no-ops so
+		   that the kernel does not use the buffers of the requests when
+		   they are submitted later.  The no-ops occupy the ring until they
+		   complete.  */
+		for (i = n - failed; i < n; i++)
+		{
+			sqe = (struct io_uring_sqe *) reqs[i].sqe;
+			io_uring_prep_nop(sqe);
+			io_uring_sqe_set_data(sqe, &io_cancelled_request);
+		}
+		batch.pending -= failed;
+		io_ring_unsubmitted = failed;
+	}
+
+	io_stats.in_flight += n;
+	if (io_stats.in_flight > io_stats.max_in_flight)
+		io_stats.max_in_flight = io_stats.in_flight;
+	io_stats.submitted += n - failed;
+	zfsd_mutex_unlock(&io_engine_mutex);
+
+	for (i = n - failed; i < n; i++)
+		io_request_sync(&reqs[i]);
+
+	zfsd_mutex_lock(&io_engine_mutex);
+	while (batch.pending > 0)
+		zfsd_cond_wait(&io_engine_cond, &io_engine_mutex);
+	zfsd_mutex_unlock(&io_engine_mutex);
+}
+
+#endif
+
+/*! Start the engine with a ring of ENTRIES entries.  If ENTRIES is 0, the
+   ring is not supported by the kernel or zfsd is built without liburing,
+   the requests are done synchronously.  Return false if the ring could not
+   be started.  */
+
+bool io_engine_start(ATTRIBUTE_UNUSED unsigned int entries)
+{
+#ifdef HAVE_LIBURING
+	struct io_uring_probe *probe;
+	bool supported;
+	int r;
+
+	if (entries == 0)
+		return true;
+
+	r = io_uring_queue_init(entries, &io_ring, 0);
+	if (r < 0)
+	{
+		message(LOG_NOTICE, FACILITY_DATA,
+				"io_uring_queue_init: %s, using synchronous I/O\n",
+				strerror(-r));
+		return true;
+	}
+
+	probe = io_uring_get_probe_ring(&io_ring);
+	supported = (probe != NULL
+				 && io_uring_opcode_supported(probe, IORING_OP_READ)
+				 && io_uring_opcode_supported(probe, IORING_OP_WRITE));
+	if (probe)
+		io_uring_free_probe(probe);
+	if (!supported)
+	{
+		message(LOG_NOTICE, FACILITY_DATA,
+				"io_uring can't read and write, using synchronous I/O\n");
+		io_uring_queue_exit(&io_ring);
+		return true;
+	}
+
+	zfsd_mutex_lock(&io_engine_mutex);
+	io_stats.entries = *io_ring.sq.kring_entries;
+	zfsd_mutex_unlock(&io_engine_mutex);
+
+	r = pthread_create(&io_completion_thread, NULL, io_completion_main, NULL);
+	if (r != 0)
+	{
+		message(LOG_ERROR, FACILITY_THREADING, "pthread_create() failed\n");
+		io_uring_queue_exit(&io_ring);
+		io_stats.entries = 0;
+		return false;
+	}
+
+	io_ring_running = true;
+	message(LOG_INFO, FACILITY_DATA, "Using io_uring with %u entries\n",
+			io_stats.entries);
+#endif
+
+	return true;
+}
+
+/*! Stop the engine.  No other thread may do I/O.  */
+
+void io_engine_cleanup(void)
+{
+#ifdef HAVE_LIBURING
+	struct io_uring_sqe *sqe;
+	bool stopped;
+
+	if (!io_ring_running)
+		return;
+
+	io_ring_running = false;
+
+	/* Wake up the completion thread by a request without data.  */
+	zfsd_mutex_lock(&io_engine_mutex);
+	sqe = io_uring_get_sqe(&io_ring);
+	if (sqe)
+	{
+		io_uring_prep_nop(sqe);
+		io_uring_sqe_set_data(sqe, NULL);
+		io_ring_unsubmitted = io_ring_submit(io_ring_unsubmitted + 1);
+	}
+	stopped = (sqe != NULL && io_ring_unsubmitted == 0);
+	zfsd_mutex_unlock(&io_engine_mutex);
+
+	/* The completion thread would wait for the request forever, leave the
+	   ring to the exit of the process.  */
+	if (!stopped)
+	{
+		message(LOG_ERROR, FACILITY_DATA,
+				"Could not stop the I/O completion thread\n");
+		return;
+	}
+
+	pthread_join(io_completion_thread, NULL);
+	io_uring_queue_exit(&io_ring);
+
+	zfsd_mutex_lock(&io_engine_mutex);
+	io_stats.entries = 0;
+	zfsd_mutex_unlock(&io_engine_mutex);
+#endif
+}
+
+/*! Do the N requests REQS and wait until all of them are done.  The result
+   of each request is stored to its RESULT.  */
+
+void io_engine_rw(io_request * reqs, unsigned int n)
+{
+	unsigned int i;
+
+	__atomic_add_fetch(&io_stats.requests, n, __ATOMIC_RELAXED);
+
+#ifdef HAVE_LIBURING
+	if (io_ring_running)
+	{
+		unsigned int chunk;
+
+		for (i = 0; i < n; i += chunk)
+		{
+			chunk = n - i;
+			if (chunk > io_stats.entries)
+				chunk = io_stats.entries;
+			io_ring_rw(reqs + i, chunk);
+		}
+		return;
+	}
+#endif
+
+	for (i = 0; i < n; i++)
+		io_request_sync(&reqs[i]);
+}
+
+/*! Read at most LEN bytes from offset OFFSET of file descriptor FD to
+   buffer BUF.  Return the number of bytes read or -1 and set errno.  */
+
+ssize_t io_pread(int fd, void *buf, size_t len, off_t offset)
+{
+	io_request req;
+
+	req.fd = fd;
+	req.write = false;
+	req.buf = buf;
+	req.len = len;
+	req.offset = offset;
+	io_engine_rw(&req, 1);
+
+	if (req.result < 0)
+	{
+		errno = -req.result;
+		return -1;
+	}
+
+	return req.result;
+}
+
+/*! Write at most LEN bytes from buffer BUF to offset OFFSET of file
+   descriptor FD.  Return the number of bytes written or -1 and set
+   errno.  */
+
+ssize_t io_pwrite(int fd, const void *buf, size_t len, off_t offset)
+{
+	io_request req;
+
+	req.fd = fd;
+	req.write = true;
+	req.buf = CAST_QUAL(void *, buf);
+	req.len = len;
+	req.offset = offset;
+	io_engine_rw(&req, 1);
+
+	if (req.result < 0)
+	{
+		errno = -req.result;
+		return -1;
+	}
+
+	return req.result;
+}
+
+/*! Store the statistics of the engine to STATS.  */
+
+void io_engine_get_stats(io_engine_stats * stats)
+{
+	zfsd_mutex_lock(&io_engine_mutex);
+	*stats = io_stats;
+	zfsd_mutex_unlock(&io_engine_mutex);
+	stats->requests = __atomic_load_n(&io_stats.requests, __ATOMIC_RELAXED);
+	stats->sync_calls = __atomic_load_n(&io_stats.sync_calls,
+										__ATOMIC_RELAXED);
+}
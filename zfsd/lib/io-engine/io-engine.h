@@ -0,0 +1,77 @@
+/**
+ *  \file io-engine.h
+ *  \brief Engine doing the positional I/O on local files.
+ *
+ */
+
+/* Copyright (C) 2026 ZFS contributors
+
+   This file is part of ZFS.
+
+   ZFS is free software; you can redistribute it and/or modify it under the
+   terms of the GNU General Public License as published by the Free Software
+   Foundation; either version 2, or (at your option) any later version.
+
+   ZFS is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General Public License along
+   with ZFS; see the file COPYING.  If not, write to the Free Software
+   Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA; or
+   download it from http://www.gnu.org/licenses/gpl.html */
+
+#ifndef IO_ENGINE_H
+#define IO_ENGINE_H
+
+#include "system.h"
+#include <inttypes.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*! \brief One read or write of a local file.  */
+typedef struct io_request_def
+{
+	int fd;						/*!< file descriptor */
+	bool write;					/*!< write BUF instead of reading to it */
+	void *buf;					/*!< buffer for the data */
+	size_t len;					/*!< number of bytes to transfer */
+	off_t offset;				/*!< offset in the file */
+	ssize_t result;				/*!< bytes transferred or -errno */
+	void *batch;				/*!< batch of the request, used internally */
+	void *sqe;					/*!< ring entry, used internally */
+} io_request;
+
+/*! \brief Statistics of the I/O engine.  */
+typedef struct io_engine_stats_def
+{
+	uint32_t entries;			/*!< size of the ring, 0 if it is not used */
+	uint32_t in_flight;			/*!< requests being processed by the kernel */
+	uint32_t max_in_flight;		/*!< the maximal number of IN_FLIGHT */
+	uint64_t submitted;			/*!< number of requests submitted */
+	uint64_t submit_calls;		/*!< number of submissions to the kernel */
+	uint64_t completed;			/*!< number of requests completed */
+	uint64_t completion_batches;	/*!< number of completion batches reaped */
+	uint64_t requests;			/*!< number of reads and writes requested */
+	uint64_t sync_calls;		/*!< number of reads and writes done by
+								   pread and pwrite */
+} io_engine_stats;
+
+extern bool io_engine_start(unsigned int entries);
+extern void io_engine_cleanup(void);
+extern void io_engine_rw(io_request * reqs, unsigned int n);
+extern ssize_t io_pread(int fd, void *buf, size_t len, off_t offset);
+extern ssize_t io_pwrite(int fd, const void *buf, size_t len, off_t offset);
+extern void io_engine_get_stats(io_engine_stats * stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -20,6 +20,7 @@
 
 #include "system.h"
 #include <stdlib.h>
+#include <string.h>
 #include "pthread-wrapper.h"
 #include "queue.h"
 #include "log.h"
@@ -94,12 +95,40 @@ void queue_put(queue * q, void *elem)
 	zfsd_cond_signal(&q->non_empty);
 }
 
-/*! Get an element from the queue Q and store it to ELEM.  */
+/*! Put an element ELEM to the head of the queue Q, it is got before the
+   elements already in the queue.  */
 
-bool queue_get(queue * q, void *elem)
+void queue_put_first(queue * q, void *elem)
 {
 	queue_node node;
 
+	CHECK_MUTEX_LOCKED(q->mutex);
+#ifdef ENABLE_CHECKING
+	if (q->size == 0)
+		zfsd_abort();
+#endif
+
+	node = (queue_node) pool_alloc(q->pool);
+	node->next = q->first;
+	memcpy(node->data, elem, q->size);
+
+	q->first = node;
+	if (!q->last)
+		q->last = node;
+
+	q->nelem++;
+	zfsd_cond_signal(&q->non_empty);
+}
+
+/*! Get up to MAX elements from the queue Q and store them to the array
+   ELEMS.  Wait until there is at least one element in the queue.  Return the
+   number of elements got, 0 when the program is exiting.  */
+
+unsigned int queue_get_batch(queue * q, void *elems, unsigned int max)
+{
+	queue_node node;
+	unsigned int n;
+
 	CHECK_MUTEX_LOCKED(q->mutex);
 #ifdef ENABLE_CHECKING
 	if (q->size == 0)
@@ -112,22 +141,34 @@ bool queue_get(queue * q, void *elem)
 			zfsd_cond_wait(&q->non_empty, q->mutex);
 
 		if (q->exiting)
-			return false;
+			return 0;
 	}
 
-	node = q->first;
+	for (n = 0; n < max && q->nelem > 0; n++)
+	{
+		node = q->first;
 #ifdef ENABLE_CHECKING
-	if (!node)
-		zfsd_abort();
+		if (!node)
+			zfsd_abort();
 #endif
 
-	if (q->first == q->last)
-		q->last = NULL;
+		if (q->first == q->last)
+			q->last = NULL;
 
-	q->first = q->first->next;
-	q->nelem--;
-	memcpy(elem, node->data, q->size);
-	return true;
+		q->first = q->first->next;
+		q->nelem--;
+		memcpy((char *) elems + n * q->size, node->data, q->size);
+		pool_free(q->pool, node);
+	}
+
+	return n;
+}
+
+/*! Get an element from the queue Q and store it to ELEM.  */
+
+bool queue_get(queue * q, void *elem)
+{
+	return queue_get_batch(q, elem, 1) == 1;
 }
 
 /*! Tell the queue we are exiting, i.e. wake up threads waiting for an
@@ -51,7 +51,9 @@ extern void queue_create(queue * q, size_t size, size_t num,
 						 pthread_mutex_t * mutex);
 extern void queue_destroy(queue * q);
 extern void queue_put(queue * q, void *elem);
+extern void queue_put_first(queue * q, void *elem);
 extern bool queue_get(queue * q, void *elem);
+extern unsigned int queue_get_batch(queue * q, void *elems, unsigned int max);
 extern void queue_exiting(queue * q);
 
 #endif
@@ -0,0 +1,113 @@
+/*! \file \brief Rolling checksums of blocks and reconstruction of data from
+   a delta against the blocks.
+
+   The checksums of the blocks are the weak rolling checksums, which can be
+   moved by one byte cheaply, and MD5 sums which confirm a match of a weak
+   checksum.  A delta is a list of copies of the blocks and of lengths of
+   literal data.  */
+
+/* Copyright (C) 2026 ZFS contributors
+
+   This file is part of ZFS.
+
+   ZFS is free software; you can redistribute it and/or modify it under the
+   terms of the GNU General Public License as published by the Free Software
+   Foundation; either version 2, or (at your option) any later version.
+
+   ZFS is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General Public License along
+   with ZFS; see the file COPYING.  If not, write to the Free Software
+   Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA; or
+   download it from http://www.gnu.org/licenses/gpl.html */
+
+#include "system.h"
+#include <inttypes.h>
+#include <string.h>
+#include "md5.h"
+#include "zfs-prot.h"
+#include "rolling-delta.h"
+
+/*! Compute the parts A and B of the rolling checksum of LEN bytes of BUF.  */
+
+void
+delta_weak_init(const unsigned char *buf, uint32_t len, uint32_t * a,
+				uint32_t * b)
+{
+	uint32_t i;
+
+	*a = 0;
+	*b = 0;
+	for (i = 0; i < len; i++)
+	{
+		*a += buf[i];
+		*b += (len - i) * buf[i];
+	}
+}
+
+/*! Compute the rolling checksums and MD5 sums of ARGS->COUNT blocks of
+   ARGS->BLOCK_SIZE bytes of BUF and store them to ARGS.  */
+
+void delta_signatures(delta_args * args, const void *buf)
+{
+	const unsigned char *p;
+	MD5Context context;
+	uint32_t i, a, b;
+
+	for (i = 0; i < args->count; i++)
+	{
+		p = (const unsigned char *)buf + (size_t) i * args->block_size;
+		delta_weak_init(p, args->block_size, &a, &b);
+		args->weak[i] = DELTA_WEAK(a, b);
+
+		MD5Init(&context);
+		MD5Update(&context, p, args->block_size);
+		MD5Final(args->strong[i], &context);
+	}
+}
+
+/*! Reconstruct RES->LENGTH bytes described by RES to OUT, the blocks are
+   copied from COUNT blocks of BLOCK_SIZE bytes in BASIS.  Return false if
+   RES does not describe the data correctly.  */
+
+bool
+delta_apply(void *out, delta_res * res, const void *basis, uint32_t count,
+			uint32_t block_size)
+{
+	uint32_t i, n, pos, lit;
+
+	pos = 0;
+	lit = 0;
+	for (i = 0; i < res->count; i++)
+	{
+		if (res->op[i] & ZFS_DELTA_COPY)
+		{
+			n = res->op[i] & ~ZFS_DELTA_COPY;
+			if (res->block[i] > count || n > count - res->block[i])
+				return false;
+
+			n *= block_size;
+			if (n > res->length - pos)
+				return false;
+
+			memcpy((char *)out + pos,
+				   (const char *)basis + (size_t) res->block[i] * block_size,
+				   n);
+		}
+		else
+		{
+			n = res->op[i];
+			if (n > res->data.len - lit || n > res->length - pos)
+				return false;
+
+			memcpy((char *)out + pos, res->data.buf + lit, n);
+			lit += n;
+		}
+		pos += n;
+	}
+
+	return (pos == res->length && lit == res->data.len);
+}
@@ -0,0 +1,58 @@
+/*! \file \brief Rolling checksums of blocks and reconstruction of data from
+   a delta against the blocks.  */
+
+/* Copyright (C) 2026 ZFS contributors
+
+   This file is part of ZFS.
+
+   ZFS is free software; you can redistribute it and/or modify it under the
+   terms of the GNU General Public License as published by the Free Software
+   Foundation; either version 2, or (at your option) any later version.
+
+   ZFS is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General Public License along
+   with ZFS; see the file COPYING.  If not, write to the Free Software
+   Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA; or
+   download it from http://www.gnu.org/licenses/gpl.html */
+
+#ifndef ROLLING_DELTA_H
+#define ROLLING_DELTA_H
+
+#include "system.h"
+#include <inttypes.h>
+#include "zfs-prot.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*! Rolling checksum composed of its parts A and B.  */
+#define DELTA_WEAK(A, B) (((A) & 0xffff) | ((B) << 16))
+
+/*! Move the window of LEN bytes whose rolling checksum has parts A and B by
+   one byte, byte OUT leaves the window and byte IN enters it.  */
+
+static inline void
+delta_weak_roll(uint32_t * a, uint32_t * b, unsigned char out,
+				unsigned char in, uint32_t len)
+{
+	*a += in - out;
+	*b += *a - len * out;
+}
+
+extern void delta_weak_init(const unsigned char *buf, uint32_t len,
+							uint32_t * a, uint32_t * b);
+extern void delta_signatures(delta_args * args, const void *buf);
+extern bool delta_apply(void *out, delta_res * res, const void *basis,
+						uint32_t count, uint32_t block_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include "md5.h"
+#include "rolling-delta.h"
+
+#define BLOCK_SIZE 64
+#define N_BLOCKS 4
+
+static unsigned char basis[N_BLOCKS * BLOCK_SIZE];
+
+static void fill_basis(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(basis); i++)
+		basis[i] = (unsigned char) (i * 7 + i / BLOCK_SIZE);
+}
+
+TEST(rolling_delta_test, signatures)
+{
+	static delta_args args;
+	unsigned char digest[MD5_SIZE];
+	MD5Context context;
+	uint32_t i, a, b;
+
+	fill_basis();
+	args.block_size = BLOCK_SIZE;
+	args.count = N_BLOCKS;
+	delta_signatures(&args, basis);
+
+	for (i = 0; i < N_BLOCKS; i++)
+	{
+		MD5Init(&context);
+		MD5Update(&context, basis + i * BLOCK_SIZE, BLOCK_SIZE);
+		MD5Final(digest, &context);
+		ASSERT_EQ(0, memcmp(digest, args.strong[i], MD5_SIZE));
+	}
+
+	/* Rolling the checksum by whole blocks finds the checksums of the
+	   blocks.  */
+	delta_weak_init(basis, BLOCK_SIZE, &a, &b);
+	ASSERT_EQ(args.weak[0], DELTA_WEAK(a, b));
+	for (i = 0; i + BLOCK_SIZE < sizeof(basis); i++)
+	{
+		delta_weak_roll(&a, &b, basis[i], basis[i + BLOCK_SIZE], BLOCK_SIZE);
+		if ((i + 1) % BLOCK_SIZE == 0)
+			ASSERT_EQ(args.weak[(i + 1) / BLOCK_SIZE], DELTA_WEAK(a, b));
+	}
+}
+
+TEST(rolling_delta_test, apply)
+{
+	static delta_res res;
+	unsigned char out[3 * BLOCK_SIZE + 10];
+	unsigned char expected[sizeof(out)];
+	char literal[10];
+
+	fill_basis();
+	memset(literal, 'x', sizeof(literal));
+
+	/* Block 2, 5 literal bytes, blocks 0 and 1, 5 literal bytes.  */
+	memcpy(expected, basis + 2 * BLOCK_SIZE, BLOCK_SIZE);
+	memcpy(expected + BLOCK_SIZE, literal, 5);
+	memcpy(expected + BLOCK_SIZE + 5, basis, 2 * BLOCK_SIZE);
+	memcpy(expected + 3 * BLOCK_SIZE + 5, literal + 5, 5);
+
+	res.length = sizeof(out);
+	res.count = 4;
+	res.op[0] = ZFS_DELTA_COPY | 1;
+	res.block[0] = 2;
+	res.op[1] = 5;
+	res.op[2] = ZFS_DELTA_COPY | 2;
+	res.block[2] = 0;
+	res.op[3] = 5;
+	res.data.len = sizeof(literal);
+	res.data.buf = literal;
+
+	ASSERT_TRUE(delta_apply(out, &res, basis, N_BLOCKS, BLOCK_SIZE));
+	ASSERT_EQ(0, memcmp(out, expected, sizeof(out)));
+}
+
+TEST(rolling_delta_test, apply_invalid)
+{
+	static delta_res res;
+	unsigned char out[2 * BLOCK_SIZE];
+	char literal[BLOCK_SIZE];
+
+	fill_basis();
+	memset(literal, 'x', sizeof(literal));
+	res.data.buf = literal;
+
+	/* Copy past the last block.  */
+	res.length = 2 * BLOCK_SIZE;
+	res.count = 1;
+	res.op[0] = ZFS_DELTA_COPY | 2;
+	res.block[0] = N_BLOCKS - 1;
+	res.data.len = 0;
+	ASSERT_FALSE(delta_apply(out, &res, basis, N_BLOCKS, BLOCK_SIZE));
+
+	/* Copy longer than the data.  */
+	res.length = BLOCK_SIZE;
+	res.block[0] = 0;
+	ASSERT_FALSE(delta_apply(out, &res, basis, N_BLOCKS, BLOCK_SIZE));
+
+	/* Literal data longer than the reply carries.  */
+	res.length = 2 * BLOCK_SIZE;
+	res.op[0] = 2 * BLOCK_SIZE;
+	res.data.len = BLOCK_SIZE;
+	ASSERT_FALSE(delta_apply(out, &res, basis, N_BLOCKS, BLOCK_SIZE));
+
+	/* Unused literal data.  */
+	res.length = BLOCK_SIZE / 2;
+	res.op[0] = BLOCK_SIZE / 2;
+	ASSERT_FALSE(delta_apply(out, &res, basis, N_BLOCKS, BLOCK_SIZE));
+
+	/* Data shorter than the length.  */
+	res.length = BLOCK_SIZE;
+	res.op[0] = BLOCK_SIZE / 2;
+	res.data.len = BLOCK_SIZE / 2;
+	ASSERT_FALSE(delta_apply(out, &res, basis, N_BLOCKS, BLOCK_SIZE));
+}
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
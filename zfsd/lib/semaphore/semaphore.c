@@ -19,9 +19,133 @@
    download it from http://www.gnu.org/licenses/gpl.html */
 
 #include "system.h"
+#include <limits.h>
+#ifdef HAVE_LINUX_FUTEX_H
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 #include "pthread-wrapper.h"
 #include "semaphore.h"
 
+#ifdef HAVE_LINUX_FUTEX_H
+
+/*! Number of attempts to decrease the semaphore before going to sleep.  The
+   semaphore is usually raised by the thread which has just got the reply or
+   request so spinning for a while saves two context switches.  There is
+   nobody to raise the semaphore while we spin on a uniprocessor.  */
+#define SEMAPHORE_SPIN_COUNT 100
+
+/*! Number of spins in semaphore_down, -1 until it is initialized.  */
+static int semaphore_spin_count = -1;
+
+/*! Hint the CPU that we are spinning.  */
+#if defined(__i386__) || defined(__x86_64__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
+/*! Sleep until the value of futex ADDR is different from VAL.  */
+
+static inline void futex_wait(volatile unsigned int *addr, unsigned int val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+/*! Wake up to N threads sleeping on futex ADDR.  */
+
+static inline void futex_wake(volatile unsigned int *addr, int n)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+/*! Try to decrease semaphore SEM by N without blocking.  Return true on
+   success.  */
+
+static inline bool semaphore_try_down(semaphore * sem, unsigned int n)
+{
+	unsigned int value = __atomic_load_n(&sem->value, __ATOMIC_RELAXED);
+
+	while (value >= n)
+	{
+		if (__atomic_compare_exchange_n(&sem->value, &value, value - n, true,
+										__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return true;
+	}
+
+	return false;
+}
+
+/*! Initialize semaphore SEM and set its value to N.  */
+
+int semaphore_init(semaphore * sem, unsigned int n)
+{
+	sem->value = n;
+	sem->waiters = 0;
+	return 0;
+}
+
+/*! Destroy semaphore SEM.  */
+
+int semaphore_destroy(ATTRIBUTE_UNUSED semaphore * sem)
+{
+	return 0;
+}
+
+/*! Increase semaphore SEM by N.  */
+
+int semaphore_up(semaphore * sem, unsigned int n)
+{
+	__atomic_add_fetch(&sem->value, n, __ATOMIC_SEQ_CST);
+
+	/* Pairs with the increment of WAITERS in semaphore_down: either the
+	   sleeper sees the new value or we see the sleeper.  Several threads
+	   may wait for different amounts so wake them all, there is usually
+	   at most one.  */
+	if (__atomic_load_n(&sem->waiters, __ATOMIC_SEQ_CST) != 0)
+		futex_wake(&sem->value, INT_MAX);
+
+	return 0;
+}
+
+/*! Decrease semaphore SEM by N.  */
+
+int semaphore_down(semaphore * sem, unsigned int n)
+{
+	unsigned int value;
+	int i;
+
+	if (semaphore_spin_count < 0)
+		semaphore_spin_count = (sysconf(_SC_NPROCESSORS_ONLN) > 1
+								? SEMAPHORE_SPIN_COUNT : 0);
+
+	for (i = 0; i < semaphore_spin_count; i++)
+	{
+		if (semaphore_try_down(sem, n))
+			return 0;
+		cpu_relax();
+	}
+
+	if (semaphore_try_down(sem, n))
+		return 0;
+
+	__atomic_add_fetch(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+	while (!semaphore_try_down(sem, n))
+	{
+		/* futex_wait returns immediately when the value has changed
+		   since we have read it.  */
+		value = __atomic_load_n(&sem->value, __ATOMIC_SEQ_CST);
+		if (value < n)
+			futex_wait(&sem->value, value);
+	}
+	__atomic_sub_fetch(&sem->waiters, 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+#else
+
 /*! Initialize semaphore SEM and set its value to N.  */
 
 int semaphore_init(semaphore * sem, unsigned int n)
@@ -81,3 +205,5 @@ int semaphore_down(semaphore * sem, unsigned int n)
 
 	return 0;
 }
+
+#endif
@@ -24,7 +24,26 @@
 #include "system.h"
 #include "pthread-wrapper.h"
 
-// NOTE: why do not use posix semaphores?
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifdef HAVE_LINUX_FUTEX_H
+
+/*! \brief Semaphore.  The value is changed by atomic operations, a thread
+   sleeps in futex(2) on the value only when the semaphore stays down after
+   a short spin.  */
+typedef struct semaphore_def
+{
+	volatile unsigned int value;	/*!< value of the semaphore, the futex */
+	volatile unsigned int waiters;	/*!< number of threads sleeping in futex */
+} semaphore;
+
+#define ZFS_SEMAPHORE_INITIALIZER(num) \
+	{.value = (num), .waiters = 0}
+
+#else
 
 /*! \brief Semaphore. */
 typedef struct semaphore_def
@@ -37,6 +56,7 @@ typedef struct semaphore_def
 #define ZFS_SEMAPHORE_INITIALIZER(num) \
 	{.mutex = ZFS_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER, .value = (num)}
 
+#endif
 
 
 extern int semaphore_init(semaphore * sem, unsigned int n);
@@ -44,4 +64,8 @@ extern int semaphore_destroy(semaphore * sem);
 extern int semaphore_up(semaphore * sem, unsigned int n);
 extern int semaphore_down(semaphore * sem, unsigned int n);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,168 @@
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <time.h>
+#include <iostream>
+#include "semaphore.h"
+
+/* Semaphore implemented by a mutex and condition variable, the way
+   semaphore.c used to do it.  Used as a reference by the wakeup latency
+   benchmark.  */
+struct cond_semaphore
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	unsigned int value;
+};
+
+static void cond_semaphore_up(cond_semaphore * sem)
+{
+	pthread_mutex_lock(&sem->mutex);
+	sem->value++;
+	pthread_cond_signal(&sem->cond);
+	pthread_mutex_unlock(&sem->mutex);
+}
+
+static void cond_semaphore_down(cond_semaphore * sem)
+{
+	pthread_mutex_lock(&sem->mutex);
+	while (sem->value == 0)
+		pthread_cond_wait(&sem->cond, &sem->mutex);
+	sem->value--;
+	pthread_mutex_unlock(&sem->mutex);
+}
+
+#define ROUND_TRIPS 20000
+
+/* The "request" semaphore wakes up the worker, the "reply" semaphore wakes
+   up the requesting thread, like network_dispatch and send_request do.  */
+static semaphore request_sem, reply_sem;
+static cond_semaphore cond_request_sem, cond_reply_sem;
+
+static void *echo_worker(void *)
+{
+	for (int i = 0; i < ROUND_TRIPS; i++)
+	{
+		semaphore_down(&request_sem, 1);
+		semaphore_up(&reply_sem, 1);
+	}
+	return NULL;
+}
+
+static void *cond_echo_worker(void *)
+{
+	for (int i = 0; i < ROUND_TRIPS; i++)
+	{
+		cond_semaphore_down(&cond_request_sem);
+		cond_semaphore_up(&cond_reply_sem);
+	}
+	return NULL;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+TEST(semaphore_test, up_down)
+{
+	semaphore sem;
+
+	ASSERT_EQ(0, semaphore_init(&sem, 2));
+	semaphore_down(&sem, 2);
+	semaphore_up(&sem, 3);
+	semaphore_down(&sem, 1);
+	semaphore_down(&sem, 2);
+	ASSERT_EQ(0u, sem.value);
+	ASSERT_EQ(0, semaphore_destroy(&sem));
+}
+
+#define N_THREADS 4
+#define N_OPS 100000
+
+static semaphore counting_sem;
+
+static void *counting_producer(void *)
+{
+	for (int i = 0; i < N_OPS; i++)
+		semaphore_up(&counting_sem, 1);
+	return NULL;
+}
+
+static void *counting_consumer(void *)
+{
+	for (int i = 0; i < N_OPS; i++)
+		semaphore_down(&counting_sem, 1);
+	return NULL;
+}
+
+TEST(semaphore_test, producers_consumers)
+{
+	pthread_t producers[N_THREADS], consumers[N_THREADS];
+
+	semaphore_init(&counting_sem, 0);
+	for (int i = 0; i < N_THREADS; i++)
+	{
+		ASSERT_EQ(0, pthread_create(&consumers[i], NULL, counting_consumer, NULL));
+		ASSERT_EQ(0, pthread_create(&producers[i], NULL, counting_producer, NULL));
+	}
+	for (int i = 0; i < N_THREADS; i++)
+	{
+		pthread_join(producers[i], NULL);
+		pthread_join(consumers[i], NULL);
+	}
+	ASSERT_EQ(0u, counting_sem.value);
+	semaphore_destroy(&counting_sem);
+}
+
+/* Microbenchmark of the wakeup latency of a request/reply round trip.  It
+   only reports the numbers, the test does not fail when it is slow.  */
+
+TEST(semaphore_test, round_trip_latency)
+{
+	pthread_t worker;
+	double start, sem_ns, cond_ns;
+
+	semaphore_init(&request_sem, 0);
+	semaphore_init(&reply_sem, 0);
+	ASSERT_EQ(0, pthread_create(&worker, NULL, echo_worker, NULL));
+	start = now_ns();
+	for (int i = 0; i < ROUND_TRIPS; i++)
+	{
+		semaphore_up(&request_sem, 1);
+		semaphore_down(&reply_sem, 1);
+	}
+	sem_ns = (now_ns() - start) / ROUND_TRIPS;
+	pthread_join(worker, NULL);
+	semaphore_destroy(&request_sem);
+	semaphore_destroy(&reply_sem);
+
+	pthread_mutex_init(&cond_request_sem.mutex, NULL);
+	pthread_cond_init(&cond_request_sem.cond, NULL);
+	cond_request_sem.value = 0;
+	pthread_mutex_init(&cond_reply_sem.mutex, NULL);
+	pthread_cond_init(&cond_reply_sem.cond, NULL);
+	cond_reply_sem.value = 0;
+	ASSERT_EQ(0, pthread_create(&worker, NULL, cond_echo_worker, NULL));
+	start = now_ns();
+	for (int i = 0; i < ROUND_TRIPS; i++)
+	{
+		cond_semaphore_up(&cond_request_sem);
+		cond_semaphore_down(&cond_reply_sem);
+	}
+	cond_ns = (now_ns() - start) / ROUND_TRIPS;
+	pthread_join(worker, NULL);
+
+	std::cout << "round trip: semaphore " << sem_ns << " ns, mutex+cond "
+		<< cond_ns << " ns" << std::endl;
+	RecordProperty("semaphore_round_trip_ns", (int) sem_ns);
+	RecordProperty("cond_round_trip_ns", (int) cond_ns);
+}
+
+int main(int argc, char **argv)
+{
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,291 @@
+/**
+ *  \file lock-profile.c
+ *  \brief Lock contention profiler built into the zfsd_mutex_* wrappers.
+ *
+ *  Each place which locks a mutex by zfsd_mutex_lock owns a static
+ *  lock_profile_site.  The site is linked to the list of sites when it is
+ *  used for the first time.  The held mutexes are remembered in a table
+ *  keyed by the mutex together with the site and the time they were locked,
+ *  so the hold time can be charged to the site which locked the mutex when
+ *  it is unlocked, even by another thread.
+ */
+
+/* Copyright (C) 2026 ZFS contributors
+
+   This file is part of ZFS.
+
+   ZFS is free software; you can redistribute it and/or modify it under the
+   terms of the GNU General Public License as published by the Free Software
+   Foundation; either version 2, or (at your option) any later version.
+
+   ZFS is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General Public License along
+   with ZFS; see the file COPYING.  If not, write to the Free Software
+   Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA; or
+   download it from http://www.gnu.org/licenses/gpl.html */
+
+#include "system.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "lock-profile.h"
+#include "memory.h"
+
+#ifdef ENABLE_LOCK_PROFILE
+
+/*! Number of slots of the table of held mutexes, a power of 2.  */
+#define LOCK_PROFILE_HELD_SLOTS 4096
+
+/*! Number of slots searched for a mutex, the mutexes which do not fit are
+   not tracked.  */
+#define LOCK_PROFILE_HELD_PROBES 8
+
+/*! \brief Held mutex.  The slot is taken by setting MUTEX atomically, the
+   other fields are used only by the holder of the mutex.  */
+typedef struct held_lock_def
+{
+	pthread_mutex_t *mutex;		/*!< the mutex, NULL if the slot is free */
+	lock_profile_site *site;	/*!< where the mutex was locked */
+	uint64_t locked_at;			/*!< when the mutex was locked */
+} held_lock;
+
+/*! Table of held mutexes.  */
+static held_lock held_locks[LOCK_PROFILE_HELD_SLOTS];
+
+/*! List of lock sites which have been used.  */
+static lock_profile_site *lock_profile_sites;
+
+/*! Return the current time in nanoseconds.  */
+
+static inline uint64_t lock_profile_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*! Add SITE to the list of lock sites unless some thread has already done
+   so.  */
+
+static void lock_profile_register(lock_profile_site * site)
+{
+	int expected = 0;
+
+	if (!__atomic_compare_exchange_n(&site->registered, &expected, 1, false,
+									 __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+		return;
+
+	site->next = __atomic_load_n(&lock_profile_sites, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&lock_profile_sites, &site->next, site,
+										true, __ATOMIC_RELEASE,
+										__ATOMIC_RELAXED))
+		;
+}
+
+/*! Return the first slot of the table of held mutexes for MUTEX.  */
+
+static inline unsigned int lock_profile_slot(pthread_mutex_t * mutex)
+{
+	uintptr_t x = (uintptr_t) mutex;
+
+	x ^= x >> 12;
+	return (unsigned int) (x >> 4) & (LOCK_PROFILE_HELD_SLOTS - 1);
+}
+
+/*! Remember that MUTEX has been locked at SITE at time NOW.  */
+
+static inline void lock_profile_push(pthread_mutex_t * mutex,
+									 lock_profile_site * site, uint64_t now)
+{
+	pthread_mutex_t *expected;
+	unsigned int i, slot;
+
+	slot = lock_profile_slot(mutex);
+	for (i = 0; i < LOCK_PROFILE_HELD_PROBES; i++)
+	{
+		held_lock *h = &held_locks[(slot + i) & (LOCK_PROFILE_HELD_SLOTS - 1)];
+
+		expected = NULL;
+		if (__atomic_compare_exchange_n(&h->mutex, &expected, mutex, false,
+										__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		{
+			h->site = site;
+			h->locked_at = now;
+			return;
+		}
+	}
+}
+
+/*! Charge the time MUTEX has been held to the site which locked it and
+   forget the mutex.  Return the site, NULL if the mutex was not tracked.
+   The slots freed meanwhile are not the end of the search because the
+   mutex may have been put behind them.  */
+
+static lock_profile_site *lock_profile_pop(pthread_mutex_t * mutex)
+{
+	lock_profile_site *site;
+	unsigned int i, slot;
+
+	slot = lock_profile_slot(mutex);
+	for (i = 0; i < LOCK_PROFILE_HELD_PROBES; i++)
+	{
+		held_lock *h = &held_locks[(slot + i) & (LOCK_PROFILE_HELD_SLOTS - 1)];
+
+		if (__atomic_load_n(&h->mutex, __ATOMIC_RELAXED) == mutex)
+		{
+			site = h->site;
+			__atomic_add_fetch(&site->hold_ns,
+							   lock_profile_now() - h->locked_at,
+							   __ATOMIC_RELAXED);
+			__atomic_store_n(&h->mutex, NULL, __ATOMIC_RELEASE);
+			return site;
+		}
+	}
+
+	return NULL;
+}
+
+/*! Lock MUTEX and account the acquisition to SITE.  */
+
+int lock_profile_lock(pthread_mutex_t * mutex, lock_profile_site * site)
+{
+	uint64_t start, now, wait, max;
+	int r;
+
+	if (!__atomic_load_n(&site->registered, __ATOMIC_ACQUIRE))
+		lock_profile_register(site);
+
+	r = pthread_mutex_trylock(mutex);
+	if (r == EBUSY)
+	{
+		start = lock_profile_now();
+		r = pthread_mutex_lock(mutex);
+		now = lock_profile_now();
+		if (r != 0)
+			return r;
+
+		wait = now - start;
+		__atomic_add_fetch(&site->contended, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&site->wait_ns, wait, __ATOMIC_RELAXED);
+		max = __atomic_load_n(&site->max_wait_ns, __ATOMIC_RELAXED);
+		while (wait > max
+			   && !__atomic_compare_exchange_n(&site->max_wait_ns, &max, wait,
+											   true, __ATOMIC_RELAXED,
+											   __ATOMIC_RELAXED))
+			;
+	}
+	else if (r == 0)
+		now = lock_profile_now();
+	else
+		return r;
+
+	__atomic_add_fetch(&site->count, 1, __ATOMIC_RELAXED);
+	lock_profile_push(mutex, site, now);
+
+	return 0;
+}
+
+/*! Unlock MUTEX and account the time it has been held.  */
+
+int lock_profile_unlock(pthread_mutex_t * mutex)
+{
+	lock_profile_pop(mutex);
+	return pthread_mutex_unlock(mutex);
+}
+
+/*! Wait on COND with MUTEX.  The mutex is not held while waiting so the
+   waiting is not accounted as holding the mutex.  */
+
+int lock_profile_cond_wait(pthread_cond_t * cond, pthread_mutex_t * mutex)
+{
+	lock_profile_site *site;
+	int r;
+
+	site = lock_profile_pop(mutex);
+	r = pthread_cond_wait(cond, mutex);
+	if (site)
+		lock_profile_push(mutex, site, lock_profile_now());
+
+	return r;
+}
+
+/*! Wait on COND with MUTEX until ABSTIME.  The mutex is not held while
+   waiting so the waiting is not accounted as holding the mutex.  */
+
+int lock_profile_cond_timedwait(pthread_cond_t * cond, pthread_mutex_t * mutex,
+								const struct timespec *abstime)
+{
+	lock_profile_site *site;
+	int r;
+
+	site = lock_profile_pop(mutex);
+	r = pthread_cond_timedwait(cond, mutex, abstime);
+	if (site)
+		lock_profile_push(mutex, site, lock_profile_now());
+
+	return r;
+}
+
+/*! Compare lock sites by the total time of waiting, longer first.  */
+
+static int lock_profile_compare(const void *x, const void *y)
+{
+	const lock_profile_site *s1 = *(const lock_profile_site * const *) x;
+	const lock_profile_site *s2 = *(const lock_profile_site * const *) y;
+
+	if (s1->wait_ns != s2->wait_ns)
+		return s1->wait_ns < s2->wait_ns ? 1 : -1;
+	if (s1->count != s2->count)
+		return s1->count < s2->count ? 1 : -1;
+	return 0;
+}
+
+/*! Call FUNC with DATA for each lock site, the most contended first.  */
+
+void lock_profile_for_each(lock_profile_callback func, void *data)
+{
+	lock_profile_site *site, **sites;
+	unsigned int i, n;
+
+	n = 0;
+	for (site = __atomic_load_n(&lock_profile_sites, __ATOMIC_ACQUIRE); site;
+		 site = site->next)
+		n++;
+
+	sites = (lock_profile_site **) xmalloc((n + 1) * sizeof(*sites));
+	i = 0;
+	for (site = __atomic_load_n(&lock_profile_sites, __ATOMIC_ACQUIRE);
+		 site && i < n; site = site->next)
+		sites[i++] = site;
+
+	qsort(sites, i, sizeof(*sites), lock_profile_compare);
+	for (n = 0; n < i; n++)
+		(*func) (sites[n], data);
+
+	free(sites);
+}
+
+/*! Clear the statistics of all lock sites.  */
+
+void lock_profile_reset(void)
+{
+	lock_profile_site *site;
+
+	for (site = __atomic_load_n(&lock_profile_sites, __ATOMIC_ACQUIRE); site;
+		 site = site->next)
+	{
+		__atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&site->contended, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&site->wait_ns, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&site->max_wait_ns, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&site->hold_ns, 0, __ATOMIC_RELAXED);
+	}
+}
+
+#endif
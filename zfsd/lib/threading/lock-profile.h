@@ -0,0 +1,75 @@
+/**
+ *  \file lock-profile.h
+ *  \brief Lock contention profiler built into the zfsd_mutex_* wrappers.
+ *
+ */
+
+/* Copyright (C) 2026 ZFS contributors
+
+   This file is part of ZFS.
+
+   ZFS is free software; you can redistribute it and/or modify it under the
+   terms of the GNU General Public License as published by the Free Software
+   Foundation; either version 2, or (at your option) any later version.
+
+   ZFS is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General Public License along
+   with ZFS; see the file COPYING.  If not, write to the Free Software
+   Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA; or
+   download it from http://www.gnu.org/licenses/gpl.html */
+
+#ifndef LOCK_PROFILE_H
+#define LOCK_PROFILE_H
+
+#include "system.h"
+#include <inttypes.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*! \brief Statistics of one place in the code where a mutex is locked.
+   One static instance is created by each use of zfsd_mutex_lock when
+   ENABLE_LOCK_PROFILE is defined.  The counters are updated atomically.  */
+typedef struct lock_profile_site_def
+{
+	const char *name;			/*!< the expression naming the mutex */
+	const char *file;			/*!< source file of the lock site */
+	int line;					/*!< source line of the lock site */
+	int registered;				/*!< is the site in the list of sites? */
+	struct lock_profile_site_def *next;	/*!< next site in the list */
+	uint64_t count;				/*!< number of acquisitions */
+	uint64_t contended;			/*!< number of acquisitions which waited */
+	uint64_t wait_ns;			/*!< total time of waiting for the mutex */
+	uint64_t max_wait_ns;		/*!< the longest wait for the mutex */
+	uint64_t hold_ns;			/*!< total time the mutex was held */
+} lock_profile_site;
+
+#define LOCK_PROFILE_SITE_INITIALIZER(NAME) \
+	{ (NAME), __FILE__, __LINE__, 0, NULL, 0, 0, 0, 0, 0 }
+
+/*! Type of the function called for each lock site.  */
+typedef void (*lock_profile_callback) (const lock_profile_site * site,
+									   void *data);
+
+extern int lock_profile_lock(pthread_mutex_t * mutex, lock_profile_site * site);
+extern int lock_profile_unlock(pthread_mutex_t * mutex);
+extern int lock_profile_cond_wait(pthread_cond_t * cond,
+								  pthread_mutex_t * mutex);
+extern int lock_profile_cond_timedwait(pthread_cond_t * cond,
+									   pthread_mutex_t * mutex,
+									   const struct timespec *abstime);
+extern void lock_profile_for_each(lock_profile_callback func, void *data);
+extern void lock_profile_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -145,6 +145,22 @@ extern pthread_mutex_t zfsd_mutex_initializer;
       }									\
     0; })
 
+#define zfsd_cond_timedwait(C, M, T) __extension__			\
+  ({									\
+    int def_ret;								\
+									\
+    message (LOG_LOCK, FACILITY_THREADING, "COND %p TIMEDWAIT with MUTEX %p, by %"PTRid" at %s:%d\n",\
+	     (void *) C, (void *) M,					\
+	     PTRid_conversion pthread_self (), __FILE__, __LINE__);	\
+    if ((def_ret = pthread_cond_timedwait (C, M, T)) != 0		\
+	&& def_ret != ETIMEDOUT)					\
+      {									\
+	message (LOG_ERROR, FACILITY_THREADING, "pthread_cond_timedwait: %d = %s\n",	\
+		 def_ret, strerror (def_ret));					\
+	zfsd_abort ();							\
+      }									\
+    def_ret; })
+
 #define zfsd_cond_signal(C) __extension__				\
   ({									\
     int def_ret;								\
@@ -210,6 +226,29 @@ extern pthread_mutex_t zfsd_mutex_initializer;
   } while (0);								\
   })
 
+#elif defined(ENABLE_LOCK_PROFILE)
+
+/*! Macros recording the contention of mutexes for each place they are
+   locked at, see lock-profile.c.  */
+
+#include "lock-profile.h"
+
+#define zfsd_mutex_destroy(M) pthread_mutex_destroy (M)
+#define zfsd_mutex_lock(M) __extension__				\
+  ({									\
+    static lock_profile_site lock_profile_site_				\
+      = LOCK_PROFILE_SITE_INITIALIZER (#M);				\
+    lock_profile_lock ((M), &lock_profile_site_);			\
+  })
+#define zfsd_mutex_unlock(M) lock_profile_unlock (M)
+#define zfsd_cond_destroy(C) pthread_cond_destroy (C)
+#define zfsd_cond_wait(C, M) lock_profile_cond_wait (C, M)
+#define zfsd_cond_timedwait(C, M, T) lock_profile_cond_timedwait (C, M, T)
+#define zfsd_cond_signal(C) pthread_cond_signal (C)
+#define zfsd_cond_broadcast(C) pthread_cond_broadcast (C)
+#define CHECK_MUTEX_LOCKED(M)
+#define CHECK_MUTEX_UNLOCKED(M)
+
 #else
 
 #define zfsd_mutex_destroy(M) pthread_mutex_destroy (M)
@@ -217,6 +256,7 @@ extern pthread_mutex_t zfsd_mutex_initializer;
 #define zfsd_mutex_unlock(M) pthread_mutex_unlock (M)
 #define zfsd_cond_destroy(C) pthread_cond_destroy (C)
 #define zfsd_cond_wait(C, M) pthread_cond_wait (C, M)
+#define zfsd_cond_timedwait(C, M, T) pthread_cond_timedwait (C, M, T)
 #define zfsd_cond_signal(C) pthread_cond_signal (C)
 #define zfsd_cond_broadcast(C) pthread_cond_broadcast (C)
 #define CHECK_MUTEX_LOCKED(M)
@@ -24,6 +24,8 @@
 #include <unistd.h>
 #include <errno.h>
 #include <signal.h>
+#include <string.h>
+#include <sys/time.h>
 #include "pthread-wrapper.h"
 #include "constant.h"
 #include "semaphore.h"
@@ -34,6 +36,21 @@
 
 static void *thread_pool_regulator(void *data);
 
+/*! Thread pools regulated by the thread pool regulator.  */
+static thread_pool *regulated_pools;
+
+/*! Mutex protecting the list of regulated pools and the regulator state.  */
+static pthread_mutex_t regulator_mutex = ZFS_MUTEX_INITIALIZER;
+
+/*! Condition variable the regulator sleeps on between two regulations.  */
+static pthread_cond_t regulator_cond = PTHREAD_COND_INITIALIZER;
+
+/*! Thread ID of the thread pool regulator shared by all thread pools.  */
+static volatile pthread_t regulator_thread;
+
+/*! Shall the thread pool regulator terminate?  */
+static bool regulator_exit;
+
 /*! Flag that zfsd is running. It is set to 0 when zfsd is shutting down.  */
 volatile bool running = true;
 
@@ -222,6 +239,65 @@ int32_t get_thread_retval(thread * t)
 	return res;
 }
 
+/*! Add thread pool POOL to the list of pools regulated by the thread pool
+   regulator, start the regulator if it is not running.  */
+
+static bool thread_pool_regulator_add(thread_pool * pool)
+{
+	int r = 0;
+
+	/* The regulator of previously terminated pools may be still exiting.  */
+	zfsd_mutex_lock(&regulator_mutex);
+	if (regulator_exit)
+	{
+		zfsd_mutex_unlock(&regulator_mutex);
+		wait_for_thread_to_die(&regulator_thread, NULL);
+		zfsd_mutex_lock(&regulator_mutex);
+		regulator_exit = false;
+	}
+
+	pool->next_regulated = regulated_pools;
+	regulated_pools = pool;
+
+	if (regulator_thread == 0)
+	{
+		r = pthread_create(CAST_QUAL(pthread_t *, &regulator_thread), NULL,
+						   thread_pool_regulator, NULL);
+		if (r != 0)
+		{
+			regulator_thread = 0;
+			regulated_pools = pool->next_regulated;
+		}
+	}
+	zfsd_mutex_unlock(&regulator_mutex);
+
+	return r == 0;
+}
+
+/*! Remove thread pool POOL from the list of regulated pools.  The regulator
+   does not access POOL after this function returns.  Tell the regulator to
+   exit when no pool is left.  */
+
+static void thread_pool_regulator_remove(thread_pool * pool)
+{
+	thread_pool **p;
+
+	zfsd_mutex_lock(&regulator_mutex);
+	for (p = &regulated_pools; *p; p = &(*p)->next_regulated)
+		if (*p == pool)
+		{
+			*p = pool->next_regulated;
+			break;
+		}
+
+	if (regulated_pools == NULL && regulator_thread != 0)
+	{
+		regulator_exit = true;
+		zfsd_cond_signal(&regulator_cond);
+	}
+	zfsd_mutex_unlock(&regulator_mutex);
+}
+
 /*! Initialize the thread pool. \param pool The thread pool to initialize.
    \param limit Limits for number of threads. \param main_start Start routine
    of the main thread of the pool. \param worker_start Start routine of the
@@ -239,8 +315,6 @@ thread_pool_create(thread_pool * pool, thread_limit * limit,
 #ifdef ENABLE_CHECKING
 	if (pool->main_thread != 0)
 		zfsd_abort();
-	if (pool->regulator_thread != 0)
-		zfsd_abort();
 #endif
 
 	pool->terminate = !keep_running();
@@ -253,12 +327,14 @@ thread_pool_create(thread_pool * pool, thread_limit * limit,
 	pool->unaligned_array = xmalloc(pool->size * sizeof(padded_thread) + 255);
 	pool->threads = (padded_thread *) ALIGN_PTR_256(pool->unaligned_array);
 	zfsd_mutex_init(&pool->mutex);
-	queue_create(&pool->idle, sizeof(size_t), pool->size, &pool->mutex);
+	pool->idle = (size_t *) xmalloc(pool->size * sizeof(size_t));
+	pool->n_idle = 0;
+	zfsd_cond_init(&pool->idle_cond);
 	queue_create(&pool->empty, sizeof(size_t), pool->size, &pool->mutex);
 	pool->worker_start = worker_start;
 	pool->worker_init = worker_init;
+	pool->next_regulated = NULL;
 	zfsd_mutex_init(&pool->main_in_syscall);
-	zfsd_mutex_init(&pool->regulator_in_syscall);
 
 	zfsd_mutex_lock(&pool->mutex);
 	for (i = 0; i < pool->size; i++)
@@ -277,16 +353,15 @@ thread_pool_create(thread_pool * pool, thread_limit * limit,
 		r = create_idle_thread(pool);
 		if (r != 0)
 		{
+			zfsd_mutex_unlock(&pool->mutex);
 			thread_pool_destroy(pool);
 			return false;
 		}
 	}
 	zfsd_mutex_unlock(&pool->mutex);
-	// NOTE: ^ regulator & main thread init may not (should not) be locked?
-	/* Create thread pool regulator.  */
-	r = pthread_create(CAST_QUAL(pthread_t *, &pool->regulator_thread), NULL,
-					   thread_pool_regulator, pool);
-	if (r != 0)
+
+	/* Let the shared thread pool regulator take care of this pool.  */
+	if (!thread_pool_regulator_add(pool))
 	{
 		message(LOG_ERROR, FACILITY_THREADING, "pthread_create() failed\n");
 		thread_pool_destroy(pool);
@@ -307,8 +382,8 @@ thread_pool_create(thread_pool * pool, thread_limit * limit,
 	return true;
 }
 
-/*! Terminate the main and regulator threads in thread pool POOL and tell
-   worker threads to finish.  */
+/*! Terminate the main thread in thread pool POOL, stop regulating the pool
+   and tell worker threads to finish.  */
 
 void thread_pool_terminate(thread_pool * pool)
 {
@@ -317,16 +392,18 @@ void thread_pool_terminate(thread_pool * pool)
 	if (pool->main_thread != 0)
 	{
 		zfsd_mutex_unlock(&running_mutex);
-		queue_exiting(&pool->idle);
+		zfsd_mutex_lock(&pool->mutex);
+		zfsd_cond_broadcast(&pool->idle_cond);
+		zfsd_mutex_unlock(&pool->mutex);
 		queue_exiting(&pool->empty);
 	}
 	else
 		zfsd_mutex_unlock(&running_mutex);
 
+	thread_pool_regulator_remove(pool);
+
 	thread_terminate_blocking_syscall(&pool->main_thread,
 									  &pool->main_in_syscall);
-	thread_terminate_blocking_syscall(&pool->regulator_thread,
-									  &pool->regulator_in_syscall);
 }
 
 /*! Destroy thread pool POOL - terminate idle threads, wait for active
@@ -335,13 +412,20 @@ void thread_pool_terminate(thread_pool * pool)
 void thread_pool_destroy(thread_pool * pool)
 {
 	size_t i;
+	bool regulator_exiting;
 
 	zfs_pthread_yield();
 
+	thread_pool_regulator_remove(pool);
 	wait_for_thread_to_die(&pool->main_thread, NULL);
-	wait_for_thread_to_die(&pool->regulator_thread, NULL);
 	zfsd_mutex_destroy(&pool->main_in_syscall);
-	zfsd_mutex_destroy(&pool->regulator_in_syscall);
+
+	/* Wait for the shared regulator when this was the last pool.  */
+	zfsd_mutex_lock(&regulator_mutex);
+	regulator_exiting = regulator_exit;
+	zfsd_mutex_unlock(&regulator_mutex);
+	if (regulator_exiting)
+		wait_for_thread_to_die(&regulator_thread, NULL);
 
 	/* Wait until all worker threads are idle and destroy them.  */
 	zfsd_mutex_lock(&pool->mutex);
@@ -354,14 +438,99 @@ void thread_pool_destroy(thread_pool * pool)
 	for (i = 0; i < pool->size; i++)
 		zfsd_mutex_destroy(&pool->threads[i].t.mutex);
 	free(pool->unaligned_array);
+	free(pool->idle);
 	queue_destroy(&pool->empty);
-	queue_destroy(&pool->idle);
 	zfsd_mutex_unlock(&pool->mutex);
+	zfsd_cond_destroy(&pool->idle_cond);
 	zfsd_mutex_destroy(&pool->mutex);
 }
 
+/*! Put the thread T of thread pool POOL to the top of the stack of idle
+   threads.  This function expects POOL->MUTEX to be locked.  */
+
+void thread_pool_idle_push(thread_pool * pool, thread * t)
+{
+	CHECK_MUTEX_LOCKED(&pool->mutex);
+#ifdef ENABLE_CHECKING
+	if (pool->n_idle >= pool->size)
+		zfsd_abort();
+#endif
+
+	set_thread_state(t, THREAD_IDLE);
+	pool->idle[pool->n_idle++] = t->index;
+	zfsd_cond_signal(&pool->idle_cond);
+}
+
+/*! Take the most recently used idle thread of thread pool POOL and mark it
+   busy.  Create a new thread when there is no idle one, wait for a thread
+   to become idle when the pool is full.  Return NULL when the pool is
+   terminating.  This function expects POOL->MUTEX to be locked.  */
+
+thread *thread_pool_idle_pop(thread_pool * pool)
+{
+	thread *t;
+
+	CHECK_MUTEX_LOCKED(&pool->mutex);
+
+	/* Regulate the number of threads.  */
+	if (pool->n_idle == 0)
+		thread_pool_regulate(pool);
+
+	while (pool->n_idle == 0)
+	{
+		if (pool->terminate)
+			return NULL;
+		zfsd_cond_wait(&pool->idle_cond, &pool->mutex);
+	}
+
+	t = &pool->threads[pool->idle[--pool->n_idle]].t;
+#ifdef ENABLE_CHECKING
+	if (get_thread_state(t) == THREAD_BUSY)
+		zfsd_abort();
+#endif
+	set_thread_state(t, THREAD_BUSY);
+
+	return t;
+}
+
+/*! Remove thread T, which has picked up a request by itself, from the stack
+   of idle threads of thread pool POOL and mark it busy.  Make sure there is
+   an idle thread left to pick up the next request.  Return false when T has
+   been requested to die.  This function expects POOL->MUTEX to be locked.  */
+
+bool thread_pool_idle_remove(thread_pool * pool, thread * t)
+{
+	size_t i;
+
+	CHECK_MUTEX_LOCKED(&pool->mutex);
+
+	for (i = pool->n_idle; i-- > 0;)
+		if (pool->idle[i] == t->index)
+			break;
+
+	if (i == (size_t) -1)
+	{
+#ifdef ENABLE_CHECKING
+		if (get_thread_state(t) != THREAD_DYING)
+			zfsd_abort();
+#endif
+		return false;
+	}
+
+	pool->n_idle--;
+	memmove(pool->idle + i, pool->idle + i + 1,
+			(pool->n_idle - i) * sizeof(size_t));
+	set_thread_state(t, THREAD_BUSY);
+
+	/* Regulate the number of threads.  */
+	if (pool->n_idle == 0)
+		thread_pool_regulate(pool);
+
+	return true;
+}
+
 /*! Create a new idle thread in thread pool POOL. This function expects
-   NETWORK_POOL.EMPTY.MUTEX and NETWORK_POOL.IDLE.MUTEX to be locked.  */
+   POOL->MUTEX to be locked.  */
 
 int create_idle_thread(thread_pool * pool)
 {
@@ -387,11 +556,11 @@ int create_idle_thread(thread_pool * pool)
 	r = pthread_create(&t->thread_id, NULL, pool->worker_start, t);
 	if (r == 0)
 	{
-		/* Call the initializer before we put the thread to the idle queue.  */
+		/* Call the initializer before we put the thread to the idle stack.  */
 		if (pool->worker_init)
 			(*pool->worker_init) (t);
 
-		queue_put(&pool->idle, &idx);
+		thread_pool_idle_push(pool, t);
 	}
 	else
 	{
@@ -404,8 +573,8 @@ int create_idle_thread(thread_pool * pool)
 	return r;
 }
 
-/*! Destroy an idle thread in thread pool POOL.  This function expects
-   NETWORK_POOL.EMPTY.MUTEX and NETWORK_POOL.IDLE.MUTEX to be locked.  */
+/*! Destroy an idle thread in thread pool POOL, the one which has been idle
+   for the longest time.  This function expects POOL->MUTEX to be locked.  */
 
 int destroy_idle_thread(thread_pool * pool)
 {
@@ -415,16 +584,25 @@ int destroy_idle_thread(thread_pool * pool)
 
 	CHECK_MUTEX_LOCKED(&pool->mutex);
 
-	/* Let the thread which was busy add itself to idle queue.  */
-	zfsd_mutex_unlock(&pool->mutex);
-	zfsd_mutex_lock(&pool->mutex);
+	/* Let the thread which was busy add itself to idle stack.  */
+	while (pool->n_idle == 0)
+		zfsd_cond_wait(&pool->idle_cond, &pool->mutex);
 
-	queue_get(&pool->idle, &idx);
+	idx = pool->idle[0];
+	pool->n_idle--;
+	memmove(pool->idle, pool->idle + 1, pool->n_idle * sizeof(size_t));
 	t = &pool->threads[idx].t;
 
 	set_thread_state(t, THREAD_DYING);
 	semaphore_up(&t->sem, 1);
+	if (pool->worker_wakeup)
+		(*pool->worker_wakeup) (t);
+
+	/* The thread may need the mutex to finish the request it has just
+	   picked up.  */
+	zfsd_mutex_unlock(&pool->mutex);
 	r = pthread_join(t->thread_id, NULL);
+	zfsd_mutex_lock(&pool->mutex);
 	if (r == 0)
 	{
 		semaphore_destroy(&t->sem);
@@ -454,14 +632,14 @@ void thread_disable_signals(void)
 }
 
 /*! Kill/create threads when there are too many or not enough idle threads.
-   It expects NETWORK_POOL.IDLE.MUTEX to be locked.  */
+   It expects POOL->MUTEX to be locked.  */
 
 void thread_pool_regulate(thread_pool * pool)
 {
 	CHECK_MUTEX_LOCKED(&pool->mutex);
 
 	/* Let some threads to die.  */
-	while (pool->idle.nelem > pool->max_spare_threads)
+	while (pool->n_idle > pool->max_spare_threads)
 	{
 		message(LOG_INFO, FACILITY_THREADING,
 				"Regulating: destroying idle thread\n");
@@ -469,38 +647,53 @@ void thread_pool_regulate(thread_pool * pool)
 	}
 
 	/* Create new threads.  */
-	while (pool->idle.nelem < pool->min_spare_threads
-		   && pool->idle.nelem < pool->idle.size && pool->empty.nelem > 0)
+	while (pool->n_idle < pool->min_spare_threads && pool->empty.nelem > 0)
 	{
 		message(LOG_INFO, FACILITY_THREADING,
 				"Regulating: creating idle thread\n");
-		create_idle_thread(pool);
+		if (create_idle_thread(pool) != 0)
+			break;
 	}
+
+	/* Make sure there is a thread to dispatch the request to.  */
+	if (pool->n_idle == 0 && pool->empty.nelem > 0)
+		create_idle_thread(pool);
 }
 
-/*! Main function of thread regulating the thread pool. DATA is the structure
-   with additional information for the regulator.  */
+/*! Main function of the thread regulating all thread pools.  */
 
-static void *thread_pool_regulator(void *data)
+static void *thread_pool_regulator(ATTRIBUTE_UNUSED void *data)
 {
-	thread_pool *pool = (thread_pool *) data;
+	thread_pool *pool;
+	struct timeval now;
+	struct timespec timeout;
 
 	thread_disable_signals();
 	pthread_setspecific(thread_name_key, "Regulator thread");
 
-	while (!thread_pool_terminate_p(pool))
+	zfsd_mutex_lock(&regulator_mutex);
+	while (!regulator_exit)
 	{
-		zfsd_mutex_lock(&pool->regulator_in_syscall);
-		if (!thread_pool_terminate_p(pool))
-			sleep(THREAD_POOL_REGULATOR_INTERVAL);	// NOTE: condvar will be
-		// better
-		zfsd_mutex_unlock(&pool->regulator_in_syscall);
-		if (thread_pool_terminate_p(pool))
+		gettimeofday(&now, NULL);
+		timeout.tv_sec = now.tv_sec + THREAD_POOL_REGULATOR_INTERVAL;
+		timeout.tv_nsec = now.tv_usec * 1000;
+		zfsd_cond_timedwait(&regulator_cond, &regulator_mutex, &timeout);
+		if (regulator_exit)
 			break;
-		zfsd_mutex_lock(&pool->mutex);
-		thread_pool_regulate(pool);
-		zfsd_mutex_unlock(&pool->mutex);
+
+		/* REGULATOR_MUTEX stays locked so no pool can be removed from the
+		   list while it is being regulated.  */
+		for (pool = regulated_pools; pool; pool = pool->next_regulated)
+		{
+			if (thread_pool_terminate_p(pool))
+				continue;
+
+			zfsd_mutex_lock(&pool->mutex);
+			thread_pool_regulate(pool);
+			zfsd_mutex_unlock(&pool->mutex);
+		}
 	}
+	zfsd_mutex_unlock(&regulator_mutex);
 
 	return NULL;
 }
@@ -75,9 +75,11 @@ typedef struct network_thread_data_def
 /*! \brief Additional data for a kernel thread.  */
 typedef struct kernel_thread_data_def
 {
-	void *buf;					/*!< buffer for request to this node */
-	size_t buf_size;
-	struct fuse_chan *fuse_ch;
+	void *buf;					/*!< buffer for requests read by this thread */
+	size_t buf_size;			/*!< size of BUF */
+	void *reply_buf;			/*!< buffer for data of replies */
+	size_t reply_buf_size;		/*!< size of REPLY_BUF */
+	struct fuse_chan *fuse_ch;	/*!< channel this thread reads requests from */
 } kernel_thread_data;
 
 /*! \brief Additional data for an update thread.  */
@@ -87,8 +89,23 @@ typedef struct update_thread_data_def
 	zfs_fh fh;
 	/*! Thread is a slow updater. */
 	bool slow;
+	/*! ID of the master node the update of FH is counted to, 0 if it is
+	   not counted.  */
+	uint32_t sid;
 } update_thread_data;
 
+struct thread_def;
+
+/*! \brief Additional data for a read-ahead thread.  */
+typedef struct readahead_thread_data_def
+{
+	/*! Function doing the job.  */
+	void (*func) (struct thread_def *, void *, uint64_t, unsigned int);
+	void *data;					/*!< data of the job, e.g. state of the file */
+	uint64_t offset;			/*!< offset of the block to read */
+	unsigned int generation;	/*!< generation of the read-ahead state */
+} readahead_thread_data;
+
 /*! \brief Definition of thread's variables.  */
 typedef struct thread_def
 {
@@ -118,6 +135,7 @@ typedef struct thread_def
 		network_thread_data network;
 		kernel_thread_data kernel;
 		update_thread_data update;
+		readahead_thread_data readahead;
 	} u;						// FIXME: none or meaningfull name
 } thread;
 
@@ -146,21 +164,31 @@ typedef struct thread_pool_def
 	void *unaligned_array;		/*!< pointer returned by xmalloc */
 	padded_thread *threads;		/*!< thread slots, previous pointer aligned */
 	pthread_mutex_t mutex;		/*!< mutex for queues */
-	queue idle;					/*!< queue of idle threads */
+
+	/*! Stack of indexes of idle threads.  The most recently used thread is
+	   on the top so it is woken up first while its stack and data are still
+	   in cache, the threads at the bottom are destroyed first.  */
+	size_t *idle;
+	size_t n_idle;				/*!< number of idle threads */
+	pthread_cond_t idle_cond;	/*!< signalled when a thread becomes idle */
+
 	queue empty;				/*!< queue of empty thread slots */
 	thread_start worker_start;	/*!< start routine of the worker thread */
 	thread_init worker_init;	/*!< initialization routine for worker thread 
 								 */
 
+	/*! Routine waking up an idle worker thread which does not wait on its
+	   semaphore, called when the thread is requested to die.  It is not
+	   reset by thread_pool_create, set it before creating the pool.  */
+	thread_init worker_wakeup;
+
 	/* Data for main thread.  */
 	volatile pthread_t main_thread;	/*!< thread ID of the main thread */
 	pthread_mutex_t main_in_syscall;	/*!< main thread is in blocking
 										   syscall */
 
-	/* Data for thread pool regulator.  */
-	volatile pthread_t regulator_thread;	/*!< thread ID of the regulator */
-	pthread_mutex_t regulator_in_syscall;	/*!< regulator is in blocking
-											   syscall */
+	/*! Next pool regulated by the thread pool regulator.  */
+	struct thread_pool_def *next_regulated;
 } thread_pool;
 
 /*! \brief Description of thread waiting for reply.  */
@@ -203,6 +231,9 @@ extern int create_idle_thread(thread_pool * pool);
 extern int destroy_idle_thread(thread_pool * pool);
 extern void thread_disable_signals(void);
 extern void thread_pool_regulate(thread_pool * pool);
+extern thread *thread_pool_idle_pop(thread_pool * pool);
+extern void thread_pool_idle_push(thread_pool * pool, thread * t);
+extern bool thread_pool_idle_remove(thread_pool * pool, thread * t);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,108 @@
+/**
+ *  \file token-bucket.c
+ *  \brief Token bucket limiting the rate of a traffic.
+ *
+ */
+
+/* Copyright (C) 2026 ZFS contributors
+
+   This file is part of ZFS.
+
+   ZFS is free software; you can redistribute it and/or modify it under the
+   terms of the GNU General Public License as published by the Free Software
+   Foundation; either version 2, or (at your option) any later version.
+
+   ZFS is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General Public License along
+   with ZFS; see the file COPYING.  If not, write to the Free Software
+   Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA; or
+   download it from http://www.gnu.org/licenses/gpl.html */
+
+#include "system.h"
+#include <inttypes.h>
+#include <time.h>
+#include "token-bucket.h"
+
+/*! Initialize token bucket TB with RATE tokens per second and at most
+   BURST tokens.  The bucket is full when it is used for the first time.  */
+
+void token_bucket_init(token_bucket * tb, uint32_t rate, uint32_t burst)
+{
+	tb->rate = rate;
+	tb->burst = burst;
+	tb->tokens = burst;
+	tb->last = 0;
+}
+
+/*! Change the rate of token bucket TB to RATE tokens per second and at
+   most BURST tokens.  The tokens and the debt are kept.  */
+
+void token_bucket_set_rate(token_bucket * tb, uint32_t rate, uint32_t burst)
+{
+	tb->rate = rate;
+	tb->burst = burst;
+	if (tb->tokens > (int64_t) burst)
+		tb->tokens = burst;
+}
+
+/*! Take N tokens from token bucket TB at time NOW in nanoseconds.  Return
+   the number of nanoseconds the caller has to wait until the debt of the
+   bucket is paid, 0 if there were enough tokens.  */
+
+uint64_t token_bucket_take(token_bucket * tb, uint32_t n, uint64_t now)
+{
+	uint64_t elapsed, missing, wait;
+
+	if (tb->rate == 0)
+		return 0;
+
+	/* Refill the bucket.  Only the time needed to fill the bucket is used
+	   so that the product does not overflow.  */
+	if (tb->last == 0 || now < tb->last)
+		tb->last = now;
+	if (tb->tokens < (int64_t) tb->burst)
+	{
+		missing = tb->burst - tb->tokens;
+		elapsed = now - tb->last;
+		if (elapsed >= missing * TOKEN_BUCKET_NSEC / tb->rate)
+		{
+			tb->tokens = tb->burst;
+			tb->last = now;
+		}
+		else
+		{
+			tb->tokens += elapsed * tb->rate / TOKEN_BUCKET_NSEC;
+			tb->last += ((elapsed * tb->rate / TOKEN_BUCKET_NSEC)
+						 * TOKEN_BUCKET_NSEC / tb->rate);
+		}
+	}
+	else
+		tb->last = now;
+
+	tb->tokens -= n;
+	if (tb->tokens >= 0)
+		return 0;
+
+	/* The part of the next token accumulated since the last refill is
+	   already paid.  */
+	wait = ((uint64_t) - tb->tokens * TOKEN_BUCKET_NSEC + tb->rate - 1)
+		/ tb->rate;
+	elapsed = now - tb->last;
+
+	return (wait > elapsed ? wait - elapsed : 0);
+}
+
+/*! Return the current time in nanoseconds for token_bucket_take.  */
+
+uint64_t token_bucket_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * TOKEN_BUCKET_NSEC + ts.tv_nsec;
+}
@@ -0,0 +1,63 @@
+/**
+ *  \file token-bucket.h
+ *  \brief Token bucket limiting the rate of a traffic.
+ *
+ */
+
+/* Copyright (C) 2026 ZFS contributors
+
+   This file is part of ZFS.
+
+   ZFS is free software; you can redistribute it and/or modify it under the
+   terms of the GNU General Public License as published by the Free Software
+   Foundation; either version 2, or (at your option) any later version.
+
+   ZFS is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General Public License along
+   with ZFS; see the file COPYING.  If not, write to the Free Software
+   Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA; or
+   download it from http://www.gnu.org/licenses/gpl.html */
+
+#ifndef TOKEN_BUCKET_H
+#define TOKEN_BUCKET_H
+
+#include "system.h"
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*! \brief Number of nanoseconds in a second.  */
+#define TOKEN_BUCKET_NSEC 1000000000ULL
+
+/*! \brief Token bucket.  The bucket is filled by RATE tokens per second up
+   to BURST tokens, the traffic takes one token for each byte.  When there
+   are not enough tokens the traffic goes into debt and has to wait until
+   the debt is paid.  The bucket is not locked, the user has to lock it.  */
+typedef struct token_bucket_def
+{
+	uint32_t rate;				/*!< tokens per second, 0 for no limit */
+	uint32_t burst;				/*!< the maximal number of tokens */
+	int64_t tokens;				/*!< tokens available, negative for debt */
+	uint64_t last;				/*!< time of the last refill in ns */
+} token_bucket;
+
+extern void token_bucket_init(token_bucket * tb, uint32_t rate,
+							  uint32_t burst);
+extern void token_bucket_set_rate(token_bucket * tb, uint32_t rate,
+								  uint32_t burst);
+extern uint64_t token_bucket_take(token_bucket * tb, uint32_t n,
+								  uint64_t now);
+extern uint64_t token_bucket_now(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,59 @@
+#include <gtest/gtest.h>
+#include "token-bucket.h"
+
+#define SEC TOKEN_BUCKET_NSEC
+
+TEST(token_bucket_test, unlimited)
+{
+  token_bucket tb;
+
+  token_bucket_init(&tb, 0, 0);
+  ASSERT_EQ(0U, token_bucket_take(&tb, 1000000, SEC));
+  ASSERT_EQ(0U, token_bucket_take(&tb, 1000000, SEC));
+}
+
+TEST(token_bucket_test, burst_then_rate)
+{
+  token_bucket tb;
+
+  token_bucket_init(&tb, 1000, 1000);
+
+  /* The full bucket lets the burst through.  */
+  ASSERT_EQ(0U, token_bucket_take(&tb, 1000, 10 * SEC));
+
+  /* The debt of 500 tokens is paid in half a second.  */
+  ASSERT_EQ(SEC / 2, token_bucket_take(&tb, 500, 10 * SEC));
+
+  /* After the debt is paid the bucket fills again.  */
+  ASSERT_EQ(0U, token_bucket_take(&tb, 250, 10 * SEC + SEC / 2 + SEC / 4));
+  ASSERT_EQ(0U, token_bucket_take(&tb, 1000, 20 * SEC));
+}
+
+TEST(token_bucket_test, partial_token_is_kept)
+{
+  token_bucket tb;
+
+  token_bucket_init(&tb, 1000, 1000);
+  ASSERT_EQ(0U, token_bucket_take(&tb, 1000, SEC));
+
+  /* 1.5 tokens accumulate in 1.5 ms, one of them is used and the half
+     token is kept for the next take.  */
+  ASSERT_EQ(0U, token_bucket_take(&tb, 1, SEC + 1500000));
+  ASSERT_EQ(SEC / 2000, token_bucket_take(&tb, 1, SEC + 1500000));
+}
+
+TEST(token_bucket_test, set_rate)
+{
+  token_bucket tb;
+
+  token_bucket_init(&tb, 1000, 1000);
+  token_bucket_set_rate(&tb, 100, 100);
+  ASSERT_EQ(0U, token_bucket_take(&tb, 100, SEC));
+  ASSERT_EQ(SEC, token_bucket_take(&tb, 100, SEC));
+}
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -29,6 +29,7 @@
 #include <string.h>
 #include <errno.h>
 #include "pthread-wrapper.h"
+#include "io-engine.h"
 
 /*! Print LEN bytes of buffer BUF to file F in hexadecimal ciphers. !see
    message */
@@ -85,6 +86,41 @@ again:
 	return true;
 }
 
+/*! Read LEN bytes from offset OFFSET of file descriptor FD to buffer BUF.
+   The file position of FD is not changed.  */
+
+bool full_pread(int fd, void *buf, size_t len, off_t offset)
+{
+	ssize_t r;
+	unsigned int total_read;
+
+	for (total_read = 0; total_read < len; total_read += r)
+	{
+again:
+		r = io_pread(fd, (char *)buf + total_read, len - total_read,
+					 offset + total_read);
+		if (r <= 0)
+		{
+			if (r < 0 && errno == EINTR)
+			{
+				goto again;
+			}
+
+			message(LOG_WARNING, FACILITY_DATA,
+					"reading data FAILED: %d (%s)\n", errno, strerror(errno));
+			return false;
+		}
+	}
+
+#ifdef ENABLE_DEBUG_PRINT
+	message(LOG_DEBUG, FACILITY_DATA,
+			"Reading data of length %u from %d to %p:\n", len, fd, buf);
+	print_hex_buffer(LOG_DATA, NULL, (char *)buf, len);
+#endif
+
+	return true;
+}
+
 /*! Write LEN bytes from buffer BUF to file descriptor FD.  */
 
 bool full_write(int fd, void *buf, size_t len)
@@ -118,6 +154,41 @@ again:
 	return true;
 }
 
+/*! Write LEN bytes from buffer BUF to offset OFFSET of file descriptor FD.
+   The file position of FD is not changed.  */
+
+bool full_pwrite(int fd, void *buf, size_t len, off_t offset)
+{
+	ssize_t w;
+	unsigned int total_written;
+
+#ifdef ENABLE_DEBUG_PRINT
+	message(LOG_DEBUG, FACILITY_DATA,
+			"Writing data of length %u to %d from %p:\n", len, fd, buf);
+	print_hex_buffer(LOG_DATA, NULL, (char *)buf, len);
+#endif
+
+	for (total_written = 0; total_written < len; total_written += w)
+	{
+again:
+		w = io_pwrite(fd, (char *)buf + total_written, len - total_written,
+					  offset + total_written);
+		if (w <= 0)
+		{
+			if (w < 0 && errno == EINTR)
+			{
+				goto again;
+			}
+
+			message(LOG_NOTICE, FACILITY_DATA,
+					"writing data FAILED: %d (%s)\n", errno, strerror(errno));
+			return false;
+		}
+	}
+
+	return true;
+}
+
 /*! Create a full path PATH with access rights MODE (similarly as "mkdir -p
    path" does).  Return true if PATH exists at the end of this function.  */
 
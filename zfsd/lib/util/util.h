@@ -24,10 +24,13 @@
 #include "system.h"
 #include <stdio.h>
 #include <stddef.h>
+#include <sys/types.h>
 
 extern void print_hex_buffer(int level, FILE * f, char *buf, unsigned int len);
 extern bool full_read(int fd, void *buf, size_t len);
 extern bool full_write(int fd, void *buf, size_t len);
+extern bool full_pread(int fd, void *buf, size_t len, off_t offset);
+extern bool full_pwrite(int fd, void *buf, size_t len, off_t offset);
 extern bool full_mkdir(char *path, unsigned int mode);
 extern bool bytecmp(const void *p, int byte, size_t len);
 
@@ -1291,10 +1291,7 @@ static void *network_worker(void *data)
 		/* Put self to the idle queue if not requested to die meanwhile.  */
 		zfsd_mutex_lock(&network_pool.mutex);
 		if (get_thread_state(t) == THREAD_BUSY)
-		{
-			queue_put(&network_pool.idle, &t->index);
-			set_thread_state(t, THREAD_IDLE);
-		}
+			thread_pool_idle_push(&network_pool, t);
 		else
 		{
 #ifdef ENABLE_CHECKING
@@ -1318,8 +1315,8 @@ static void *network_worker(void *data)
 static bool network_dispatch(fd_data_t * fd_data)
 {
 	DC *dc = fd_data->dc[0];
-	size_t idx;
 	direction dir;
+	thread *t;
 
 	CHECK_MUTEX_LOCKED(&fd_data->mutex);
 
@@ -1346,7 +1343,6 @@ static bool network_dispatch(fd_data_t * fd_data)
 			uint32_t request_id;
 			void **slot;
 			waiting4reply_data *data;
-			thread *t;
 
 			if (!decode_request_id(dc, &request_id))
 			{
@@ -1384,29 +1380,25 @@ static bool network_dispatch(fd_data_t * fd_data)
 	case DIR_REQUEST:
 	case DIR_ONEWAY:
 		/* Dispatch request.  */
-		fd_data->busy++;
-
 		zfsd_mutex_lock(&network_pool.mutex);
 
-		/* Regulate the number of threads.  */
-		if (network_pool.idle.nelem == 0)
-			thread_pool_regulate(&network_pool);
-
 		/* Select an idle thread and forward the request to it.  */
-		queue_get(&network_pool.idle, &idx);
-#ifdef ENABLE_CHECKING
-		if (get_thread_state(&network_pool.threads[idx].t) == THREAD_BUSY)
-			zfsd_abort();
-#endif
-		set_thread_state(&network_pool.threads[idx].t, THREAD_BUSY);
-		network_pool.threads[idx].t.from_sid = fd_data->sid;
-		network_pool.threads[idx].t.u.network.dc = dc;
-		network_pool.threads[idx].t.u.network.dir = dir;
-		network_pool.threads[idx].t.u.network.fd_data = fd_data;
-		network_pool.threads[idx].t.u.network.generation = fd_data->generation;
+		t = thread_pool_idle_pop(&network_pool);
+		if (!t)
+		{
+			zfsd_mutex_unlock(&network_pool.mutex);
+			return false;
+		}
+
+		fd_data->busy++;
+		t->from_sid = fd_data->sid;
+		t->u.network.dc = dc;
+		t->u.network.dir = dir;
+		t->u.network.fd_data = fd_data;
+		t->u.network.generation = fd_data->generation;
 
 		/* Let the thread run.  */
-		semaphore_up(&network_pool.threads[idx].t.sem, 1);
+		semaphore_up(&t->sem, 1);
 
 		zfsd_mutex_unlock(&network_pool.mutex);
 		break;
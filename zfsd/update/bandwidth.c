@@ -0,0 +1,162 @@
+/*! \file \brief Bandwidth limits of the background traffic.
+
+   The background updates of files and the reintegrations of files are
+   limited by a token bucket of the master node of the volume and by a token
+   bucket of the volume, for each class of the traffic separately.  The
+   rates of the node buckets are zfs_config.bandwidth.update_rate and
+   zfs_config.bandwidth.reintegrate_rate, the rates of the volume buckets
+   are set for each volume in the local config.  The updates of the blocks
+   which are being read are never limited.  In the windows of the day listed
+   in zfs_config.bandwidth.full_speed no traffic is limited.  */
+
+/* Copyright (C) 2026 ZFS contributors
+
+   This file is part of ZFS.
+
+   ZFS is free software; you can redistribute it and/or modify it under the
+   terms of the GNU General Public License as published by the Free Software
+   Foundation; either version 2, or (at your option) any later version.
+
+   ZFS is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General Public License along
+   with ZFS; see the file COPYING.  If not, write to the Free Software
+   Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA; or
+   download it from http://www.gnu.org/licenses/gpl.html */
+
+#include "system.h"
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include "pthread-wrapper.h"
+#include "log.h"
+#include "thread.h"
+#include "token-bucket.h"
+#include "node.h"
+#include "volume.h"
+#include "zfs_config.h"
+#include "bandwidth.h"
+
+/*! The longest sleep of bandwidth_wait between the checks whether zfsd is
+   exiting, in nanoseconds.  */
+#define BANDWIDTH_MAX_SLEEP TOKEN_BUCKET_NSEC
+
+/*! Mutex protecting the token buckets of nodes and volumes and
+   #bandwidth_statistics.  */
+pthread_mutex_t bandwidth_mutex = ZFS_MUTEX_INITIALIZER;
+
+/*! Statistics of the traffic.  */
+static bandwidth_stats bandwidth_statistics;
+
+/*! Return true if the background traffic is not limited at time NOW.  */
+
+static bool bandwidth_full_speed_p(time_t now)
+{
+	zfs_config_window *w;
+	struct tm tm;
+	uint32_t minute;
+	uint32_t i;
+
+	if (zfs_config.bandwidth.n_full_speed == 0)
+		return false;
+
+	localtime_r(&now, &tm);
+	minute = tm.tm_hour * 60 + tm.tm_min;
+	for (i = 0; i < zfs_config.bandwidth.n_full_speed; i++)
+	{
+		w = &zfs_config.bandwidth.full_speed[i];
+		if (w->start <= w->end
+			? (minute >= w->start && minute < w->end)
+			: (minute >= w->start || minute < w->end))
+			return true;
+	}
+
+	return false;
+}
+
+/*! Take BYTES tokens from bucket TB whose rate is RATE at time NOW, return
+   the nanoseconds to wait.  One second of the traffic may burst.  */
+
+static uint64_t
+bandwidth_take(token_bucket * tb, uint32_t rate, uint32_t bytes, uint64_t now)
+{
+	CHECK_MUTEX_LOCKED(&bandwidth_mutex);
+
+	if (tb->rate != rate)
+		token_bucket_set_rate(tb, rate, rate);
+
+	return token_bucket_take(tb, bytes, now);
+}
+
+/*! Account BYTES of the traffic of class CLS between the local node and the
+   master node of volume VOL.  Return the number of nanoseconds the traffic
+   has to wait to stay within the limits of the node and the volume, which
+   the caller should pass to bandwidth_wait after unlocking VOL.  */
+
+uint64_t bandwidth_use(volume vol, bandwidth_class cls, uint32_t bytes)
+{
+	uint64_t now, wait, wait2;
+
+	CHECK_MUTEX_LOCKED(&vol->mutex);
+
+	wait = 0;
+	zfsd_mutex_lock(&bandwidth_mutex);
+	bandwidth_statistics.bytes[cls] += bytes;
+	if (cls != BANDWIDTH_DEMAND && !bandwidth_full_speed_p(time(NULL)))
+	{
+		now = token_bucket_now();
+		if (cls == BANDWIDTH_UPDATE)
+		{
+			if (vol->master)
+				wait = bandwidth_take(&vol->master->update_bucket,
+									  zfs_config.bandwidth.update_rate,
+									  bytes, now);
+			wait2 = bandwidth_take(&vol->update_bucket, vol->update_rate,
+								   bytes, now);
+		}
+		else
+		{
+			if (vol->master)
+				wait = bandwidth_take(&vol->master->reintegrate_bucket,
+									  zfs_config.bandwidth.reintegrate_rate,
+									  bytes, now);
+			wait2 = bandwidth_take(&vol->reintegrate_bucket,
+								   vol->reintegrate_rate, bytes, now);
+		}
+		if (wait2 > wait)
+			wait = wait2;
+		bandwidth_statistics.wait_ns[cls] += wait;
+	}
+	zfsd_mutex_unlock(&bandwidth_mutex);
+
+	return wait;
+}
+
+/*! Sleep for NS nanoseconds or until zfsd is exiting.  */
+
+void bandwidth_wait(uint64_t ns)
+{
+	struct timespec ts;
+	uint64_t step;
+
+	while (ns > 0 && keep_running())
+	{
+		step = (ns < BANDWIDTH_MAX_SLEEP ? ns : BANDWIDTH_MAX_SLEEP);
+		ts.tv_sec = step / TOKEN_BUCKET_NSEC;
+		ts.tv_nsec = step % TOKEN_BUCKET_NSEC;
+		nanosleep(&ts, NULL);
+		ns -= step;
+	}
+}
+
+/*! Store the statistics of the traffic to STATS.  */
+
+void bandwidth_get_stats(bandwidth_stats * stats)
+{
+	zfsd_mutex_lock(&bandwidth_mutex);
+	memcpy(stats, &bandwidth_statistics, sizeof(bandwidth_stats));
+	zfsd_mutex_unlock(&bandwidth_mutex);
+}
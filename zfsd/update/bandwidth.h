@@ -0,0 +1,64 @@
+/*! \file \brief Bandwidth limits of the background traffic.  */
+
+/* Copyright (C) 2026 ZFS contributors
+
+   This file is part of ZFS.
+
+   ZFS is free software; you can redistribute it and/or modify it under the
+   terms of the GNU General Public License as published by the Free Software
+   Foundation; either version 2, or (at your option) any later version.
+
+   ZFS is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General Public License along
+   with ZFS; see the file COPYING.  If not, write to the Free Software
+   Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA; or
+   download it from http://www.gnu.org/licenses/gpl.html */
+
+#ifndef BANDWIDTH_H
+#define BANDWIDTH_H
+
+#include "system.h"
+#include <inttypes.h>
+#include "pthread-wrapper.h"
+#include "volume.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*! \brief Class of the traffic between the local node and the master node
+   of a volume.  */
+typedef enum bandwidth_class_def
+{
+	BANDWIDTH_DEMAND = 0,		/*!< updates of blocks being read */
+	BANDWIDTH_UPDATE,			/*!< background updates of files */
+	BANDWIDTH_REINTEGRATE,		/*!< reintegrations of files */
+	BANDWIDTH_CLASSES
+} bandwidth_class;
+
+/*! \brief Statistics of the traffic.  */
+typedef struct bandwidth_stats_def
+{
+	uint64_t bytes[BANDWIDTH_CLASSES];	/*!< bytes transferred */
+	uint64_t wait_ns[BANDWIDTH_CLASSES];	/*!< time spent waiting for the
+										   limits */
+} bandwidth_stats;
+
+/*! \brief Mutex protecting the token buckets of nodes and volumes.  */
+extern pthread_mutex_t bandwidth_mutex;
+
+extern uint64_t bandwidth_use(volume vol, bandwidth_class cls,
+							  uint32_t bytes);
+extern void bandwidth_wait(uint64_t ns);
+extern void bandwidth_get_stats(bandwidth_stats * stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
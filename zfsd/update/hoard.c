@@ -0,0 +1,322 @@
+/*! \file \brief Hoarding of directory trees for offline use.
+
+   The hoarding thread walks the directory trees listed by the hoard key of
+   the volumes in the local config every zfs_config.hoard_interval seconds
+   while the master node of the volume is connected.  Opening a directory
+   updates its entries and opening a regular file schedules the update of
+   its contents, to the slow update queue when the master node is connected
+   by a slow link.  The files are scheduled at most at zfs_config.hoard_rate
+   bytes per second so that hoarding does not take the whole link.  */
+
+/* Copyright (C) 2026 ZFS contributors
+
+   This file is part of ZFS.
+
+   ZFS is free software; you can redistribute it and/or modify it under the
+   terms of the GNU General Public License as published by the Free Software
+   Foundation; either version 2, or (at your option) any later version.
+
+   ZFS is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+   details.
+
+   You should have received a copy of the GNU General Public License along
+   with ZFS; see the file COPYING.  If not, write to the Free Software
+   Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA; or
+   download it from http://www.gnu.org/licenses/gpl.html */
+
+#include "system.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "pthread-wrapper.h"
+#include "semaphore.h"
+#include "memory.h"
+#include "varray.h"
+#include "log.h"
+#include "thread.h"
+#include "fh.h"
+#include "node.h"
+#include "volume.h"
+#include "network.h"
+#include "zfs-prot.h"
+#include "file.h"
+#include "dir.h"
+#include "zfs_config.h"
+#include "hoard.h"
+
+/*! Data of the hoarding thread.  */
+static thread hoard_data = {.mutex = ZFS_MUTEX_INITIALIZER };
+
+/*! Mutex locked while the hoarding thread is sleeping.  */
+static pthread_mutex_t hoard_in_syscall = ZFS_MUTEX_INITIALIZER;
+
+/*! Number of bytes of the files scheduled for updating which the hoarding
+   thread has not slept for yet.  */
+static uint64_t hoard_debt;
+
+/*! Sleep for SECONDS seconds.  Return false if zfsd is exiting.  */
+
+static bool hoard_sleep(unsigned int seconds)
+{
+	zfsd_mutex_lock(&hoard_in_syscall);
+	if (keep_running())
+		sleep(seconds);
+	zfsd_mutex_unlock(&hoard_in_syscall);
+
+	return keep_running();
+}
+
+/*! Account SIZE bytes scheduled for updating and sleep so that the files
+   are scheduled at zfs_config.hoard_rate bytes per second.  Return false
+   if zfsd is exiting.  */
+
+static bool hoard_pace(uint64_t size)
+{
+	uint32_t rate = zfs_config.hoard_rate;
+	uint64_t seconds;
+
+	if (rate == 0)
+		return keep_running();
+
+	hoard_debt += size;
+	seconds = hoard_debt / rate;
+	hoard_debt %= rate;
+	if (seconds == 0)
+		return keep_running();
+
+	return hoard_sleep(seconds < zfs_config.hoard_interval
+					   || zfs_config.hoard_interval == 0
+					   ? seconds : zfs_config.hoard_interval);
+}
+
+/*! Schedule the update of regular file FH of size SIZE if it is needed.
+   Return false if zfsd is exiting.  */
+
+static bool hoard_file(zfs_fh * fh, uint64_t size)
+{
+	internal_dentry dentry;
+	zfs_cap cap;
+	volume vol;
+	bool enqueued;
+	int32_t r;
+
+	/* Opening the file updates its metadata and schedules the update of
+	   its contents.  */
+	r = zfs_open(&cap, fh, O_RDONLY);
+	if (r != ZFS_OK)
+	{
+		message(LOG_DEBUG, FACILITY_DATA, "hoard: open: %s\n",
+				zfs_strerror(r));
+		return keep_running();
+	}
+
+	enqueued = false;
+	r = zfs_fh_lookup(fh, &vol, &dentry, NULL, false);
+	if (r == ZFS_OK)
+	{
+		enqueued = (dentry->fh->flags & IFH_ENQUEUED) != 0;
+		release_dentry(dentry);
+		zfsd_mutex_unlock(&vol->mutex);
+	}
+
+	zfs_close(&cap);
+
+	return enqueued ? hoard_pace(size) : keep_running();
+}
+
+/*! Hoard the entries of directory DIR, push the file handles of the
+   subdirectories to DIRS.  Return false if zfsd is exiting.  */
+
+static bool hoard_dir(zfs_fh * dir, varray * dirs)
+{
+	dir_entry entries[ZFS_MAX_DIR_ENTRIES];
+	dir_list list;
+	dir_op_res res;
+	zfs_cap cap;
+	int32_t cookie;
+	unsigned int i;
+	bool running;
+	int32_t r;
+
+	/* Opening the directory updates its entries.  */
+	r = zfs_open(&cap, dir, O_RDONLY);
+	if (r != ZFS_OK)
+	{
+		message(LOG_DEBUG, FACILITY_DATA, "hoard: open dir: %s\n",
+				zfs_strerror(r));
+		return keep_running();
+	}
+
+	running = true;
+	cookie = 0;
+	do
+	{
+		list.n = 0;
+		list.eof = false;
+		list.buffer = entries;
+		r = zfs_readdir(&list, &cap, cookie, ZFS_MAXDATA, &filldir_array);
+		if (r != ZFS_OK)
+			break;
+
+		for (i = 0; i < list.n; i++)
+		{
+			cookie = entries[i].cookie;
+			if (running
+				&& strcmp(entries[i].name.str, ".") != 0
+				&& strcmp(entries[i].name.str, "..") != 0)
+			{
+				r = zfs_extended_lookup(&res, &cap.fh, entries[i].name.str);
+				if (r == ZFS_OK)
+				{
+					if (res.attr.type == FT_DIR)
+						VARRAY_PUSH(*dirs, res.file, zfs_fh);
+					else if (res.attr.type == FT_REG)
+						running = hoard_file(&res.file, res.attr.size);
+				}
+			}
+			free(entries[i].name.str);
+		}
+	}
+	while (running && list.n > 0 && !list.eof);
+
+	zfs_close(&cap);
+
+	return running && keep_running();
+}
+
+/*! Hoard the directory tree PATH on volume VID.  Return false if zfsd is
+   exiting.  */
+
+static bool hoard_tree(uint32_t vid, string * path)
+{
+	dir_op_res res;
+	varray dirs;
+	zfs_fh dir;
+	volume vol;
+	char *tmp;
+	bool running;
+	int32_t r;
+
+	vol = volume_lookup(vid);
+	if (!vol)
+		return keep_running();
+	running = (volume_master_connected(vol) != CONNECTION_SPEED_NONE);
+	zfsd_mutex_unlock(&vol->mutex);
+	if (!running)
+		return keep_running();
+
+	r = zfs_volume_root(&res, vid);
+	if (r == ZFS_OK && path->str[strspn(path->str, "/")] != 0)
+	{
+		tmp = xstrdup(path->str);
+		r = zfs_extended_lookup(&res, &res.file, tmp);
+		free(tmp);
+	}
+	if (r != ZFS_OK)
+	{
+		message(LOG_NOTICE, FACILITY_DATA,
+				"hoard: lookup of %s on volume %" PRIu32 ": %s\n", path->str,
+				vid, zfs_strerror(r));
+		return keep_running();
+	}
+	if (res.attr.type != FT_DIR)
+		return hoard_file(&res.file, res.attr.size);
+
+	message(LOG_INFO, FACILITY_DATA, "hoard: %s on volume %" PRIu32 "\n",
+			path->str, vid);
+
+	running = true;
+	varray_create(&dirs, sizeof(zfs_fh), 16);
+	VARRAY_PUSH(dirs, res.file, zfs_fh);
+	while (running && VARRAY_USED(dirs) > 0)
+	{
+		dir = VARRAY_TOP(dirs, zfs_fh);
+		VARRAY_POP(dirs);
+		running = hoard_dir(&dir, &dirs);
+	}
+	varray_destroy(&dirs);
+
+	return running;
+}
+
+/*! Main function of the hoarding thread.  */
+
+static void *hoard_main(void *data)
+{
+	thread *t = (thread *) data;
+	lock_info li[MAX_LOCKED_FILE_HANDLES];
+	volume_hoard_path *item;
+	varray paths;
+	unsigned int i;
+	bool running;
+
+	thread_disable_signals();
+	pthread_setspecific(thread_data_key, data);
+	pthread_setspecific(thread_name_key, "Hoarding thread");
+	set_lock_info(li);
+	t->from_sid = this_node->id;
+
+	varray_create(&paths, sizeof(volume_hoard_path), 4);
+	running = true;
+	while (running && hoard_sleep(zfs_config.hoard_interval))
+	{
+		volume_get_hoard(&paths);
+		for (i = 0; i < VARRAY_USED(paths); i++)
+		{
+			item = &VARRAY_ACCESS(paths, i, volume_hoard_path);
+			if (running)
+				running = hoard_tree(item->vid, &item->path);
+			xfreestring(&item->path);
+		}
+		VARRAY_CLEAR(paths);
+	}
+	varray_destroy(&paths);
+
+	return NULL;
+}
+
+/*! Wake up the hoarding thread when zfsd is exiting.  */
+
+void hoard_exiting(void)
+{
+	thread_terminate_blocking_syscall(&hoard_data.thread_id,
+									  &hoard_in_syscall);
+}
+
+/*! Start the hoarding thread if hoarding is enabled.  Return false if the
+   thread could not be started.  */
+
+bool hoard_start(void)
+{
+	if (zfs_config.hoard_interval == 0)
+		return true;
+
+	semaphore_init(&hoard_data.sem, 0);
+	network_worker_init(&hoard_data);
+	if (pthread_create(&hoard_data.thread_id, NULL, hoard_main, &hoard_data))
+	{
+		message(LOG_CRIT, FACILITY_THREADING, "pthread_create() failed\n");
+		hoard_data.thread_id = 0;
+		network_worker_cleanup(&hoard_data);
+		semaphore_destroy(&hoard_data.sem);
+		return false;
+	}
+
+	return true;
+}
+
+/*! Wait for the hoarding thread to finish and free its data.  */
+
+void hoard_cleanup(void)
+{
+	if (hoard_data.thread_id == 0)
+		return;
+
+	wait_for_thread_to_die(&hoard_data.thread_id, NULL);
+	network_worker_cleanup(&hoard_data);
+	semaphore_destroy(&hoard_data.sem);
+}
@@ -26,6 +26,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <errno.h>
 #include "pthread-wrapper.h"
 #include "constant.h"
@@ -34,6 +35,8 @@
 #include "memory.h"
 #include "alloc-pool.h"
 #include "queue.h"
+#include "fibheap.h"
+#include "hashtab.h"
 #include "log.h"
 #include "random.h"
 #include "volume.h"
@@ -48,14 +51,66 @@
 #include "journal.h"
 #include "metadata.h"
 #include "zfs_config.h"
+#include "readahead.h"
+#include "delta.h"
+#include "util.h"
+
+/*! \brief File handle waiting in #update_queue.  */
+typedef struct update_queue_entry_def
+{
+	zfs_fh fh;					/*!< local file handle of the file */
+	uint32_t sid;				/*!< ID of the master node of the file */
+	fibheap heap;				/*!< heap containing the entry */
+	fibnode node;				/*!< node of the entry in HEAP */
+} *update_queue_entry;
+
+/*! \brief Number of the files of a master node being updated by the
+   threads in #update_pool.  */
+typedef struct update_queue_node_def
+{
+	uint32_t sid;				/*!< ID of the master node */
+	unsigned int n_updating;	/*!< number of the files being updated */
+	fibheap parked;				/*!< entries of the node taken from the
+								   queue while the node was at its limit,
+								   or NULL */
+} update_queue_node;
+
+/*! \brief Priority queue of file handles for updating or reintegrating.
+   The file handle with the lowest key is processed first.  */
+typedef struct update_queue_def
+{
+	fibheap heap;				/*!< entries ordered by their keys */
+	htab_t htab;				/*!< entries searched by file handle */
+	varray nodes;				/*!< master nodes with files being updated */
+	pthread_cond_t non_empty;	/*!< signalled when an entry is added or
+								   a file has been updated */
+	time_t epoch;				/*!< time the keys are relative to */
+	volatile bool exiting;		/*!< is the program going to exit? */
+} update_queue_t;
 
 /*! \brief Queue of file handles for updating or reintegrating. Protected by
    #update_queue_mutex. File handles are processed by threads in #update_pool */
-queue update_queue;
+static update_queue_t update_queue;
 
 /*! \brief Mutex for #update_queue.  */
 static pthread_mutex_t update_queue_mutex;
 
+/*! \brief Delay in seconds of the background update of a file for each
+   doubling of its size above #UPDATE_QUEUE_LARGE_FILE.  */
+#define UPDATE_QUEUE_SIZE_DELAY 2
+
+/*! \brief Size of the largest file whose background update is not
+   delayed.  */
+#define UPDATE_QUEUE_LARGE_FILE (1024 * 1024)
+
+/*! \brief Delay in seconds of the background update of a file after the
+   update of a file which has been accessed at the same time.  */
+#define UPDATE_QUEUE_BACKGROUND_DELAY 10
+
+/*! \brief Maximal number of file handles the main update thread takes from
+   #update_queue at once.  */
+#define UPDATE_QUEUE_BATCH 16
+
 /*! \brief Pool of update threads.  */
 thread_pool update_pool;
 
@@ -75,6 +130,266 @@ static thread *slow_update_worker;
    by ZFS_SLOW_BUSY */
 #define ZFS_SLOW_BUSY_DELAY   5
 
+/*! \brief Hash function for update queue entry X.  */
+static hash_t update_queue_entry_hash(const void *x)
+{
+	return ZFS_FH_HASH(&((const struct update_queue_entry_def *)x)->fh);
+}
+
+/*! \brief Compare the file handle of update queue entry XX with file handle
+   YY.  */
+static int update_queue_entry_eq(const void *xx, const void *yy)
+{
+	const zfs_fh *x = &((const struct update_queue_entry_def *)xx)->fh;
+	const zfs_fh *y = (const zfs_fh *)yy;
+
+	return ZFS_FH_EQ(*x, *y);
+}
+
+/*! \brief Return the key in #update_queue of a file of size SIZE whose
+   update has priority PRIORITY.  Background updates are done in the order
+   they were scheduled but the updates of large files are delayed so that
+   they do not hold up the files being accessed.  */
+static fibheapkey_t update_queue_key(uint64_t size, update_priority priority)
+{
+	fibheapkey_t key;
+
+	if (priority == UPDATE_PRIORITY_WAITING)
+		return FIBHEAPKEY_MIN;
+
+	key = (fibheapkey_t) (time(NULL) - update_queue.epoch) + 1;
+	if (priority == UPDATE_PRIORITY_BACKGROUND)
+	{
+		key += UPDATE_QUEUE_BACKGROUND_DELAY;
+		for (; size > UPDATE_QUEUE_LARGE_FILE; size >>= 1)
+			key += UPDATE_QUEUE_SIZE_DELAY;
+	}
+
+	return key;
+}
+
+/*! \brief Put file handle FH of a file on master node SID to
+   #update_queue with key KEY.  If FH is already in the queue, only decrease
+   its key to KEY.  \param add Add FH to the queue if it is not there.  */
+static void
+update_queue_put(zfs_fh * fh, uint32_t sid, fibheapkey_t key, bool add)
+{
+	update_queue_entry entry;
+	void **slot;
+	hash_t hash;
+
+	CHECK_MUTEX_LOCKED(&update_queue_mutex);
+
+	hash = ZFS_FH_HASH(fh);
+	entry = (update_queue_entry) htab_find_with_hash(update_queue.htab, fh,
+													 hash);
+	if (entry)
+	{
+		if (key < entry->node->key)
+			entry->node = fibheap_replace_key(entry->heap, entry->node, key);
+		return;
+	}
+
+	if (!add)
+		return;
+
+	entry = (update_queue_entry) xmalloc(sizeof(*entry));
+	entry->fh = *fh;
+	entry->sid = sid;
+	entry->heap = update_queue.heap;
+	entry->node = fibheap_insert(update_queue.heap, key, entry);
+	slot = htab_find_slot_with_hash(update_queue.htab, fh, hash, INSERT);
+	*slot = entry;
+
+	zfsd_cond_signal(&update_queue.non_empty);
+}
+
+/*! \brief Return the index of master node SID in update_queue.nodes, or
+   the number of the nodes there if no file of SID is being updated.  */
+static unsigned int update_queue_node_index(uint32_t sid)
+{
+	unsigned int i;
+
+	CHECK_MUTEX_LOCKED(&update_queue_mutex);
+
+	for (i = 0; i < VARRAY_USED(update_queue.nodes); i++)
+		if (VARRAY_ACCESS(update_queue.nodes, i, update_queue_node).sid == sid)
+			break;
+
+	return i;
+}
+
+/*! \brief Return master node SID in update_queue.nodes if the threads in
+   #update_pool are already updating zfs_config.threads.update_node_limit
+   of its files, NULL otherwise.  */
+static update_queue_node *update_queue_node_full(uint32_t sid)
+{
+	update_queue_node *qn;
+	unsigned int i;
+
+	CHECK_MUTEX_LOCKED(&update_queue_mutex);
+
+	if (zfs_config.threads.update_node_limit == 0)
+		return NULL;
+
+	i = update_queue_node_index(sid);
+	if (i == VARRAY_USED(update_queue.nodes))
+		return NULL;
+
+	qn = &VARRAY_ACCESS(update_queue.nodes, i, update_queue_node);
+	if (qn->n_updating < zfs_config.threads.update_node_limit)
+		return NULL;
+
+	return qn;
+}
+
+/*! \brief Move ENTRY with key KEY from the heap it is in to HEAP.  */
+static void
+update_queue_entry_move(update_queue_entry entry, fibheapkey_t key,
+						fibheap heap)
+{
+	CHECK_MUTEX_LOCKED(&update_queue_mutex);
+
+	entry->heap = heap;
+	entry->node = fibheap_insert(heap, key, entry);
+}
+
+/*! \brief Count a file of master node SID which is going to be updated.  */
+static void update_queue_node_get(uint32_t sid)
+{
+	update_queue_node qn;
+	unsigned int i;
+
+	CHECK_MUTEX_LOCKED(&update_queue_mutex);
+
+	i = update_queue_node_index(sid);
+	if (i == VARRAY_USED(update_queue.nodes))
+	{
+		qn.sid = sid;
+		qn.n_updating = 0;
+		qn.parked = NULL;
+		VARRAY_PUSH(update_queue.nodes, qn, update_queue_node);
+	}
+	VARRAY_ACCESS(update_queue.nodes, i, update_queue_node).n_updating++;
+}
+
+/*! \brief Uncount a file of master node SID which has been updated, return
+   the first of its parked files to #update_queue and wake up the main
+   update thread which may be waiting for it.  */
+static void update_queue_node_put(uint32_t sid)
+{
+	update_queue_node *qn;
+	update_queue_entry entry;
+	fibheapkey_t key;
+	unsigned int i, last;
+
+	zfsd_mutex_lock(&update_queue_mutex);
+
+	i = update_queue_node_index(sid);
+#ifdef ENABLE_CHECKING
+	if (i == VARRAY_USED(update_queue.nodes))
+		zfsd_abort();
+#endif
+	qn = &VARRAY_ACCESS(update_queue.nodes, i, update_queue_node);
+	qn->n_updating--;
+	if (qn->parked && fibheap_size_nolock(qn->parked) > 0)
+	{
+		key = fibheap_min_key(qn->parked);
+		entry = (update_queue_entry) fibheap_extract_min(qn->parked);
+		update_queue_entry_move(entry, key, update_queue.heap);
+	}
+	if (qn->n_updating == 0
+		&& (!qn->parked || fibheap_size_nolock(qn->parked) == 0))
+	{
+		if (qn->parked)
+			fibheap_delete(qn->parked);
+		last = VARRAY_USED(update_queue.nodes) - 1;
+		if (i != last)
+			*qn = VARRAY_ACCESS(update_queue.nodes, last, update_queue_node);
+		VARRAY_POP(update_queue.nodes);
+	}
+
+	zfsd_cond_signal(&update_queue.non_empty);
+	zfsd_mutex_unlock(&update_queue_mutex);
+}
+
+/*! \brief Get up to MAX file handles with the lowest keys from
+   #update_queue and store them to the array FHS and the IDs of their master
+   nodes to the array SIDS.  The files of the master nodes which already
+   have zfs_config.threads.update_node_limit files being updated are parked
+   at the node so that one master node does not get all the update threads;
+   update_queue_node_put returns them to the queue one by one.  Each file
+   got is counted to its master node until update_queue_node_put is called
+   for it.  Wait until there is at least one such file handle in the queue.
+   Return the number of file handles got, 0 when the program is exiting.  */
+static unsigned int
+update_queue_get_batch(zfs_fh * fhs, uint32_t * sids, unsigned int max)
+{
+	update_queue_entry entry;
+	update_queue_node *qn;
+	fibheapkey_t key;
+	void **slot;
+	unsigned int n;
+
+	CHECK_MUTEX_LOCKED(&update_queue_mutex);
+
+	while (1)
+	{
+		while (fibheap_size_nolock(update_queue.heap) == 0
+			   && !update_queue.exiting)
+			zfsd_cond_wait(&update_queue.non_empty, &update_queue_mutex);
+
+		if (update_queue.exiting)
+			return 0;
+
+		n = 0;
+		while (n < max && fibheap_size_nolock(update_queue.heap) > 0)
+		{
+			key = fibheap_min_key(update_queue.heap);
+			entry = (update_queue_entry) fibheap_extract_min(update_queue.heap);
+			qn = update_queue_node_full(entry->sid);
+			if (qn)
+			{
+				/* The file keeps its key among the files of its node.  */
+				if (!qn->parked)
+					qn->parked = fibheap_new(32, &update_queue_mutex);
+				update_queue_entry_move(entry, key, qn->parked);
+				continue;
+			}
+
+			fhs[n] = entry->fh;
+			sids[n] = entry->sid;
+			update_queue_node_get(entry->sid);
+			n++;
+
+			slot = htab_find_slot_with_hash(update_queue.htab, &entry->fh,
+											ZFS_FH_HASH(&entry->fh),
+											NO_INSERT);
+#ifdef ENABLE_CHECKING
+			if (!slot)
+				zfsd_abort();
+#endif
+			htab_clear_slot(update_queue.htab, slot);
+		}
+
+		if (n > 0)
+			return n;
+
+		/* All files have been parked, wait until a file is added or
+		   a file has been updated.  */
+	}
+}
+
+/*! \brief Tell #update_queue we are exiting, i.e. wake up the main update
+   thread waiting for a file handle to be added to the queue.  */
+void update_queue_exiting(void)
+{
+	zfsd_mutex_lock(&update_queue_mutex);
+	update_queue.exiting = true;
+	zfsd_cond_broadcast(&update_queue.non_empty);
+	zfsd_mutex_unlock(&update_queue_mutex);
+}
+
 /*! \brief Determine, which blocks in specified part of the file need to be
    updated. Get blocks of file FH from interval [START, END) which need to be
    updated and store them to BLOCKS. */
@@ -102,6 +417,44 @@ void get_blocks_for_updating(internal_fh fh, uint64_t start, uint64_t end,
 	RETURN_VOID;
 }
 
+/*! \brief Choose the block size of regular file DENTRY on volume VOL if it
+   has not been chosen yet.  The blocks are chosen so that the updated and
+   modified intervals of the whole file are tracked by few blocks, the
+   blocks transferred over a slow connection are not larger than ZFS_MAXDATA.
+   The MD5 sums are still requested for ranges of at most ZFS_MAX_MD5_LENGTH
+   bytes, see #update_file_blocks.  The block size is stored to
+   the metadata of the file, it is not chosen while the master node is not
+   connected.  \param size Size of the remote file.  \param
+   speed Speed of the connection to the master node. */
+static void
+update_choose_block_size(volume vol, internal_dentry dentry, uint64_t size,
+						 connection_speed speed)
+{
+	unsigned int shift;
+
+	TRACE("");
+	CHECK_MUTEX_LOCKED(&vol->mutex);
+	CHECK_MUTEX_LOCKED(&dentry->fh->mutex);
+
+	if (METADATA_BLOCK_SHIFT(dentry->fh->meta->flags) != 0
+		|| speed == CONNECTION_SPEED_NONE)
+		RETURN_VOID;
+
+	for (shift = ZFS_MIN_UPDATED_BLOCK_SHIFT;
+		 (shift < ZFS_MAX_UPDATED_BLOCK_SHIFT
+		  && (size >> shift) >= ZFS_MAX_MD5_CHUNKS); shift++)
+		;
+	if (speed == CONNECTION_SPEED_SLOW)
+		while ((1U << shift) > ZFS_MAXDATA)
+			shift--;
+
+	dentry->fh->meta->flags |= shift << METADATA_BLOCK_SHIFT_FIRST_BIT;
+	if (!flush_metadata(vol, dentry->fh->meta))
+		MARK_VOLUME_DELETE(vol);
+
+	RETURN_VOID;
+}
+
 /*! \brief Clear the tree of updated intervals and set version of dentry.
    Used when new version detected on master node, to update whole file again.
    Changes file's local and master version in metadata and updated tree.
@@ -119,27 +472,28 @@ static int32_t update_file_clear_updated_tree_1(volume vol, internal_dentry dent
 
 	r = ZFS_OK;
 
-	/* file has updated tree and is no longer treated as complete */
-	dentry->fh->meta.flags |= METADATA_UPDATED_TREE;
-	dentry->fh->meta.flags &= ~METADATA_COMPLETE;
+	/* file has updated tree and is no longer treated as complete, the block
+	   size is chosen again for the new size of the file */
+	dentry->fh->meta->flags |= METADATA_UPDATED_TREE;
+	dentry->fh->meta->flags &= ~(METADATA_COMPLETE | METADATA_BLOCK_SHIFT_MASK);
 
 	/* update the local and master versions in metadata */
-	if (dentry->fh->meta.local_version > dentry->fh->meta.master_version)
+	if (dentry->fh->meta->local_version > dentry->fh->meta->master_version)
 	{
-		if (dentry->fh->meta.local_version <= version)
-			dentry->fh->meta.local_version = version + 1;
+		if (dentry->fh->meta->local_version <= version)
+			dentry->fh->meta->local_version = version + 1;
 	}
 	else
 	{
 		/* increase local version to the desired one */
-		if (dentry->fh->meta.local_version < version)
-			dentry->fh->meta.local_version = version;
+		if (dentry->fh->meta->local_version < version)
+			dentry->fh->meta->local_version = version;
 	}
-	dentry->fh->meta.master_version = version;
-	set_attr_version(&dentry->fh->attr, &dentry->fh->meta);
+	dentry->fh->meta->master_version = version;
+	set_attr_version(&dentry->fh->attr, dentry->fh->meta);
 
 	/* write out the updated metadata */
-	if (!flush_metadata(vol, &dentry->fh->meta))
+	if (!flush_metadata(vol, dentry->fh->meta))
 	{
 		MARK_VOLUME_DELETE(vol);
 		r = ZFS_METADATA_ERROR;
@@ -239,7 +593,7 @@ static int32_t truncate_local_file(volume * volp, internal_dentry * dentryp, zfs
 	/* Flush the interval tree if the file was complete but now is larger to
 	   clean the complete flag.  */
 	flush = ((*dentryp)->fh->attr.size < size
-			 && !((*dentryp)->fh->meta.flags & METADATA_UPDATED_TREE));
+			 && !((*dentryp)->fh->meta->flags & METADATA_UPDATED_TREE));
 
 	(*dentryp)->fh->attr.size = fa.size;
 	interval_tree_delete((*dentryp)->fh->updated, fa.size, UINT64_MAX);
@@ -260,6 +614,231 @@ static int32_t truncate_local_file(volume * volp, internal_dentry * dentryp, zfs
 	RETURN_INT(r);
 }
 
+/*! \brief Piece of a block of remote file read by one request.  */
+typedef struct update_piece_def
+{
+	uint64_t offset;			/*!< offset of the piece */
+	uint32_t length;			/*!< length of the piece */
+} update_piece;
+
+/*! Maximal number of pieces of one block.  */
+#define UPDATE_MAX_PIECES (ZFS_MAX_UPDATED_BLOCK_SIZE / ZFS_MAXDATA)
+
+/*! \brief State of a block read for #update_file_blocks_1.  */
+typedef enum update_fetch_state_def
+{
+	UPDATE_FETCH_QUEUED,		/*!< waiting for a read-ahead thread */
+	UPDATE_FETCH_RUNNING,		/*!< being read */
+	UPDATE_FETCH_DONE			/*!< read, the result is valid */
+} update_fetch_state;
+
+/*! \brief Block of remote file read for #update_file_blocks_1.  */
+typedef struct update_fetch_slot_def
+{
+	/*! Sequence number of the block in the update.  */
+	unsigned int seq;
+
+	/*! State of the block.  */
+	update_fetch_state state;
+
+	/*! Offset of the block.  */
+	uint64_t offset;
+
+	/*! Length of the block.  */
+	uint32_t length;
+
+	/*! Number of bytes read.  */
+	uint32_t count;
+
+	/*! Version of the remote file, see #full_remote_read.  */
+	uint64_t version;
+
+	/*! Result of reading.  */
+	int32_t r;
+
+	/*! The data read.  */
+	char buf[ZFS_MAXDATA];
+} update_fetch_slot;
+
+/*! \brief Blocks of remote file being read while the previous blocks are
+   written to local file.  Block number SEQ is read to slot SEQ % DEPTH by a
+   read-ahead thread.  A block which no read-ahead thread has started to read
+   yet is read by the update thread itself.  */
+typedef struct update_fetch_def
+{
+	/*! Capability of the remote file.  */
+	zfs_cap cap;
+
+	/*! Check the version of the remote file.  */
+	bool check_version;
+
+	/*! Version of the remote file expected.  */
+	uint64_t version;
+
+	/*! Number of slots.  */
+	unsigned int depth;
+
+	/*! Number of blocks being read by read-ahead threads.  */
+	unsigned int running;
+
+	/*! Number of references: the update thread and the queued jobs.  */
+	unsigned int refs;
+
+	/*! The update has finished, the queued jobs have nothing to do.  */
+	bool cancelled;
+
+	/*! Signalled when a read-ahead thread has read a block.  */
+	pthread_cond_t cond;
+
+	/*! The slots.  */
+	update_fetch_slot *slots;
+} *update_fetch;
+
+/*! \brief Mutex protecting all update_fetch structures.  */
+static pthread_mutex_t update_fetch_mutex = ZFS_MUTEX_INITIALIZER;
+
+/*! \brief Read the block in SLOT of fetch F.  */
+static void update_fetch_read(update_fetch f, update_fetch_slot * slot)
+{
+	slot->version = f->version;
+	slot->r = full_remote_read(&slot->count, slot->buf, &f->cap, slot->offset,
+							   slot->length,
+							   f->check_version ? &slot->version : NULL);
+}
+
+/*! \brief Drop a reference to fetch F and free it when it was the last
+   one.  */
+static void update_fetch_release(update_fetch f)
+{
+	CHECK_MUTEX_LOCKED(&update_fetch_mutex);
+
+	if (--f->refs > 0)
+		return;
+
+	zfsd_cond_destroy(&f->cond);
+	free(f->slots);
+	free(f);
+}
+
+/*! \brief Read ahead the block number SEQ of fetch DATA.  It is run by a
+   read-ahead thread T.  */
+static void
+update_fetch_job(ATTRIBUTE_UNUSED thread * t, void *data,
+				 ATTRIBUTE_UNUSED uint64_t offset, unsigned int seq)
+{
+	update_fetch f = (update_fetch) data;
+	update_fetch_slot *slot = &f->slots[seq % f->depth];
+
+	zfsd_mutex_lock(&update_fetch_mutex);
+	if (!f->cancelled && slot->seq == seq
+		&& slot->state == UPDATE_FETCH_QUEUED)
+	{
+		slot->state = UPDATE_FETCH_RUNNING;
+		f->running++;
+		zfsd_mutex_unlock(&update_fetch_mutex);
+
+		update_fetch_read(f, slot);
+
+		zfsd_mutex_lock(&update_fetch_mutex);
+		slot->state = UPDATE_FETCH_DONE;
+		f->running--;
+		zfsd_cond_broadcast(&f->cond);
+	}
+	update_fetch_release(f);
+	zfsd_mutex_unlock(&update_fetch_mutex);
+}
+
+/*! \brief Create a fetch of blocks of remote file CAP with DEPTH blocks
+   read at once.  If VERSION is not NULL the version of the remote file must
+   be *VERSION.  */
+static update_fetch
+update_fetch_create(zfs_cap * cap, uint64_t * version, unsigned int depth)
+{
+	update_fetch f;
+
+	f = (update_fetch) xmalloc(sizeof(struct update_fetch_def));
+	f->cap = *cap;
+	f->check_version = (version != NULL);
+	f->version = version ? *version : 0;
+	f->depth = depth;
+	f->running = 0;
+	f->refs = 1;
+	f->cancelled = false;
+	zfsd_cond_init(&f->cond);
+	f->slots = (update_fetch_slot *) xmalloc(depth * sizeof(update_fetch_slot));
+
+	return f;
+}
+
+/*! \brief Start reading block number SEQ at OFFSET of length LENGTH for
+   fetch F.  The block SEQ - DEPTH must have been processed.  */
+static void
+update_fetch_queue(update_fetch f, unsigned int seq, uint64_t offset,
+				   uint32_t length)
+{
+	update_fetch_slot *slot = &f->slots[seq % f->depth];
+
+	zfsd_mutex_lock(&update_fetch_mutex);
+	slot->seq = seq;
+	slot->state = UPDATE_FETCH_QUEUED;
+	slot->offset = offset;
+	slot->length = length;
+	if (f->depth > 1)
+		f->refs++;
+	zfsd_mutex_unlock(&update_fetch_mutex);
+
+	/* Without read-ahead the update thread reads the block itself.  */
+	if (f->depth > 1)
+		readahead_queue_job(update_fetch_job, f, offset, seq, false);
+}
+
+/*! \brief Wait until block number SEQ of fetch F is read, or read it if no
+   read-ahead thread has started yet.  Store the data to *BUFP, the number
+   of bytes read to *COUNTP and the version of the remote file to *VERSIONP.
+   Return the result of reading.  */
+static int32_t
+update_fetch_wait(update_fetch f, unsigned int seq, char **bufp,
+				  uint32_t * countp, uint64_t * versionp)
+{
+	update_fetch_slot *slot = &f->slots[seq % f->depth];
+
+	zfsd_mutex_lock(&update_fetch_mutex);
+#ifdef ENABLE_CHECKING
+	if (slot->seq != seq)
+		zfsd_abort();
+#endif
+	if (slot->state == UPDATE_FETCH_QUEUED)
+	{
+		slot->state = UPDATE_FETCH_RUNNING;
+		zfsd_mutex_unlock(&update_fetch_mutex);
+
+		update_fetch_read(f, slot);
+
+		zfsd_mutex_lock(&update_fetch_mutex);
+		slot->state = UPDATE_FETCH_DONE;
+	}
+	while (slot->state != UPDATE_FETCH_DONE)
+		zfsd_cond_wait(&f->cond, &update_fetch_mutex);
+	zfsd_mutex_unlock(&update_fetch_mutex);
+
+	*bufp = slot->buf;
+	*countp = slot->count;
+	*versionp = slot->version;
+	return slot->r;
+}
+
+/*! \brief Finish fetch F.  Wait for the blocks being read because they use
+   the capability of the file, the queued jobs will do nothing.  */
+static void update_fetch_destroy(update_fetch f)
+{
+	zfsd_mutex_lock(&update_fetch_mutex);
+	f->cancelled = true;
+	while (f->running > 0)
+		zfsd_cond_wait(&f->cond, &update_fetch_mutex);
+	update_fetch_release(f);
+	zfsd_mutex_unlock(&update_fetch_mutex);
+}
+
 /*! \brief Update parts of file from remote file. The core function for
    updating file contents from remote file. Used either for updating part of
    file that user requested, or for all blocks not updated yet, via background 
@@ -270,11 +849,12 @@ static int32_t truncate_local_file(volume * volp, internal_dentry * dentryp, zfs
    file to be updated. \param blocks List of blocks to update. \param args
    List of blocks for md5 comparing. \param idx Number of block to start
    searching from. \param slow Determines if it should check for requests
-   pending on slow lines and abort if there are some. */
+   pending on slow lines and abort if there are some. \param cls Class of
+   the traffic, the background updates wait for the bandwidth limits. */
 
 static int32_t
 update_file_blocks_1(md5sum_args * args, zfs_cap * cap, varray * blocks,
-					 unsigned int *idx, bool slow)
+					 unsigned int *idx, bool slow, bandwidth_class cls)
 {
 	bool flush;
 	volume vol;
@@ -282,8 +862,12 @@ update_file_blocks_1(md5sum_args * args, zfs_cap * cap, varray * blocks,
 	md5sum_res local_md5;
 	md5sum_res remote_md5;
 	int32_t r;
-	unsigned int i, j;
+	unsigned int i, j, k;
+	update_piece *piece;
+	unsigned int n_diff, depth;
+	update_fetch fetch;
 	uint64_t local_version, remote_version;
+	uint64_t wait;
 	bool modified;
 
 	TRACE("");
@@ -342,12 +926,12 @@ update_file_blocks_1(md5sum_args * args, zfs_cap * cap, varray * blocks,
 	message(LOG_DATA, FACILITY_DATA | FACILITY_NET,
 			"update_file_blocks_1(): version local: %llu,"
 			"master: %llu, md5: %llu\n", dentry->fh->attr.version,
-			dentry->fh->meta.master_version, remote_md5.version);
+			dentry->fh->meta->master_version, remote_md5.version);
 
 	/* check if there file version on master node changed from what we assumed 
 	   in our metadata */
-	if (dentry->fh->attr.version == dentry->fh->meta.master_version
-		&& dentry->fh->meta.master_version != remote_md5.version)
+	if (dentry->fh->attr.version == dentry->fh->meta->master_version
+		&& dentry->fh->meta->master_version != remote_md5.version)
 	{
 		/* in that case, the whole file should be reupdated */
 		message(LOG_DEBUG, FACILITY_DATA | FACILITY_NET,
@@ -416,144 +1000,184 @@ update_file_blocks_1(md5sum_args * args, zfs_cap * cap, varray * blocks,
 	/* update local and master versions to what we currently know */
 	local_version = dentry->fh->attr.version;
 	remote_version = remote_md5.version;
-	modified = (dentry->fh->attr.version != dentry->fh->meta.master_version);
+	modified = (dentry->fh->attr.version != dentry->fh->meta->master_version);
 
 	release_dentry(dentry);
 	zfsd_mutex_unlock(&vol->mutex);
 
-	/* Process all blocks, update those with different local and remote
-	   checksums. */
-	for (i = 0, j = *idx; i < remote_md5.count; i++)
+	/* Split the blocks with different local and remote checksums to pieces
+	   which are read by one request.  */
+	piece = (update_piece *) xmalloc(remote_md5.count * UPDATE_MAX_PIECES
+									 * sizeof(update_piece));
+	n_diff = 0;
+	for (i = 0; i < remote_md5.count; i++)
 	{
 		/* sanity check (could this really happen?) */
-		if (remote_md5.length[i] > ZFS_MAXDATA
+		if (remote_md5.length[i] > ZFS_MAX_UPDATED_BLOCK_SIZE
 			|| remote_md5.offset[i] + remote_md5.length[i] > remote_md5.size)
 		{
+			free(piece);
 			RETURN_INT(ZFS_UPDATE_FAILED);
 		}
 
 		if (i >= local_md5.count	// remote file was bigger
-			|| local_md5.length[i] != remote_md5.length[i]	// remote file was 
-															// 
-			// bigger
-			|| memcmp(local_md5.md5sum[i], remote_md5.md5sum[i], MD5_SIZE) != 0)	// md5 
-																					// 
-			// hashes 
-			// not 
-			// equal
-		{
-			/* we need to update this block */
-			uint32_t count;
-			char buf[ZFS_MAXDATA];
-			char buf2[ZFS_MAXDATA];
-
-
-			/* find the update block that matches this md5 block */
-			while (j < VARRAY_USED(*blocks)
-				   && (VARRAY_ACCESS(*blocks, j, interval).end
-					   < remote_md5.offset[i]))
-				j++;
-
-			/* If the slow line is used, abort updating */
-			if (slow)
+			|| local_md5.length[i] != remote_md5.length[i]
+			|| memcmp(local_md5.md5sum[i], remote_md5.md5sum[i], MD5_SIZE) != 0)
+		{
+			uint32_t done, len;
+
+			for (done = 0; done < remote_md5.length[i]; done += len)
 			{
-				zfsd_mutex_lock(&pending_slow_reqs_mutex);
-				if (pending_slow_reqs_count > 0)
-				{
-					message(LOG_NOTICE,
-							FACILITY_THREADING | FACILITY_DATA | FACILITY_NET,
-							"Slow connections busy, aborting update\n");
-					zfsd_mutex_unlock(&pending_slow_reqs_mutex);
-					RETURN_INT(ZFS_SLOW_BUSY);
-				}
-				zfsd_mutex_unlock(&pending_slow_reqs_mutex);
+				len = (remote_md5.length[i] - done < ZFS_MAXDATA
+					   ? remote_md5.length[i] - done : ZFS_MAXDATA);
+				piece[n_diff].offset = remote_md5.offset[i] + done;
+				piece[n_diff].length = len;
+				n_diff++;
 			}
+		}
+	}
 
-			/* read the remote block */
-			r = full_remote_read(&remote_md5.length[i], buf, cap,
-								 remote_md5.offset[i], remote_md5.length[i],
-								 modified ? NULL : &remote_version);
-			if (r == ZFS_CHANGED)
+	/* Read the following blocks from the master node while a block is being
+	   written to the local file.  The slow update reads one block at a time
+	   so it can stop when the slow line is needed.  */
+	depth = slow ? 1 : zfs_config.update_pipeline_depth;
+	if (depth > n_diff)
+		depth = n_diff;
+	if (depth == 0)
+		depth = 1;
+	fetch = update_fetch_create(cap, modified ? NULL : &remote_version, depth);
+	for (k = 0; k < depth && k < n_diff; k++)
+		update_fetch_queue(fetch, k, piece[k].offset, piece[k].length);
+
+	/* Update the blocks with different checksums.  */
+	r = ZFS_OK;
+	for (k = 0, j = *idx; k < n_diff; k++)
+	{
+		uint32_t count;
+		char *buf;
+		char buf2[ZFS_MAXDATA];
+
+		/* find the update block that matches this piece */
+		while (j < VARRAY_USED(*blocks)
+			   && (VARRAY_ACCESS(*blocks, j, interval).end
+				   < piece[k].offset))
+			j++;
+
+		/* If the slow line is used, abort updating */
+		if (slow)
+		{
+			zfsd_mutex_lock(&pending_slow_reqs_mutex);
+			if (pending_slow_reqs_count > 0)
 			{
-				/* remote file version was changed meanwhile */
-				r = update_file_clear_updated_tree(&cap->fh, remote_version);
-				if (r != ZFS_OK)
-					RETURN_INT(r);
-
-				RETURN_INT(ZFS_CHANGED);
+				message(LOG_NOTICE,
+						FACILITY_THREADING | FACILITY_DATA | FACILITY_NET,
+						"Slow connections busy, aborting update\n");
+				zfsd_mutex_unlock(&pending_slow_reqs_mutex);
+				r = ZFS_SLOW_BUSY;
+				break;
 			}
+			zfsd_mutex_unlock(&pending_slow_reqs_mutex);
+		}
 
+		/* get the remote block */
+		r = update_fetch_wait(fetch, k, &buf, &piece[k].length,
+							  &remote_version);
+		if (r == ZFS_CHANGED)
+		{
+			/* remote file version was changed meanwhile */
+			update_fetch_destroy(fetch);
+			free(piece);
+			r = update_file_clear_updated_tree(&cap->fh, remote_version);
 			if (r != ZFS_OK)
 				RETURN_INT(r);
 
-			if ((VARRAY_ACCESS(*blocks, j, interval).start
-				 <= remote_md5.offset[i])
-				&& (remote_md5.offset[i] + remote_md5.length[i]
-					<= VARRAY_ACCESS(*blocks, j, interval).end))
+			RETURN_INT(ZFS_CHANGED);
+		}
+
+		if (r != ZFS_OK)
+			break;
+
+		if ((VARRAY_ACCESS(*blocks, j, interval).start
+			 <= piece[k].offset)
+			&& (piece[k].offset + piece[k].length
+				<= VARRAY_ACCESS(*blocks, j, interval).end))
+		{
+			/* The piece is not larger than the block to be updated. */
+			r = full_local_write(&count, buf, cap, piece[k].offset,
+								 piece[k].length, &local_version);
+			if (r != ZFS_OK)
+				break;
+		}
+		else
+		{
+			/* The piece is larger than block(s) to be updated.  */
+			r = full_local_read(&count, buf2, cap, piece[k].offset,
+								piece[k].length, &local_version);
+			if (r != ZFS_OK)
+				break;
+
+			/* Copy the part which was not written from local file because 
+			   local file was truncated meanwhile.  */
+			if (count < piece[k].length)
+				memcpy(buf2 + count, buf + count,
+					   piece[k].length - count);
+
+			/* Update the blocks in buffer BUF.  */
+			for (; (j < VARRAY_USED(*blocks)
+					&& (VARRAY_ACCESS(*blocks, j, interval).end
+						< piece[k].offset)); j++)
 			{
-				/* MD5 block is not larger than the block to be updated. */
-				r = full_local_write(&count, buf, cap, remote_md5.offset[i],
-									 remote_md5.length[i], &local_version);
-				if (r != ZFS_OK)
-					RETURN_INT(r);
+				uint64_t start;
+				uint64_t end;
+
+				start = VARRAY_ACCESS(*blocks, j, interval).start;
+				if (start < piece[k].offset)
+					start = piece[k].offset;
+				end = VARRAY_ACCESS(*blocks, j, interval).end;
+				if (end > piece[k].offset + piece[k].length)
+					end = piece[k].offset + piece[k].length;
+
+				memcpy(buf2 + start - piece[k].offset,
+					   buf + start - piece[k].offset, end - start);
 			}
-			else
-			{
-				/* MD5 block is larger than block(s) to be updated.  */
-				r = full_local_read(&count, buf2, cap, remote_md5.offset[i],
-									remote_md5.length[i], &local_version);
-				if (r != ZFS_OK)
-					RETURN_INT(r);
-
-				/* Copy the part which was not written from local file because 
-				   local file was truncated meanwhile.  */
-				if (count < remote_md5.length[i])
-					memcpy(buf2 + count, buf + count,
-						   remote_md5.length[i] - count);
-
-				/* Update the blocks in buffer BUF.  */
-				for (; (j < VARRAY_USED(*blocks)
-						&& (VARRAY_ACCESS(*blocks, j, interval).end
-							< remote_md5.offset[i])); j++)
-				{
-					uint64_t start;
-					uint64_t end;
-
-					start = VARRAY_ACCESS(*blocks, j, interval).start;
-					if (start < remote_md5.offset[i])
-						start = remote_md5.offset[i];
-					end = VARRAY_ACCESS(*blocks, j, interval).end;
-					if (end > remote_md5.offset[i] + remote_md5.length[i])
-						end = remote_md5.offset[i] + remote_md5.length[i];
-
-					memcpy(buf2 + start - remote_md5.offset[i],
-						   buf + start - remote_md5.offset[i], end - start);
-				}
 
-				/* Write updated buffer BUF.  */
-				r = full_local_write(&count, buf2, cap, remote_md5.offset[i],
-									 remote_md5.length[i], &local_version);
-				if (r != ZFS_OK)
-					RETURN_INT(r);
-			}
+			/* Write updated buffer BUF.  */
+			r = full_local_write(&count, buf2, cap, piece[k].offset,
+								 piece[k].length, &local_version);
+			if (r != ZFS_OK)
+				break;
+		}
+
+		/* The slot of the block can be reused for the next block.  */
+		if (k + depth < n_diff)
+			update_fetch_queue(fetch, k + depth, piece[k + depth].offset,
+							   piece[k + depth].length);
 
-			/* Add the interval to UPDATED. */
-			r = zfs_fh_lookup(&cap->fh, &vol, &dentry, NULL, false);
+		/* Add the interval to UPDATED. */
+		r = zfs_fh_lookup(&cap->fh, &vol, &dentry, NULL, false);
 #ifdef ENABLE_CHECKING
-			if (r != ZFS_OK)
-				zfsd_abort();
+		if (r != ZFS_OK)
+			zfsd_abort();
 #endif
 
-			if (!append_interval(vol, dentry->fh, METADATA_TYPE_UPDATED,
-								 remote_md5.offset[i],
-								 remote_md5.offset[i] + count))
-				MARK_VOLUME_DELETE(vol);
+		if (!append_interval(vol, dentry->fh, METADATA_TYPE_UPDATED,
+							 piece[k].offset,
+							 piece[k].offset + count))
+			MARK_VOLUME_DELETE(vol);
+
+		wait = bandwidth_use(vol, cls, piece[k].length);
+		release_dentry(dentry);
+		zfsd_mutex_unlock(&vol->mutex);
+
+		/* Do not read the following blocks faster than allowed.  */
+		bandwidth_wait(wait);
+	}
+	update_fetch_destroy(fetch);
+	free(piece);
+
+	if (r != ZFS_OK)
+		RETURN_INT(r);
 
-			release_dentry(dentry);
-			zfsd_mutex_unlock(&vol->mutex);
-		}
-	}							// end for (i = 0, j = *idx; i <
-	// remote_md5.count; i++)
 	*idx = j;
 
 	if (flush)
@@ -578,14 +1202,18 @@ update_file_blocks_1(md5sum_args * args, zfs_cap * cap, varray * blocks,
 /*! \brief Update blocks of local file according to remote file.  Prepares
    the md5sum arguments for #update_file_blocks_1 and calls it.  \param cap
    Capability of the local file.  \param blocks Blocks to be updated.  \param
-   modified Flag saying the local file has been modified.  \param slow Just
-   passed to #update_file_blocks_1 */
+   block_size Maximal length of a block whose MD5 sum is compared, see
+   #UPDATED_BLOCK_SIZE.  \param modified Flag saying the local file has been
+   modified.  \param slow Just passed to #update_file_blocks_1 \param cls
+   Just passed to #update_file_blocks_1 */
 int32_t
-update_file_blocks(zfs_cap * cap, varray * blocks, bool modified, bool slow)
+update_file_blocks(zfs_cap * cap, varray * blocks, uint32_t block_size,
+				   bool modified, bool slow, bandwidth_class cls)
 {
 	md5sum_args args;
 	int32_t r;
 	unsigned int i, idx;
+	uint32_t length;
 
 	TRACE("");
 #ifdef ENABLE_CHECKING
@@ -593,6 +1221,11 @@ update_file_blocks(zfs_cap * cap, varray * blocks, bool modified, bool slow)
 		zfsd_abort();
 #endif
 
+	/* The master node may not be able to compute the MD5 sum of a longer
+	   range.  */
+	length = (block_size < ZFS_MAX_MD5_LENGTH
+			  ? block_size : ZFS_MAX_MD5_LENGTH);
+
 	args.count = 0;
 	args.ignore_changes = modified;
 	idx = 0;
@@ -604,21 +1237,22 @@ update_file_blocks(zfs_cap * cap, varray * blocks, bool modified, bool slow)
 		do
 		{
 			if (args.count > 0
-				&& (x.start - args.offset[args.count - 1] < ZFS_MAXDATA)
+				&& (x.start - args.offset[args.count - 1] < length)
 				&& (x.start - args.offset[args.count - 1]
-					- args.length[args.count - 1] < ZFS_MODIFIED_BLOCK_SIZE))
+					- args.length[args.count - 1]
+					< (block_size >> ZFS_MODIFIED_BLOCK_RATIO_SHIFT)))
 			{
 				x.start = args.offset[args.count - 1];
-				args.length[args.count - 1] = (x.end - x.start < ZFS_MAXDATA
-											   ? x.end -
-											   x.start : ZFS_MAXDATA);
-				x.start += args.length[args.count];
+				args.length[args.count - 1] = (x.end - x.start < length
+											   ? x.end - x.start : length);
+				x.start += args.length[args.count - 1];
 			}
 			else
 			{
 				if (args.count == ZFS_MAX_MD5_CHUNKS)
 				{
-					r = update_file_blocks_1(&args, cap, blocks, &idx, slow);
+					r = update_file_blocks_1(&args, cap, blocks, &idx, slow,
+											 cls);
 					if (r == ZFS_CHANGED)
 						RETURN_INT(ZFS_OK);
 					if (r != ZFS_OK)
@@ -626,8 +1260,8 @@ update_file_blocks(zfs_cap * cap, varray * blocks, bool modified, bool slow)
 					args.count = 0;
 				}
 				args.offset[args.count] = x.start;
-				args.length[args.count] = (x.end - x.start < ZFS_MAXDATA
-										   ? x.end - x.start : ZFS_MAXDATA);
+				args.length[args.count] = (x.end - x.start < length
+										   ? x.end - x.start : length);
 				x.start += args.length[args.count];
 				args.count++;
 			}
@@ -637,7 +1271,7 @@ update_file_blocks(zfs_cap * cap, varray * blocks, bool modified, bool slow)
 
 	if (args.count > 0)
 	{
-		r = update_file_blocks_1(&args, cap, blocks, &idx, slow);
+		r = update_file_blocks_1(&args, cap, blocks, &idx, slow, cls);
 		if (r == ZFS_CHANGED)
 			RETURN_INT(ZFS_OK);
 		if (r != ZFS_OK)
@@ -647,6 +1281,252 @@ update_file_blocks(zfs_cap * cap, varray * blocks, bool modified, bool slow)
 	RETURN_INT(ZFS_OK);
 }
 
+/*! \brief Check whether the file should be updated by deltas against its
+   old contents.  It should when the file has not been modified locally,
+   nothing of the current version of the master file has been updated yet
+   and both the old and the new contents are large.  \param dentry Dentry of
+   the local file.  \param attr Attributes of the master file. */
+static bool update_file_delta_p(internal_dentry dentry, fattr * attr)
+{
+	CHECK_MUTEX_LOCKED(&dentry->fh->mutex);
+
+	return (dentry->fh->attr.version == dentry->fh->meta->master_version
+			&& dentry->fh->meta->master_version == attr->version
+			&& dentry->fh->updated->size == 0
+			&& dentry->fh->modified->size == 0
+			&& dentry->fh->attr.size >= DELTA_MIN_FILE_SIZE
+			&& attr->size >= DELTA_MIN_FILE_SIZE);
+}
+
+/*! \brief Read the old contents of the local file for #update_file_delta.
+   The local file has been overwritten by the new contents up to HIST_START
+   + HIST_LEN, the old contents from HIST_START are kept in HIST.  \param
+   buf Buffer for COUNT bytes of the old contents starting at BASE.  \param
+   cap Capability of the local file.  \param version Local version of the
+   file, reading fails when it changes. */
+static int32_t
+update_file_delta_basis(char *buf, zfs_cap * cap, uint64_t base,
+						uint32_t count, char *hist, uint64_t hist_start,
+						uint32_t hist_len, uint64_t * version)
+{
+	uint64_t written;
+	uint32_t n, rcount;
+	int32_t r;
+
+	TRACE("");
+#ifdef ENABLE_CHECKING
+	if (base < hist_start)
+		zfsd_abort();
+#endif
+
+	n = 0;
+	written = hist_start + hist_len;
+	if (base < written)
+	{
+		n = (written - base < count ? written - base : count);
+		memcpy(buf, hist + (base - hist_start), n);
+	}
+
+	if (n < count)
+	{
+		r = full_local_read(&rcount, buf + n, cap, base + n, count - n,
+							version);
+		if (r != ZFS_OK)
+			RETURN_INT(r);
+		if (rcount < count - n)
+			RETURN_INT(ZFS_UPDATE_FAILED);
+	}
+
+	RETURN_INT(ZFS_OK);
+}
+
+/*! \brief Update the whole local file by deltas of the master file against
+   the old contents of the local file.  For each range of the master file
+   the checksums of the blocks of the old contents following the last block
+   found are offered, or the blocks around the expected position when no
+   block has been found for a long time.  The master node replies with the
+   blocks found in the range and the literal data between them.  The old
+   contents are read from the local file itself, at least the last
+   DELTA_MAX_LENGTH bytes of the old contents which have been overwritten
+   are kept in memory.  \param cap Capability of the local file.  \param
+   basis_size Size of the old contents, the local file must not be shorter.
+   \param size Size of the master file.  \param version Version
+   of the master file.  \param local_version Local version of the file.
+   \param slow Check for requests pending on slow lines and abort if there
+   are some. */
+static int32_t
+update_file_delta(zfs_cap * cap, uint64_t basis_size, uint64_t size,
+				  uint64_t version, uint64_t * local_version, bool slow)
+{
+	volume vol;
+	internal_dentry dentry;
+	delta_args args;
+	delta_res res;
+	char data[ZFS_MAXDATA];
+	char *basis, *out, *hist;
+	uint64_t offset, base, anchor, expected, pos, wait, hist_start;
+	uint32_t count, hist_len, i, n;
+	int32_t r;
+
+	TRACE("");
+
+	basis = (char *)xmalloc(DELTA_MAX_LENGTH);
+	out = (char *)xmalloc(DELTA_MAX_LENGTH);
+	hist = (char *)xmalloc(2 * DELTA_MAX_LENGTH);
+	hist_start = 0;
+	hist_len = 0;
+	args.block_size = DELTA_BLOCK_SIZE;
+	anchor = 0;
+	expected = 0;
+	r = ZFS_OK;
+	for (offset = 0; offset < size; offset += res.length)
+	{
+		/* If the slow line is used, abort updating */
+		if (slow)
+		{
+			zfsd_mutex_lock(&pending_slow_reqs_mutex);
+			if (pending_slow_reqs_count > 0)
+			{
+				message(LOG_NOTICE,
+						FACILITY_THREADING | FACILITY_DATA | FACILITY_NET,
+						"Slow connections busy, aborting update\n");
+				zfsd_mutex_unlock(&pending_slow_reqs_mutex);
+				r = ZFS_SLOW_BUSY;
+				break;
+			}
+			zfsd_mutex_unlock(&pending_slow_reqs_mutex);
+		}
+
+		/* Choose the blocks of the old contents to offer.  */
+		base = anchor;
+		if (expected - anchor > DELTA_MAX_LENGTH / 2)
+			base = expected - DELTA_MAX_LENGTH / 4;
+		if (base + DELTA_MAX_LENGTH > basis_size)
+			base = (basis_size > DELTA_MAX_LENGTH
+					? basis_size - DELTA_MAX_LENGTH : 0);
+		/* The older overwritten contents have been dropped.  */
+		if (base < hist_start)
+			base = hist_start + DELTA_BLOCK_SIZE - 1;
+		base -= base % DELTA_BLOCK_SIZE;
+		count = (base >= basis_size ? 0
+				 : basis_size - base < DELTA_MAX_LENGTH
+				 ? basis_size - base : DELTA_MAX_LENGTH);
+		r = update_file_delta_basis(basis, cap, base, count, hist,
+									hist_start, hist_len, local_version);
+		if (r != ZFS_OK)
+			break;
+
+		args.cap = *cap;
+		args.offset = offset;
+		args.length = DELTA_MAX_LENGTH;
+		args.count = count / DELTA_BLOCK_SIZE;
+		delta_signatures(&args, basis);
+
+		res.data.buf = data;
+		r = remote_delta(&res, &args);
+		if (r != ZFS_OK)
+			break;
+
+		if (res.version != version)
+		{
+			/* remote file version was changed meanwhile */
+			free(basis);
+			free(out);
+			free(hist);
+			r = update_file_clear_updated_tree(&cap->fh, res.version);
+			if (r != ZFS_OK)
+				RETURN_INT(r);
+
+			RETURN_INT(ZFS_CHANGED);
+		}
+
+		if (res.length > args.length
+			|| !delta_apply(out, &res, basis, args.count, args.block_size))
+		{
+			r = ZFS_UPDATE_FAILED;
+			break;
+		}
+
+		/* the master file is shorter than we have thought */
+		if (res.length == 0)
+			break;
+
+		/* Keep the old contents being overwritten, their blocks may be
+		   offered for the following ranges.  */
+		if (offset < basis_size)
+		{
+			n = (basis_size - offset < res.length
+				 ? basis_size - offset : res.length);
+			if (hist_len + n > 2 * DELTA_MAX_LENGTH)
+			{
+				count = hist_len + n - DELTA_MAX_LENGTH;
+				memmove(hist, hist + count, hist_len - count);
+				hist_start += count;
+				hist_len -= count;
+			}
+
+			r = full_local_read(&count, hist + hist_len, cap, offset, n,
+								local_version);
+			if (r != ZFS_OK)
+				break;
+			if (count < n)
+			{
+				r = ZFS_UPDATE_FAILED;
+				break;
+			}
+			hist_len += n;
+		}
+
+		r = full_local_write(&count, out, cap, offset, res.length,
+							 local_version);
+		if (r != ZFS_OK)
+			break;
+
+		r = zfs_fh_lookup(&cap->fh, &vol, &dentry, NULL, false);
+#ifdef ENABLE_CHECKING
+		if (r != ZFS_OK)
+			zfsd_abort();
+#endif
+
+		if (!append_interval(vol, dentry->fh, METADATA_TYPE_UPDATED,
+							 offset, offset + count))
+			MARK_VOLUME_DELETE(vol);
+
+		/* Only the literal data and the checksums were transferred.  */
+		wait = bandwidth_use(vol, BANDWIDTH_UPDATE,
+							 res.data.len
+							 + args.count * (sizeof(uint32_t) + MD5_SIZE));
+		release_dentry(dentry);
+		zfsd_mutex_unlock(&vol->mutex);
+
+		if (count < res.length)
+			break;
+
+		bandwidth_wait(wait);
+
+		/* The old contents continue after the last block found, the data
+		   after it are expected to have replaced the old contents.  */
+		expected += res.length;
+		for (pos = offset, i = 0; i < res.count; i++)
+		{
+			if (res.op[i] & ZFS_DELTA_COPY)
+			{
+				n = (res.op[i] & ~ZFS_DELTA_COPY) * DELTA_BLOCK_SIZE;
+				anchor = base + (uint64_t) res.block[i] * DELTA_BLOCK_SIZE + n;
+				expected = anchor + offset + res.length - pos - n;
+			}
+			else
+				n = res.op[i];
+			pos += n;
+		}
+	}
+
+	free(basis);
+	free(out);
+	free(hist);
+	RETURN_INT(r);
+}
+
 /*! \brief Reintegrate modified blocks of local file CAP to remote file.
    Function for performing the actual reintegration work.  \param cap
    Capability of the file.  \param slow Determines a slow reintegration,
@@ -664,6 +1544,7 @@ static int32_t reintegrate_file_blocks(zfs_cap * cap, bool slow)
 	int32_t r, r2, r3;
 	uint64_t version_increase;
 	uint64_t diff;
+	uint64_t wait;
 	metadata *meta;
 
 	TRACE("");
@@ -673,7 +1554,7 @@ static int32_t reintegrate_file_blocks(zfs_cap * cap, bool slow)
 #ifdef ENABLE_CHECKING
 	if (r2 != ZFS_OK)
 		zfsd_abort();
-	if (zfs_fh_undefined(dentry->fh->meta.master_fh))
+	if (zfs_fh_undefined(dentry->fh->meta->master_fh))
 		zfsd_abort();
 #endif
 
@@ -771,6 +1652,25 @@ static int32_t reintegrate_file_blocks(zfs_cap * cap, bool slow)
 		}
 		else
 			break;
+
+		/* Do not write the following blocks faster than allowed, the file
+		   is unlocked while waiting.  */
+		wait = bandwidth_use(vol, BANDWIDTH_REINTEGRATE, count);
+		if (wait > 0)
+		{
+			release_dentry(dentry);
+			zfsd_mutex_unlock(&vol->mutex);
+			zfsd_mutex_unlock(&fh_mutex);
+
+			bandwidth_wait(wait);
+
+			r2 = find_capability_nolock(cap, &icap, &vol, &dentry, NULL,
+										false);
+#ifdef ENABLE_CHECKING
+			if (r2 != ZFS_OK)
+				zfsd_abort();
+#endif
+		}
 	}
 
 	zfsd_mutex_unlock(&fh_mutex);
@@ -811,7 +1711,7 @@ static int32_t reintegrate_file_blocks(zfs_cap * cap, bool slow)
 	}
 
 	/* Update the versions.  */
-	meta = &dentry->fh->meta;
+	meta = dentry->fh->meta;
 	diff = meta->local_version - (meta->master_version + version_increase);
 
 	message(LOG_DATA, FACILITY_DATA | FACILITY_NET,
@@ -835,7 +1735,7 @@ static int32_t reintegrate_file_blocks(zfs_cap * cap, bool slow)
 		zfsd_abort();
 #endif
 
-	meta = &dentry->fh->meta;
+	meta = dentry->fh->meta;
 	if (version_increase)
 	{
 		meta->master_version += version_increase;
@@ -904,7 +1804,7 @@ update_p(volume * volp, internal_dentry * dentryp, zfs_fh * fh, fattr * attr,
 		zfsd_abort();
 #endif
 
-	if (zfs_fh_undefined((*dentryp)->fh->meta.master_fh))
+	if (zfs_fh_undefined((*dentryp)->fh->meta->master_fh))
 		RETURN_INT(0);
 
 	if (fh_mutex_locked)
@@ -914,7 +1814,7 @@ update_p(volume * volp, internal_dentry * dentryp, zfs_fh * fh, fattr * attr,
 	r = remote_getattr(attr, *dentryp, *volp);
 	message(LOG_DEBUG, FACILITY_DATA | FACILITY_NET,
 			"update_p() got master version %llu, local meta: %llu for %s\n",
-			attr->version, (*dentryp)->fh->meta.master_version,
+			attr->version, (*dentryp)->fh->meta->master_version,
 			(*dentryp)->name.str);
 	if (r != ZFS_OK)
 		goto out;
@@ -949,10 +1849,44 @@ update_p(volume * volp, internal_dentry * dentryp, zfs_fh * fh, fattr * attr,
 	RETURN_INT(0);
 }
 
-/*! \brief Fully update regular file with file handle FH.  The main file
-   updating function of #update_worker. Determines what should be updated and
-   performs it.  Handles the connection status change of volume master of the
-   file.  Reschedules the file for further updating if it couldn't finish it.
+/*! \brief Reintegrate directory DENTRY with file handle FH on volume VOL
+   taken from #update_queue.  A directory is scheduled when it has been
+   created on the master node by the reintegration of its parent so the
+   independent subtrees are reintegrated by the threads in #update_pool in
+   parallel, each after its parent.  */
+static int32_t update_file_dir(volume vol, internal_dentry dentry, zfs_fh * fh)
+{
+	int32_t r;
+
+	TRACE("");
+	CHECK_MUTEX_LOCKED(&vol->mutex);
+	CHECK_MUTEX_LOCKED(&dentry->fh->mutex);
+
+	dentry->fh->flags &= ~IFH_ENQUEUED;
+	if (volume_master_connected(vol) == CONNECTION_SPEED_NONE)
+	{
+		release_dentry(dentry);
+		zfsd_mutex_unlock(&vol->mutex);
+		RETURN_INT(ZFS_OK);
+	}
+
+	r = internal_dentry_lock(LEVEL_EXCLUSIVE, &vol, &dentry, fh);
+	if (r != ZFS_OK)
+		RETURN_INT(r);
+
+	r = update_fh_if_needed(&vol, &dentry, fh, IFH_REINTEGRATE);
+	if (r != ZFS_OK)
+		RETURN_INT(r);
+
+	internal_dentry_unlock(vol, dentry);
+	RETURN_INT(ZFS_OK);
+}
+
+/*! \brief Fully update regular file with file handle FH or reintegrate
+   directory FH.  The main file updating function of #update_worker.
+   Determines what should be updated and performs it.  Handles the
+   connection status change of volume master of the file.  Reschedules the
+   file for further updating if it couldn't finish it.
    \param fh File handle (taken from #update_queue or #update_slow_queue)
    \param slowthread Determines if the thread is slow updater. If the file is
    on volume with different speed, it's resolved. */
@@ -969,6 +1903,8 @@ static int32_t update_file(zfs_fh * fh, bool slowthread)
 	bool opened_remote = false;
 	bool slow = slowthread;		// the speed of volume with the file
 	zfs_fh reschedule_fh;		// file handle to be rescheduled
+	fibheapkey_t reschedule_key = FIBHEAPKEY_MAX;
+	uint32_t reschedule_sid = NODE_ID_NONE;
 
 	TRACE("");
 
@@ -989,13 +1925,21 @@ static int32_t update_file(zfs_fh * fh, bool slowthread)
 
 	/* can't update files without local cache or on volumes without master */
 	if (!(INTERNAL_FH_HAS_LOCAL_PATH(dentry->fh) && vol->master != this_node)
-		|| zfs_fh_undefined(dentry->fh->meta.master_fh))
+		|| zfs_fh_undefined(dentry->fh->meta->master_fh))
 	{
+		/* The file is scheduled again when it is created on master.  */
+		dentry->fh->flags &= ~IFH_ENQUEUED;
 		release_dentry(dentry);
 		zfsd_mutex_unlock(&vol->mutex);
 		RETURN_INT(EINVAL);
 	}
 
+	if (dentry->fh->attr.type == FT_DIR)
+	{
+		r = update_file_dir(vol, dentry, fh);
+		RETURN_INT(r);
+	}
+
 	r = internal_dentry_lock(LEVEL_SHARED, &vol, &dentry, fh);
 	if (r != ZFS_OK)
 		RETURN_INT(r);
@@ -1063,6 +2007,11 @@ static int32_t update_file(zfs_fh * fh, bool slowthread)
 		break;
 	}
 
+	/* choose the block size before the file is updated for the first time */
+	update_choose_block_size(vol, dentry, attr.size,
+							 (slow ? CONNECTION_SPEED_SLOW
+							  : CONNECTION_SPEED_FAST));
+
 	/* calculate the capability rights needed for desired action */
 	switch (what & (IFH_UPDATE | IFH_REINTEGRATE))
 	{
@@ -1158,32 +2107,96 @@ static int32_t update_file(zfs_fh * fh, bool slowthread)
 
 	if (r == ZFS_OK && (what & IFH_UPDATE))
 	{
+		bool delta;
+		uint64_t basis_size = 0;
+		uint64_t local_version = 0;
+
 		/* we are updating */
 		message(LOG_FUNC, FACILITY_DATA | FACILITY_NET,
 				"update_file() in IFH_UPDATE\n");
+
+		/* a large file is updated by deltas against its old contents, keep
+		   the old contents until the deltas have been applied */
+		delta = update_file_delta_p(dentry, &attr);
+		if (delta)
+		{
+			basis_size = dentry->fh->attr.size;
+			local_version = dentry->fh->attr.version;
+		}
+
 		/* change file size according to remote, if needed */
-		r = truncate_local_file(&vol, &dentry, fh, attr.size);
+		r = truncate_local_file(&vol, &dentry, fh,
+								(attr.size < basis_size
+								 ? basis_size : attr.size));
 		if (r == ZFS_OK)
 		{
 			message(LOG_DATA, FACILITY_DATA,
 					"update_file() truncate_local_file() was OK\n");
+			uint32_t block_size;
 			bool modified;
+			bool changed = false;
+
+			if (delta)
+			{
+				release_dentry(dentry);
+				zfsd_mutex_unlock(&vol->mutex);
+
+				message(LOG_INFO, FACILITY_DATA | FACILITY_NET,
+						"update_file() calling update_file_delta()\n");
+				r = update_file_delta(&cap, basis_size, attr.size,
+									  attr.version, &local_version, slow);
+
+				/* Update the rest of the file block by block unless updating
+				   has been aborted or the file has changed meanwhile.  */
+				changed = (r == ZFS_CHANGED);
+				if (r != ZFS_SLOW_BUSY)
+				{
+					if (r != ZFS_OK && !changed)
+						message(LOG_NOTICE, FACILITY_DATA | FACILITY_NET,
+								"update_file_delta() failed: %d, updating "
+								"blocks\n", r);
+					r = ZFS_OK;
+				}
+
+				r2 = zfs_fh_lookup_nolock(fh, &vol, &dentry, NULL, false);
+#ifdef ENABLE_CHECKING
+				if (r2 != ZFS_OK)
+					zfsd_abort();
+#endif
+
+				/* cut the old contents following the end of the master
+				   file */
+				r2 = truncate_local_file(&vol, &dentry, fh, attr.size);
+				if (r2 != ZFS_OK)
+				{
+					if (r == ZFS_OK)
+						r = r2;
+
+					r2 = zfs_fh_lookup(fh, &vol, &dentry, NULL, false);
+#ifdef ENABLE_CHECKING
+					if (r2 != ZFS_OK)
+						zfsd_abort();
+#endif
+				}
+			}
 
 			zfsd_mutex_unlock(&vol->mutex);
 
 			get_blocks_for_updating(dentry->fh, 0, attr.size, &blocks);
+			block_size = UPDATED_BLOCK_SIZE(dentry->fh);
 			modified =
-				(dentry->fh->attr.version != dentry->fh->meta.master_version);
+				(dentry->fh->attr.version != dentry->fh->meta->master_version);
 			message(LOG_DATA, FACILITY_DATA | FACILITY_NET,
 					"update_file() local version %llu master %llu\n",
-					dentry->fh->attr.version, dentry->fh->meta.master_version);
+					dentry->fh->attr.version, dentry->fh->meta->master_version);
 			release_dentry(dentry);
 
-			if (VARRAY_USED(blocks) > 0)
+			if (r == ZFS_OK && !changed && VARRAY_USED(blocks) > 0)
 			{
 				message(LOG_INFO, FACILITY_DATA | FACILITY_NET,
 						"update_file() calling update_file_blocks()\n");
-				r = update_file_blocks(&cap, &blocks, modified, slow);
+				r = update_file_blocks(&cap, &blocks, block_size, modified,
+									   slow, BANDWIDTH_UPDATE);
 			}
 			varray_destroy(&blocks);
 		}
@@ -1198,8 +2211,8 @@ static int32_t update_file(zfs_fh * fh, bool slowthread)
 		if (interval_tree_covered(dentry->fh->updated, 0, attr.size))
 		{
 			/* yes, mark file as complete and flush metadata */
-			dentry->fh->meta.flags |= METADATA_COMPLETE;
-			if (!flush_metadata(vol, &dentry->fh->meta))
+			dentry->fh->meta->flags |= METADATA_COMPLETE;
+			if (!flush_metadata(vol, dentry->fh->meta))
 				MARK_VOLUME_DELETE(vol);
 		}
 	}
@@ -1214,8 +2227,8 @@ static int32_t update_file(zfs_fh * fh, bool slowthread)
 	/* If the file was not completelly updated or reintegrated add it to queue 
 	   again.  */
 	if (((r == ZFS_OK) || (r == ZFS_SLOW_BUSY))
-		&& ((dentry->fh->meta.flags & METADATA_COMPLETE) == 0
-			|| (dentry->fh->meta.flags & METADATA_MODIFIED_TREE) != 0))
+		&& ((dentry->fh->meta->flags & METADATA_COMPLETE) == 0
+			|| (dentry->fh->meta->flags & METADATA_MODIFIED_TREE) != 0))
 	{
 		message(LOG_NOTICE, FACILITY_DATA | FACILITY_NET,
 				"File not fully updated or reintegrated, rescheduling\n");
@@ -1247,6 +2260,12 @@ static int32_t update_file(zfs_fh * fh, bool slowthread)
 		message(LOG_FUNC, FACILITY_DATA | FACILITY_NET, "put_capability\n");
 		put_capability(icap, dentry->fh, NULL);
 	}
+	if (!zfs_fh_undefined(reschedule_fh))
+	{
+		reschedule_key = update_queue_key(dentry->fh->attr.size,
+										  UPDATE_PRIORITY_BACKGROUND);
+		reschedule_sid = vol->master->id;
+	}
 	message(LOG_FUNC, FACILITY_THREADING | FACILITY_DATA | FACILITY_NET,
 			"internal_dentry_unlock\n");
 	internal_dentry_unlock(vol, dentry);
@@ -1259,7 +2278,8 @@ static int32_t update_file(zfs_fh * fh, bool slowthread)
 			message(LOG_INFO, FACILITY_DATA | FACILITY_NET,
 					"Rescheduling file on the update_file() end... to fast queue\n");
 			zfsd_mutex_lock(&update_queue_mutex);
-			queue_put(&update_queue, &reschedule_fh);
+			update_queue_put(&reschedule_fh, reschedule_sid, reschedule_key,
+							 true);
 			zfsd_mutex_unlock(&update_queue_mutex);
 		}
 		else
@@ -1669,16 +2689,16 @@ synchronize_attributes(volume * volp, internal_dentry * dentryp,
 
 	message(LOG_FUNC, FACILITY_DATA | FACILITY_NET,
 			"synchronize_attributes(): name=%s, local=%u, remote=%u\n",
-			(*dentryp)->fh->meta.name, local_changed, remote_changed);
+			(*dentryp)->fh->meta->name, local_changed, remote_changed);
 
 	if (local_changed && METADATA_ATTR_EQ_P((*dentryp)->fh->attr, *attr))
 	{
 		/* local attributes were supposed to be changed but actually aren't,
 		   just update local metadata then */
-		(*dentryp)->fh->meta.modetype = GET_MODETYPE(attr->mode, attr->type);
-		(*dentryp)->fh->meta.uid = attr->uid;
-		(*dentryp)->fh->meta.gid = attr->gid;
-		if (!flush_metadata(*volp, &(*dentryp)->fh->meta))
+		(*dentryp)->fh->meta->modetype = GET_MODETYPE(attr->mode, attr->type);
+		(*dentryp)->fh->meta->uid = attr->uid;
+		(*dentryp)->fh->meta->gid = attr->gid;
+		if (!flush_metadata(*volp, (*dentryp)->fh->meta))
 			MARK_VOLUME_DELETE(*volp);
 
 		RETURN_INT(ZFS_OK);
@@ -1689,7 +2709,7 @@ synchronize_attributes(volume * volp, internal_dentry * dentryp,
 	sa.atime = (zfs_time) - 1;
 	sa.mtime = (zfs_time) - 1;
 	if ((*dentryp)->fh->level == LEVEL_UNLOCKED)
-		meta = (*dentryp)->fh->meta;
+		meta = *(*dentryp)->fh->meta;
 
 	if (local_changed)
 	{
@@ -1706,12 +2726,12 @@ synchronize_attributes(volume * volp, internal_dentry * dentryp,
 		message(LOG_FUNC, FACILITY_DATA | FACILITY_NET, "here\n");
 		message(LOG_DATA, FACILITY_DATA | FACILITY_NET,
 				"attr->version %llu, meta_master version %llu\n",
-				attr->version, (*dentryp)->fh->meta.master_version);
+				attr->version, (*dentryp)->fh->meta->master_version);
 		r = remote_setattr(attr, *dentryp, &sa, *volp);
 		message(LOG_FUNC, FACILITY_DATA | FACILITY_NET,
 				"attr->version %llu, meta_master version %llu\n",
-				attr->version, (*dentryp)->fh->meta.master_version);
-		(*dentryp)->fh->meta.master_version = attr->version;
+				attr->version, (*dentryp)->fh->meta->master_version);
+		(*dentryp)->fh->meta->master_version = attr->version;
 	}
 	if (remote_changed)
 	{
@@ -1737,12 +2757,12 @@ synchronize_attributes(volume * volp, internal_dentry * dentryp,
 		if (remote_changed)
 			(*dentryp)->fh->attr = fa;
 
-		(*dentryp)->fh->meta.modetype = GET_MODETYPE((*dentryp)->fh->attr.mode,
+		(*dentryp)->fh->meta->modetype = GET_MODETYPE((*dentryp)->fh->attr.mode,
 													 (*dentryp)->fh->
 													 attr.type);
-		(*dentryp)->fh->meta.uid = (*dentryp)->fh->attr.uid;
-		(*dentryp)->fh->meta.gid = (*dentryp)->fh->attr.gid;
-		if (!flush_metadata(*volp, &(*dentryp)->fh->meta))
+		(*dentryp)->fh->meta->uid = (*dentryp)->fh->attr.uid;
+		(*dentryp)->fh->meta->gid = (*dentryp)->fh->attr.gid;
+		if (!flush_metadata(*volp, (*dentryp)->fh->meta))
 			MARK_VOLUME_DELETE(*volp);
 	}
 	else
@@ -1886,12 +2906,12 @@ create_local_fh(internal_dentry dir, string * name, volume vol,
 		{
 			if (remote_attr->size > 0)
 			{
-				flags = ((dentry->fh->meta.flags & ~METADATA_COMPLETE)
+				flags = ((dentry->fh->meta->flags & ~METADATA_COMPLETE)
 						 | METADATA_UPDATED_TREE);
 			}
 			else
 			{
-				flags = ((dentry->fh->meta.flags | METADATA_COMPLETE)
+				flags = ((dentry->fh->meta->flags | METADATA_COMPLETE)
 						 & ~METADATA_UPDATED_TREE);
 
 			}
@@ -1915,6 +2935,27 @@ create_local_fh(internal_dentry dir, string * name, volume vol,
 	RETURN_INT(r);
 }
 
+/*! \brief Set attributes SA of remote file created according to local
+   attributes ATTR.  */
+static void reintegrate_sattr(sattr * sa, fattr * attr)
+{
+	sa->mode = attr->mode;
+	sa->uid = attr->uid;
+	sa->gid = attr->gid;
+	/* for regular files, create with local file's size so it is known on
+	   remote node before reintegrating whole content */
+	if (attr->type == FT_REG)
+	{
+		sa->size = attr->size;
+	}
+	else
+	{
+		sa->size = (uint64_t) - 1;
+	}
+	sa->atime = attr->atime;
+	sa->mtime = attr->mtime;
+}
+
 /*! \brief Create remote generic file based on local attributes Create remote 
    generic file NAME in directory DIR on volume VOL according to local
    attributes ATTR.  DIR_FH is a file handle of the directory.  \param[out]
@@ -1932,21 +2973,7 @@ create_remote_fh(dir_op_res * res, internal_dentry dir, string * name,
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 	CHECK_MUTEX_LOCKED(&dir->fh->mutex);
 
-	sa.mode = attr->mode;
-	sa.uid = attr->uid;
-	sa.gid = attr->gid;
-	/* for regular files, create with local file's size so it is known on
-	   remote node before reintegrating whole content */
-	if (attr->type == FT_REG)
-	{
-		sa.size = attr->size;
-	}
-	else
-	{
-		sa.size = (uint64_t) - 1;
-	}
-	sa.atime = attr->atime;
-	sa.mtime = attr->mtime;
+	reintegrate_sattr(&sa, attr);
 
 	switch (attr->type)
 	{
@@ -1990,19 +3017,23 @@ create_remote_fh(dir_op_res * res, internal_dentry dir, string * name,
 }
 
 /*! \brief Schedule update or reintegration of a not yet enqueued regular
-   file.  The scheduling happens only for volumes that are currently connected 
-   and if some threads in #update_pool are running.  If the file is on slow
-   connected volume and there is a #slow_update_worker thread running, it's
-   put into #update_slow_queue. Otherwise, it's put into #update_queue. \param 
-   vol Volume the file is on.  \param dentry The dentry of the file. */
-static void
-schedule_update_or_reintegration(volume vol, internal_dentry dentry)
+   file or reintegration of a directory.  The scheduling happens only for
+   volumes that are currently connected and if some threads in #update_pool
+   are running.  If the file is on slow connected volume and there is a
+   #slow_update_worker thread running, it's put into #update_slow_queue.
+   Otherwise, it's put into #update_queue with a key given by PRIORITY and the size of the file.  If the file is already
+   waiting in #update_queue, its priority is raised to PRIORITY.  \param 
+   vol Volume the file is on.  \param dentry The dentry of the file.  \param
+   priority How urgent the update is. */
+void
+schedule_update_or_reintegration(volume vol, internal_dentry dentry,
+								 update_priority priority)
 {
 	TRACE("");
 	CHECK_MUTEX_LOCKED(&vol->mutex);
 	CHECK_MUTEX_LOCKED(&dentry->fh->mutex);
 #ifdef ENABLE_CHECKING
-	if (dentry->fh->attr.type != FT_REG)
+	if (dentry->fh->attr.type != FT_REG && dentry->fh->attr.type != FT_DIR)
 		zfsd_abort();
 #endif
 
@@ -2010,6 +3041,8 @@ schedule_update_or_reintegration(volume vol, internal_dentry dentry)
 			"schedule_update_or_reintegration(): name=%s\n", dentry->name.str);
 
 	connection_speed speed = volume_master_connected(vol);
+	fibheapkey_t key;
+
 	if (speed == CONNECTION_SPEED_NONE)
 		RETURN_VOID;
 
@@ -2025,8 +3058,22 @@ schedule_update_or_reintegration(volume vol, internal_dentry dentry)
 	{
 		zfsd_mutex_unlock(&update_pool.mutex);
 
+		key = update_queue_key(dentry->fh->attr.size, priority);
+
 		/* File must not be in any queue yet */
-		if (!(dentry->fh->flags & IFH_ENQUEUED))
+		if (dentry->fh->flags & IFH_ENQUEUED)
+		{
+			/* The file is in some queue or it is being updated, raise its
+			   priority if it is still waiting in the update queue.  */
+			if (speed != CONNECTION_SPEED_SLOW)
+			{
+				zfsd_mutex_lock(&update_queue_mutex);
+				update_queue_put(&dentry->fh->local_fh, vol->master->id, key,
+								 false);
+				zfsd_mutex_unlock(&update_queue_mutex);
+			}
+		}
+		else
 		{
 			dentry->fh->flags |= IFH_ENQUEUED;
 
@@ -2046,7 +3093,8 @@ schedule_update_or_reintegration(volume vol, internal_dentry dentry)
 			}
 
 			zfsd_mutex_lock(&update_queue_mutex);
-			queue_put(&update_queue, &dentry->fh->local_fh);
+			update_queue_put(&dentry->fh->local_fh, vol->master->id, key,
+							 true);
 			zfsd_mutex_unlock(&update_queue_mutex);
 		}
 	}
@@ -2146,7 +3194,7 @@ synchronize_file(volume vol, internal_dentry dentry, zfs_fh * fh, fattr * attr,
 #ifdef ENABLE_CHECKING
 	if (!(INTERNAL_FH_HAS_LOCAL_PATH(dentry->fh) && vol->master != this_node))
 		zfsd_abort();
-	if (zfs_fh_undefined(dentry->fh->meta.master_fh))
+	if (zfs_fh_undefined(dentry->fh->meta->master_fh))
 		zfsd_abort();
 #endif
 
@@ -2155,10 +3203,10 @@ synchronize_file(volume vol, internal_dentry dentry, zfs_fh * fh, fattr * attr,
 			dentry->name.str, what, same_place);
 
 	/* detects changes of metadata (attributes and size) */
-	local_changed = METADATA_ATTR_CHANGE_P(dentry->fh->meta, dentry->fh->attr)
+	local_changed = METADATA_ATTR_CHANGE_P(*dentry->fh->meta, dentry->fh->attr)
 		|| (METADATA_SIZE_CHANGE_P(dentry->fh->attr, *attr)
 			&& (dentry->fh->attr.version > attr->version));
-	remote_changed = METADATA_ATTR_CHANGE_P(dentry->fh->meta, *attr)
+	remote_changed = METADATA_ATTR_CHANGE_P(*dentry->fh->meta, *attr)
 		|| (METADATA_SIZE_CHANGE_P(dentry->fh->attr, *attr)
 			&& (dentry->fh->attr.version < attr->version));
 
@@ -2187,7 +3235,7 @@ synchronize_file(volume vol, internal_dentry dentry, zfs_fh * fh, fattr * attr,
 		if (r != ZFS_OK)
 			RETURN_INT(r);
 
-		if (!ZFS_FH_EQ(dentry->fh->meta.master_fh, res.file))
+		if (!ZFS_FH_EQ(dentry->fh->meta->master_fh, res.file))
 		{
 			release_dentry(dentry);
 			zfsd_mutex_unlock(&vol->mutex);
@@ -2196,15 +3244,15 @@ synchronize_file(volume vol, internal_dentry dentry, zfs_fh * fh, fattr * attr,
 		}
 
 		attr = &res.attr;
-		remote_changed = METADATA_ATTR_CHANGE_P(dentry->fh->meta, *attr);
+		remote_changed = METADATA_ATTR_CHANGE_P(*dentry->fh->meta, *attr);
 	}
 
 	/* detect attribute and data conflicts */
 	attr_conflict = local_changed && remote_changed;
 	data_conflict = (dentry->fh->attr.type == FT_REG
 					 && dentry->fh->attr.version >
-					 dentry->fh->meta.master_version
-					 && attr->version > dentry->fh->meta.master_version);
+					 dentry->fh->meta->master_version
+					 && attr->version > dentry->fh->meta->master_version);
 
 	if (!attr_conflict && data_conflict
 		&& (dentry->fh->flags & IFH_REINTEGRATING))
@@ -2244,7 +3292,7 @@ synchronize_file(volume vol, internal_dentry dentry, zfs_fh * fh, fattr * attr,
 
 		/* Create an attr-attr or modify-modify conflict.  */
 		local_attr = dentry->fh->attr;
-		master_fh = dentry->fh->meta.master_fh;
+		master_fh = dentry->fh->meta->master_fh;
 		release_dentry(dentry);
 		conflict = create_conflict(vol, parent, &name, fh, &local_attr);
 		free(name.str);
@@ -2262,17 +3310,17 @@ synchronize_file(volume vol, internal_dentry dentry, zfs_fh * fh, fattr * attr,
 		message(LOG_DATA, FACILITY_DATA | FACILITY_NET,
 				"synchronize_file() end, versions: local: %llu, master: %llu, meta master: %llu\n",
 				dentry->fh->attr.version, attr->version,
-				dentry->fh->meta.master_version);
+				dentry->fh->meta->master_version);
 
 		if (dentry->fh->attr.type == FT_REG)
 		{
 			/* for the regular files, check if master version changed from
 			   what we knew in local metadata */
-			if (attr->version > dentry->fh->meta.master_version)
+			if (attr->version > dentry->fh->meta->master_version)
 			{
 				message(LOG_DATA, FACILITY_DATA | FACILITY_NET,
 						"synchronize_file(): master version changed, clearing updated tree\n");
-				// dentry->fh->attr.version = dentry->fh->meta.master_version;
+				// dentry->fh->attr.version = dentry->fh->meta->master_version;
 				/* if yes, this will update the version and remove updated
 				   tree if any */
 				update_file_clear_updated_tree_1(vol, dentry, attr->version);
@@ -2281,7 +3329,8 @@ synchronize_file(volume vol, internal_dentry dentry, zfs_fh * fh, fattr * attr,
 			/* schedule if wanted */
 			if ((what & (IFH_UPDATE | IFH_REINTEGRATE)) != 0)
 			{
-				schedule_update_or_reintegration(vol, dentry);
+				schedule_update_or_reintegration(vol, dentry,
+												 UPDATE_PRIORITY_BACKGROUND);
 			}
 		}
 
@@ -2323,8 +3372,8 @@ resolve_conflict_discard_local(zfs_fh * conflict_fh, internal_dentry local,
 	CHECK_MUTEX_LOCKED(&remote->fh->mutex);
 
 	/* Synchronize the attributes if necessary.  */
-	if (METADATA_ATTR_CHANGE_P(local->fh->meta, local->fh->attr)
-		&& METADATA_ATTR_CHANGE_P(local->fh->meta, remote->fh->attr))
+	if (METADATA_ATTR_CHANGE_P(*local->fh->meta, local->fh->attr)
+		&& METADATA_ATTR_CHANGE_P(*local->fh->meta, remote->fh->attr))
 	{
 		sa.mode = (local->fh->attr.mode != remote->fh->attr.mode
 				   ? remote->fh->attr.mode : (uint32_t) - 1);
@@ -2355,12 +3404,12 @@ resolve_conflict_discard_local(zfs_fh * conflict_fh, internal_dentry local,
 			zfsd_abort();
 #endif
 
-		set_attr_version(&fa, &local->fh->meta);
+		set_attr_version(&fa, local->fh->meta);
 		local->fh->attr = fa;
-		local->fh->meta.modetype = GET_MODETYPE(fa.mode, fa.type);
-		local->fh->meta.uid = fa.uid;
-		local->fh->meta.gid = fa.gid;
-		if (!flush_metadata(vol, &local->fh->meta))
+		local->fh->meta->modetype = GET_MODETYPE(fa.mode, fa.type);
+		local->fh->meta->uid = fa.uid;
+		local->fh->meta->gid = fa.gid;
+		if (!flush_metadata(vol, local->fh->meta))
 			MARK_VOLUME_DELETE(vol);
 	}
 
@@ -2389,12 +3438,12 @@ resolve_conflict_discard_local(zfs_fh * conflict_fh, internal_dentry local,
 		goto out;
 
 	/* Update local and remote version.  */
-	local->fh->meta.local_version = version;
-	local->fh->meta.master_version = version;
-	local->fh->meta.flags &= ~METADATA_COMPLETE;
-	local->fh->meta.flags |= METADATA_UPDATED_TREE;
-	set_attr_version(&local->fh->attr, &local->fh->meta);
-	if (!flush_metadata(vol, &local->fh->meta))
+	local->fh->meta->local_version = version;
+	local->fh->meta->master_version = version;
+	local->fh->meta->flags &= ~METADATA_COMPLETE;
+	local->fh->meta->flags |= METADATA_UPDATED_TREE;
+	set_attr_version(&local->fh->attr, local->fh->meta);
+	if (!flush_metadata(vol, local->fh->meta))
 		MARK_VOLUME_DELETE(vol);
 	release_dentry(local);
 	zfsd_mutex_unlock(&vol->mutex);
@@ -2421,7 +3470,7 @@ resolve_conflict_discard_local(zfs_fh * conflict_fh, internal_dentry local,
 	release_dentry(conflict);
 	zfsd_mutex_unlock(&fh_mutex);
 
-	schedule_update_or_reintegration(vol, local);
+	schedule_update_or_reintegration(vol, local, UPDATE_PRIORITY_BACKGROUND);
 	release_dentry(local);
 	zfsd_mutex_unlock(&vol->mutex);
 
@@ -2456,8 +3505,8 @@ resolve_conflict_discard_remote(zfs_fh * conflict_fh, internal_dentry local,
 	CHECK_MUTEX_LOCKED(&remote->fh->mutex);
 
 	/* Synchronize the attributes if necessary.  */
-	if (METADATA_ATTR_CHANGE_P(local->fh->meta, local->fh->attr)
-		&& METADATA_ATTR_CHANGE_P(local->fh->meta, remote->fh->attr))
+	if (METADATA_ATTR_CHANGE_P(*local->fh->meta, local->fh->attr)
+		&& METADATA_ATTR_CHANGE_P(*local->fh->meta, remote->fh->attr))
 	{
 		sa.mode = (local->fh->attr.mode != remote->fh->attr.mode
 				   ? local->fh->attr.mode : (uint32_t) - 1);
@@ -2490,10 +3539,10 @@ resolve_conflict_discard_remote(zfs_fh * conflict_fh, internal_dentry local,
 #endif
 
 		remote->fh->attr = fa;
-		local->fh->meta.modetype = GET_MODETYPE(fa.mode, fa.type);
-		local->fh->meta.uid = fa.uid;
-		local->fh->meta.gid = fa.gid;
-		if (!flush_metadata(vol, &local->fh->meta))
+		local->fh->meta->modetype = GET_MODETYPE(fa.mode, fa.type);
+		local->fh->meta->uid = fa.uid;
+		local->fh->meta->gid = fa.gid;
+		if (!flush_metadata(vol, local->fh->meta))
 			MARK_VOLUME_DELETE(vol);
 	}
 
@@ -2522,12 +3571,12 @@ resolve_conflict_discard_remote(zfs_fh * conflict_fh, internal_dentry local,
 		goto out;
 
 	/* Update local and remote version.  */
-	local->fh->meta.local_version = version + 1;
-	local->fh->meta.master_version = version;
-	local->fh->meta.flags &= ~METADATA_COMPLETE;
-	local->fh->meta.flags |= METADATA_UPDATED_TREE;
-	set_attr_version(&local->fh->attr, &local->fh->meta);
-	if (!flush_metadata(vol, &local->fh->meta))
+	local->fh->meta->local_version = version + 1;
+	local->fh->meta->master_version = version;
+	local->fh->meta->flags &= ~METADATA_COMPLETE;
+	local->fh->meta->flags |= METADATA_UPDATED_TREE;
+	set_attr_version(&local->fh->attr, local->fh->meta);
+	if (!flush_metadata(vol, local->fh->meta))
 		MARK_VOLUME_DELETE(vol);
 	release_dentry(local);
 	zfsd_mutex_unlock(&vol->mutex);
@@ -2554,7 +3603,7 @@ resolve_conflict_discard_remote(zfs_fh * conflict_fh, internal_dentry local,
 	release_dentry(conflict);
 	zfsd_mutex_unlock(&fh_mutex);
 
-	schedule_update_or_reintegration(vol, local);
+	schedule_update_or_reintegration(vol, local, UPDATE_PRIORITY_BACKGROUND);
 	release_dentry(local);
 	zfsd_mutex_unlock(&vol->mutex);
 
@@ -2693,7 +3742,7 @@ update_dir(volume vol, internal_dentry dir, zfs_fh * fh, fattr * attr)
 #ifdef ENABLE_CHECKING
 	if (!(INTERNAL_FH_HAS_LOCAL_PATH(dir->fh) && vol->master != this_node))
 		zfsd_abort();
-	if (zfs_fh_undefined(dir->fh->meta.master_fh))
+	if (zfs_fh_undefined(dir->fh->meta->master_fh))
 		zfsd_abort();
 	if (dir->fh->attr.type != FT_DIR)
 		zfsd_abort();
@@ -2701,8 +3750,8 @@ update_dir(volume vol, internal_dentry dir, zfs_fh * fh, fattr * attr)
 		zfsd_abort();
 #endif
 
-	if (dir->fh->meta.master_version == attr->version
-		&& (dir->fh->meta.flags & METADATA_COMPLETE))
+	if (dir->fh->meta->master_version == attr->version
+		&& (dir->fh->meta->flags & METADATA_COMPLETE))
 	{
 		/* This happens when we have reintegrated a directory and no other
 		   node has changed the directory.  */
@@ -2902,7 +3951,7 @@ update_dir(volume vol, internal_dentry dir, zfs_fh * fh, fattr * attr)
 
 				/* Create a modify-delete conflict.  */
 				have_conflicts = true;
-				remote_res.file.sid = dir->fh->meta.master_fh.sid;
+				remote_res.file.sid = dir->fh->meta->master_fh.sid;
 				conflict =
 					create_conflict(vol, dir, &entry->name, &local_res.file,
 									&local_res.attr);
@@ -3184,6 +4233,290 @@ reintegrate_deleted_dir(dir_op_res * res, uint32_t vid,
 	RETURN_INT(r);
 }
 
+/*! \brief Set the master file handle and version in metadata META of
+   local file LOCAL_FH on volume VOL to file RES created on the master node.
+   Return false if the metadata could not be written.  */
+static bool
+reintegrate_set_master(volume vol, zfs_fh * local_fh, dir_op_res * res,
+					   metadata * meta)
+{
+	internal_dentry subdentry;
+	bool success;
+
+	TRACE("");
+	CHECK_MUTEX_LOCKED(&fh_mutex);
+	CHECK_MUTEX_LOCKED(&vol->mutex);
+
+	/* Update local metadata.  */
+	subdentry = dentry_lookup(local_fh);
+	if (subdentry)
+		*meta = *subdentry->fh->meta;
+
+	meta->master_fh = res->file;
+	meta->master_version = res->attr.version;
+	if (meta->flags & METADATA_MODIFIED_TREE)
+	{
+		if (meta->local_version <= meta->master_version)
+			meta->local_version = meta->master_version + 1;
+	}
+	else
+	{
+		if (meta->local_version < meta->master_version)
+			meta->local_version = meta->master_version;
+	}
+
+	success = flush_metadata(vol, meta);
+
+	if (subdentry)
+	{
+		if (success)
+		{
+			*subdentry->fh->meta = *meta;
+			set_attr_version(&subdentry->fh->attr, subdentry->fh->meta);
+
+			/* The contents of the file can be reintegrated now, schedule
+			   it so that it does not wait until it is accessed.  */
+			if (subdentry->fh->attr.type == FT_REG
+				|| subdentry->fh->attr.type == FT_DIR)
+				schedule_update_or_reintegration(vol, subdentry,
+												 UPDATE_PRIORITY_BACKGROUND);
+		}
+		release_dentry(subdentry);
+	}
+
+	RETURN_BOOL(success);
+}
+
+/*! \brief Journal entries of a directory sent to the master node in one
+   request.  */
+typedef struct reintegrate_batch_def
+{
+	reintegrate_batch_args args;
+	reintegrate_batch_res res;
+
+	/*! Journal entries of the operations in ARGS.  */
+	journal_entry entry[ZFS_MAX_REINTEGRATE_BATCH];
+
+	/*! Local file handles and metadata of the files created by ARGS.  */
+	zfs_fh local_fh[ZFS_MAX_REINTEGRATE_BATCH];
+	metadata meta[ZFS_MAX_REINTEGRATE_BATCH];
+
+	/*! Total length of the names in ARGS.  */
+	uint32_t names;
+} reintegrate_batch;
+
+/*! \brief Send the journal entries in BATCH of directory *DIRP with file
+   handle FH on volume *VOLP to the master node and delete the entries it
+   has applied from the journal.  Increase *VERSION_INCREASE by the number
+   of the entries which changed the master directory and set *FLUSH_JOURNAL
+   when the journal has changed.  Return false if the master node has not
+   applied the batch.  */
+static bool
+reintegrate_dir_batch_flush(volume * volp, internal_dentry * dirp,
+							zfs_fh * fh, reintegrate_batch * batch,
+							bool * flush_journal, uint64_t * version_increase)
+{
+	reintegrate_batch_op *op;
+	uint32_t i;
+	int32_t r, r2;
+
+	TRACE("count = %" PRIu32, batch->args.count);
+	CHECK_MUTEX_LOCKED(&fh_mutex);
+	CHECK_MUTEX_LOCKED(&(*volp)->mutex);
+	CHECK_MUTEX_LOCKED(&(*dirp)->fh->mutex);
+
+	zfsd_mutex_unlock(&fh_mutex);
+	r = remote_reintegrate_batch(&batch->res, &batch->args, *volp, *dirp, fh);
+	r2 = zfs_fh_lookup_nolock(fh, volp, dirp, NULL, false);
+#ifdef ENABLE_CHECKING
+	if (r2 != ZFS_OK)
+		zfsd_abort();
+#endif
+
+	for (i = 0; r == ZFS_OK && i < batch->args.count; i++)
+	{
+		op = &batch->args.op[i];
+		if (batch->res.status[i] == ZFS_OK)
+		{
+			(*version_increase)++;
+			if (op->oper == REINTEGRATE_BATCH_CREATE
+				&& !reintegrate_set_master(*volp, &batch->local_fh[i],
+										   &batch->res.res[i],
+										   &batch->meta[i]))
+			{
+				MARK_VOLUME_DELETE(*volp);
+				continue;
+			}
+		}
+		/* The name is not the deleted file on master any more.  */
+		else if (!(op->oper == REINTEGRATE_BATCH_DEL
+				   && batch->res.status[i] == ENOENT))
+			continue;
+
+		if (!journal_delete_entry((*dirp)->fh->journal, batch->entry[i]))
+			zfsd_abort();
+		*flush_journal = true;
+	}
+
+	batch->args.count = 0;
+	batch->names = 0;
+	RETURN_BOOL(r == ZFS_OK);
+}
+
+/*! \brief Reintegrate the journal entries of directory *DIRP on volume
+   *VOLP with file handle FH in batches.  The entries which create a file,
+   name an existing master file or delete a file are sent to the master
+   node in batches of at most #ZFS_MAX_REINTEGRATE_BATCH entries.  The
+   entries of the names in a conflict or with both an ADD and a DEL entry,
+   and the entries which the master node has not applied are left in the
+   journal for reintegrate_dir.  Increase *VERSION_INCREASE by the number
+   of the entries which changed the master directory and set
+   *FLUSH_JOURNAL when the journal has changed.  */
+static void
+reintegrate_dir_batch(volume * volp, internal_dentry * dirp, zfs_fh * fh,
+					  bool * flush_journal, uint64_t * version_increase)
+{
+	volume vol = *volp;
+	internal_dentry dir = *dirp;
+	internal_dentry conflict;
+	reintegrate_batch *batch;
+	reintegrate_batch_op *op;
+	journal_entry entry, next;
+	journal_operation_t other;
+	dir_op_res local_res;
+	file_info_res info;
+	metadata meta;
+	zfs_fh file_fh;
+	bool local_volume_root;
+	bool local_exists;
+	bool conflict_p;
+	int32_t r, r2;
+
+	TRACE("");
+	CHECK_MUTEX_LOCKED(&fh_mutex);
+	CHECK_MUTEX_LOCKED(&vol->mutex);
+	CHECK_MUTEX_LOCKED(&dir->fh->mutex);
+
+	local_volume_root = LOCAL_VOLUME_ROOT_P(dir);
+	batch = (reintegrate_batch *) xmalloc(sizeof(reintegrate_batch));
+	batch->args.count = 0;
+	batch->names = 0;
+	for (entry = dir->fh->journal->first; entry; entry = next)
+	{
+		next = entry->next;
+
+		if (local_volume_root && SPECIAL_NAME_P(entry->name.str, true))
+			continue;
+
+		other = (entry->oper == JOURNAL_OPERATION_ADD
+				 ? JOURNAL_OPERATION_DEL : JOURNAL_OPERATION_ADD);
+		if (journal_member(dir->fh->journal, other, &entry->name))
+			continue;
+
+		conflict = dentry_lookup_name(vol, dir, &entry->name);
+		if (conflict)
+		{
+			conflict_p = CONFLICT_DIR_P(conflict->fh->local_fh);
+			release_dentry(conflict);
+			if (conflict_p)
+				continue;
+		}
+
+		op = &batch->args.op[batch->args.count];
+		switch (entry->oper)
+		{
+		default:
+			zfsd_abort();
+
+		case JOURNAL_OPERATION_ADD:
+			r = local_lookup(&local_res, dir, &entry->name, vol, &meta);
+			r2 = zfs_fh_lookup_nolock(fh, &vol, &dir, NULL, false);
+#ifdef ENABLE_CHECKING
+			if (r2 != ZFS_OK)
+				zfsd_abort();
+#endif
+			if (r != ZFS_OK)
+				continue;
+
+			if (!zfs_fh_undefined(meta.master_fh))
+			{
+				op->oper = REINTEGRATE_BATCH_ADD;
+				op->fh = entry->master_fh;
+			}
+			else if (local_res.attr.type != FT_LNK)
+			{
+				op->oper = REINTEGRATE_BATCH_CREATE;
+				reintegrate_sattr(&op->attr, &local_res.attr);
+				op->type = local_res.attr.type;
+				op->rdev = local_res.attr.rdev;
+				batch->local_fh[batch->args.count] = local_res.file;
+				batch->meta[batch->args.count] = meta;
+			}
+			else
+			{
+				/* The target of a symlink is read by create_remote_fh.  */
+				continue;
+			}
+			break;
+
+		case JOURNAL_OPERATION_DEL:
+			zfsd_mutex_unlock(&fh_mutex);
+
+			file_fh.dev = entry->dev;
+			file_fh.ino = entry->ino;
+			file_fh.gen = entry->gen;
+			r = local_file_info(&info, &file_fh, vol);
+			local_exists = (r == ZFS_OK);
+			if (r == ZFS_OK)
+				free(info.path.str);
+
+			release_dentry(dir);
+			zfsd_mutex_unlock(&vol->mutex);
+
+			r = ZFS_OK;
+			if (!local_exists)
+				r = reintegrate_deleted_dir(&local_res, fh->vid, entry);
+
+			r2 = zfs_fh_lookup_nolock(fh, &vol, &dir, NULL, false);
+#ifdef ENABLE_CHECKING
+			if (r2 != ZFS_OK)
+				zfsd_abort();
+#endif
+			if (r != ZFS_OK)
+				continue;
+
+			op->oper = REINTEGRATE_BATCH_DEL;
+			op->fh = entry->master_fh;
+			op->version = entry->master_version;
+			op->destroy_p = !local_exists;
+			break;
+		}
+
+		op->name = entry->name;
+		batch->entry[batch->args.count] = entry;
+		batch->args.count++;
+		batch->names += entry->name.len;
+		if (batch->args.count == ZFS_MAX_REINTEGRATE_BATCH
+			|| (batch->names
+				> ZFS_MAX_REINTEGRATE_BATCH_NAMES - ZFS_MAXNAMELEN))
+		{
+			if (!reintegrate_dir_batch_flush(&vol, &dir, fh, batch,
+											 flush_journal,
+											 version_increase))
+				break;
+		}
+	}
+
+	if (batch->args.count > 0)
+		reintegrate_dir_batch_flush(&vol, &dir, fh, batch, flush_journal,
+									version_increase);
+
+	free(batch);
+	*volp = vol;
+	*dirp = dir;
+	RETURN_VOID;
+}
+
 /*! \brief Reintegrate journal for directory DIR on volume VOL with file
    handle FH. Update version of remote directrory in ATTR. */
 static int32_t
@@ -3210,7 +4543,7 @@ reintegrate_dir(volume vol, internal_dentry dir, zfs_fh * fh, fattr * attr)
 #ifdef ENABLE_CHECKING
 	if (!(INTERNAL_FH_HAS_LOCAL_PATH(dir->fh) && vol->master != this_node))
 		zfsd_abort();
-	if (zfs_fh_undefined(dir->fh->meta.master_fh))
+	if (zfs_fh_undefined(dir->fh->meta->master_fh))
 		zfsd_abort();
 	if (dir->fh->attr.type != FT_DIR)
 		zfsd_abort();
@@ -3218,9 +4551,14 @@ reintegrate_dir(volume vol, internal_dentry dir, zfs_fh * fh, fattr * attr)
 		zfsd_abort();
 #endif
 
-	local_volume_root = LOCAL_VOLUME_ROOT_P(dir);
 	flush_journal = false;
 	version_increase = 0;
+
+	/* Send the independent entries to the master node in batches first,
+	   the remaining entries are reintegrated one by one.  */
+	reintegrate_dir_batch(&vol, &dir, fh, &flush_journal, &version_increase);
+
+	local_volume_root = LOCAL_VOLUME_ROOT_P(dir);
 	for (entry = dir->fh->journal->first; entry; entry = next)
 	{
 		next = entry->next;
@@ -3327,9 +4665,6 @@ reintegrate_dir(volume vol, internal_dentry dir, zfs_fh * fh, fattr * attr)
 			{
 				if (zfs_fh_undefined(meta.master_fh))
 				{
-					internal_dentry subdentry;
-					bool success;
-
 					r = create_remote_fh(&res, dir, &entry->name, vol,
 										 fh, &local_res.attr);
 					r2 = zfs_fh_lookup_nolock(fh, &vol, &dir, NULL, false);
@@ -3342,38 +4677,8 @@ reintegrate_dir(volume vol, internal_dentry dir, zfs_fh * fh, fattr * attr)
 
 					version_increase++;
 
-					/* Update local metadata.  */
-					subdentry = dentry_lookup(&local_res.file);
-					if (subdentry)
-						meta = subdentry->fh->meta;
-
-					meta.master_fh = res.file;
-					meta.master_version = res.attr.version;
-					if (meta.flags & METADATA_MODIFIED_TREE)
-					{
-						if (meta.local_version <= meta.master_version)
-							meta.local_version = meta.master_version + 1;
-					}
-					else
-					{
-						if (meta.local_version < meta.master_version)
-							meta.local_version = meta.master_version;
-					}
-
-					success = flush_metadata(vol, &meta);
-
-					if (subdentry)
-					{
-						if (success)
-						{
-							subdentry->fh->meta = meta;
-							set_attr_version(&subdentry->fh->attr,
-											 &subdentry->fh->meta);
-						}
-						release_dentry(subdentry);
-					}
-
-					if (!success)
+					if (!reintegrate_set_master(vol, &local_res.file, &res,
+												&meta))
 					{
 						MARK_VOLUME_DELETE(vol);
 						continue;
@@ -3628,7 +4933,7 @@ reintegrate_dir(volume vol, internal_dentry dir, zfs_fh * fh, fattr * attr)
 			goto out2;
 		}
 
-		if (!lookup_metadata(vol, &dir->fh->local_fh, &dir->fh->meta, true))
+		if (!lookup_metadata(vol, &dir->fh->local_fh, dir->fh->meta, true))
 		{
 			MARK_VOLUME_DELETE(vol);
 			version = attr->version;
@@ -3636,41 +4941,41 @@ reintegrate_dir(volume vol, internal_dentry dir, zfs_fh * fh, fattr * attr)
 		else
 		{
 			if (attr->version ==
-				dir->fh->meta.master_version + version_increase)
+				dir->fh->meta->master_version + version_increase)
 			{
-				if (dir->fh->meta.local_version > attr->version)
-					version = dir->fh->meta.local_version;
+				if (dir->fh->meta->local_version > attr->version)
+					version = dir->fh->meta->local_version;
 				else
 					version = attr->version;
 
-				dir->fh->meta.local_version = version;
-				dir->fh->meta.master_version = version;
+				dir->fh->meta->local_version = version;
+				dir->fh->meta->master_version = version;
 			}
 			else
 			{
 				version = attr->version;
-				dir->fh->meta.master_version += version_increase;
+				dir->fh->meta->master_version += version_increase;
 				if (dir->fh->journal->first)
 				{
-					if (dir->fh->meta.local_version
-						<= dir->fh->meta.master_version)
-						dir->fh->meta.local_version
-							= dir->fh->meta.master_version + 1;
-					if (dir->fh->meta.local_version <= version)
-						dir->fh->meta.local_version = version + 1;
+					if (dir->fh->meta->local_version
+						<= dir->fh->meta->master_version)
+						dir->fh->meta->local_version
+							= dir->fh->meta->master_version + 1;
+					if (dir->fh->meta->local_version <= version)
+						dir->fh->meta->local_version = version + 1;
 				}
 				else
 				{
-					if (dir->fh->meta.local_version
-						< dir->fh->meta.master_version)
-						dir->fh->meta.local_version =
-							dir->fh->meta.master_version;
-					if (dir->fh->meta.local_version < version)
-						dir->fh->meta.local_version = version;
+					if (dir->fh->meta->local_version
+						< dir->fh->meta->master_version)
+						dir->fh->meta->local_version =
+							dir->fh->meta->master_version;
+					if (dir->fh->meta->local_version < version)
+						dir->fh->meta->local_version = version;
 				}
 			}
-			set_attr_version(&dir->fh->attr, &dir->fh->meta);
-			if (!flush_metadata(vol, &dir->fh->meta))
+			set_attr_version(&dir->fh->attr, dir->fh->meta);
+			if (!flush_metadata(vol, dir->fh->meta))
 				MARK_VOLUME_DELETE(vol);
 		}
 
@@ -3719,7 +5024,7 @@ update(volume vol, internal_dentry dentry, zfs_fh * fh, fattr * attr, int how)
 #ifdef ENABLE_CHECKING
 	if (!(INTERNAL_FH_HAS_LOCAL_PATH(dentry->fh) && vol->master != this_node))
 		zfsd_abort();
-	if (zfs_fh_undefined(dentry->fh->meta.master_fh))
+	if (zfs_fh_undefined(dentry->fh->meta->master_fh))
 		zfsd_abort();
 #endif
 
@@ -3840,6 +5145,14 @@ static void *update_worker(void *data)
 		 */
 		r = update_file((zfs_fh *) & t->u.update.fh, t->u.update.slow);
 
+		/* Let the main update thread take another file of the master
+		   node.  */
+		if (t->u.update.sid != NODE_ID_NONE)
+		{
+			update_queue_node_put(t->u.update.sid);
+			t->u.update.sid = NODE_ID_NONE;
+		}
+
 		message(LOG_LOOPS, FACILITY_NET | FACILITY_THREADING,
 				"Entering busy check\n");
 		/* Sleep if slow line was busy */
@@ -3860,8 +5173,8 @@ static void *update_worker(void *data)
 						"Worker update thread: waiting for slow reqs count == 0\n");
 				while (pending_slow_reqs_count != 0)
 				{
-					pthread_cond_wait(&pending_slow_reqs_cond,
-									  &pending_slow_reqs_mutex);
+					zfsd_cond_wait(&pending_slow_reqs_cond,
+								   &pending_slow_reqs_mutex);
 				}
 				gettimeofday(&now, NULL);
 				timeout.tv_sec = now.tv_sec + ZFS_SLOW_BUSY_DELAY;
@@ -3869,8 +5182,8 @@ static void *update_worker(void *data)
 				message(LOG_DEBUG,
 						FACILITY_DATA | FACILITY_NET | FACILITY_THREADING,
 						"Worker update thread: waiting for 5 seconds of no activity\n");
-				r = pthread_cond_timedwait(&pending_slow_reqs_cond,
-										   &pending_slow_reqs_mutex, &timeout);
+				r = zfsd_cond_timedwait(&pending_slow_reqs_cond,
+										&pending_slow_reqs_mutex, &timeout);
 			}
 			zfsd_mutex_unlock(&pending_slow_reqs_mutex);
 		}
@@ -3925,8 +5238,7 @@ static void *update_worker(void *data)
 				/* regular updater thread, will have to wait on the semaphore */
 				message(LOG_INFO, FACILITY_NET | FACILITY_THREADING,
 						"Update worker: going idle\n");
-				queue_put(&update_pool.idle, &t->index);
-				set_thread_state(t, THREAD_IDLE);
+				thread_pool_idle_push(&update_pool, t);
 			}
 			else
 			{
@@ -3965,8 +5277,10 @@ static void *update_worker(void *data)
    that thread via raising its semaphore. */
 static void *update_main(ATTRIBUTE_UNUSED void *data)
 {
-	zfs_fh fh;
-	size_t idx;
+	zfs_fh fh[UPDATE_QUEUE_BATCH];
+	uint32_t sid[UPDATE_QUEUE_BATCH];
+	unsigned int i, n, max;
+	thread *t;
 
 	thread_disable_signals();
 	pthread_setspecific(thread_name_key, "Update main thread");
@@ -3976,44 +5290,56 @@ static void *update_main(ATTRIBUTE_UNUSED void *data)
 
 	while (!thread_pool_terminate_p(&update_pool))
 	{
-		bool succeeded;
-
-		/* Get the file handle.  */
+		/* Get the file handles.  */
 		message(LOG_DEBUG, FACILITY_DATA | FACILITY_NET,
 				"Main update thread: get file handle...\n");
+		/* Take only as many file handles as there are idle threads so that
+		   the file handles scheduled meanwhile with a higher priority are
+		   not stuck behind them.  */
+		zfsd_mutex_lock(&update_pool.mutex);
+		max = update_pool.n_idle;
+		zfsd_mutex_unlock(&update_pool.mutex);
+		if (max == 0)
+			max = 1;
+		else if (max > UPDATE_QUEUE_BATCH)
+			max = UPDATE_QUEUE_BATCH;
+
 		zfsd_mutex_lock(&update_queue_mutex);
-		succeeded = queue_get(&update_queue, &fh);
+		n = update_queue_get_batch(fh, sid, max);
 		zfsd_mutex_unlock(&update_queue_mutex);
-		if (!succeeded)
+		if (n == 0)
 		{
 			message(LOG_DATA, FACILITY_DATA | FACILITY_NET,
 					"Main update thread: get file handle...failed\n");
 			break;
 		}
 		message(LOG_DATA, FACILITY_DATA | FACILITY_NET,
-				"Main update thread: get file handle...succeeded\n");
+				"Main update thread: got %u file handles\n", n);
 
 		zfsd_mutex_lock(&update_pool.mutex);
+		for (i = 0; i < n; i++)
+		{
+			t = thread_pool_idle_pop(&update_pool);
+			if (!t)
+				break;
 
-		/* Regulate the number of threads.  */
-		if (update_pool.idle.nelem == 0)
-			thread_pool_regulate(&update_pool);
-
-		queue_get(&update_pool.idle, &idx);
-#ifdef ENABLE_CHECKING
-		if (get_thread_state(&update_pool.threads[idx].t) == THREAD_BUSY)
-			zfsd_abort();
-#endif
-		set_thread_state(&update_pool.threads[idx].t, THREAD_BUSY);
-		update_pool.threads[idx].t.u.update.fh = fh;
-		update_pool.threads[idx].t.u.update.slow = false;
-
-		/* Let the thread run.  */
-		message(LOG_DEBUG, FACILITY_NET | FACILITY_THREADING,
-				"Main update thread: starting worker thread\n");
-		semaphore_up(&update_pool.threads[idx].t.sem, 1);
+			t->u.update.fh = fh[i];
+			t->u.update.slow = false;
+			t->u.update.sid = sid[i];
 
+			/* Let the thread run.  */
+			message(LOG_DEBUG, FACILITY_NET | FACILITY_THREADING,
+					"Main update thread: starting worker thread\n");
+			semaphore_up(&t->sem, 1);
+		}
 		zfsd_mutex_unlock(&update_pool.mutex);
+
+		if (i < n)
+		{
+			for (; i < n; i++)
+				update_queue_node_put(sid[i]);
+			break;
+		}
 	}
 
 	message(LOG_NOTICE, FACILITY_NET | FACILITY_THREADING,
@@ -4022,12 +5348,37 @@ static void *update_main(ATTRIBUTE_UNUSED void *data)
 	return NULL;
 }
 
+/*! \brief Destroy #update_queue and its mutex.  */
+static void update_queue_destroy(void)
+{
+	unsigned int i;
+
+	zfsd_mutex_lock(&update_queue_mutex);
+	htab_destroy(update_queue.htab);
+	fibheap_delete(update_queue.heap);
+	for (i = 0; i < VARRAY_USED(update_queue.nodes); i++)
+		if (VARRAY_ACCESS(update_queue.nodes, i, update_queue_node).parked)
+			fibheap_delete(VARRAY_ACCESS(update_queue.nodes, i,
+										 update_queue_node).parked);
+	varray_destroy(&update_queue.nodes);
+	zfsd_cond_destroy(&update_queue.non_empty);
+	zfsd_mutex_unlock(&update_queue_mutex);
+	zfsd_mutex_destroy(&update_queue_mutex);
+}
+
 /*! \brief Initialize the mutexes and queues for updating, and create the
    #update_pool. */
 bool update_start(void)
 {
 	zfsd_mutex_init(&update_queue_mutex);
-	queue_create(&update_queue, sizeof(zfs_fh), 250, &update_queue_mutex);
+	update_queue.heap = fibheap_new(250, &update_queue_mutex);
+	update_queue.htab = htab_create(250, update_queue_entry_hash,
+									update_queue_entry_eq, free,
+									&update_queue_mutex);
+	varray_create(&update_queue.nodes, sizeof(update_queue_node), 8);
+	zfsd_cond_init(&update_queue.non_empty);
+	update_queue.epoch = time(NULL);
+	update_queue.exiting = false;
 	zfsd_mutex_init(&update_slow_queue_mutex);
 	queue_create(&update_slow_queue, sizeof(zfs_fh), 250,
 				 &update_slow_queue_mutex);
@@ -4035,10 +5386,7 @@ bool update_start(void)
 	if (!thread_pool_create(&update_pool, &zfs_config.threads.update_thread_limit,
 							update_main, update_worker, update_worker_init))
 	{
-		zfsd_mutex_lock(&update_queue_mutex);
-		queue_destroy(&update_queue);
-		zfsd_mutex_unlock(&update_queue_mutex);
-		zfsd_mutex_destroy(&update_queue_mutex);
+		update_queue_destroy();
 
 		zfsd_mutex_lock(&update_slow_queue_mutex);
 		queue_destroy(&update_slow_queue);
@@ -4057,10 +5405,7 @@ void update_cleanup(void)
 {
 	thread_pool_destroy(&update_pool);
 
-	zfsd_mutex_lock(&update_queue_mutex);
-	queue_destroy(&update_queue);
-	zfsd_mutex_unlock(&update_queue_mutex);
-	zfsd_mutex_destroy(&update_queue_mutex);
+	update_queue_destroy();
 
 	zfsd_mutex_lock(&update_slow_queue_mutex);
 	queue_destroy(&update_slow_queue);
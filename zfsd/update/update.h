@@ -31,13 +31,42 @@
 #include "cap.h"
 #include "metadata.h"
 #include "zfs-prot.h"
+#include "bandwidth.h"
 
-/*! \brief Maximum block size for updating \see ZFS_MAXDATA */
+/*! \brief Block size for updating files whose block size has not been
+   chosen yet \see ZFS_MAXDATA */
 #define ZFS_UPDATED_BLOCK_SIZE ZFS_MAXDATA
 
-/*! \brief Maximum block size for reintegrating */
+/*! \brief Block size for reintegrating files whose block size has not been
+   chosen yet */
 #define ZFS_MODIFIED_BLOCK_SIZE 1024
 
+/*! \brief log2 of the minimal block size for updating */
+#define ZFS_MIN_UPDATED_BLOCK_SHIFT 11
+
+/*! \brief log2 of the maximal block size for updating */
+#define ZFS_MAX_UPDATED_BLOCK_SHIFT 16
+
+/*! \brief Maximal block size for updating */
+#define ZFS_MAX_UPDATED_BLOCK_SIZE (1U << ZFS_MAX_UPDATED_BLOCK_SHIFT)
+
+/*! \brief Maximal length of a range whose MD5 sum is requested from the
+   master node, older nodes compute the MD5 sum from a single read */
+#define ZFS_MAX_MD5_LENGTH ZFS_MAXDATA
+
+/*! \brief log2 of the ratio of block sizes for updating and reintegrating */
+#define ZFS_MODIFIED_BLOCK_RATIO_SHIFT 3
+
+/*! \brief Block size for updating file FH.  */
+#define UPDATED_BLOCK_SIZE(FH)						\
+  (METADATA_BLOCK_SHIFT ((FH)->meta->flags) != 0				\
+   ? 1U << METADATA_BLOCK_SHIFT ((FH)->meta->flags)			\
+   : ZFS_UPDATED_BLOCK_SIZE)
+
+/*! \brief Block size for reintegrating file FH.  */
+#define MODIFIED_BLOCK_SIZE(FH)						\
+  (UPDATED_BLOCK_SIZE (FH) >> ZFS_MODIFIED_BLOCK_RATIO_SHIFT)
+
 /*! \brief Check whether we should update a generic file. Update the generic
    file if it has not been completely updated yet, otherwise update a directory 
    if the remote version has changed since the last time we updated the
@@ -45,11 +74,11 @@
    file was modified since we updated it last time.  \param DENTRY The dentry
    of the file to be checked.  \param ATTR The remote attributes of the file. */
 #define UPDATE_P(DENTRY, ATTR)						   \
-  (!((DENTRY)->fh->meta.flags & METADATA_COMPLETE)			   \
+  (!((DENTRY)->fh->meta->flags & METADATA_COMPLETE)			   \
    || ((DENTRY)->fh->attr.type == FT_DIR				   \
-       ? (ATTR).version > (DENTRY)->fh->meta.master_version		   \
-       : (((DENTRY)->fh->attr.version == (DENTRY)->fh->meta.master_version \
-           && (ATTR).version > (DENTRY)->fh->meta.master_version))))
+       ? (ATTR).version > (DENTRY)->fh->meta->master_version		   \
+       : (((DENTRY)->fh->attr.version == (DENTRY)->fh->meta->master_version \
+           && (ATTR).version > (DENTRY)->fh->meta->master_version))))
 
 /*! \brief Check whether we should reintegrate a generic file. Reintegrate a
    directory if the local version has changed since the last time we
@@ -60,9 +89,9 @@
    ATTR The remote attributes of the file. */
 #define REINTEGRATE_P(DENTRY, ATTR)					\
   ((DENTRY)->fh->attr.type == FT_DIR					\
-   ? (DENTRY)->fh->attr.version > (DENTRY)->fh->meta.master_version	\
-   : ((ATTR).version == (DENTRY)->fh->meta.master_version		\
-      && (DENTRY)->fh->attr.version > (DENTRY)->fh->meta.master_version))
+   ? (DENTRY)->fh->attr.version > (DENTRY)->fh->meta->master_version	\
+   : ((ATTR).version == (DENTRY)->fh->meta->master_version		\
+      && (DENTRY)->fh->attr.version > (DENTRY)->fh->meta->master_version))
 
 /*! \brief Are file sizes (for regular files) different? */
 #define METADATA_SIZE_CHANGE_P(ATTR1, ATTR2)			\
@@ -70,7 +99,7 @@
 
 /*! \brief Did the master version (for regular files) change? */
 #define METADATA_MASTER_VERSION_CHANGE_P(DENTRY, ATTR)                        \
-        (((ATTR).type == FT_REG) && ((DENTRY)->fh->meta.master_version != (ATTR).version))
+        (((ATTR).type == FT_REG) && ((DENTRY)->fh->meta->master_version != (ATTR).version))
 
 /*! \brief Are metadata (mode, UID and GID) different in META and ATTR? */
 #define METADATA_ATTR_CHANGE_P(META, ATTR)				\
@@ -81,8 +110,8 @@
 /*! \brief Have local or remote metadata/attributes (mode, UID and GID, size
    and master version) changed? */
 #define METADATA_CHANGE_P(DENTRY, ATTR)					\
-  (METADATA_ATTR_CHANGE_P ((DENTRY)->fh->meta, (DENTRY)->fh->attr)	\
-   || METADATA_ATTR_CHANGE_P ((DENTRY)->fh->meta, ATTR)			\
+  (METADATA_ATTR_CHANGE_P (*(DENTRY)->fh->meta, (DENTRY)->fh->attr)	\
+   || METADATA_ATTR_CHANGE_P (*(DENTRY)->fh->meta, ATTR)			\
    || METADATA_SIZE_CHANGE_P ((DENTRY)->fh->attr, ATTR)                 \
    || METADATA_MASTER_VERSION_CHANGE_P(DENTRY, ATTR))
 
@@ -94,8 +123,13 @@
    && (ATTR1).gid == (ATTR2).gid                                        \
    && !METADATA_SIZE_CHANGE_P(ATTR1, ATTR2))
 
-/* Queue of file handles for updating or reintegrating.  */
-extern queue update_queue;
+/*! \brief Priority of the update or reintegration of a file.  */
+typedef enum update_priority_def
+{
+	UPDATE_PRIORITY_WAITING,	/*!< a request is waiting for the file */
+	UPDATE_PRIORITY_ACCESSED,	/*!< the file has been accessed recently */
+	UPDATE_PRIORITY_BACKGROUND	/*!< the file is updated in background */
+} update_priority;
 
 /* Pool of update threads.  */
 extern thread_pool update_pool;
@@ -103,7 +137,11 @@ extern thread_pool update_pool;
 extern void get_blocks_for_updating(internal_fh fh, uint64_t start,
 									uint64_t end, varray * blocks);
 extern int32_t update_file_blocks(zfs_cap * cap, varray * blocks,
-								  bool modified, bool slow);
+								  uint32_t block_size, bool modified,
+								  bool slow, bandwidth_class cls);
+extern void schedule_update_or_reintegration(volume vol,
+											 internal_dentry dentry,
+											 update_priority priority);
 extern int32_t update_fh_if_needed(volume * volp, internal_dentry * dentryp,
 								   zfs_fh * fh, int what);
 extern int32_t update_fh_if_needed_2(volume * volp, internal_dentry * dentryp,
@@ -138,6 +176,7 @@ extern int32_t resolve_conflict_delete_remote(volume vol, internal_dentry dir,
 extern int32_t update(volume vol, internal_dentry dentry, zfs_fh * fh,
 					  fattr * attr, int how);
 
+extern void update_queue_exiting(void);
 extern bool update_start(void);
 extern void update_cleanup(void);
 
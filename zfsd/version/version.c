@@ -39,6 +39,7 @@
 #include "version.h"
 #include "update.h"
 #include "zfs_dirent.h"
+#include "io-engine.h"
 
 /*! Hash function for file name.  */
 #define DIRHTAB_HASH(N) (crc32_string((N)->name))
@@ -96,20 +97,17 @@ version_readdir_from_dirhtab(dir_list * list, internal_dentry dentry,
 							 int32_t cookie, readdir_data * data,
 							 filldir_f filldir)
 {
-	unsigned int i;
+	void **slot;
 
 	// retrieve from hash table
-	for (i = 0; i < dentry->dirhtab->size; i++)
+	HTAB_FOR_EACH_SLOT(dentry->dirhtab, slot)
 	{
-		struct dirhtab_item_def *e = dentry->dirhtab->table[i];
-
-		if ((e == EMPTY_ENTRY) || (e == DELETED_ENTRY))
-			continue;
+		struct dirhtab_item_def *e = (struct dirhtab_item_def *)*slot;
 
 		if (!(*filldir) (e->ino, cookie, e->name, strlen(e->name), list, data))
 			break;
 
-		htab_clear_slot(dentry->dirhtab, &dentry->dirhtab->table[i]);
+		htab_clear_slot(dentry->dirhtab, slot);
 	}
 
 	RETURN_INT(ZFS_OK);
@@ -169,7 +167,8 @@ version_readdir_fill_dirhtab(internal_dentry dentry, time_t stamp, long ino,
    path Complete path of the interval file \param fh Internal file handle */
 static void version_build_interval_path(string * path, internal_fh fh)
 {
-	path->str = xstrconcat(fh->version_path, VERSION_INTERVAL_FILE_ADD, NULL);
+	path->str = xstrconcat(INTERNAL_FH_VERSION_PATH(fh),
+						   VERSION_INTERVAL_FILE_ADD, NULL);
 	path->len = strlen(path->str);
 }
 
@@ -181,20 +180,22 @@ bool version_load_interval_tree(internal_fh fh)
 	string path;
 	struct stat st;
 	bool r = true;
+	internal_fh_version ver;
 
 	TRACE("");
 	CHECK_MUTEX_LOCKED(&fh->mutex);
 
-	fh->version_interval_tree_users++;
-	if (fh->version_interval_tree_users > 1)
+	ver = internal_fh_version_get(fh);
+	ver->interval_tree_users++;
+	if (ver->interval_tree_users > 1)
 	{
-		if (fh->versioned->size > 0)
+		if (ver->versioned->size > 0)
 			RETURN_BOOL(true);
 		else
 			RETURN_BOOL(false);
 	}
 
-	fh->versioned = interval_tree_create(1, NULL);
+	ver->versioned = interval_tree_create(1, NULL);
 
 	version_build_interval_path(&path, fh);
 
@@ -227,10 +228,10 @@ bool version_load_interval_tree(internal_fh fh)
 		else
 		{
 			if (!interval_tree_read
-				(fh->versioned, fd, st.st_size / sizeof(interval)))
+				(ver->versioned, fd, st.st_size / sizeof(interval)))
 			{
-				interval_tree_destroy(fh->versioned);
-				fh->versioned = NULL;
+				interval_tree_destroy(ver->versioned);
+				ver->versioned = NULL;
 				r = false;
 			}
 		}
@@ -249,21 +250,23 @@ bool version_save_interval_trees(internal_fh fh)
 	int fd;
 	bool r = true;
 	string path;
+	internal_fh_version ver;
 
 	TRACE("");
 	CHECK_MUTEX_LOCKED(&fh->mutex);
 
+	ver = fh->version;
 #ifdef ENABLE_CHECKING
-	if (fh->version_interval_tree_users == 0)
+	if (!ver || ver->interval_tree_users == 0)
 		zfsd_abort();
 #endif
 
-	fh->version_interval_tree_users--;
-	if (fh->version_interval_tree_users > 0)
+	ver->interval_tree_users--;
+	if (ver->interval_tree_users > 0)
 		RETURN_BOOL(true);
 
 #ifdef ENABLE_CHECKING
-	if (!fh->versioned)
+	if (!ver->versioned)
 		zfsd_abort();
 #endif
 
@@ -272,14 +275,14 @@ bool version_save_interval_trees(internal_fh fh)
 	fd = open(path.str, O_WRONLY | O_CREAT | O_TRUNC, fh->attr.mode);
 	if (fd < 0)
 		r = false;
-	else if (!interval_tree_write(fh->versioned, fd))
+	else if (!interval_tree_write(ver->versioned, fd))
 		r = false;
 
 	close(fd);
 	free(path.str);
 
-	interval_tree_destroy(fh->versioned);
-	fh->versioned = NULL;
+	interval_tree_destroy(ver->versioned);
+	ver->versioned = NULL;
 
 	RETURN_BOOL(r);
 }
@@ -322,10 +325,10 @@ static int32_t version_set_time(internal_fh fh)
 	string ipath;
 
 	/* Set version file time attributes.  */
-	sa = &fh->version_orig_attr;
+	sa = &fh->version->orig_attr;
 	t.actime = sa->atime;
 	t.modtime = sa->mtime;
-	utime(fh->version_path, &t);
+	utime(fh->version->path, &t);
 
 	/* Same for interval file.  */
 	version_build_interval_path(&ipath, fh);
@@ -344,11 +347,13 @@ version_create_file_with_attr(char *path, internal_dentry dentry, volume vol,
 							  string * orgpath)
 {
 	fattr *sa;
+	internal_fh_version ver;
 
 	zfs_fh fh;
 	int32_t r;
 
-	sa = &dentry->fh->version_orig_attr;
+	ver = internal_fh_version_get(dentry->fh);
+	sa = &ver->orig_attr;
 	// make sure we have correct attributes of the file
 	if (orgpath)
 	{
@@ -357,8 +362,8 @@ version_create_file_with_attr(char *path, internal_dentry dentry, volume vol,
 	else
 		memcpy(sa, &dentry->fh->attr, sizeof(fattr));
 
-	dentry->fh->version_fd = creat(path, GET_MODE(sa->mode));
-	dentry->fh->version_path = xstrdup(path);
+	ver->fd = creat(path, GET_MODE(sa->mode));
+	ver->path = xstrdup(path);
 
 	if (lchown(path, map_uid_zfs2node(sa->uid),
 			   map_gid_zfs2node(sa->gid)) != 0)
@@ -422,8 +427,8 @@ version_create_file_with_attr(char *path, internal_dentry dentry, volume vol,
 				if (!add_journal_entry(vol, dentry->parent->fh->journal,
 									   &dentry->parent->fh->local_fh,
 									   &ndentry->fh->local_fh,
-									   &ndentry->fh->meta.master_fh,
-									   ndentry->fh->meta.master_version, &name,
+									   &ndentry->fh->meta->master_fh,
+									   ndentry->fh->meta->master_version, &name,
 									   JOURNAL_OPERATION_ADD))
 				{
 					MARK_VOLUME_DELETE(vol);
@@ -466,8 +471,10 @@ int32_t version_create_file(internal_dentry dentry, volume vol)
 	{
 		// open last version
 		message(LOG_DEBUG, FACILITY_VERSION, "open last version\n");
-		dentry->fh->version_fd = open(verpath.str, O_RDWR);
-		dentry->fh->version_path = xstrdup(verpath.str);
+		internal_fh_version ver = internal_fh_version_get(dentry->fh);
+
+		ver->fd = open(verpath.str, O_RDWR);
+		ver->path = xstrdup(verpath.str);
 	}
 	else
 	{
@@ -488,19 +495,19 @@ int32_t version_create_file(internal_dentry dentry, volume vol)
    function should make the version file sparse. */
 int32_t version_close_file(internal_fh fh, bool tidy)
 {
-	message(LOG_DEBUG, FACILITY_VERSION, "version_close_file: version_fd=%d\n",
-			fh->version_fd);
-
-	if (fh->version_fd < 0)
+	if (!fh->version || fh->version->fd < 0)
 		RETURN_INT(ZFS_INVALID_REQUEST);
 
-	close(fh->version_fd);
-	fh->version_fd = -1;
+	message(LOG_DEBUG, FACILITY_VERSION, "version_close_file: version_fd=%d\n",
+			fh->version->fd);
+
+	close(fh->version->fd);
+	fh->version->fd = -1;
 
 	version_set_time(fh);
 
-	free(fh->version_path);
-	fh->version_path = NULL;
+	free(fh->version->path);
+	fh->version->path = NULL;
 
 	if (tidy)
 	{
@@ -523,7 +530,7 @@ int32_t version_truncate_file(internal_dentry dentry, volume vol, char *path)
 
 	// skip copy if version file already in use - it has all original
 	// attributes
-	if (dentry->fh->version_fd > 0)
+	if (INTERNAL_FH_VERSION_OPEN(dentry->fh))
 		RETURN_INT(ZFS_OK);
 
 	version_generate_filename(path, &verpath);
@@ -906,6 +913,7 @@ int32_t version_build_intervals(internal_dentry dentry, volume vol)
 	unsigned int i, j;
 	string dpath;
 	bool r;
+	internal_fh_version ver;
 
 	r = version_load_interval_tree(dentry->fh);
 	if (!r)
@@ -998,8 +1006,9 @@ int32_t version_build_intervals(internal_dentry dentry, volume vol)
 	for (j = i + 1; j < n; j++)
 		CLEAR_VERSION_ITEM(list[j]);
 
-	dentry->fh->version_list = list;
-	dentry->fh->version_list_length = m;
+	ver = internal_fh_version_get(dentry->fh);
+	ver->list = list;
+	ver->list_length = m;
 
 	RETURN_INT(ZFS_OK);
 }
@@ -1020,14 +1029,15 @@ version_read_old_data(internal_dentry dentry, uint64_t start, uint64_t end,
 	uint32_t rsize = 0;
 
 	covered = interval_tree_create(1, NULL);
-	interval_tree_add(covered, dentry->fh->versioned);
+	interval_tree_add(covered, dentry->fh->version->versioned);
 
-	for (i = 0; i < dentry->fh->version_list_length; i++)
+	for (i = 0; i < dentry->fh->version->list_length; i++)
 	{
 		varray v, rv;
+		io_request *reqs;
 		int fd;
 
-		item = &dentry->fh->version_list[i];
+		item = &dentry->fh->version->list[i];
 		if (!item->stamp)
 			continue;
 
@@ -1051,29 +1061,37 @@ version_read_old_data(internal_dentry dentry, uint64_t start, uint64_t end,
 		interval_tree_complement_varray(covered, &v, &rv);
 		varray_destroy(&v);
 
+		/* Read all intervals of the version file by one batch.  */
 		fd = open(item->path, O_RDONLY);
+		reqs = (io_request *) xmalloc(VARRAY_USED(rv) * sizeof(io_request));
 		for (j = 0; j < VARRAY_USED(rv); j++)
 		{
 			interval ival;
-			ssize_t rd;
 
 			ival = VARRAY_ACCESS(rv, j, interval);
+			reqs[j].fd = fd;
+			reqs[j].write = false;
+			reqs[j].buf = buf + ival.start - start;
+			reqs[j].len = ival.end - ival.start;
+			reqs[j].offset = ival.start;
+		}
+		io_engine_rw(reqs, VARRAY_USED(rv));
 
-			lseek(fd, ival.start, SEEK_SET);
-read_again:
-			rd = read(fd, buf + ival.start - start, ival.end - ival.start);
-			if (rd < 0 && errno == EINTR)
-				goto read_again;
+		for (j = 0; j < VARRAY_USED(rv); j++)
+		{
+			interval ival;
 
-			if (rd > 0)
+			ival = VARRAY_ACCESS(rv, j, interval);
+			if (reqs[j].result > 0)
 			{
-				rsize += rd;
+				rsize += reqs[j].result;
 				interval_tree_insert(covered, ival.start, ival.end);
 			}
 			message(LOG_DEBUG, FACILITY_VERSION,
 					"read version name=%s, start=%lld, end=%lld, read=%d\n",
-					item->name, ival.start, ival.end, rd);
+					item->name, ival.start, ival.end, (int) reqs[j].result);
 		}
+		free(reqs);
 		close(fd);
 
 		varray_destroy(&rv);
@@ -1195,7 +1213,6 @@ version_copy_data(int fd, int fdv, uint64_t offset, uint32_t length,
 
 	ssize_t r;
 	char olddata[ZFS_VERSION_BLOCK_SIZE];
-	off_t position = -1;
 	uint32_t to_read;
 	uint32_t to_write;
 
@@ -1210,20 +1227,12 @@ version_copy_data(int fd, int fdv, uint64_t offset, uint32_t length,
 		RETURN_INT(-fd);
 	}
 
-	position = lseek(fd, offset, SEEK_SET);
-	if (position == (off_t) - 1)
-	{
-		message(LOG_WARNING, FACILITY_VERSION, "old data seek error: %d\n",
-				errno);
-		RETURN_INT(errno);
-	}
-
 	to_read = length;
 	if (to_read >= sizeof(olddata))
 		to_read = sizeof(olddata) - 1;
 
 read_again:
-	r = read(fd, olddata, to_read);
+	r = io_pread(fd, olddata, to_read, offset);
 	if (r < 0)
 	{
 		if (errno == EINTR)
@@ -1249,17 +1258,9 @@ read_again:
 	}
 
 	// write data into version file
-	position = lseek(fdv, offset, SEEK_SET);
-	if (position == (off_t) - 1)
-	{
-		message(LOG_WARNING, FACILITY_VERSION, "new data seek error: %d\n",
-				errno);
-		RETURN_INT(errno);
-	}
-
 	to_write = r;
 write_again:
-	r = write(fdv, olddata, to_write);
+	r = io_pwrite(fdv, olddata, to_write, offset);
 	if (r < 0)
 	{
 		if (errno == EINTR)
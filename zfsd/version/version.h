@@ -43,13 +43,14 @@
 /*! Mark file as truncated.  */
 #define MARK_FILE_TRUNCATED(FH)           \
   ({ \
-    (FH)->file_truncated = true; \
+    internal_fh_version_get (FH)->file_truncated = true; \
   })
 
 /*! Unmark file as truncated.  */
 #define UNMARK_FILE_TRUNCATED(FH)           \
   ({ \
-    (FH)->file_truncated = false; \
+    if ((FH)->version) \
+      (FH)->version->file_truncated = false; \
   })
 
 /*! True when the NAME is a version file.  */
@@ -57,7 +58,8 @@
   (strchr ((NAME), VERSION_NAME_SPECIFIER_C) != NULL)
 
 /*! Was file as truncated before opening? */
-#define WAS_FILE_TRUNCATED(FH) ((FH)->file_truncated)
+#define WAS_FILE_TRUNCATED(FH) \
+  ((FH)->version != NULL && (FH)->version->file_truncated)
 
 typedef struct version_item_def
 {
@@ -893,6 +893,100 @@ bool encode_md5sum_res(DC * dc, md5sum_res * res)
 	return true;
 }
 
+bool decode_delta_args(DC * dc, delta_args * args)
+{
+	uint32_t i;
+
+	if (!decode_zfs_cap(dc, &args->cap)
+		|| !decode_uint64_t(dc, &args->offset)
+		|| !decode_uint32_t(dc, &args->length)
+		|| !decode_uint32_t(dc, &args->block_size)
+		|| !decode_uint32_t(dc, &args->count))
+		return false;
+
+	if (args->count > ZFS_MAX_DELTA_BLOCKS)
+		return false;
+
+	for (i = 0; i < args->count; i++)
+		if (!decode_uint32_t(dc, &args->weak[i]))
+			return false;
+
+	for (i = 0; i < args->count; i++)
+		if (!decode_fixed_buffer(dc, args->strong[i], MD5_SIZE))
+			return false;
+
+	return true;
+}
+
+bool encode_delta_args(DC * dc, const delta_args * args)
+{
+	uint32_t i;
+
+#ifdef ENABLE_CHECKING
+	if (args->count > ZFS_MAX_DELTA_BLOCKS)
+		zfsd_abort();
+#endif
+
+	encode_zfs_cap(dc, &args->cap);
+	encode_uint64_t(dc, args->offset);
+	encode_uint32_t(dc, args->length);
+	encode_uint32_t(dc, args->block_size);
+	encode_uint32_t(dc, args->count);
+
+	for (i = 0; i < args->count; i++)
+		encode_uint32_t(dc, args->weak[i]);
+
+	for (i = 0; i < args->count; i++)
+		encode_fixed_buffer(dc, CAST_QUAL(unsigned char *, args->strong[i]),
+							MD5_SIZE);
+
+	return true;
+}
+
+bool decode_delta_res(DC * dc, delta_res * res)
+{
+	uint32_t i;
+
+	if (!decode_uint64_t(dc, &res->size)
+		|| !decode_uint64_t(dc, &res->version)
+		|| !decode_uint32_t(dc, &res->length)
+		|| !decode_uint32_t(dc, &res->count))
+		return false;
+
+	if (res->count > ZFS_MAX_DELTA_OPS)
+		return false;
+
+	for (i = 0; i < res->count; i++)
+		if (!decode_uint32_t(dc, &res->op[i])
+			|| !decode_uint32_t(dc, &res->block[i]))
+			return false;
+
+	return decode_data_buffer(dc, &res->data);
+}
+
+bool encode_delta_res(DC * dc, delta_res * res)
+{
+	uint32_t i;
+
+#ifdef ENABLE_CHECKING
+	if (res->count > ZFS_MAX_DELTA_OPS)
+		zfsd_abort();
+#endif
+
+	encode_uint64_t(dc, res->size);
+	encode_uint64_t(dc, res->version);
+	encode_uint32_t(dc, res->length);
+	encode_uint32_t(dc, res->count);
+
+	for (i = 0; i < res->count; i++)
+	{
+		encode_uint32_t(dc, res->op[i]);
+		encode_uint32_t(dc, res->block[i]);
+	}
+
+	return encode_data_buffer(dc, &res->data);
+}
+
 bool decode_file_info_res(DC * dc, file_info_res * res)
 {
 	return decode_zfs_path(dc, &res->path);
@@ -955,6 +1049,143 @@ bool encode_reintegrate_ver_args(DC * dc, const reintegrate_ver_args * args)
 			&& encode_uint64_t(dc, args->version_inc));
 }
 
+bool decode_reintegrate_batch_args(DC * dc, reintegrate_batch_args * args)
+{
+	reintegrate_batch_op *op;
+	uint32_t i, oper;
+
+	if (!decode_zfs_fh(dc, &args->dir)
+		|| !decode_uint32_t(dc, &args->count))
+		return false;
+
+	if (args->count > ZFS_MAX_REINTEGRATE_BATCH)
+		return false;
+
+	for (i = 0; i < args->count; i++)
+	{
+		op = &args->op[i];
+		if (!decode_uint32_t(dc, &oper)
+			|| !decode_filename(dc, &op->name))
+			return false;
+
+		op->oper = (reintegrate_batch_oper) oper;
+		switch (op->oper)
+		{
+		case REINTEGRATE_BATCH_CREATE:
+			if (!decode_sattr(dc, &op->attr)
+				|| !decode_ftype(dc, &op->type)
+				|| !decode_uint32_t(dc, &op->rdev))
+				return false;
+			break;
+
+		case REINTEGRATE_BATCH_ADD:
+			if (!decode_zfs_fh(dc, &op->fh))
+				return false;
+			break;
+
+		case REINTEGRATE_BATCH_DEL:
+			if (!decode_zfs_fh(dc, &op->fh)
+				|| !decode_uint64_t(dc, &op->version)
+				|| !decode_char(dc, &op->destroy_p))
+				return false;
+			break;
+
+		default:
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool encode_reintegrate_batch_args(DC * dc, const reintegrate_batch_args * args)
+{
+	const reintegrate_batch_op *op;
+	uint32_t i;
+
+#ifdef ENABLE_CHECKING
+	if (args->count > ZFS_MAX_REINTEGRATE_BATCH)
+		zfsd_abort();
+#endif
+
+	encode_zfs_fh(dc, &args->dir);
+	encode_uint32_t(dc, args->count);
+
+	for (i = 0; i < args->count; i++)
+	{
+		op = &args->op[i];
+		encode_uint32_t(dc, op->oper);
+		encode_filename(dc, &op->name);
+
+		switch (op->oper)
+		{
+		case REINTEGRATE_BATCH_CREATE:
+			encode_sattr(dc, &op->attr);
+			encode_ftype(dc, op->type);
+			encode_uint32_t(dc, op->rdev);
+			break;
+
+		case REINTEGRATE_BATCH_ADD:
+			encode_zfs_fh(dc, &op->fh);
+			break;
+
+		case REINTEGRATE_BATCH_DEL:
+			encode_zfs_fh(dc, &op->fh);
+			encode_uint64_t(dc, op->version);
+			encode_char(dc, op->destroy_p);
+			break;
+
+		default:
+			zfsd_abort();
+		}
+	}
+
+	return true;
+}
+
+bool decode_reintegrate_batch_res(DC * dc, reintegrate_batch_res * res)
+{
+	uint32_t i;
+
+	if (!decode_uint32_t(dc, &res->count))
+		return false;
+
+	if (res->count > ZFS_MAX_REINTEGRATE_BATCH)
+		return false;
+
+	for (i = 0; i < res->count; i++)
+	{
+		if (!decode_int32_t(dc, &res->status[i]))
+			return false;
+		if (res->status[i] == ZFS_OK
+			&& !decode_dir_op_res(dc, &res->res[i]))
+			return false;
+	}
+
+	return true;
+}
+
+bool encode_reintegrate_batch_res(DC * dc, reintegrate_batch_res * res)
+{
+	uint32_t i;
+
+#ifdef ENABLE_CHECKING
+	if (res->count > ZFS_MAX_REINTEGRATE_BATCH)
+		zfsd_abort();
+#endif
+
+	encode_uint32_t(dc, res->count);
+
+	for (i = 0; i < res->count; i++)
+	{
+		encode_int32_t(dc, res->status[i]);
+		if (res->status[i] == ZFS_OK)
+			encode_dir_op_res(dc, &res->res[i]);
+	}
+
+	return true;
+}
+
 bool encode_invalidate_args(DC * dc, invalidate_args * args)
 {
 	return encode_zfs_fh(dc, &args->fh);
@@ -267,6 +267,10 @@ extern bool decode_md5sum_args(DC * dc, md5sum_args * args);
 extern bool encode_md5sum_args(DC * dc, const md5sum_args * args);
 extern bool decode_md5sum_res(DC * dc, md5sum_res * res);
 extern bool encode_md5sum_res(DC * dc, md5sum_res * res);
+extern bool decode_delta_args(DC * dc, delta_args * args);
+extern bool encode_delta_args(DC * dc, const delta_args * args);
+extern bool decode_delta_res(DC * dc, delta_res * res);
+extern bool encode_delta_res(DC * dc, delta_res * res);
 extern bool decode_file_info_res(DC * dc, file_info_res * res);
 extern bool encode_file_info_res(DC * dc, file_info_res * res);
 extern bool decode_reintegrate_args(DC * dc, reintegrate_args * args);
@@ -280,6 +284,14 @@ extern bool encode_reintegrate_del_args(DC * dc,
 extern bool decode_reintegrate_ver_args(DC * dc, reintegrate_ver_args * args);
 extern bool encode_reintegrate_ver_args(DC * dc,
 										const reintegrate_ver_args * args);
+extern bool decode_reintegrate_batch_args(DC * dc,
+										  reintegrate_batch_args * args);
+extern bool encode_reintegrate_batch_args(DC * dc,
+										  const reintegrate_batch_args * args);
+extern bool decode_reintegrate_batch_res(DC * dc,
+										 reintegrate_batch_res * res);
+extern bool encode_reintegrate_batch_res(DC * dc,
+										 reintegrate_batch_res * res);
 extern bool encode_invalidate_args(DC * dc, invalidate_args * args);
 extern bool decode_reread_config_args(DC * dc, reread_config_args * args);
 extern bool encode_reread_config_args(DC * dc,
@@ -35,6 +35,7 @@
 # include "node.h"
 # include "dir.h"
 # include "file.h"
+# include "delta.h"
 # include "volume.h"
 # include "log.h"
 # include "user-group.h"
@@ -541,6 +542,30 @@ zfs_proc_md5sum_server(md5sum_args * args, DC * dc,
 		encode_md5sum_res(dc, &md5);
 }
 
+/*! uint64_t size, uint64_t version, uint32_t length, uint32_t count,
+   uint32_t op[count], uint32_t block[count], data_buffer data
+   zfs_proc_delta (zfs_cap cap, uint64_t offset, uint32_t length,
+   uint32_t block_size, uint32_t count, uint32_t weak[count],
+   uint8_t strong[count][#MD5_SIZE]);
+
+   Describe at most \p length bytes of the file starting at \p offset as
+   copies of the \p count blocks of \p block_size bytes with rolling checksums
+   \p weak and MD5 sums \p strong, and literal data.  The operation fails
+   with #ZFS_CHANGED if the file is changed while reading it.  */
+void
+zfs_proc_delta_server(delta_args * args, DC * dc, ATTRIBUTE_UNUSED void *data)
+{
+	int32_t r;
+	delta_res res;
+	char buf[ZFS_MAXDATA];
+
+	res.data.buf = buf;
+	r = local_delta(&res, args);
+	encode_status(dc, r);
+	if (r == ZFS_OK)
+		encode_delta_res(dc, &res);
+}
+
 /*! string zfs_proc_file_info (zfs_fh);
 
    Get relative path for the file handle.  */
@@ -643,6 +668,29 @@ zfs_proc_reintegrate_ver_server(reintegrate_ver_args * args, DC * dc,
 	encode_status(dc, r);
 }
 
+/*! uint32_t count, (int32_t status, [zfs_fh file, fattr attr])[count]
+   zfs_proc_reintegrate_batch (zfs_fh dir, uint32_t count,
+   (uint32_t oper, string filename, ...)[count]);
+
+   Apply \p count journal entries to \p dir in order while \p dir is
+   locked.  An entry either creates \p filename (sattr attr, ftype type,
+   uint32_t rdev), names the existing zfs_fh fh as \p filename or deletes
+   \p filename which is zfs_fh fh (uint64_t version, int8_t destroy).
+   Each entry has its own status, the file handle and attributes are
+   replied for the entries which succeeded.  */
+void
+zfs_proc_reintegrate_batch_server(reintegrate_batch_args * args, DC * dc,
+								  ATTRIBUTE_UNUSED void *data)
+{
+	int32_t r;
+	reintegrate_batch_res res;
+
+	r = zfs_reintegrate_batch(&res, args);
+	encode_status(dc, r);
+	if (r == ZFS_OK)
+		encode_reintegrate_batch_res(dc, &res);
+}
+
 /*! Call remote FUNCTION with ARGS using data structures in thread T and
    return its error code.  Use FD for communication with remote node.  */
 #define ZFS_CALL_CLIENT
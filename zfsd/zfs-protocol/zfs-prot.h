@@ -36,6 +36,15 @@
 #define ZFS_VERIFY_LEN MD5_SIZE
 #define ZFS_MAX_MD5_CHUNKS (ZFS_MAXDATA / (MD5_SIZE + 2 * sizeof (uint64_t)))
 #define ZFS_MAX_DIR_ENTRIES (ZFS_MAXDATA / (4 * sizeof (uint32_t)))
+#define ZFS_MAX_DELTA_BLOCKS 256
+#define ZFS_MAX_DELTA_OPS 64
+#define ZFS_MAX_DELTA_LENGTH (1024 * 1024)
+#define ZFS_MAX_REINTEGRATE_BATCH 64
+#define ZFS_MAX_REINTEGRATE_BATCH_NAMES 4096
+
+/*! Flag of an operation of delta_res copying blocks of the local file,
+   the operations without it are lengths of literal data.  */
+#define ZFS_DELTA_COPY 0x80000000
 
 /*! Error codes. System errors have positive numbers, ZFS errors have
    negative numbers.  */
@@ -347,6 +356,28 @@ typedef struct md5sum_res_def
 	unsigned char md5sum[ZFS_MAX_MD5_CHUNKS][MD5_SIZE];
 } md5sum_res;
 
+typedef struct delta_args_def
+{
+	zfs_cap cap;
+	uint64_t offset;
+	uint32_t length;
+	uint32_t block_size;
+	uint32_t count;
+	uint32_t weak[ZFS_MAX_DELTA_BLOCKS];
+	unsigned char strong[ZFS_MAX_DELTA_BLOCKS][MD5_SIZE];
+} delta_args;
+
+typedef struct delta_res_def
+{
+	uint64_t size;
+	uint64_t version;
+	uint32_t length;
+	uint32_t count;
+	uint32_t op[ZFS_MAX_DELTA_OPS];
+	uint32_t block[ZFS_MAX_DELTA_OPS];
+	data_buffer data;
+} delta_res;
+
 typedef struct file_info_res_def
 {
 	zfs_path path;
@@ -379,6 +410,41 @@ typedef struct reintegrate_ver_args_def
 	uint64_t version_inc;
 } reintegrate_ver_args;
 
+/*! Operation of reintegrate_batch_args.  */
+typedef enum reintegrate_batch_oper_def
+{
+	REINTEGRATE_BATCH_CREATE,	/*!< create a new file */
+	REINTEGRATE_BATCH_ADD,		/*!< name an existing file */
+	REINTEGRATE_BATCH_DEL,		/*!< delete a file */
+	REINTEGRATE_BATCH_LAST_AND_UNUSED
+} reintegrate_batch_oper;
+
+typedef struct reintegrate_batch_op_def
+{
+	reintegrate_batch_oper oper;
+	filename name;
+	zfs_fh fh;					/*!< file to add or delete */
+	sattr attr;					/*!< attributes of the created file */
+	ftype type;					/*!< type of the created file */
+	uint32_t rdev;				/*!< device number of the created file */
+	uint64_t version;			/*!< version of the deleted file */
+	char destroy_p;				/*!< destroy the deleted file */
+} reintegrate_batch_op;
+
+typedef struct reintegrate_batch_args_def
+{
+	zfs_fh dir;
+	uint32_t count;
+	reintegrate_batch_op op[ZFS_MAX_REINTEGRATE_BATCH];
+} reintegrate_batch_args;
+
+typedef struct reintegrate_batch_res_def
+{
+	uint32_t count;
+	int32_t status[ZFS_MAX_REINTEGRATE_BATCH];
+	dir_op_res res[ZFS_MAX_REINTEGRATE_BATCH];
+} reintegrate_batch_res;
+
 typedef struct invalidate_args_def
 {
 	zfs_fh fh;
@@ -422,6 +488,8 @@ typedef union call_args_def
 	invalidate_args invalidate;
 	reread_config_args reread_config;
 	reintegrate_args reintegrate;
+	delta_args delta;
+	reintegrate_batch_args reintegrate_batch;
 } call_args;
 
 /*! Mapping file type -> file mode.  */
@@ -67,6 +67,10 @@
 #include "metadata.h"
 #include "user-group.h"
 #include "update.h"
+#include "readahead.h"
+#include "writebehind.h"
+#include "hoard.h"
+#include "io-engine.h"
 #include "log.h"
 #include "control.h"
 #include "zfsd_state.h"
@@ -98,14 +102,17 @@ static void exit_sighandler(ATTRIBUTE_UNUSED int signum)
 #endif
 #endif
 
-	thread_pool_terminate(&network_pool);
+	/* The network and read-ahead threads are terminated by
+	   zfs_stop_services after the data written behind are written.  */
 
-	if (update_pool.regulator_thread)
+	if (update_pool.main_thread)
 	{
-		queue_exiting(&update_queue);
+		update_queue_exiting();
 		thread_pool_terminate(&update_pool);
 	}
 
+	hoard_exiting();
+
 	thread_terminate_blocking_syscall(&cleanup_dentry_thread, &cleanup_dentry_thread_in_syscall);
 
 	if (zfs_config.config_reader_data.thread_id)
@@ -425,7 +432,6 @@ static void set_daemon_paging_strategy()
 static void wait_for_pool_to_die(thread_pool * pool)
 {
 	wait_for_thread_to_die(&pool->main_thread, NULL);
-	wait_for_thread_to_die(&pool->regulator_thread, NULL);
 }
 
 /*! \brief Keeps state of zlomekFS services */
@@ -437,6 +443,12 @@ typedef struct zfs_started_services_def
 	bool network_started;
 	/*! update thread is running */
 	bool update_started;
+	/*! read-ahead threads are running */
+	bool readahead_started;
+	/*! I/O engine is running */
+	bool io_engine_started;
+	/*! hoarding thread is running */
+	bool hoard_started;
 #if defined ENABLE_HTTP_INTERFACE
 	/*! http server is running */
 	bool http_started;
@@ -447,10 +459,15 @@ zfs_started_services;
 static int zfs_start_services(zfs_started_services * services)
 {
 	services->kernel_started = false;
+	services->hoard_started = false;
+	services->io_engine_started = io_engine_start(zfs_config.io_uring_entries);
 	services->update_started = update_start();
+	services->readahead_started = readahead_start();
 	services->network_started = network_start (zfs_config.this_node.host_port);
 	
-	if (services->network_started != true || services->update_started != true)
+	if (services->network_started != true || services->update_started != true
+		|| services->readahead_started != true
+		|| services->io_engine_started != true)
 	{
 		terminate();
 		return EXIT_FAILURE;
@@ -481,6 +498,13 @@ static int zfs_start_services(zfs_started_services * services)
 		return EXIT_FAILURE;
 	}
 
+	services->hoard_started = hoard_start();
+	if (services->hoard_started != true)
+	{
+		terminate();
+		return EXIT_FAILURE;
+	}
+
 #ifdef ENABLE_FS_INTERFACE
 	services->kernel_started = fs_start();
 #endif
@@ -493,9 +517,28 @@ static int zfs_start_services(zfs_started_services * services)
 
 static void zfs_stop_services(zfs_started_services * services)
 {
+	/* Write the data written behind while the read-ahead threads and the
+	   connections to the master nodes are alive.  */
+	if (services->readahead_started && services->network_started)
+		writebehind_flush_all();
+
+	thread_pool_terminate(&network_pool);
+
+	if (readahead_pool.main_thread)
+	{
+		readahead_exiting();
+		thread_pool_terminate(&readahead_pool);
+	}
+
+	if (services->hoard_started)
+		hoard_cleanup();
+
 	if (services->update_started)
 		wait_for_pool_to_die(&update_pool);
 
+	if (services->readahead_started)
+		wait_for_pool_to_die(&readahead_pool);
+
 	if (services->network_started)
 		wait_for_pool_to_die(&network_pool);
 
@@ -514,6 +557,9 @@ static void zfs_stop_services(zfs_started_services * services)
 	if (services->update_started)
 		update_cleanup();
 
+	if (services->readahead_started)
+		readahead_cleanup();
+
 	if (services->network_started)
 		network_cleanup();
 
@@ -526,6 +572,9 @@ static void zfs_stop_services(zfs_started_services * services)
 	if (services->http_started)
 		http_fs_cleanup();
 #endif
+
+	if (services->io_engine_started)
+		io_engine_cleanup();
 }
 
 static void zfsd_main_loop(void)